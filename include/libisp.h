@@ -19,5 +19,10 @@
 #include "libisp/mem.h"
 #include "libisp/builtin.h"
 #include "libisp/thread.h"
+#include "libisp/image.h"
+#include "libisp/load.h"
+#include "libisp/serial.h"
+#include "libisp/json.h"
+#include "libisp/hash.h"
 
 #endif
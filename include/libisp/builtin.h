@@ -17,9 +17,28 @@
 #define LISP_CVAR_RO	1
 #define LISP_CVAR_RW	2
 
+#ifndef LISP_LIBISP_H_
+
+void lisp_add_builtin_cvars(lisp_ctx_t *context);
+const char *lisp_prim_name(const lisp_data_t *prim, const lisp_ctx_t *context);
+lisp_data_t *lisp_make_named_prim(const char *name, lisp_ctx_t *context);
+lisp_data_t *lisp_make_prim_object(const lisp_prim_proc_list_t *entry, lisp_ctx_t *context);
+int lisp_is_builtin_prim(const lisp_prim_def_t *def);
+void lisp_add_numvec_prims(lisp_ctx_t *context);
+void lisp_add_text_prims(lisp_ctx_t *context);
+void lisp_add_sort_prims(lisp_ctx_t *context);
+lisp_data_t *lisp_make_strbuf(lisp_ctx_t *context);
+int lisp_strbuf_append(lisp_data_t *strbuf, const char *text, const size_t len);
+
+#endif
+
 void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context);
+void lisp_add_vprim(const lisp_prim_def_t *def, lisp_ctx_t *context);
 void lisp_add_cvar(const char *name, const size_t *valptr, const int access, lisp_ctx_t *context);
 void lisp_setup_env(lisp_ctx_t *context);
+void lisp_setup_env_from(lisp_ctx_t *context, const lisp_ctx_t *base);
+void lisp_freeze_context(lisp_ctx_t *context);
+lisp_ctx_t *lisp_clone_context(lisp_ctx_t *base);
 void lisp_free_context(lisp_ctx_t *context);
 lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout);
 void lisp_destroy_context(lisp_ctx_t *context);
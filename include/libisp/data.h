@@ -18,8 +18,16 @@ lisp_data_t *lisp_make_int(const int i, lisp_ctx_t *context);
 lisp_data_t *lisp_make_decimal(const double d, lisp_ctx_t *context);
 lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context);
 lisp_data_t *lisp_make_symbol(const char *ident, lisp_ctx_t *context);
+lisp_data_t *lisp_make_stringn(const char *str, const size_t len, lisp_ctx_t *context);
+lisp_data_t *lisp_make_symboln(const char *ident, const size_t len, lisp_ctx_t *context);
 lisp_data_t *lisp_make_prim(lisp_prim_proc in, lisp_ctx_t *context);
+lisp_data_t *lisp_make_vprim(const lisp_prim_def_t *def, lisp_ctx_t *context);
 lisp_data_t *lisp_make_error(const char *error, lisp_ctx_t *context);
+lisp_data_t *lisp_make_vector(const size_t length, const lisp_data_t *fill, lisp_ctx_t *context);
+lisp_data_t *lisp_wrap_vector(lisp_data_t **items, const size_t length, lisp_ctx_t *context);
+lisp_data_t *lisp_make_f64vector(const size_t length, lisp_ctx_t *context);
+lisp_data_t *lisp_make_s64vector(const size_t length, lisp_ctx_t *context);
+lisp_data_t *lisp_make_weak_box(const lisp_data_t *value, lisp_ctx_t *context);
 
 #define lisp_cons(l, r) lisp_cons_in_context(l, r, context)
 
@@ -36,4 +44,13 @@ lisp_data_t *lisp_set_cdr(lisp_data_t *pair, const lisp_data_t *val);
 lisp_data_t *lisp_make_copy(const lisp_data_t *in);
 lisp_data_t *lisp_append(const lisp_data_t *list1, const lisp_data_t *list2);
 
+#ifndef LISP_LIBISP_H_
+
+#define LISP_LIST_IMPROPER	-1
+#define LISP_LIST_CIRCULAR	-2
+
+long lisp_count_pairs(const lisp_data_t *list, lisp_ctx_t *context);
+
+#endif
+
 #endif
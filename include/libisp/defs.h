@@ -30,13 +30,16 @@
 #define lisp_cdddr(l)	lisp_cdr(lisp_cdr(lisp_cdr(l)))
 
 typedef enum lisp_type_t {
-	lisp_type_integer, lisp_type_decimal, lisp_type_string, lisp_type_symbol, lisp_type_pair, lisp_type_prim, lisp_type_error
+	lisp_type_integer, lisp_type_decimal, lisp_type_string, lisp_type_symbol, lisp_type_pair, lisp_type_prim, lisp_type_error,
+	lisp_type_lazy, lisp_type_vprim, lisp_type_vector, lisp_type_f64vector, lisp_type_s64vector,
+	lisp_type_hashtable, lisp_type_weakbox, lisp_type_strbuf
 } lisp_type_t;
 
 typedef struct lisp_data_t lisp_data_t;
 typedef struct lisp_ctx_t lisp_ctx_t;
 
 typedef lisp_data_t* (*lisp_prim_proc)(const lisp_data_t*, lisp_ctx_t*);
+typedef lisp_data_t* (*lisp_vprim_proc)(const int argc, lisp_data_t *const *argv, lisp_ctx_t*);
 
 struct lisp_data_t {
 	lisp_type_t type;
@@ -47,13 +50,49 @@ struct lisp_data_t {
 		char *symbol;
 		char *error;
 		lisp_prim_proc proc;
+		const struct lisp_prim_def_t *def;
 		struct lisp_cons_t *pair;
+		struct lisp_lazy_t *lazy;
+		struct lisp_vector_t *vector;
+		struct lisp_numvector_t *numvector;
+		struct lisp_hashtable_t *hashtable;
+		struct lisp_weakbox_t *weakbox;
+		struct lisp_strbuf_t *strbuf;
 	};
 };
 
+/* Argument types a vectorcall primitive accepts, or'd together. A mask of 0
+ * accepts anything. */
+#define LISP_ARG(type)		(1u << (type))
+#define LISP_ARG_NIL		(1u << 31)
+#define LISP_ARG_ANY		0
+#define LISP_ARG_NUMBER		(LISP_ARG(lisp_type_integer) | LISP_ARG(lisp_type_decimal))
+#define LISP_ARG_LIST		(LISP_ARG(lisp_type_pair) | LISP_ARG_NIL)
+#define LISP_ARGS_ALL(mask)	{ (mask), (mask), (mask), (mask) }
+
+#define LISP_VARIADIC		-1
+#define LISP_PRIM_TYPES		4
+
+/* The result only depends on the arguments, and nothing is changed. */
+#define LISP_PRIM_PURE		1
+
+/* A primitive that receives its arguments as an array. The evaluator checks
+ * the number of arguments and their types before calling proc, argument i
+ * against types[i] and all from LISP_PRIM_TYPES - 1 on against the last
+ * entry. It has to stay valid for as long as any context uses it. */
+typedef struct lisp_prim_def_t {
+	const char *name;
+	lisp_vprim_proc proc;
+	int min_args;
+	int max_args;
+	unsigned int types[LISP_PRIM_TYPES];
+	int flags;
+} lisp_prim_def_t;
+
 typedef struct lisp_prim_proc_list_t {
 	char *name;
 	lisp_prim_proc proc;
+	const lisp_prim_def_t *def;
 	struct lisp_prim_proc_list_t *next;
 	struct lisp_prim_proc_list_t *prev;
 } lisp_prim_proc_list_t;
@@ -69,13 +108,87 @@ typedef struct lisp_cons_t {
 	struct lisp_data_t *l, *r;
 } lisp_cons_t;
 
+/* The elements of a vector. They live in the same allocation as the vector
+ * itself, unless the host wrapped an array it keeps owning. */
+typedef struct lisp_vector_t {
+	size_t length;
+	lisp_data_t **items;
+} lisp_vector_t;
+
+/* The elements of an f64vector or s64vector, unboxed and in the same
+ * allocation as the vector itself. */
+typedef struct lisp_numvector_t {
+	size_t length;
+	union {
+		double *f64;
+		int64_t *s64;
+	};
+} lisp_numvector_t;
+
+/* A hash of 0 marks an empty slot and 1 a deleted one, real hashes are
+ * moved out of the way of both. */
+typedef struct lisp_hash_slot_t {
+	size_t hash;
+	lisp_data_t *key, *value;
+} lisp_hash_slot_t;
+
+/* Open addressing with linear probing in a power of two number of slots.
+ * While the table grows, entries move from old to slots a few at a time, and
+ * the ones in old below moved are gone already. The collector links the weak
+ * tables it marks through next_weak. */
+typedef struct lisp_hashtable_t {
+	int kind, weak;
+	size_t count, used, size;
+	lisp_hash_slot_t *slots;
+	lisp_hash_slot_t *old;
+	size_t old_size, moved;
+	lisp_data_t *next_weak;
+} lisp_hashtable_t;
+
+/* Holds on to value without keeping it alive. The collector sets broken and
+ * clears value once nothing else refers to it. */
+typedef struct lisp_weakbox_t {
+	lisp_data_t *value;
+	int broken;
+	lisp_data_t *next_weak;
+} lisp_weakbox_t;
+
+/* A string builder. The text is always terminated, size counts the zero. */
+typedef struct lisp_strbuf_t {
+	char *data;
+	size_t length, size;
+} lisp_strbuf_t;
+
+/* Data the host holds on to outside of the environment, the garbage collector
+ * treats every entry as reachable. */
+typedef struct lisp_root_t {
+	const lisp_data_t *data;
+	struct lisp_root_t *next;
+	struct lisp_root_t *prev;
+} lisp_root_t;
+
+/* The unread tail of a list from lisp_read_lazy(), only ever found in the cdr
+ * of a pair. lisp_cdr() reads it on first use. */
+typedef struct lisp_lazy_t {
+	const char *pos;
+	int flags;
+	lisp_ctx_t *context;
+} lisp_lazy_t;
+
 struct lisp_ctx_t {
 	lisp_data_t *the_global_environment;
 	lisp_prim_proc_list_t *the_prim_procs;
 	lisp_prim_proc_list_t *the_last_prim_proc;
+	lisp_prim_proc_list_t *the_last_builtin_proc;
+
+	const lisp_ctx_t *base;
+	int frozen;
 
 	lisp_cvar_list_t *the_cvars;
 	lisp_cvar_list_t *the_last_cvar;
+
+	lisp_root_t *the_roots;
+	lisp_data_t *the_weak;
 	
 	size_t mem_lim_soft;
 	size_t mem_lim_hard;
@@ -87,10 +200,17 @@ struct lisp_ctx_t {
 	size_t n_bytes_peak;
 	size_t warned;
 	struct alloclist_t *alloc_list;
+	const void **alloc_set;
+	size_t alloc_set_size;
+	struct lisp_scratch_t *the_scratch;
+	size_t n_scratch;
 
 	size_t thread_timeout;
 	int thread_running;
 	int eval_plz_die;
+	int64_t deadline;
+	unsigned int n_checks;
+	void *escape;
 };
 
 #endif
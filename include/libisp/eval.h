@@ -21,7 +21,14 @@ lisp_data_t *extend_environment(const lisp_data_t *vars, const lisp_data_t *vals
 
 #endif
 
+typedef struct lisp_prepared_t lisp_prepared_t;
+
 lisp_data_t *lisp_eval(const lisp_data_t *exp, lisp_ctx_t *context);
 int lisp_run(const char *exp, lisp_ctx_t *context);
+lisp_data_t *lisp_apply(const lisp_data_t *proc, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context);
+
+lisp_prepared_t *lisp_prepare(const char *exp, lisp_ctx_t *context);
+lisp_data_t *lisp_call(lisp_prepared_t *prepared, const int argc, lisp_data_t *const *argv);
+void lisp_destroy_prepared(lisp_prepared_t *prepared);
 
 #endif
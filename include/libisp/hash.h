@@ -0,0 +1,47 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <stddef.h>
+
+#include "defs.h"
+
+#ifndef LISP_HASH_H_
+#define LISP_HASH_H_
+
+/* How keys are compared. EQ keys are the same object, or equal numbers or
+ * symbols. EQUAL keys are lisp_is_equal(). STRING keys are strings with the
+ * same characters. */
+#define LISP_HASH_EQ		0
+#define LISP_HASH_EQUAL		1
+#define LISP_HASH_STRING	2
+
+/* Or'd into the kind. The collector drops entries whose weak key or value
+ * nothing else refers to. A value in a table with weak keys is only kept
+ * alive by the table while its key is. */
+#define LISP_HASH_WEAK_KEYS		4
+#define LISP_HASH_WEAK_VALUES	8
+#define LISP_HASH_WEAK			(LISP_HASH_WEAK_KEYS | LISP_HASH_WEAK_VALUES)
+
+#ifndef LISP_LIBISP_H_
+
+lisp_data_t *lisp_copy_hashtable(const lisp_data_t *in);
+void lisp_add_hash_prims(lisp_ctx_t *context);
+size_t lisp_hashtable_prune(lisp_data_t *table, int (*is_reachable)(const lisp_data_t*, lisp_ctx_t*), lisp_ctx_t *context);
+
+#endif
+
+lisp_data_t *lisp_make_hashtable(const int kind, lisp_ctx_t *context);
+lisp_data_t *lisp_hashtable_ref(const lisp_data_t *table, const lisp_data_t *key, int *found);
+int lisp_hashtable_set(lisp_data_t *table, const lisp_data_t *key, const lisp_data_t *value);
+int lisp_hashtable_delete(lisp_data_t *table, const lisp_data_t *key);
+int lisp_hashtable_next(const lisp_data_t *table, size_t *pos, lisp_data_t **key, lisp_data_t **value);
+
+#endif
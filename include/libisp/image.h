@@ -0,0 +1,30 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "libisp/defs.h"
+
+#ifndef LISP_IMAGE_H_
+#define LISP_IMAGE_H_
+
+#define LISP_IMAGE_OK		0
+#define LISP_IMAGE_EIO		1
+#define LISP_IMAGE_EFORMAT	2
+#define LISP_IMAGE_EPRIM	3
+#define LISP_IMAGE_EMEM		4
+
+int lisp_save_image(const char *path, lisp_ctx_t *context);
+int lisp_load_image(const char *path, lisp_ctx_t *context);
+
+#ifndef LISP_LIBISP_H_
+int lisp_copy_image(lisp_ctx_t *context, lisp_ctx_t *from);
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#include "libisp/defs.h"
+#include "libisp/print.h"
+
+#ifndef LISP_JSON_H_
+#define LISP_JSON_H_
+
+lisp_data_t *lisp_from_json(const char *json, const size_t len, size_t *readto, int *error, lisp_ctx_t *context);
+int lisp_to_json(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context);
+
+#endif
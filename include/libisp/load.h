@@ -0,0 +1,36 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#include "libisp/defs.h"
+
+#ifndef LISP_LOAD_H_
+#define LISP_LOAD_H_
+
+#ifndef LISP_LIBISP_H_
+
+/* A read only view of a whole file, followed by a NUL byte so it can be
+ * handed to lisp_read() directly. */
+typedef struct lisp_mapping_t {
+	const char *data;
+	size_t len;
+	size_t size;
+} lisp_mapping_t;
+
+int lisp_map_file(const char *path, lisp_mapping_t *map);
+void lisp_unmap_file(lisp_mapping_t *map);
+lisp_data_t *lisp_load_forms(const char *exp, const int gc, lisp_ctx_t *context);
+
+#endif
+
+lisp_data_t *lisp_load_file(const char *path, lisp_ctx_t *context);
+
+#endif
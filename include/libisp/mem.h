@@ -27,5 +27,22 @@ void lisp_gc_stats(FILE *fp, lisp_ctx_t *context);
 void lisp_free_data(lisp_data_t *in, lisp_ctx_t *context);
 void lisp_free_data_rec(lisp_data_t *in, lisp_ctx_t *context);
 size_t lisp_gc(const int force, lisp_ctx_t *context);
+int lisp_is_immutable(const lisp_data_t *data, const lisp_ctx_t *context);
+lisp_root_t *lisp_add_root(const lisp_data_t *data, lisp_ctx_t *context);
+void lisp_remove_root(lisp_root_t *root, lisp_ctx_t *context);
+
+#ifndef LISP_LIBISP_H_
+
+void lisp_free_roots(lisp_ctx_t *context);
+size_t lisp_heap_serial(const lisp_ctx_t *context);
+size_t lisp_gc_since(const size_t since, lisp_ctx_t *context);
+void lisp_force_all_lazy(lisp_ctx_t *context);
+
+void *lisp_scratch(const size_t size, void (*release)(void*), lisp_ctx_t *context);
+void lisp_unscratch(void *memory, lisp_ctx_t *context);
+size_t lisp_scratch_mark(const lisp_ctx_t *context);
+void lisp_free_scratch(const size_t mark, lisp_ctx_t *context);
+
+#endif
 
 #endif
@@ -9,11 +9,34 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#include <stdio.h>
+
 #include "libisp/defs.h"
+#include "libisp/serial.h"
 
 #ifndef LISP_PRINT_H_
 #define LISP_PRINT_H_
 
+typedef struct lisp_sink_t lisp_sink_t;
+
 void lisp_print(const lisp_data_t *d, lisp_ctx_t *context);
+void lisp_print_shared(const lisp_data_t *d, lisp_ctx_t *context);
+
+lisp_sink_t *lisp_make_buffer_sink(lisp_buffer_t *buf);
+lisp_sink_t *lisp_make_file_sink(FILE *fp);
+lisp_sink_t *lisp_make_fd_sink(const int fd);
+int lisp_print_to(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context);
+int lisp_print_shared_to(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context);
+int lisp_sink_flush(lisp_sink_t *sink);
+void lisp_destroy_sink(lisp_sink_t *sink);
+
+#ifndef LISP_LIBISP_H_
+/* Longest output of the number formatters, without a terminating zero. */
+#define LISP_NUMBER_MAX		32
+
+size_t lisp_format_int(const int i, char *out);
+size_t lisp_format_decimal(const double d, char *out);
+int lisp_sink_put(lisp_sink_t *sink, const char *data, const size_t len);
+#endif
 
 #endif
@@ -9,11 +9,33 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#include <stdio.h>
+
 #include "libisp/defs.h"
 
 #ifndef LISP_READ_H_
 #define LISP_READ_H_
 
+#define LISP_READ_OK		0
+#define LISP_READ_MORE		1
+#define LISP_READ_EOF		2
+#define LISP_READ_ERROR		3
+
+typedef struct lisp_reader_t lisp_reader_t;
+
 lisp_data_t *lisp_read(const char *exp, size_t *readto, int *error, lisp_ctx_t *context);
+lisp_data_t *lisp_read_lazy(const char *exp, size_t *readto, int *error, lisp_ctx_t *context);
+
+#ifndef LISP_LIBISP_H_
+lisp_data_t *lisp_force_lazy(lisp_data_t *lazy);
+lisp_type_t lisp_parse_number(const char *exp, const char *end, int *integer, double *decimal);
+#endif
+
+lisp_reader_t *lisp_make_reader(void);
+lisp_reader_t *lisp_make_file_reader(FILE *fp);
+lisp_reader_t *lisp_make_fd_reader(const int fd);
+int lisp_reader_feed(lisp_reader_t *reader, const char *buf, const size_t len);
+lisp_data_t *lisp_reader_next(lisp_reader_t *reader, int *status, lisp_ctx_t *context);
+void lisp_destroy_reader(lisp_reader_t *reader);
 
 #endif
@@ -0,0 +1,57 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#include <stdint.h>
+
+#include "libisp/defs.h"
+
+#ifndef LISP_SERIAL_H_
+#define LISP_SERIAL_H_
+
+typedef struct lisp_buffer_t {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+} lisp_buffer_t;
+
+#ifndef LISP_LIBISP_H_
+
+/* Open addressing map from data to their record numbers, used to find
+ * shared structure while writing. */
+typedef struct lisp_ptrmap_entry_t {
+	const lisp_data_t *key;
+	uint32_t val;
+} lisp_ptrmap_entry_t;
+
+typedef struct lisp_ptrmap_t {
+	lisp_ptrmap_entry_t *entries;
+	size_t size;
+	size_t used;
+} lisp_ptrmap_t;
+
+int lisp_ptrmap_init(lisp_ptrmap_t *map, const size_t size);
+void lisp_ptrmap_free(lisp_ptrmap_t *map);
+uint32_t *lisp_ptrmap_ref(const lisp_ptrmap_t *map, const lisp_data_t *key);
+int lisp_ptrmap_find(const lisp_ptrmap_t *map, const lisp_data_t *key, uint32_t *val);
+int lisp_ptrmap_insert(lisp_ptrmap_t *map, const lisp_data_t *key, const uint32_t val);
+int lisp_ptrmap_intern(lisp_ptrmap_t *map, const lisp_data_t *key, const uint32_t val, uint32_t *found);
+
+#endif
+
+void lisp_buffer_init(lisp_buffer_t *buf);
+int lisp_buffer_append(lisp_buffer_t *buf, const void *data, const size_t len);
+void lisp_buffer_free(lisp_buffer_t *buf);
+
+int lisp_serialize(const lisp_data_t *data, lisp_buffer_t *buf, lisp_ctx_t *context);
+lisp_data_t *lisp_deserialize(const void *data, const size_t len, size_t *readto, int *error, lisp_ctx_t *context);
+
+#endif
@@ -14,6 +14,60 @@
 #ifndef LISP_THREAD_H_
 #define LISP_THREAD_H_
 
+#define LISP_ASYNC_RUNNING		0
+#define LISP_ASYNC_DONE			1
+#define LISP_ASYNC_CANCELLED	2
+#define LISP_ASYNC_TIMEOUT		3
+#define LISP_ASYNC_MEMLIMIT		4
+
+#ifndef LISP_LIBISP_H_
+
+/* The host thread and the eval thread share thread_running and eval_plz_die. */
+
+/* thread_running is 0, running, or doomed once the host destroyed the context
+ * while a thread it left behind still runs in it. */
+#define LISP_THREAD_RUNNING		1
+#define LISP_THREAD_DOOMED		2
+
+#ifdef _WIN32
+#include <intrin.h>
+#define lisp_atomic_get(p)				_InterlockedCompareExchange((volatile long*)(p), 0, 0)
+#define lisp_atomic_set(p, v)			_InterlockedExchange((volatile long*)(p), (long)(v))
+#define lisp_atomic_cas(p, old, new)	(_InterlockedCompareExchange((volatile long*)(p), (long)(new), (long)(old)) == (long)(old))
+#else
+#define lisp_atomic_get(p)				__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define lisp_atomic_set(p, v)			__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define lisp_atomic_cas(p, old, new)	__sync_bool_compare_and_swap((p), (old), (new))
+#endif
+
+/* Called by eval() on every step and in the loops of primitives. It ends the
+ * evaluation once it was cancelled, and every LISP_CHECK_INTERVAL calls looks
+ * at the clock, so the eval thread keeps its deadline by itself. */
+#define LISP_CHECK_INTERVAL		1024
+#define lisp_check_eval(c)		do { if(lisp_atomic_get(&(c)->eval_plz_die) || ((c)->deadline && !(++(c)->n_checks % LISP_CHECK_INTERVAL))) lisp_poll_eval(c); } while(0)
+
+void lisp_poll_eval(lisp_ctx_t *context);
+void lisp_abort_eval(lisp_ctx_t *context);
+
+/* lisp_eval_thread() that says how the evaluation ended. */
+#define LISP_ASYNC_REFUSED		-1
+
+lisp_data_t *lisp_eval_wait(const lisp_data_t *exp, int *status, lisp_ctx_t *context);
+
+#endif
+
+typedef struct lisp_async_t lisp_async_t;
+typedef void (*lisp_async_callback)(lisp_async_t *handle, const int status, lisp_data_t *result, void *userdata);
+
+lisp_async_t *lisp_eval_async(const lisp_data_t *exp, lisp_async_callback callback, void *userdata, lisp_ctx_t *context);
+int lisp_eval_poll(lisp_async_t *handle);
+void lisp_eval_cancel(lisp_async_t *handle);
+int lisp_eval_fd(const lisp_async_t *handle);
+lisp_data_t *lisp_eval_result(const lisp_async_t *handle);
+void lisp_eval_free(lisp_async_t *handle);
+
 lisp_data_t *lisp_eval_thread(const lisp_data_t *exp, lisp_ctx_t *context);
 
+int lisp_context_busy(const lisp_ctx_t *context);
+
 #endif
@@ -12,32 +12,35 @@
 #include <float.h>
 #include <limits.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "libisp/builtin.h"
 #include "libisp/data.h"
 #include "libisp/eval.h"
+#include "libisp/hash.h"
+#include "libisp/image.h"
+#include "libisp/load.h"
 #include "libisp/mem.h"
 #include "libisp/thread.h"
 
-static lisp_data_t *prim_add(const lisp_data_t *list, lisp_ctx_t *context) {
-	int iout = 0;
-	double dout = 0.0f;
-	lisp_data_t *head, *tail;
+/* The evaluator has checked the number of arguments and their types against
+ * the definitions in builtin_prims[] before any of these is called. */
 
-	while(list) {
-		if((head = lisp_car(list)) == NULL)
-			return lisp_make_error("+ -- Expected number", context);
-		tail = lisp_cdr(list);
+static double decimal_of(const lisp_data_t *num) { return (num->type == lisp_type_integer) ? (double)num->integer : num->decimal; }
+static int is_word(const lisp_data_t *d, const char *word) { return d && (d->type == lisp_type_symbol) && !strcmp(d->symbol, word); }
+static lisp_data_t *make_bool(const int val, lisp_ctx_t *context) { return lisp_make_symbol(val ? "#t" : "#f", context); }
 
-		if(head->type == lisp_type_integer)
-			iout += head->integer;
-		else if(head->type == lisp_type_decimal)
-			dout += head->decimal;
-		else return lisp_make_error("+ -- Expected number", context);
+static lisp_data_t *prim_add(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int iout = 0, i;
+	double dout = 0.0f;
 
-		list = tail;
+	for(i = 0; i < argc; i++) {
+		if(argv[i]->type == lisp_type_integer)
+			iout += argv[i]->integer;
+		else
+			dout += argv[i]->decimal;
 	}
 
 	if(dout == 0.0f)
@@ -49,22 +52,15 @@ static lisp_data_t *prim_add(const lisp_data_t *list, lisp_ctx_t *context) {
 	return lisp_make_decimal(dout + iout, context);
 }
 
-static lisp_data_t *prim_mul(const lisp_data_t *list, lisp_ctx_t *context) {
-	int iout = 1;
+static lisp_data_t *prim_mul(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int iout = 1, i;
 	double dout = 1.0f;
-	lisp_data_t *head, *tail;
-
-	while(list) {
-		if((head = lisp_car(list)) == NULL)
-			return lisp_make_error("* -- Expected number", context);
-		tail = lisp_cdr(list);
-		if(head->type == lisp_type_integer)
-			iout *= head->integer;
-		else if(head->type == lisp_type_decimal)
-			dout *= head->decimal;
-		else return lisp_make_error("* -- Expected number", context);
-
-		list = tail;
+
+	for(i = 0; i < argc; i++) {
+		if(argv[i]->type == lisp_type_integer)
+			iout *= argv[i]->integer;
+		else
+			dout *= argv[i]->decimal;
 	}
 
 	if(dout == 1.0f)
@@ -76,53 +72,33 @@ static lisp_data_t *prim_mul(const lisp_data_t *list, lisp_ctx_t *context) {
 	return lisp_make_decimal(dout * iout, context);
 }
 
-static lisp_data_t *prim_sub(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_type_t out_type;
-	int iout = 0, istart;
-	double dout = 0.0f, dstart;
-	lisp_data_t *head, *tail;
+static lisp_data_t *prim_sub(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_type_t out_type = argv[0]->type;
+	int iout = 0, istart = 0, i;
+	double dout = 0.0f, dstart = 0.0f;
 
-	if(!lisp_list_length(list))
-		return lisp_make_error("- -- No operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("- -- Expected number", context);
-
-	tail = lisp_cdr(list);
-	out_type = head->type;
 	if(out_type == lisp_type_decimal)
-		dstart = head->decimal;
-	else if(out_type == lisp_type_integer)
-		istart = head->integer;
+		dstart = argv[0]->decimal;
 	else
-		return lisp_make_error("- -- Expected number", context);
-
-	list = tail;
+		istart = argv[0]->integer;
 
-	if(!list) {
-		if(out_type == lisp_type_integer) {
+	if(argc == 1) {
+		if(out_type == lisp_type_integer)
 			return lisp_make_int(-istart, context);
-		} else {
-			return lisp_make_decimal(-dstart, context);
-		}
+		return lisp_make_decimal(-dstart, context);
 	}
 
-	do {
-		if((head = lisp_car(list)) == NULL)
-			return lisp_make_error("- -- Expected number", context);
-		tail = lisp_cdr(list);
-		if(head->type == lisp_type_integer)
-			iout += head->integer;
-		else if(head->type == lisp_type_decimal) {
+	for(i = 1; i < argc; i++) {
+		if(argv[i]->type == lisp_type_integer)
+			iout += argv[i]->integer;
+		else {
 			if(out_type == lisp_type_integer) {
 				out_type = lisp_type_decimal;
 				dstart = (double)istart;
 			}
-			dout += head->decimal;
+			dout += argv[i]->decimal;
 		}
-		else return lisp_make_error("- -- Expected number", context);
-
-		list = tail;
-	} while(list);
+	}
 
 	if(out_type == lisp_type_integer)
 		return lisp_make_int(istart - iout, context);
@@ -130,43 +106,15 @@ static lisp_data_t *prim_sub(const lisp_data_t *list, lisp_ctx_t *context) {
 	return lisp_make_decimal(dstart - dout - iout, context);
 }
 
-static lisp_data_t *prim_div(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_type_t start_type;
-	double dout = 1.0f, dstart;
-	lisp_data_t *head, *tail;
-
-	if(!lisp_list_length(list))
-		return lisp_make_error("/ -- No operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("/ -- Expected number", context);
-
-	tail = lisp_cdr(list);
-	start_type = head->type;
-	if(start_type == lisp_type_decimal)
-		dstart = head->decimal;
-	else if(start_type == lisp_type_integer)
-		dstart = (double)head->integer;
-	else
-		return lisp_make_error("/ -- Expected number", context);
-
-	list = tail;
+static lisp_data_t *prim_div(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double dout = 1.0f, dstart = decimal_of(argv[0]);
+	int i;
 
-	if(!list)
+	if(argc == 1)
 		return lisp_make_decimal(1 / dstart, context);
 
-	do {
-		if((head = lisp_car(list)) == NULL)
-			return lisp_make_error("/ -- Expected number", context);
-		tail = lisp_cdr(list);
-
-		if(head->type == lisp_type_integer)
-			dout *= head->integer;
-		else if(head->type == lisp_type_decimal)
-			dout *= head->decimal;
-		else return 0;
-
-		list = tail;
-	} while(list);
+	for(i = 1; i < argc; i++)
+		dout *= decimal_of(argv[i]);
 
 	if(dout == 0)
 		return lisp_make_error("/ -- Division by zero", context);
@@ -177,617 +125,903 @@ static lisp_data_t *prim_div(const lisp_data_t *list, lisp_ctx_t *context) {
 	return lisp_make_decimal(dstart / dout, context);
 }
 
-static lisp_data_t *prim_comp_eq(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *first, *second;
-	lisp_type_t type_first, type_second;
+static lisp_data_t *prim_comp_eq(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if((argv[0]->type == lisp_type_integer) && (argv[1]->type == lisp_type_integer))
+		return make_bool(argv[0]->integer == argv[1]->integer, context);
+	return make_bool(decimal_of(argv[0]) == decimal_of(argv[1]), context);
+}
+
+static lisp_data_t *prim_comp_less(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if((argv[0]->type == lisp_type_integer) && (argv[1]->type == lisp_type_integer))
+		return make_bool(argv[0]->integer < argv[1]->integer, context);
+	return make_bool(decimal_of(argv[0]) < decimal_of(argv[1]), context);
+}
+
+static lisp_data_t *prim_comp_more(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if((argv[0]->type == lisp_type_integer) && (argv[1]->type == lisp_type_integer))
+		return make_bool(argv[0]->integer > argv[1]->integer, context);
+	return make_bool(decimal_of(argv[0]) > decimal_of(argv[1]), context);
+}
+
+static lisp_data_t *prim_floor(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0]->type == lisp_type_integer)
+		return lisp_make_int(argv[0]->integer, context);
+	return lisp_make_int((int)floor(argv[0]->decimal), context);
+}
 
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("= -- Expected two operands", context);
-	if((first = lisp_car(list)) == NULL)
-		return lisp_make_error("= -- Expected number", context);
-	if((second = lisp_cdr(list)) == NULL)
-		return lisp_make_error("= -- Expected pair", context);
-	if(second->type != lisp_type_pair)
-		return lisp_make_error("= -- Expected pair", context);
-	if((second = lisp_car(second)) == NULL)
-		return lisp_make_error("= -- Expected number", context);
+static lisp_data_t *prim_ceiling(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0]->type == lisp_type_integer)
+		return lisp_make_int(argv[0]->integer, context);
+	return lisp_make_int((int)ceil(argv[0]->decimal), context);
+}
 
-	type_first = first->type;
-	type_second = second->type;
+static lisp_data_t *prim_trunc(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double num;
 
-	if((type_first != lisp_type_decimal) && (type_first != lisp_type_integer))
-		return lisp_make_error("= -- Expected number", context);
-	if((type_second != lisp_type_decimal) && (type_second != lisp_type_integer))
-		return lisp_make_error("= -- Expected number", context);
+	if(argv[0]->type == lisp_type_integer)
+		return lisp_make_int(argv[0]->integer, context);
 
-	if(type_first == lisp_type_integer)
-		if(first->integer == second->integer)
-			return lisp_make_symbol("#t", context);
+	num = argv[0]->decimal;
+	if(num < 0)
+		return lisp_make_int((int)ceil(num), context);
+	return lisp_make_int((int)floor(num), context);
+}
 
-	if(type_first == lisp_type_decimal)
-		if(first->decimal == second->decimal)
-			return lisp_make_symbol("#t", context);
+static lisp_data_t *prim_round(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double num, fracpart;
+	int intpart;
 
-	return lisp_make_symbol("#f", context);
+	if(argv[0]->type == lisp_type_integer)
+		return lisp_make_int(argv[0]->integer, context);
+
+	num = argv[0]->decimal;
+	fracpart = num - floor(num);
+	if(fracpart < .5)
+		return lisp_make_int((int)(num - fracpart), context);
+	if(fracpart > .5)
+		return lisp_make_int((int)(num - fracpart + 1), context);
+	intpart = (int)(num - fracpart);
+	if(intpart % 2)
+		return lisp_make_int(intpart + 1, context);
+	return lisp_make_int(intpart, context);
 }
 
-static lisp_data_t *prim_comp_less(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *head, *tail;
+static lisp_data_t *prim_max(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int imax = 0, i;
+	double dmax = 0.0f;
 
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("< -- Expected two operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("< -- Expected number", context);
-	if((tail = lisp_car(lisp_cdr(list))) == NULL)
-		return lisp_make_error("< -- Expected number", context);
-		
-	if((head->type == lisp_type_integer) && (tail->type == lisp_type_integer)) {
-		if(head->integer < tail->integer) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_integer)) {
-		if(head->decimal < tail->integer) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_integer) && (tail->type == lisp_type_decimal)) {
-		if(head->integer < tail->decimal) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_decimal)) {
-		if(head->decimal < tail->decimal) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
+	for(i = 0; i < argc; i++) {
+		if(argv[i]->type == lisp_type_integer) {
+			if(argv[i]->integer > imax)
+				imax = argv[i]->integer;
+		} else if(argv[i]->decimal > dmax)
+			dmax = argv[i]->decimal;
 	}
 
-	return lisp_make_error("< -- Invalid comparison", context);
+	if((double)imax > dmax)
+		return lisp_make_int(imax, context);
+	return lisp_make_decimal(dmax, context);
 }
 
-static lisp_data_t *prim_comp_more(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *head, *tail;
-
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("> -- Expected two operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("> -- Expected number", context);
-	if((tail = lisp_car(lisp_cdr(list))) == NULL)
-		return lisp_make_error("> -- Expected number", context);
+static lisp_data_t *prim_min(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int imin = INT_MAX, i;
+	double dmin = DBL_MAX;
 
-	if((head->type == lisp_type_integer) && (tail->type == lisp_type_integer)) {
-		if(head->integer > tail->integer) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_integer)) {
-		if(head->decimal > tail->integer) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_integer) && (tail->type == lisp_type_decimal)) {
-		if(head->integer > tail->decimal) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_decimal)) {
-		if(head->decimal > tail->decimal) {
-			return lisp_make_symbol("#t", context);
-		} else {
-			return lisp_make_symbol("#f", context);
-		}
+	for(i = 0; i < argc; i++) {
+		if(argv[i]->type == lisp_type_integer) {
+			if(argv[i]->integer < imin)
+				imin = argv[i]->integer;
+		} else if(argv[i]->decimal < dmin)
+			dmin = argv[i]->decimal;
 	}
 
-	return lisp_make_error("> -- Invalid comparison", context);
+	if((double)imin < dmin)
+		return lisp_make_int(imin, context);
+	return lisp_make_decimal(dmin, context);
 }
 
-static lisp_data_t *prim_or(const lisp_data_t *list, lisp_ctx_t *context) {
-	while(list) {
-		if(lisp_is_equal(lisp_car(list), lisp_make_symbol("#t", context)))
-			return lisp_make_symbol("#t", context);
-		list = lisp_cdr(list);
-	}
-	return lisp_make_symbol("#f", context);
+static lisp_data_t *prim_eq(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(lisp_is_equal(argv[0], argv[1]), context);
 }
 
-static lisp_data_t *prim_and(const lisp_data_t *list, lisp_ctx_t *context) {
-	while(list) {
-		if(lisp_is_equal(lisp_car(list), lisp_make_symbol("#f", context)))
-			return lisp_make_symbol("#f", context);
-		list = lisp_cdr(list);
-	}
-	return lisp_make_symbol("#t", context);
+static lisp_data_t *prim_not(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(is_word(argv[0], "#f"), context);
 }
 
-static lisp_data_t *prim_floor(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("FLOOR -- Expected one operand", context);
-	if((list = lisp_car(list)) == NULL)
-		return lisp_make_error("FLOOR -- Expected number", context);
-		
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+static lisp_data_t *prim_car(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0] && argv[0]->type == lisp_type_pair)
+		return lisp_car(argv[0]);
+	return NULL;
+}
 
-	if(list->type == lisp_type_decimal)
-		return lisp_make_int((int)floor(list->decimal), context);
+static lisp_data_t *prim_cdr(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0] && argv[0]->type == lisp_type_pair)
+		return lisp_cdr(argv[0]);
+	return NULL;
+}
 
-	return lisp_make_error("FLOOR -- Expected number", context);
+static lisp_data_t *prim_cons(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_cons(argv[0], argv[1]);
 }
 
-static lisp_data_t *prim_ceiling(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("CEILING -- Expected one operand", context);
-	if((list = lisp_car(list)) == NULL)
-		return lisp_make_error("CEILING -- Expected number", context);
+static lisp_data_t *prim_list(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL;
+	int i;
+
+	for(i = argc - 1; i >= 0; i--)
+		out = lisp_cons(argv[i], out);
+	return out;
+}
 
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+static lisp_data_t *prim_set_car(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("SET-CAR! -- Immutable pair", context);
 
-	if(list->type == lisp_type_decimal)
-		return lisp_make_int((int)ceil(list->decimal), context);
+	argv[0]->pair->l = argv[1];
 
-	return lisp_make_error("CEILING -- Invalid comparison", context);
+	return argv[0];
 }
 
-static lisp_data_t *prim_trunc(const lisp_data_t *list, lisp_ctx_t *context) {
-	double num;
+static lisp_data_t *prim_set_cdr(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("SET-CDR! -- Immutable pair", context);
 
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("TRUNCATE -- Expected one operand", context);
-	if((list = lisp_car(list)) == NULL)
-		return lisp_make_error("TRUNCATE -- Expected number", context);
-		
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+	argv[0]->pair->r = argv[1];
 
-	if(list->type == lisp_type_decimal) {
-		num = list->decimal;
+	return argv[0];
+}
 
-		if(num < 0)
-			return lisp_make_int((int)ceil(list->decimal), context);
-		return lisp_make_int((int)floor(list->decimal), context);
-	}
+static lisp_data_t *prim_sym_to_str(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_string(argv[0]->symbol, context);
+}
 
-	return lisp_make_error("TRUNCATE -- Expected number", context);
+static lisp_data_t *prim_str_to_sym(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_symbol(argv[0]->string, context);
 }
 
-static lisp_data_t *prim_round(const lisp_data_t *list, lisp_ctx_t *context) {
-	double num, fracpart;
-	int intpart;
+static lisp_data_t *is_type(const lisp_data_t *d, lisp_type_t type, lisp_ctx_t *context) { return make_bool(d && (d->type == type), context); }
 
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("ROUND -- Expected one operand", context);
-	if((list = lisp_car(list)) == NULL)
-		return lisp_make_error("ROUND -- Expected number", context);
-
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
-
-	if(list->type == lisp_type_decimal) {
-		num = list->decimal;
-		fracpart = num - floor(num);
-		if(fracpart < .5)
-			return lisp_make_int((int)(num - fracpart), context);
-		if(fracpart > .5)
-			return lisp_make_int((int)(num - fracpart + 1), context);
-		intpart = (int)(num - fracpart);
-		if(intpart % 2)
-			return lisp_make_int(intpart + 1, context);
-		return lisp_make_int(intpart, context);
-	}
+static lisp_data_t *prim_is_sym(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_symbol, context); }
 
-	return lisp_make_error("ROUND -- Expected number", context);
-}
-
-static lisp_data_t *prim_max(const lisp_data_t *list, lisp_ctx_t *context) {
-	int ival, imax = 0;
-	double dval, dmax = 0.0f;
-	lisp_data_t *val;
-
-	if(!lisp_list_length(list))
-		return lisp_make_error("MAX -- No operands", context);
-
-	while(list) {
-		if(list->type != lisp_type_pair)
-			return lisp_make_error("MAX -- Expected pair", context);
-		val = lisp_car(list);
-		if(val->type == lisp_type_integer) {
-			ival = val->integer;
-			if(ival > imax)
-				imax = ival;
-		} else if(val->type == lisp_type_decimal) {
-			dval = val->decimal;
-			if(dval > dmax)
-				dmax = dval;
-		} else
-			return lisp_make_error("MAX -- Expected number", context);
-		list = lisp_cdr(list);
-	}
+static lisp_data_t *prim_is_str(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_string, context); }
+	
+static lisp_data_t *prim_is_pair(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_pair, context); }
 
-	if((double)imax > dmax)
-		return lisp_make_int(imax, context);
-	return lisp_make_decimal(dmax, context);
+static lisp_data_t *prim_is_int(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_integer, context); }
+
+static lisp_data_t *prim_is_num(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(argv[0] && ((argv[0]->type == lisp_type_integer) || (argv[0]->type == lisp_type_decimal)), context);
 }
 
-static lisp_data_t *prim_min(const lisp_data_t *list, lisp_ctx_t *context) {
-	int ival, imin = INT_MAX;
-	double dval, dmin = DBL_MAX;
-	lisp_data_t *val;
-
-	if(!lisp_list_length(list))
-		return lisp_make_error("MIN -- No operands", context);
-
-	while(list) {
-		if(list->type != lisp_type_pair)
-			return lisp_make_error("MIN -- Expected pair", context);
-		val = lisp_car(list);
-		if(val->type == lisp_type_integer) {
-			ival = val->integer;
-			if(ival < imin)
-				imin = ival;
-		} else if(val->type == lisp_type_decimal) {
-			dval = val->decimal;
-			if(dval < dmin)
-				dmin = dval;
-		}
-		list = lisp_cdr(list);
-	}
+static lisp_data_t *prim_is_proc(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *tag;
 
-	if((double)imin < dmin)
-		return lisp_make_int(imin, context);
-	return lisp_make_decimal(dmin, context);
+	if(!argv[0] || argv[0]->type != lisp_type_pair)
+		return make_bool(0, context);
+	
+	tag = lisp_car(argv[0]);
+	return make_bool(is_word(tag, "closure") || is_word(tag, "primitive"), context);
 }
 
-static lisp_data_t *prim_eq(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *first, *second;
+static lisp_data_t *mathfn(const lisp_data_t *num, double (*func)(double), lisp_ctx_t *context) {
+	return lisp_make_decimal(func(decimal_of(num)), context);
+}
 
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("EQ? -- No operands", context);
+static lisp_data_t *prim_sin(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], sin, context); }
 
-	first = lisp_car(list);
-	second = lisp_car(lisp_cdr(list));
-	
-	if(lisp_is_equal(first, second))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
-}
+static lisp_data_t *prim_cos(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], cos, context); }
 
-static lisp_data_t *prim_not(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("NOT -- Expected one operand", context);
-	if((list = lisp_car(list)) == NULL)
-		return lisp_make_error("NOT -- Expected boolean", context);
-	
-	if(!strcmp(list->symbol, "#f"))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+static lisp_data_t *prim_tan(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], tan, context); }
+
+static lisp_data_t *prim_asin(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], asin, context); }
+
+static lisp_data_t *prim_acos(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], acos, context); }
+
+static lisp_data_t *prim_atan(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], atan, context); }
+
+static lisp_data_t *prim_log(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], log, context); }
+
+static lisp_data_t *prim_exp(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return mathfn(argv[0], exp, context); }
+
+static lisp_data_t *prim_expt(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_decimal(pow(decimal_of(argv[0]), decimal_of(argv[1])), context);
 }
 
-static lisp_data_t *prim_car(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("CAR -- Expected one operand", context);
-	
-	list = lisp_car(list);
-	
-	if(list && list->type == lisp_type_pair)
-		return lisp_car(list);
-	return NULL;
+static int gcd(const int a, const int b) {
+	if(a == 0)
+		return b;
+	else if(b == 0)
+		return a;
+	else if(a > b)
+		return gcd(a % b, b);
+	else
+		return gcd(a, b % a);
 }
 
-static lisp_data_t *prim_cdr(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("CDR -- Expected one operand", context);
+static int lcm(const int a, const int b) { return a * b / gcd(a, b); }
+
+static lisp_data_t *cumulfn(const int argc, lisp_data_t *const *argv, int (*func)(const int, const int), lisp_ctx_t *context)  {
+	int cumul, i;
+
+	if(argc == 0)
+		return lisp_make_int(0, context);
 		
-	list = lisp_car(list);
-	
-	if(list && list->type == lisp_type_pair)
-		return lisp_cdr(list);
-	return NULL;
-}
+	cumul = argv[0]->integer;
+	for(i = 1; i < argc; i++)
+		cumul = func(cumul, argv[i]->integer);
 
-static lisp_data_t *prim_cons(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("CONS -- Expected two operands", context);
-	
-	return lisp_cons(lisp_car(list), lisp_car(lisp_cdr(list)));
+	return lisp_make_int(cumul, context);
 }
 
-static lisp_data_t *prim_list(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(!list)
-		return NULL;
-	return lisp_cons(lisp_car(list), prim_list(lisp_cdr(list), context));
+static lisp_data_t *prim_gcd(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return cumulfn(argc, argv, gcd, context);
 }
 
-static lisp_data_t *prim_set_car(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *head, *newcar;
-	
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("SET-CAR -- Expected two operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("SET-CAR -- Expected pair", context);
+static lisp_data_t *prim_lcm(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return cumulfn(argc, argv, lcm, context);
+}
 
-	newcar = lisp_car(lisp_cdr(list));
-	if(head->type != lisp_type_pair)
-		return lisp_make_error("SET-CAR -- Expected pair", context);
+static lisp_data_t *prim_set_cvar(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_cvar_list_t *cvar = context->the_cvars;
 
-	head->pair->l = newcar;
+	while(cvar) {
+		if(!strcmp(cvar->name, argv[0]->symbol)) {
+			if(cvar->access == LISP_CVAR_RO)
+				return lisp_make_error("SET-CVAR -- Read only", context);
+			*(cvar->value) = argv[1]->integer;
+			return lisp_make_symbol("ok", context);
+		}
+		cvar = cvar->next;
+	}
 
-	return head;
+	return lisp_make_error("SET-CVAR -- Unknown CVAR", context);
 }
 
-static lisp_data_t *prim_set_cdr(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *head, *newcdr;
+static lisp_data_t *prim_get_cvar(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_cvar_list_t *cvar = context->the_cvars;
+
+	while(cvar) {
+		if(!strcmp(cvar->name, argv[0]->symbol))
+			return lisp_make_int(*(cvar->value), context);
+		cvar = cvar->next;
+	}
 	
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("SET-CDR -- Expected two operands", context);
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_error("SET-CDR -- Expected pair", context);
+	return lisp_make_error("GET-CVAR -- Unknown CVAR", context);
+}
+
+static void unmap(void *map) {
+	lisp_unmap_file((lisp_mapping_t*)map);
+}
 
-	newcdr = lisp_car(lisp_cdr(list));
-	if(head->type != lisp_type_pair)
-		return lisp_make_error("SET-CDR -- Expected pair", context);
+/* The mapping is kept in scratch memory, so a load that is aborted halfway
+ * through still unmaps the file. */
+static lisp_data_t *prim_load(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_mapping_t *map;
+	lisp_data_t *out;
 
-	head->pair->r = newcdr;
+	if((map = lisp_scratch(sizeof(lisp_mapping_t), unmap, context)) == NULL)
+		return lisp_make_error("LOAD -- Out of memory", context);
 
-	return head;
-}
+	if(lisp_map_file(argv[0]->string, map) == -1) {
+		lisp_unscratch(map, context);
+		return lisp_make_error("LOAD -- Could not read file", context);
+	}
 
-static lisp_data_t *prim_sym_to_str(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *sym;
+	out = lisp_load_forms(map->data, 0, context);
+	lisp_unmap_file(map);
+	lisp_unscratch(map, context);
 
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("SYMBOL->STRING -- Expected one operand", context);
-	sym = lisp_car(list);
+	return out;
+}
 
-	if(!sym || sym->type != lisp_type_symbol)
-		return lisp_make_error("SYMBOL->STRING -- Expected symbol", context);
+/* NUMBER LIBRARY */
 
-	return lisp_make_string(sym->symbol, context);
+static lisp_data_t *prim_abs(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0]->type == lisp_type_integer)
+		return lisp_make_int((argv[0]->integer < 0) ? -argv[0]->integer : argv[0]->integer, context);
+	return lisp_make_decimal(fabs(argv[0]->decimal), context);
 }
 
-static lisp_data_t *prim_str_to_sym(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *str;
+static int is_integer_pair(lisp_data_t *const *argv) { return (argv[0]->type == lisp_type_integer) && (argv[1]->type == lisp_type_integer); }
 
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("STRING->SYMBOL -- Expected one operand", context);
-	str = lisp_car(list);
+static lisp_data_t *prim_modulo(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double num = decimal_of(argv[0]), div = decimal_of(argv[1]);
+	int rem;
 
-	if(!str || str->type != lisp_type_string)
-		return lisp_make_error("STRING->SYMBOL -- Expected string", context);
+	if(div == 0)
+		return lisp_make_error("MODULO -- Division by zero", context);
 
-	return lisp_make_symbol(str->string, context);
+	if(is_integer_pair(argv)) {
+		rem = argv[0]->integer % argv[1]->integer;
+		if(rem && ((rem < 0) != (argv[1]->integer < 0)))
+			rem += argv[1]->integer;
+		return lisp_make_int(rem, context);
+	}
+	return lisp_make_decimal(num - floor(num / div) * div, context);
 }
 
-static lisp_data_t *is_type(const lisp_data_t *list, lisp_type_t type, lisp_ctx_t *context) {
-	lisp_data_t *sym;
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("IS-TYPE -- Expected one operand", context);
+static lisp_data_t *prim_quotient(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double div = decimal_of(argv[1]);
+
+	if(div == 0)
+		return lisp_make_error("QUOTIENT -- Division by zero", context);
 
-	sym = lisp_car(list);
-	if(sym && (sym->type == type))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+	if(is_integer_pair(argv))
+		return lisp_make_int(argv[0]->integer / argv[1]->integer, context);
+	return lisp_make_int((int)(decimal_of(argv[0]) / div), context);
 }
 
-static lisp_data_t *prim_is_sym(const lisp_data_t *list, lisp_ctx_t *context) { return is_type(list, lisp_type_symbol, context); }
+static lisp_data_t *prim_remainder(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double num = decimal_of(argv[0]), div = decimal_of(argv[1]);
 
-static lisp_data_t *prim_is_str(const lisp_data_t *list, lisp_ctx_t *context) { return is_type(list, lisp_type_string, context); }
-	
-static lisp_data_t *prim_is_pair(const lisp_data_t *list, lisp_ctx_t *context) { return is_type(list, lisp_type_pair, context); }
+	if(div == 0)
+		return lisp_make_error("REMAINDER -- Division by zero", context);
+
+	if(is_integer_pair(argv))
+		return lisp_make_int(argv[0]->integer % argv[1]->integer, context);
+	return lisp_make_decimal(fmod(num, div), context);
+}
 
-static lisp_data_t *prim_is_int(const lisp_data_t *list, lisp_ctx_t *context) { return is_type(list, lisp_type_integer, context); }
+static int is_odd(const lisp_data_t *num) {
+	if(num->type == lisp_type_integer)
+		return num->integer % 2 != 0;
+	return fabs(fmod(num->decimal, 2)) == 1;
+}
 
-static lisp_data_t *prim_is_num(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *head;
-	lisp_type_t type;
-	
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("IS-NUM -- Expected one operand", context);
+static lisp_data_t *prim_is_odd(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(is_odd(argv[0]), context); }
+
+static lisp_data_t *prim_is_even(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(!is_odd(argv[0]), context); }
+
+static lisp_data_t *prim_is_zero(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(decimal_of(argv[0]) == 0, context); }
 
-	if((head = lisp_car(list)) == NULL)
-		return lisp_make_symbol("#f", context);
+static lisp_data_t *prim_is_negative(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(decimal_of(argv[0]) < 0, context); }
 
-	type = head->type;
-	if((type == lisp_type_integer) || (type == lisp_type_decimal))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+static lisp_data_t *prim_is_positive(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(decimal_of(argv[0]) > 0, context); }
+
+static lisp_data_t *prim_comp_less_eq(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(is_integer_pair(argv))
+		return make_bool(argv[0]->integer <= argv[1]->integer, context);
+	return make_bool(!(decimal_of(argv[0]) > decimal_of(argv[1])), context);
 }
 
-static lisp_data_t *prim_is_proc(const lisp_data_t *list, lisp_ctx_t *context) {
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("IS-PROC -- Expected one operand", context);
+static lisp_data_t *prim_comp_more_eq(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(is_integer_pair(argv))
+		return make_bool(argv[0]->integer >= argv[1]->integer, context);
+	return make_bool(!(decimal_of(argv[0]) < decimal_of(argv[1])), context);
+}
 
-	list = lisp_car(list);
-	if(!list || list->type != lisp_type_pair)
-		return lisp_make_symbol("#f", context);
-	
-	list = lisp_car(list);
-	if(!list || (list->type != lisp_type_symbol))
-		return lisp_make_symbol("#f", context);
-	
-	if((!strcmp(list->symbol, "closure")) || (!strcmp(list->symbol, "primitive")))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+/* Same results as the Lisp definitions had, including +, * and / turning
+ * whole decimals into integers. */
+static lisp_data_t *prim_square(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *args[2] = { argv[0], argv[0] };
+
+	return prim_mul(2, args, context);
 }
 
-static lisp_data_t *mathfn(const lisp_data_t *list, double (*func)(double), lisp_ctx_t *context) {
-	lisp_data_t *val;
-	
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("MATHFN -- Expected one operand", context);
-	if((val = lisp_car(list)) == NULL)
-		return lisp_make_error("MATHFN -- Expected number", context);
+static lisp_data_t *prim_average(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *args[2];
 
-	if(val->type == lisp_type_integer)
-		return lisp_make_decimal(func((double)val->integer), context);
-	if(val->type == lisp_type_decimal)
-		return lisp_make_decimal(func(val->decimal), context);
-	return lisp_make_error("MATHFN -- Expected number", context);
+	if((args[0] = prim_add(2, argv, context)) == NULL)
+		return lisp_make_error("AVERAGE -- Out of memory", context);
+	if((args[1] = lisp_make_int(2, context)) == NULL)
+		return lisp_make_error("AVERAGE -- Out of memory", context);
+	return prim_div(2, args, context);
 }
 
-static lisp_data_t *prim_sin(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, sin, context); }
+static lisp_data_t *prim_sqrt(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	double num = decimal_of(argv[0]);
 
-static lisp_data_t *prim_cos(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, cos, context); }
+	if(num < 0)
+		return lisp_make_error("SQRT -- Negative operand", context);
+	return lisp_make_decimal(sqrt(num), context);
+}
 
-static lisp_data_t *prim_tan(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, tan, context); }
+static lisp_data_t *prim_is_null(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(argv[0] == NULL, context); }
 
-static lisp_data_t *prim_asin(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, asin, context); }
+static lisp_data_t *prim_is_bool(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_bool(is_word(argv[0], "#t") || is_word(argv[0], "#f"), context); }
 
-static lisp_data_t *prim_acos(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, acos, context); }
+/* LIST LIBRARY */
 
-static lisp_data_t *prim_atan(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, atan, context); }
+/* All of these walk their lists in a loop and build results front to back,
+ * none of them recurses on the length of a list. */
 
-static lisp_data_t *prim_log(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, log, context); }
+static int is_pair(const lisp_data_t *d) { return d && (d->type == lisp_type_pair); }
 
-static lisp_data_t *prim_exp(const lisp_data_t *list, lisp_ctx_t *context) { return mathfn(list, exp, context); }
+/* Appends val to the list that starts in *head and ends in *tail. */
+static int push_back(lisp_data_t **head, lisp_data_t **tail, const lisp_data_t *val, lisp_ctx_t *context) {
+	lisp_data_t *cell;
 
-static lisp_data_t *prim_expt(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_data_t *base, *ex;
-	double dbase, dex;
-	
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("EXPT -- Expected one operand", context);
-	if((base = lisp_car(list)) == NULL)
-		return lisp_make_error("EXPT -- Expected number", context);
-	if((ex = lisp_car(lisp_cdr(list))) == NULL)
-		return lisp_make_error("EXPT -- Expected number", context);
-
-	if(base->type == lisp_type_integer)
-		dbase = (double)base->integer;
-	else if(base->type == lisp_type_decimal)
-		dbase = base->decimal;
+	if((cell = lisp_cons(val, NULL)) == NULL)
+		return -1;
+	if(*tail)
+		(*tail)->pair->r = cell;
 	else
-		return lisp_make_error("EXPT -- Expected number", context);
+		*head = cell;
+	*tail = cell;
+	return 0;
+}
 
-	if(ex->type == lisp_type_integer)
-		dex = (double)ex->integer;
-	else if(ex->type == lisp_type_decimal)
-		dex = ex->decimal;
-	else
-		return lisp_make_error("EXPT -- Expected number", context);
+/* The error for a list lisp_count_pairs() turned down with n. */
+static lisp_data_t *list_error(const char *name, const long n, lisp_ctx_t *context) {
+	char msg[64];
 
-	return lisp_make_decimal(pow(dbase, dex), context);
+	snprintf(msg, sizeof(msg), "%s -- %s", name, (n == LISP_LIST_CIRCULAR) ? "Circular list" : "Expected list");
+	return lisp_make_error(msg, context);
 }
 
-static int gcd(const int a, const int b) {
-	if(a == 0)
-		return b;
-	else if(b == 0)
-		return a;
-	else if(a > b)
-		return gcd(a % b, b);
-	else
-		return gcd(a, b % a);
+static lisp_data_t *prim_length(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	long n = lisp_count_pairs(argv[0], context);
+
+	if(n < 0)
+		return list_error("LENGTH", n, context);
+	return lisp_make_int((int)n, context);
 }
 
-static int lcm(const int a, const int b) { return a * b / gcd(a, b); }
+/* All lists but the last are copied, the result shares the last one. */
+static lisp_data_t *prim_append(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *head = NULL, *tail = NULL, *list;
+	long n;
+	int i;
 
-static lisp_data_t *cumulfn(const lisp_data_t *list, int (*func)(const int, const int), lisp_ctx_t *context)  {
-	int cumul, n;
-	lisp_data_t *head;
+	if(argc == 0)
+		return NULL;
 
-	if(lisp_list_length(list) == 0)
-		return lisp_make_int(0, context);
-		
-	head = lisp_car(list);
-	if(!head || (head->type != lisp_type_integer))
-		return lisp_make_error("CUMULFN -- Expected integer", context);
-	cumul = head->integer;
+	for(i = 0; i < argc - 1; i++) {
+		if((n = lisp_count_pairs(argv[i], context)) < 0)
+			return list_error("APPEND", n, context);
+		for(list = argv[i]; is_pair(list); list = lisp_cdr(list))
+			if(push_back(&head, &tail, lisp_car(list), context) == -1)
+				return lisp_make_error("APPEND -- Out of memory", context);
+	}
 
-	list = lisp_cdr(list);
-	while(list) {
-		head = lisp_car(list);
-		if(!head || (head->type != lisp_type_integer))
-			return lisp_make_error("CUMULFN -- Expected integer", context);
+	if(!tail)
+		return argv[argc - 1];
+	tail->pair->r = argv[argc - 1];
+	return head;
+}
+
+static lisp_data_t *prim_reverse(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL, *list;
+	long n = lisp_count_pairs(argv[0], context);
 
-		n = head->integer;
-		cumul = func(cumul, n);
+	if(n < 0)
+		return list_error("REVERSE", n, context);
+	for(list = argv[0]; is_pair(list); list = lisp_cdr(list))
+		if((out = lisp_cons(lisp_car(list), out)) == NULL)
+			return lisp_make_error("REVERSE -- Out of memory", context);
+	return out;
+}
 
+/* k is bounded, so a circular list does no harm here, but a large k still
+ * takes long enough to be worth polling for. */
+static lisp_data_t *list_tail(const lisp_data_t *list, int k, lisp_ctx_t *context) {
+	while((k-- > 0) && is_pair(list)) {
+		lisp_check_eval(context);
 		list = lisp_cdr(list);
 	}
-
-	return lisp_make_int(cumul, context);
+	return (lisp_data_t*)list;
 }
 
-static lisp_data_t *prim_gcd(const lisp_data_t *list, lisp_ctx_t *context) {
-	return cumulfn(list, gcd, context);
-}
+static lisp_data_t *prim_list_tail(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int k = argv[1]->integer;
 
-static lisp_data_t *prim_lcm(const lisp_data_t *list, lisp_ctx_t *context) {
-	return cumulfn(list, lcm, context);
+	if((k < 0) || (k > 0 && !is_pair(list_tail(argv[0], k - 1, context))))
+		return lisp_make_error("LIST-TAIL -- Index out of range", context);
+	return list_tail(argv[0], k, context);
 }
 
-static lisp_data_t *prim_set_cvar(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_cvar_list_t *cvar = context->the_cvars;
-	lisp_data_t *var, *val;
-	char *var_name;
-	int value;
+static lisp_data_t *prim_list_ref(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *tail;
+
+	if((argv[1]->integer < 0) || !is_pair(tail = list_tail(argv[0], argv[1]->integer, context)))
+		return lisp_make_error("LIST-REF -- Index out of range", context);
+	return lisp_car(tail);
+}
 
-	if(lisp_list_length(list) != 2)
-		return lisp_make_error("SET-CVAR -- Expected two operands", context);
+/* member and assoc accept an improper list and stop at its end, only a
+ * circular one is turned down. */
+static lisp_data_t *prim_member(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *list;
+
+	if(lisp_count_pairs(argv[1], context) == LISP_LIST_CIRCULAR)
+		return list_error("MEMBER", LISP_LIST_CIRCULAR, context);
+	for(list = argv[1]; is_pair(list); list = lisp_cdr(list))
+		if(lisp_is_equal(argv[0], lisp_car(list)))
+			return list;
+	return make_bool(0, context);
+}
 
-	var = lisp_car(list);
-	val = lisp_car(lisp_cdr(list));
+static lisp_data_t *prim_assoc(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *list, *entry;
 
-	if(!var || (var->type != lisp_type_symbol))
-		return lisp_make_error("SET-CVAR -- Expected identifier", context);
-	var_name = var->symbol;
+	if(lisp_count_pairs(argv[1], context) == LISP_LIST_CIRCULAR)
+		return list_error("ASSOC", LISP_LIST_CIRCULAR, context);
+	for(list = argv[1]; is_pair(list); list = lisp_cdr(list)) {
+		entry = lisp_car(list);
+		if(is_pair(entry) && lisp_is_equal(argv[0], lisp_car(entry)))
+			return entry;
+	}
+	return make_bool(0, context);
+}
 
-	if(!val || (val->type != lisp_type_integer))
-		return lisp_make_error("SET-CVAR -- Expected integer", context);
-	value = val->integer;
+/* (map proc list1 list2 ...) stops at the end of the shortest list, which
+ * may be the only one that is not circular. Many lists are kept in scratch
+ * memory, proc may abort the evaluation. */
+static lisp_data_t *prim_map(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *stack[2 * LISP_PRIM_TYPES], **lists = stack, **args, *head = NULL, *tail = NULL, *val;
+	int n = argc - 1, i;
+
+	for(i = 0; i < n; i++)
+		if(lisp_count_pairs(argv[i + 1], context) != LISP_LIST_CIRCULAR)
+			break;
+	if(i == n)
+		return list_error("MAP", LISP_LIST_CIRCULAR, context);
+
+	if((n > LISP_PRIM_TYPES) && ((lists = lisp_scratch(2 * n * sizeof(lisp_data_t*), NULL, context)) == NULL))
+		return lisp_make_error("MAP -- Out of memory", context);
+	args = lists + n;
+
+	for(i = 0; i < n; i++)
+		lists[i] = argv[i + 1];
+
+	for(;;) {
+		lisp_check_eval(context);
+		for(i = 0; i < n; i++) {
+			if(!is_pair(lists[i]))
+				goto done;
+			args[i] = lisp_car(lists[i]);
+			lists[i] = lisp_cdr(lists[i]);
+		}
 
-	while(cvar) {
-		if(!strcmp(cvar->name, var_name)) {
-			if(cvar->access == LISP_CVAR_RO)
-				return lisp_make_error("SET-CVAR -- Read only", context);
-			*(cvar->value) = value;
-			return lisp_make_symbol("ok", context);
+		val = lisp_apply(argv[0], n, args, context);
+		if(val && (val->type == lisp_type_error)) {
+			head = val;
+			goto done;
+		}
+		if(push_back(&head, &tail, val, context) == -1) {
+			head = lisp_make_error("MAP -- Out of memory", context);
+			goto done;
 		}
-		cvar = cvar->next;
 	}
 
-	return lisp_make_error("SET-CVAR -- Unknown CVAR", context);
+done:
+	if(lists != stack)
+		lisp_unscratch(lists, context);
+	return head;
 }
 
-static lisp_data_t *prim_get_cvar(const lisp_data_t *list, lisp_ctx_t *context) {
-	lisp_cvar_list_t *cvar = context->the_cvars;
-	lisp_data_t *var;
-	char *var_name;
+static int is_true(const lisp_data_t *d) { return !is_word(d, "#f"); }
+
+static lisp_data_t *prim_filter(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *head = NULL, *tail = NULL, *list, *item, *keep;
+
+	if(lisp_count_pairs(argv[1], context) == LISP_LIST_CIRCULAR)
+		return list_error("FILTER", LISP_LIST_CIRCULAR, context);
+	for(list = argv[1]; is_pair(list); list = lisp_cdr(list)) {
+		lisp_check_eval(context);
+		item = lisp_car(list);
+		keep = lisp_apply(argv[0], 1, &item, context);
+		if(keep && (keep->type == lisp_type_error))
+			return keep;
+		if(is_true(keep) && (push_back(&head, &tail, item, context) == -1))
+			return lisp_make_error("FILTER -- Out of memory", context);
+	}
+	return head;
+}
 
-	if(lisp_list_length(list) != 1)
-		return lisp_make_error("GET-CVAR -- Expected one operand", context);
-	if((var = lisp_car(list)) == NULL)
-		return lisp_make_error("GET-CVAR -- Expected identifier", context);
+/* (fold-left f init list) is (f (f init x1) x2)... */
+static lisp_data_t *prim_fold_left(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *list, *args[2];
+
+	if(lisp_count_pairs(argv[2], context) == LISP_LIST_CIRCULAR)
+		return list_error("FOLD-LEFT", LISP_LIST_CIRCULAR, context);
+	args[0] = argv[1];
+	for(list = argv[2]; is_pair(list); list = lisp_cdr(list)) {
+		lisp_check_eval(context);
+		args[1] = lisp_car(list);
+		args[0] = lisp_apply(argv[0], 2, args, context);
+		if(args[0] && (args[0]->type == lisp_type_error))
+			break;
+	}
+	return args[0];
+}
 
-	if(var->type != lisp_type_symbol)
-		return lisp_make_error("GET-CVAR -- Expected identifier", context);
-	var_name = var->symbol;
+/* (fold-right f init list) is (f x1 (f x2 ... (f xn init))), the list is
+ * reversed first so the calls go in the right order without recursing. */
+static lisp_data_t *prim_fold_right(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *list, *args[2];
+
+	if((list = prim_reverse(1, &argv[2], context)) && (list->type == lisp_type_error))
+		return list;
+
+	args[1] = argv[1];
+	for(; is_pair(list); list = lisp_cdr(list)) {
+		lisp_check_eval(context);
+		args[0] = lisp_car(list);
+		args[1] = lisp_apply(argv[0], 2, args, context);
+		if(args[1] && (args[1]->type == lisp_type_error))
+			break;
+	}
+	return args[1];
+}
 
-	while(cvar) {
-		if(!strcmp(cvar->name, var_name))
-			return lisp_make_int(*(cvar->value), context);
-		cvar = cvar->next;
+/* (reduce f init list) is init for an empty list, and (f x2 x1), then
+ * (f x3 (f x2 x1))... otherwise. */
+static lisp_data_t *prim_reduce(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *list = argv[2], *args[2];
+
+	if(lisp_count_pairs(list, context) == LISP_LIST_CIRCULAR)
+		return list_error("REDUCE", LISP_LIST_CIRCULAR, context);
+	if(!is_pair(list))
+		return argv[1];
+
+	args[1] = lisp_car(list);
+	for(list = lisp_cdr(list); is_pair(list); list = lisp_cdr(list)) {
+		lisp_check_eval(context);
+		args[0] = lisp_car(list);
+		args[1] = lisp_apply(argv[0], 2, args, context);
+		if(args[1] && (args[1]->type == lisp_type_error))
+			break;
 	}
-	
-	return lisp_make_error("GET-CVAR -- Unknown CVAR", context);
+	return args[1];
+}
+
+/* (apply proc arg1 ... list) calls proc on the args followed by the elements
+ * of list. Long argument lists are kept in scratch memory like in map. */
+static lisp_data_t *prim_apply(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *stack[2 * LISP_PRIM_TYPES], **args = stack, *list, *out;
+	long n = lisp_count_pairs(argv[argc - 1], context);
+	int i;
+
+	if(n < 0)
+		return list_error("APPLY", n, context);
+	n += argc - 2;
+
+	if((n > 2 * LISP_PRIM_TYPES) && ((args = lisp_scratch(n * sizeof(lisp_data_t*), NULL, context)) == NULL))
+		return lisp_make_error("APPLY -- Out of memory", context);
+
+	for(i = 0; i < argc - 2; i++)
+		args[i] = argv[i + 1];
+	for(list = argv[argc - 1]; is_pair(list); list = lisp_cdr(list))
+		args[i++] = lisp_car(list);
+
+	out = lisp_apply(argv[0], (int)n, args, context);
+
+	if(args != stack)
+		lisp_unscratch(args, context);
+	return out;
+}
+
+/* VECTORS */
+
+static int is_index(const lisp_data_t *vector, const lisp_data_t *k) { return (k->integer >= 0) && ((size_t)k->integer < vector->vector->length); }
+
+static lisp_data_t *prim_make_vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(argv[0]->integer < 0)
+		return lisp_make_error("MAKE-VECTOR -- Negative length", context);
+	if((out = lisp_make_vector((size_t)argv[0]->integer, (argc > 1) ? argv[1] : NULL, context)) == NULL)
+		return lisp_make_error("MAKE-VECTOR -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	int i;
+
+	if((out = lisp_make_vector((size_t)argc, NULL, context)) == NULL)
+		return lisp_make_error("VECTOR -- Out of memory", context);
+	for(i = 0; i < argc; i++)
+		out->vector->items[i] = argv[i];
+	return out;
+}
+
+static lisp_data_t *prim_is_vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_vector, context); }
+
+static lisp_data_t *prim_vector_length(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_int((int)argv[0]->vector->length, context);
+}
+
+static lisp_data_t *prim_vector_ref(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(!is_index(argv[0], argv[1]))
+		return lisp_make_error("VECTOR-REF -- Index out of range", context);
+	return argv[0]->vector->items[argv[1]->integer];
+}
+
+static lisp_data_t *prim_vector_set(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("VECTOR-SET! -- Immutable vector", context);
+	if(!is_index(argv[0], argv[1]))
+		return lisp_make_error("VECTOR-SET! -- Index out of range", context);
+
+	argv[0]->vector->items[argv[1]->integer] = argv[2];
+
+	return argv[0];
+}
+
+static lisp_data_t *prim_vector_fill(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t i;
+
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("VECTOR-FILL! -- Immutable vector", context);
+
+	for(i = 0; i < argv[0]->vector->length; i++)
+		argv[0]->vector->items[i] = argv[1];
+
+	return argv[0];
+}
+
+static lisp_data_t *prim_vector_to_list(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL;
+	size_t i;
+
+	for(i = argv[0]->vector->length; i > 0; i--)
+		if((out = lisp_cons(argv[0]->vector->items[i - 1], out)) == NULL)
+			return lisp_make_error("VECTOR->LIST -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_list_to_vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out, *list;
+	long n = lisp_count_pairs(argv[0], context);
+
+	if(n < 0)
+		return list_error("LIST->VECTOR", n, context);
+
+	if((out = lisp_make_vector((size_t)n, NULL, context)) == NULL)
+		return lisp_make_error("LIST->VECTOR -- Out of memory", context);
+	for(n = 0, list = argv[0]; list; list = lisp_cdr(list))
+		out->vector->items[n++] = lisp_car(list);
+	return out;
+}
+
+/* WEAK BOXES */
+
+static lisp_data_t *prim_make_weak_box(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if((out = lisp_make_weak_box(argv[0], context)) == NULL)
+		return lisp_make_error("MAKE-WEAK-BOX -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_is_weak_box(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return is_type(argv[0], lisp_type_weakbox, context); }
+
+/* (weak-box-value box [default]), the default is #f. */
+static lisp_data_t *prim_weak_box_value(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(!argv[0]->weakbox->broken)
+		return argv[0]->weakbox->value;
+	return (argc > 1) ? argv[1] : make_bool(0, context);
+}
+
+static lisp_data_t *prim_weak_box_broken(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(argv[0]->weakbox->broken, context);
 }
 
+#define NUMBER		LISP_ARG_NUMBER
+#define INTEGER		LISP_ARG(lisp_type_integer)
+#define STRING		LISP_ARG(lisp_type_string)
+#define SYMBOL		LISP_ARG(lisp_type_symbol)
+#define PAIR		LISP_ARG(lisp_type_pair)
+#define LIST		LISP_ARG_LIST
+#define VECTOR		LISP_ARG(lisp_type_vector)
+#define WEAKBOX		LISP_ARG(lisp_type_weakbox)
+#define ANY		LISP_ARG_ANY
+#define PURE		LISP_PRIM_PURE
+
+static const lisp_prim_def_t builtin_prims[] = {
+	{ "+", prim_add, 0, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "*", prim_mul, 0, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "-", prim_sub, 1, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "/", prim_div, 1, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "=", prim_comp_eq, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "<", prim_comp_less, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ ">", prim_comp_more, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "not", prim_not, 1, 1, { ANY }, PURE },
+	{ "floor", prim_floor, 1, 1, { NUMBER }, PURE },
+	{ "ceiling", prim_ceiling, 1, 1, { NUMBER }, PURE },
+	{ "truncate", prim_trunc, 1, 1, { NUMBER }, PURE },
+	{ "round", prim_round, 1, 1, { NUMBER }, PURE },
+	{ "max", prim_max, 1, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "min", prim_min, 1, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), PURE },
+	{ "eq?", prim_eq, 2, 2, { ANY }, PURE },
+	{ "car", prim_car, 1, 1, { ANY }, 0 },
+	{ "cdr", prim_cdr, 1, 1, { ANY }, 0 },
+	{ "set-car!", prim_set_car, 2, 2, { PAIR, ANY }, 0 },
+	{ "set-cdr!", prim_set_cdr, 2, 2, { PAIR, ANY }, 0 },
+	{ "cons", prim_cons, 2, 2, { ANY }, 0 },
+	{ "list", prim_list, 0, LISP_VARIADIC, { ANY }, 0 },
+	{ "number?", prim_is_num, 1, 1, { ANY }, PURE },
+	{ "real?", prim_is_num, 1, 1, { ANY }, PURE },
+	{ "integer?", prim_is_int, 1, 1, { ANY }, PURE },
+	{ "procedure?", prim_is_proc, 1, 1, { ANY }, PURE },
+	{ "symbol->string", prim_sym_to_str, 1, 1, { SYMBOL }, PURE },
+	{ "string->symbol", prim_str_to_sym, 1, 1, { STRING }, PURE },
+	{ "symbol?", prim_is_sym, 1, 1, { ANY }, PURE },
+	{ "string?", prim_is_str, 1, 1, { ANY }, PURE },
+	{ "pair?", prim_is_pair, 1, 1, { ANY }, PURE },
+	{ "gcd", prim_gcd, 0, LISP_VARIADIC, LISP_ARGS_ALL(INTEGER), PURE },
+	{ "lcm", prim_lcm, 0, LISP_VARIADIC, LISP_ARGS_ALL(INTEGER), PURE },
+
+	{ "sin", prim_sin, 1, 1, { NUMBER }, PURE },
+	{ "cos", prim_cos, 1, 1, { NUMBER }, PURE },
+	{ "tan", prim_tan, 1, 1, { NUMBER }, PURE },
+	{ "asin", prim_asin, 1, 1, { NUMBER }, PURE },
+	{ "acos", prim_acos, 1, 1, { NUMBER }, PURE },
+	{ "atan", prim_atan, 1, 1, { NUMBER }, PURE },
+	{ "log", prim_log, 1, 1, { NUMBER }, PURE },
+	{ "exp", prim_exp, 1, 1, { NUMBER }, PURE },
+	{ "expt", prim_expt, 2, 2, { NUMBER, NUMBER }, PURE },
+
+	{ "set-cvar!", prim_set_cvar, 2, 2, { SYMBOL, INTEGER }, 0 },
+	{ "get-cvar", prim_get_cvar, 1, 1, { SYMBOL }, 0 },
+	{ "load", prim_load, 1, 1, { STRING }, 0 },
+
+	{ "abs", prim_abs, 1, 1, { NUMBER }, PURE },
+	{ "modulo", prim_modulo, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "quotient", prim_quotient, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "remainder", prim_remainder, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "odd?", prim_is_odd, 1, 1, { NUMBER }, PURE },
+	{ "even?", prim_is_even, 1, 1, { NUMBER }, PURE },
+	{ "zero?", prim_is_zero, 1, 1, { NUMBER }, PURE },
+	{ "negative?", prim_is_negative, 1, 1, { NUMBER }, PURE },
+	{ "positive?", prim_is_positive, 1, 1, { NUMBER }, PURE },
+	{ "<=", prim_comp_less_eq, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ ">=", prim_comp_more_eq, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "square", prim_square, 1, 1, { NUMBER }, PURE },
+	{ "average", prim_average, 2, 2, { NUMBER, NUMBER }, PURE },
+	{ "sqrt", prim_sqrt, 1, 1, { NUMBER }, PURE },
+	{ "null?", prim_is_null, 1, 1, { ANY }, PURE },
+	{ "boolean?", prim_is_bool, 1, 1, { ANY }, PURE },
+
+	{ "length", prim_length, 1, 1, { LIST }, 0 },
+	{ "append", prim_append, 0, LISP_VARIADIC, { ANY }, 0 },
+	{ "reverse", prim_reverse, 1, 1, { LIST }, 0 },
+	{ "list-tail", prim_list_tail, 2, 2, { LIST, INTEGER }, 0 },
+	{ "list-ref", prim_list_ref, 2, 2, { LIST, INTEGER }, 0 },
+	{ "member", prim_member, 2, 2, { ANY, LIST }, 0 },
+	{ "assoc", prim_assoc, 2, 2, { ANY, LIST }, 0 },
+	{ "map", prim_map, 2, LISP_VARIADIC, { ANY, LIST, LIST, LIST }, 0 },
+	{ "filter", prim_filter, 2, 2, { ANY, LIST }, 0 },
+	{ "fold-left", prim_fold_left, 3, 3, { ANY, ANY, LIST }, 0 },
+	{ "fold-right", prim_fold_right, 3, 3, { ANY, ANY, LIST }, 0 },
+	{ "reduce", prim_reduce, 3, 3, { ANY, ANY, LIST }, 0 },
+	{ "apply", prim_apply, 2, LISP_VARIADIC, { ANY }, 0 },
+
+	{ "make-vector", prim_make_vector, 1, 2, { INTEGER, ANY }, 0 },
+	{ "vector", prim_vector, 0, LISP_VARIADIC, { ANY }, 0 },
+	{ "vector?", prim_is_vector, 1, 1, { ANY }, PURE },
+	{ "vector-length", prim_vector_length, 1, 1, { VECTOR }, PURE },
+	{ "vector-ref", prim_vector_ref, 2, 2, { VECTOR, INTEGER }, 0 },
+	{ "vector-set!", prim_vector_set, 3, 3, { VECTOR, INTEGER, ANY }, 0 },
+	{ "vector-fill!", prim_vector_fill, 2, 2, { VECTOR, ANY }, 0 },
+	{ "vector->list", prim_vector_to_list, 1, 1, { VECTOR }, 0 },
+	{ "list->vector", prim_list_to_vector, 1, 1, { LIST }, 0 },
+	{ "make-weak-box", prim_make_weak_box, 1, 1, { ANY }, 0 },
+	{ "weak-box?", prim_is_weak_box, 1, 1, { ANY }, PURE },
+	{ "weak-box-value", prim_weak_box_value, 1, 2, { WEAKBOX, ANY }, 0 },
+	{ "weak-box-broken?", prim_weak_box_broken, 1, 1, { WEAKBOX }, 0 }
+};
+
+#undef NUMBER
+#undef INTEGER
+#undef STRING
+#undef SYMBOL
+#undef PAIR
+#undef LIST
+#undef VECTOR
+#undef WEAKBOX
+#undef ANY
+#undef PURE
+
 /* --- */
 
-static lisp_data_t *primitive_procedure_names(lisp_ctx_t *context) {
+static lisp_data_t *primitive_procedure_names(const lisp_prim_proc_list_t *stop, lisp_ctx_t *context) {
 	lisp_prim_proc_list_t *curr_proc = context->the_last_prim_proc;
 	lisp_data_t *out = NULL;
 
-	while(curr_proc) {
+	while(curr_proc != stop) {
 		out = lisp_cons(lisp_make_symbol(curr_proc->name, context), out);
 		curr_proc = curr_proc->prev;
 	}
@@ -795,19 +1029,19 @@ static lisp_data_t *primitive_procedure_names(lisp_ctx_t *context) {
 	return out;
 }
 
-static lisp_data_t *primitive_procedure_objects(lisp_ctx_t *context) {
+static lisp_data_t *primitive_procedure_objects(const lisp_prim_proc_list_t *stop, lisp_ctx_t *context) {
 	lisp_prim_proc_list_t *curr_proc = context->the_last_prim_proc;
 	lisp_data_t *out = NULL;
 
-	while(curr_proc) {
-		out = lisp_cons(lisp_cons(lisp_make_symbol("primitive", context), lisp_cons(lisp_make_prim(curr_proc->proc, context), NULL)), out);
+	while(curr_proc != stop) {
+		out = lisp_cons(lisp_make_prim_object(curr_proc, context), out);
 		curr_proc = curr_proc->prev;
 	}
 
 	return out;
 }
 
-void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context) {
+static void add_prim_entry(const char *name, lisp_prim_proc proc, const lisp_prim_def_t *def, lisp_ctx_t *context) {
 	lisp_prim_proc_list_t *curr_proc;
 
 	if(context->the_last_prim_proc == NULL) {
@@ -815,6 +1049,7 @@ void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context) {
 		context->the_prim_procs->name = malloc(strlen(name) + 1);
 		strcpy(context->the_prim_procs->name, name);
 		context->the_prim_procs->proc = proc;
+		context->the_prim_procs->def = def;
 		context->the_prim_procs->next = NULL;
 		context->the_prim_procs->prev = NULL;
 		context->the_last_prim_proc = context->the_prim_procs;
@@ -825,6 +1060,7 @@ void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context) {
 	curr_proc->name = malloc(strlen(name) + 1);
 	strcpy(curr_proc->name, name);
 	curr_proc->proc = proc;
+	curr_proc->def = def;
 	curr_proc->prev = context->the_last_prim_proc;
 	curr_proc->next = NULL;
 
@@ -832,6 +1068,26 @@ void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context) {
 	context->the_last_prim_proc = curr_proc;
 }
 
+void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context) {
+	add_prim_entry(name, proc, NULL, context);
+}
+
+/* The definition is not copied, it is usually static. */
+void lisp_add_vprim(const lisp_prim_def_t *def, lisp_ctx_t *context) {
+	add_prim_entry(def->name, NULL, def, context);
+}
+
+lisp_data_t *lisp_make_prim_object(const lisp_prim_proc_list_t *entry, lisp_ctx_t *context) {
+	lisp_data_t *impl;
+
+	if(entry->def)
+		impl = lisp_make_vprim(entry->def, context);
+	else
+		impl = lisp_make_prim(entry->proc, context);
+
+	return lisp_cons(lisp_make_symbol("primitive", context), lisp_cons(impl, NULL));
+}
+
 void lisp_add_cvar(const char *name, const size_t *valptr, const int access, lisp_ctx_t *context) {
 	lisp_cvar_list_t *curr_var;
 
@@ -857,69 +1113,61 @@ void lisp_add_cvar(const char *name, const size_t *valptr, const int access, lis
 	context->the_last_cvar = curr_var;
 }
 
+const char *lisp_prim_name(const lisp_data_t *prim, const lisp_ctx_t *context) {
+	lisp_prim_proc_list_t *curr_proc = context->the_prim_procs;
+
+	while(curr_proc) {
+		if((prim->type == lisp_type_vprim) ? (curr_proc->def == prim->def) : (!curr_proc->def && (curr_proc->proc == prim->proc)))
+			return curr_proc->name;
+		curr_proc = curr_proc->next;
+	}
+	return NULL;
+}
+
+lisp_data_t *lisp_make_named_prim(const char *name, lisp_ctx_t *context) {
+	lisp_prim_proc_list_t *curr_proc = context->the_prim_procs;
+
+	while(curr_proc) {
+		if(!strcmp(curr_proc->name, name))
+			return curr_proc->def ? lisp_make_vprim(curr_proc->def, context) : lisp_make_prim(curr_proc->proc, context);
+		curr_proc = curr_proc->next;
+	}
+	return NULL;
+}
+
 static void add_builtin_prim_procs(lisp_ctx_t *context) {
-	lisp_add_prim_proc("+", prim_add, context);
-	lisp_add_prim_proc("*", prim_mul, context);
-	lisp_add_prim_proc("-", prim_sub, context);
-	lisp_add_prim_proc("/", prim_div, context);
-	lisp_add_prim_proc("=", prim_comp_eq, context);
-	lisp_add_prim_proc("<", prim_comp_less, context);
-	lisp_add_prim_proc(">", prim_comp_more, context);
-	lisp_add_prim_proc("or", prim_or, context);
-	lisp_add_prim_proc("and", prim_and, context);
-	lisp_add_prim_proc("not", prim_not, context);
-	lisp_add_prim_proc("floor", prim_floor, context);
-	lisp_add_prim_proc("ceiling", prim_ceiling, context);
-	lisp_add_prim_proc("truncate", prim_trunc, context);
-	lisp_add_prim_proc("round", prim_round, context);
-	lisp_add_prim_proc("max", prim_max, context);
-	lisp_add_prim_proc("min", prim_min, context);
-	lisp_add_prim_proc("eq?", prim_eq, context);
-	lisp_add_prim_proc("car", prim_car, context);
-	lisp_add_prim_proc("cdr", prim_cdr, context);
-	lisp_add_prim_proc("set-car!", prim_set_car, context);
-	lisp_add_prim_proc("set-cdr!", prim_set_cdr, context);
-	lisp_add_prim_proc("cons", prim_cons, context);
-	lisp_add_prim_proc("list", prim_list, context);
-	lisp_add_prim_proc("number?", prim_is_num, context);
-	lisp_add_prim_proc("real?", prim_is_num, context);
-	lisp_add_prim_proc("integer?", prim_is_int, context);
-	lisp_add_prim_proc("procedure?", prim_is_proc, context);
-	lisp_add_prim_proc("symbol->string", prim_sym_to_str, context);
-	lisp_add_prim_proc("string->symbol", prim_str_to_sym, context);
-	lisp_add_prim_proc("symbol?", prim_is_sym, context);
-	lisp_add_prim_proc("string?", prim_is_str, context);
-	lisp_add_prim_proc("pair?", prim_is_pair, context);
-	lisp_add_prim_proc("gcd", prim_gcd, context);
-	lisp_add_prim_proc("lcm", prim_lcm, context);
-
-	lisp_add_prim_proc("sin", prim_sin, context);
-	lisp_add_prim_proc("cos", prim_cos, context);
-	lisp_add_prim_proc("tan", prim_tan, context);
-	lisp_add_prim_proc("asin", prim_asin, context);
-	lisp_add_prim_proc("acos", prim_acos, context);
-	lisp_add_prim_proc("atan", prim_atan, context);
-	lisp_add_prim_proc("log", prim_log, context);
-	lisp_add_prim_proc("exp", prim_exp, context);
-	lisp_add_prim_proc("expt", prim_expt, context);
-
-	lisp_add_prim_proc("set-cvar!", prim_set_cvar, context);
-	lisp_add_prim_proc("get-cvar", prim_get_cvar, context);
+	size_t i;
+
+	for(i = 0; i < sizeof(builtin_prims) / sizeof(builtin_prims[0]); i++)
+		lisp_add_vprim(&builtin_prims[i], context);
+	lisp_add_numvec_prims(context);
+	lisp_add_hash_prims(context);
+	lisp_add_text_prims(context);
+	lisp_add_sort_prims(context);
 }
 
-void lisp_setup_env(lisp_ctx_t *context) {
-	lisp_data_t *the_empty_environment = lisp_cons(lisp_cons(NULL, NULL), NULL);
+/* True for the definitions above, a host primitive may have the same name. */
+int lisp_is_builtin_prim(const lisp_prim_def_t *def) {
+	return (def >= builtin_prims) && (def < builtin_prims + sizeof(builtin_prims) / sizeof(builtin_prims[0]));
+}
 
+void lisp_add_builtin_cvars(lisp_ctx_t *context) {
 	lisp_add_cvar("mem_lim_hard", &context->mem_lim_hard, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_lim_soft", &context->mem_lim_soft, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_list_entries", &context->mem_list_entries, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_verbosity", &context->mem_verbosity, LISP_CVAR_RW, context);
 	lisp_add_cvar("mem_allocated", &context->mem_allocated, LISP_CVAR_RO, context);
 	lisp_add_cvar("thread_timeout", &context->thread_timeout, LISP_CVAR_RW, context);
+}
+
+void lisp_setup_env(lisp_ctx_t *context) {
+	lisp_data_t *the_empty_environment = lisp_cons(lisp_cons(NULL, NULL), NULL);
+
+	lisp_add_builtin_cvars(context);
 
 	context->the_global_environment = 
-		extend_environment(primitive_procedure_names(context), 
-						   primitive_procedure_objects(context),
+		extend_environment(primitive_procedure_names(NULL, context), 
+						   primitive_procedure_objects(NULL, context),
 						   the_empty_environment, context);
 
 	lisp_run("(define (caar pair) (car (car pair)))", context);
@@ -954,36 +1202,85 @@ void lisp_setup_env(lisp_ctx_t *context) {
 	lisp_run("(define (cddddr pair) (cdr (cdr (cdr (cdr pair)))))", context);
 
 	lisp_run("(define nil '())", context);
-	lisp_run("(define (zero? exp) (= 0 exp))", context);
-	lisp_run("(define (null? exp) (eq? exp nil))", context);
-	lisp_run("(define (negative? exp) (< exp 0))", context);
-	lisp_run("(define (positive? exp) (> exp 0))", context);
-	lisp_run("(define (boolean? exp) (or (eq? exp '#t) (eq? exp '#f)))", context);
-	lisp_run("(define (abs n) (if (negative? n) (- 0 n) n))", context);
-	lisp_run("(define (<= a b) (not (> a b)))", context);
-	lisp_run("(define (>= a b) (not (< a b)))", context);
-	lisp_run("(define (map proc items) (if (null? items) nil (cons (proc (car items)) (map proc (cdr items)))))", context);
 	lisp_run("(define (fact n) (if (= n 1) 1 (* n (fact (- n 1)))))", context);
 	lisp_run("(define (delay proc) (lambda () proc))", context);
 	lisp_run("(define (force proc) (proc))", context);
-	lisp_run("(define (length list) (define (list-loop part count) (if (null? part) count (list-loop (cdr part) (+ count 1)))) (list-loop list 0))", context);
-	lisp_run("(define (modulo num div) (- num (* (floor (/ num div)) div)))", context);
-	lisp_run("(define (quotient num div) (truncate (/ num div)))", context);
-	lisp_run("(define (remainder num div) (+ (* (quotient num div) div -1) num))", context);
-	lisp_run("(define (odd? n) (if (= 1 (modulo n 2)) '#t '#f))", context);
-	lisp_run("(define (even? n) (not (odd? n)))", context);
-	lisp_run("(define (square n) (* n n))", context);
-	lisp_run("(define (average a b) (/ (+ a b) 2))", context);
-	lisp_run("(define (sqrt x) (define (good-enough? guess) (< (abs (- (square guess) x)) 0.000001)) (define (improve guess) (average guess (/ x guess))) (define (sqrt-iter guess) (if (good-enough? guess) (abs guess) (sqrt-iter (improve guess)))) (sqrt-iter 1.0))", context);
-	lisp_run("(define (append list1 list2) (if (null? list1) list2 (cons (car list1) (append (cdr list1) list2))))", context);
 
 	lisp_gc(LISP_GC_FORCE, context);
 }
 
+/* Only the primitives added after lisp_make_context() go into the new frame,
+ * the builtin ones are already bound in the base environment. */
+void lisp_setup_env_from(lisp_ctx_t *context, const lisp_ctx_t *base) {
+	lisp_add_builtin_cvars(context);
+
+	context->base = base;
+	context->the_global_environment = 
+		extend_environment(primitive_procedure_names(context->the_last_builtin_proc, context), 
+						   primitive_procedure_objects(context->the_last_builtin_proc, context),
+						   base->the_global_environment, context);
+}
+
+/* Lazy tails are read first, reading them later would allocate in the base
+ * from whichever thread got there first. */
+void lisp_freeze_context(lisp_ctx_t *context) {
+	if(lisp_context_busy(context)) {
+		fprintf(stderr, "ERROR: Cannot freeze a context while eval() is running.\n");
+		return;
+	}
+
+	lisp_gc(LISP_GC_FORCE, context);
+	lisp_force_all_lazy(context);
+	context->frozen = 1;
+}
+
+/* CLONING */
+
+static int is_context_field(const size_t *valptr, const lisp_ctx_t *context) {
+	return ((const char*)valptr >= (const char*)context) && ((const char*)valptr < (const char*)(context + 1));
+}
+
+/* A frozen base is shared as it is. Anything else is copied, so base and clone
+ * can both go on changing their data without seeing each other's changes. */
+lisp_ctx_t *lisp_clone_context(lisp_ctx_t *base) {
+	lisp_prim_proc_list_t *proc;
+	lisp_cvar_list_t *cvar;
+	lisp_ctx_t *out;
+
+	if(lisp_context_busy(base)) {
+		fprintf(stderr, "ERROR: Cannot clone a context while eval() is running.\n");
+		return NULL;
+	}
+
+	if((out = lisp_make_context(base->mem_lim_soft, base->mem_lim_hard, base->mem_verbosity, base->thread_timeout)) == NULL)
+		return NULL;
+
+	proc = base->the_last_builtin_proc ? base->the_last_builtin_proc->next : base->the_prim_procs;
+	for(; proc; proc = proc->next)
+		add_prim_entry(proc->name, proc->proc, proc->def, out);
+
+	/* The builtin cvars point into base and are set up anew for the clone. */
+	for(cvar = base->the_cvars; cvar; cvar = cvar->next)
+		if(!is_context_field(cvar->value, base))
+			lisp_add_cvar(cvar->name, cvar->value, cvar->access, out);
+
+	if(base->frozen) {
+		/* Host primitives are bound in the shared environment already. */
+		out->the_last_builtin_proc = out->the_last_prim_proc;
+		lisp_setup_env_from(out, base);
+	} else if(lisp_copy_image(out, base) != LISP_IMAGE_OK) {
+		lisp_destroy_context(out);
+		return NULL;
+	}
+
+	return out;
+}
+
 void lisp_free_context(lisp_ctx_t *context) {
 	lisp_prim_proc_list_t *current_proc = context->the_prim_procs, *procbuf;
 	lisp_cvar_list_t *current_var = context->the_cvars, *varbuf;
 
+	lisp_free_roots(context);
 	lisp_gc(LISP_GC_FORCE, context);
 	lisp_free_data_rec(context->the_global_environment, context);
 
@@ -1004,6 +1301,7 @@ void lisp_free_context(lisp_ctx_t *context) {
 	}
 	context->the_cvars = NULL;
 	context->the_last_cvar = NULL;
+	context->base = NULL;
 }
 
 lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout) {
@@ -1014,8 +1312,14 @@ lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_ha
 
 	out->the_cvars = NULL;
 	out->the_last_cvar = NULL;
+	out->the_roots = NULL;
+	out->the_weak = NULL;
 	out->the_prim_procs = NULL;
 	out->the_last_prim_proc = NULL;
+	out->the_last_builtin_proc = NULL;
+	out->the_global_environment = NULL;
+	out->base = NULL;
+	out->frozen = 0;
 
 	out->mem_lim_soft = mem_lim_soft;
 	out->mem_lim_hard = mem_lim_hard;
@@ -1027,22 +1331,37 @@ lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_ha
 	out->n_bytes_peak = 0;
 	out->warned = 0;
 	out->alloc_list = NULL;
+	out->alloc_set = NULL;
+	out->alloc_set_size = 0;
+	out->the_scratch = NULL;
+	out->n_scratch = 0;
 
 	out->thread_timeout = thread_timeout;
 	out->thread_running = 0;
 	out->eval_plz_die = 0;
+	out->deadline = 0;
+	out->n_checks = 0;
+	out->escape = NULL;
 
 	add_builtin_prim_procs(out);
+	out->the_last_builtin_proc = out->the_last_prim_proc;
 
 	return out;
 }
 
+/* A context that a thread left behind by lisp_eval_free() still runs in is
+ * destroyed by that thread when it ends. */
 void lisp_destroy_context(lisp_ctx_t *context) {
 	if(context == NULL)
 		return;
 
+	if(lisp_atomic_cas(&context->thread_running, LISP_THREAD_RUNNING, LISP_THREAD_DOOMED))
+		return;
+
+	lisp_free_scratch(0, context);
 	lisp_free_context(context);
 	lisp_gc_stats(stderr, context);
 
+	free((void*)context->alloc_set);
 	free(context);
 }
\ No newline at end of file
@@ -10,10 +10,15 @@
  */
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "libisp/data.h"
+#include "libisp/hash.h"
 #include "libisp/mem.h"
+#include "libisp/read.h"
+#include "libisp/thread.h"
 
 /* MAKE DATA OBJECTS */
 
@@ -41,65 +46,160 @@ lisp_data_t *lisp_make_decimal(const double d, lisp_ctx_t *context) {
 	return out;
 }
 
-lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context) {
+/* The text does not have to be terminated, the reader hands in slices of
+ * its input. */
+static lisp_data_t *make_text(const lisp_type_t type, const char *text, const size_t len, lisp_ctx_t *context) {
 	lisp_data_t *out;
+	char *buf;
 
-	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+	if(!(buf = malloc(len + 1)))
 		return NULL;
 
-	if(!(out->string = malloc(strlen(str) + 1))) {
-		free(out);
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context))) {
+		free(buf);
 		return NULL;
 	}
 
-	out->type = lisp_type_string;
-	strcpy(out->string, str);
+	memcpy(buf, text, len);
+	buf[len] = '\0';
+
+	out->type = type;
+	out->string = buf;
 
 	return out;
 }
 
+lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context) {
+	return make_text(lisp_type_string, str, strlen(str), context);
+}
+
+lisp_data_t *lisp_make_stringn(const char *str, const size_t len, lisp_ctx_t *context) {
+	return make_text(lisp_type_string, str, len, context);
+}
+
 lisp_data_t *lisp_make_symbol(const char *ident, lisp_ctx_t *context) {
-	lisp_data_t *out;
+	return make_text(lisp_type_symbol, ident, strlen(ident), context);
+}
+
+lisp_data_t *lisp_make_symboln(const char *ident, const size_t len, lisp_ctx_t *context) {
+	return make_text(lisp_type_symbol, ident, len, context);
+}
+
+lisp_data_t *lisp_make_prim(lisp_prim_proc in, lisp_ctx_t *context) {
+		lisp_data_t *out;
 
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
-	if(!(out->symbol = malloc(strlen(ident) + 1))) {
-		free(out);
+	out->type = lisp_type_prim;
+	out->proc = in;
+
+	return out;
+}
+
+lisp_data_t *lisp_make_vprim(const lisp_prim_def_t *def, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
+
+	out->type = lisp_type_vprim;
+	out->def = def;
+
+	return out;
+}
+
+lisp_data_t *lisp_make_error(const char *errmsg, lisp_ctx_t *context) {
+	return make_text(lisp_type_error, errmsg, strlen(errmsg), context);
+}
+
+/* VECTORS */
+
+/* The datum, the vector and its elements are a single allocation, so the
+ * elements count against the memory limits and are freed along with it. */
+static lisp_data_t *new_vector(const size_t length, lisp_data_t **items, lisp_ctx_t *context) {
+	size_t size = sizeof(lisp_data_t) + sizeof(lisp_vector_t);
+	lisp_data_t *out;
+
+	if(!items) {
+		if(length > (SIZE_MAX - size) / sizeof(lisp_data_t*))
+			return NULL;
+		size += length * sizeof(lisp_data_t*);
 	}
 
-	out->type = lisp_type_symbol;
-	strcpy(out->symbol, ident);
+	if(!(out = lisp_data_alloc(size, context)))
+		return NULL;
+
+	out->type = lisp_type_vector;
+	out->vector = (lisp_vector_t*)(out + 1);
+	out->vector->length = length;
+	out->vector->items = items ? items : (lisp_data_t**)(out->vector + 1);
 
 	return out;
 }
 
-lisp_data_t *lisp_make_prim(lisp_prim_proc in, lisp_ctx_t *context) {
-		lisp_data_t *out;
+lisp_data_t *lisp_make_vector(const size_t length, const lisp_data_t *fill, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	size_t i;
 
-	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+	if(!(out = new_vector(length, NULL, context)))
 		return NULL;
 
-	out->type = lisp_type_prim;
-	out->proc = in;
+	for(i = 0; i < length; i++)
+		out->vector->items[i] = (lisp_data_t*)fill;
 
 	return out;
 }
 
-lisp_data_t *lisp_make_error(const char *errmsg, lisp_ctx_t *context) {
+/* The array is used in place and stays the host's, it has to outlive the
+ * vector. The collector keeps what it points to alive while the vector is. */
+lisp_data_t *lisp_wrap_vector(lisp_data_t **items, const size_t length, lisp_ctx_t *context) {
+	return new_vector(length, items, context);
+}
+
+/* NUMERIC VECTORS */
+
+/* Both element types take eight bytes. The elements start out as zero. */
+static lisp_data_t *new_numvector(const lisp_type_t type, const size_t length, lisp_ctx_t *context) {
+	size_t size = sizeof(lisp_data_t) + sizeof(lisp_numvector_t);
 	lisp_data_t *out;
 
-	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+	if(length > (SIZE_MAX - size) / sizeof(int64_t))
 		return NULL;
 
-	if(!(out->error = malloc(strlen(errmsg) + 1))) {
-		free(out);
+	if(!(out = lisp_data_alloc(size + length * sizeof(int64_t), context)))
 		return NULL;
-	}
 
-	out->type = lisp_type_error;
-	strcpy(out->error, errmsg);
+	out->type = type;
+	out->numvector = (lisp_numvector_t*)(out + 1);
+	out->numvector->length = length;
+	out->numvector->s64 = (int64_t*)(out->numvector + 1);
+	memset(out->numvector->s64, 0, length * sizeof(int64_t));
+
+	return out;
+}
+
+lisp_data_t *lisp_make_f64vector(const size_t length, lisp_ctx_t *context) {
+	return new_numvector(lisp_type_f64vector, length, context);
+}
+
+lisp_data_t *lisp_make_s64vector(const size_t length, lisp_ctx_t *context) {
+	return new_numvector(lisp_type_s64vector, length, context);
+}
+
+/* WEAK BOXES */
+
+lisp_data_t *lisp_make_weak_box(const lisp_data_t *value, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t) + sizeof(lisp_weakbox_t), context)))
+		return NULL;
+
+	out->type = lisp_type_weakbox;
+	out->weakbox = (lisp_weakbox_t*)(out + 1);
+	out->weakbox->value = (lisp_data_t*)value;
+	out->weakbox->broken = 0;
+	out->weakbox->next_weak = NULL;
 
 	return out;
 }
@@ -112,8 +212,11 @@ lisp_data_t *lisp_cons_in_context(const lisp_data_t *l, const lisp_data_t *r, li
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
+	/* The type is still whatever malloc() left there, lisp_free_data() must
+	 * not take it for one that owns more memory. */
 	if(!(out->pair = malloc(sizeof(lisp_cons_t)))) {
-		free(out);
+		out->type = lisp_type_integer;
+		lisp_free_data(out, context);
 		return NULL;
 	}
 
@@ -141,10 +244,15 @@ lisp_data_t *lisp_cdr(const lisp_data_t *in) {
 	if(in->type != lisp_type_pair)
 		return NULL;
 
+	if(in->pair->r && (in->pair->r->type == lisp_type_lazy))
+		in->pair->r = lisp_force_lazy(in->pair->r);
+
 	return in->pair->r;
 }
 
 int lisp_is_equal(const lisp_data_t *d1, const lisp_data_t *d2) {
+	size_t i;
+
 	if(d1 == d2)
 		return 1;
 
@@ -165,9 +273,32 @@ int lisp_is_equal(const lisp_data_t *d1, const lisp_data_t *d2) {
 			return d1->decimal == d2->decimal;
 		case lisp_type_prim:
 			return d1->proc == d2->proc;
+		case lisp_type_vprim:
+			return d1->def == d2->def;
 		case lisp_type_string:
 			return !strcmp(d1->string, d2->string);
+		case lisp_type_vector:
+			if(d1->vector->length != d2->vector->length)
+				return 0;
+			for(i = 0; i < d1->vector->length; i++)
+				if(!lisp_is_equal(d1->vector->items[i], d2->vector->items[i]))
+					return 0;
+			return 1;
+		case lisp_type_f64vector:
+			if(d1->numvector->length != d2->numvector->length)
+				return 0;
+			for(i = 0; i < d1->numvector->length; i++)
+				if(d1->numvector->f64[i] != d2->numvector->f64[i])
+					return 0;
+			return 1;
+		case lisp_type_s64vector:
+			return (d1->numvector->length == d2->numvector->length) &&
+				   !memcmp(d1->numvector->s64, d2->numvector->s64, d1->numvector->length * sizeof(int64_t));
 		case lisp_type_error:
+		case lisp_type_lazy:
+		case lisp_type_hashtable:
+		case lisp_type_weakbox:
+		case lisp_type_strbuf:
 			return 0;
 		case lisp_type_symbol:			
 			return !strcmp(d1->symbol, d2->symbol);
@@ -188,7 +319,7 @@ int lisp_list_length(const lisp_data_t *list) {
 	do {
 		out++;
 		if(list->type == lisp_type_pair)
-			list = list->pair->r;
+			list = lisp_cdr(list);
 		else
 			list = NULL;
 	} while(list);
@@ -196,6 +327,25 @@ int lisp_list_length(const lisp_data_t *list) {
 	return out;
 }
 
+/* Counts the pairs of a proper list for the primitives that walk one, and
+ * returns LISP_LIST_IMPROPER or LISP_LIST_CIRCULAR for anything else. slow
+ * follows at half the speed and is caught up with inside a cycle. */
+long lisp_count_pairs(const lisp_data_t *list, lisp_ctx_t *context) {
+	const lisp_data_t *slow = list;
+	long out;
+
+	for(out = 0; list && (list->type == lisp_type_pair); out++) {
+		lisp_check_eval(context);
+		list = lisp_cdr(list);
+		if(out & 1)
+			slow = lisp_cdr(slow);
+		if(list == slow)
+			return LISP_LIST_CIRCULAR;
+	}
+
+	return list ? LISP_LIST_IMPROPER : out;
+}
+
 lisp_data_t *lisp_set_car(lisp_data_t *in, const lisp_data_t *val) {
 	if(in->type != lisp_type_pair)
 		return NULL;
@@ -211,7 +361,8 @@ lisp_data_t *lisp_set_cdr(lisp_data_t *in, const lisp_data_t *val) {
 }
 
 lisp_data_t *lisp_make_copy(const lisp_data_t *in) {
-	lisp_data_t *out;
+	lisp_data_t *out, *buf;
+	size_t i;
 
 	if(!in)
 		return NULL;
@@ -226,6 +377,7 @@ lisp_data_t *lisp_make_copy(const lisp_data_t *in) {
 		case lisp_type_integer: out->integer = in->integer; break;
 		case lisp_type_decimal: out->decimal = in->decimal; break;
 		case lisp_type_prim: out->proc = in->proc; break;
+		case lisp_type_vprim: out->def = in->def; break;
 		case lisp_type_string: 
 			out->string = malloc(strlen(in->string) + 1);
 			strcpy(out->string, in->string);
@@ -247,10 +399,71 @@ lisp_data_t *lisp_make_copy(const lisp_data_t *in) {
 			else
 				out->pair->l = NULL;
 
-			if(in->pair->r)
-				out->pair->r = lisp_make_copy(in->pair->r);
+			if(lisp_cdr(in))
+				out->pair->r = lisp_make_copy(lisp_cdr(in));
 			else
 				out->pair->r = NULL;
+			break;
+		case lisp_type_vector:
+			/* Laid out like new_vector() does, wrapped arrays are copied too. */
+			buf = realloc(out, sizeof(lisp_data_t) + sizeof(lisp_vector_t) + in->vector->length * sizeof(lisp_data_t*));
+			if(!buf) {
+				free(out);
+				return NULL;
+			}
+			out = buf;
+			out->vector = (lisp_vector_t*)(out + 1);
+			out->vector->length = in->vector->length;
+			out->vector->items = (lisp_data_t**)(out->vector + 1);
+			for(i = 0; i < in->vector->length; i++)
+				out->vector->items[i] = lisp_make_copy(in->vector->items[i]);
+			break;
+		case lisp_type_f64vector:
+		case lisp_type_s64vector:
+			buf = realloc(out, sizeof(lisp_data_t) + sizeof(lisp_numvector_t) + in->numvector->length * sizeof(int64_t));
+			if(!buf) {
+				free(out);
+				return NULL;
+			}
+			out = buf;
+			out->numvector = (lisp_numvector_t*)(out + 1);
+			out->numvector->length = in->numvector->length;
+			out->numvector->s64 = (int64_t*)(out->numvector + 1);
+			memcpy(out->numvector->s64, in->numvector->s64, in->numvector->length * sizeof(int64_t));
+			break;
+		case lisp_type_hashtable:
+			free(out);
+			return lisp_copy_hashtable(in);
+		case lisp_type_weakbox:
+			/* The copy is not collected, so it holds on to its own value. */
+			if((buf = realloc(out, sizeof(lisp_data_t) + sizeof(lisp_weakbox_t))) == NULL) {
+				free(out);
+				return NULL;
+			}
+			out = buf;
+			out->weakbox = (lisp_weakbox_t*)(out + 1);
+			out->weakbox->value = lisp_make_copy(in->weakbox->value);
+			out->weakbox->broken = in->weakbox->broken;
+			out->weakbox->next_weak = NULL;
+			break;
+		case lisp_type_strbuf:
+			if((buf = realloc(out, sizeof(lisp_data_t) + sizeof(lisp_strbuf_t))) == NULL) {
+				free(out);
+				return NULL;
+			}
+			out = buf;
+			out->strbuf = (lisp_strbuf_t*)(out + 1);
+			*out->strbuf = *in->strbuf;
+			if((out->strbuf->data = malloc(in->strbuf->size)) == NULL) {
+				free(out);
+				return NULL;
+			}
+			memcpy(out->strbuf->data, in->strbuf->data, in->strbuf->length + 1);
+			break;
+		case lisp_type_lazy:
+			/* Placeholders are read by lisp_cdr() before they can be seen. */
+			free(out);
+			return NULL;
 	}
 
 	return out;
@@ -9,19 +9,17 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
-#ifdef _WIN32
-#include <Windows.h>
-#else
-#include <pthread.h>
-#define ExitThread pthread_exit
-#endif
-
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "libisp/builtin.h"
 #include "libisp/data.h"
+#include "libisp/eval.h"
 #include "libisp/mem.h"
 #include "libisp/print.h"
 #include "libisp/read.h"
@@ -48,7 +46,7 @@ static int is_tagged_list(const lisp_data_t *exp, const char *tag) {
 	}
 	return 0;
 }
-static int is_self_evaluating(const lisp_data_t *exp) { return (!exp || (exp->type == lisp_type_integer) || (exp->type == lisp_type_decimal) || (exp->type == lisp_type_string)); }
+static int is_self_evaluating(const lisp_data_t *exp) { return (!exp || (exp->type == lisp_type_integer) || (exp->type == lisp_type_decimal) || (exp->type == lisp_type_string) || (exp->type == lisp_type_vector) || (exp->type == lisp_type_f64vector) || (exp->type == lisp_type_s64vector)); }
 static int is_symbol(const lisp_data_t *exp) { return (exp->type == lisp_type_symbol); }
 static int is_variable(const lisp_data_t *exp) { return is_symbol(exp); }
 static int is_error(const lisp_data_t *exp) { return (exp && (exp->type == lisp_type_error)); }
@@ -100,14 +98,53 @@ static lisp_data_t *get_if_alternative(const lisp_data_t *exp) {
 static lisp_data_t *make_if(const lisp_data_t *pred, const lisp_data_t *conseq, const lisp_data_t *alt, lisp_ctx_t *context) {
 	return lisp_cons(lisp_make_symbol("if", context), lisp_cons(pred, lisp_cons(conseq, lisp_cons(alt, NULL))));
 }
-static int is_true(const lisp_data_t *x) { return !strcmp(x->symbol, "#t"); }
-static int is_false(const lisp_data_t *x) { return strcmp(x->symbol, "#t"); }
+/* Everything but #f counts as true. */
+static int is_true(const lisp_data_t *x) { return !x || (x->type != lisp_type_symbol) || strcmp(x->symbol, "#f"); }
 static lisp_data_t *eval_if(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
-	if(is_true(eval(get_if_predicate(exp), env, context)))
+	lisp_data_t *pred = eval(get_if_predicate(exp), env, context);
+
+	if(is_error(pred))
+		return pred;
+	if(is_true(pred))
 		return eval(get_if_consequent(exp), env, context);
 	return eval(get_if_alternative(exp), env, context);
 }
 
+/* AND, OR, WHEN, UNLESS */
+
+/* These only evaluate their operands as far as needed. and returns the first
+ * false value or the last one, or returns the first true value or the last
+ * one. */
+static int is_and(const lisp_data_t *exp) { return is_tagged_list(exp, "and"); }
+static int is_or(const lisp_data_t *exp) { return is_tagged_list(exp, "or"); }
+static lisp_data_t *eval_and_or(const lisp_data_t *exp, const int stop_on, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *exps = lisp_cdr(exp), *val;
+
+	if(!exps)
+		return lisp_make_symbol(stop_on ? "#f" : "#t", context);
+
+	do {
+		val = eval(get_first_exp(exps), env, context);
+		if(is_error(val) || (is_true(val) == stop_on))
+			return val;
+		exps = get_rest_exps(exps);
+	} while(exps);
+
+	return val;
+}
+
+static int is_when(const lisp_data_t *exp) { return is_tagged_list(exp, "when"); }
+static int is_unless(const lisp_data_t *exp) { return is_tagged_list(exp, "unless"); }
+static lisp_data_t *eval_when(const lisp_data_t *exp, const int run_on, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *test = eval(lisp_cadr(exp), env, context);
+
+	if(is_error(test))
+		return test;
+	if(is_true(test) == run_on)
+		return eval_sequence(lisp_cddr(exp), env, context);
+	return NULL;
+}
+
 /* COND */
 
 static int is_cond(const lisp_data_t *exp) { return is_tagged_list(exp, "cond"); }
@@ -136,6 +173,29 @@ static lisp_data_t *cond_to_if(const lisp_data_t *exp, lisp_ctx_t *context) {
 	return expand_clauses(get_cond_clauses(exp), context);
 }
 
+/* CASE */
+
+static int is_case(const lisp_data_t *exp) { return is_tagged_list(exp, "case"); }
+static lisp_data_t *get_case_key(const lisp_data_t *exp) { return lisp_cadr(exp); }
+static lisp_data_t *get_case_clauses(const lisp_data_t *exp) { return lisp_cddr(exp); }
+static int is_case_else(const lisp_data_t *data) { return data && is_symbol(data) && !strcmp(data->symbol, "else"); }
+static lisp_data_t *eval_case(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *key = eval(get_case_key(exp), env, context), *clauses, *data;
+
+	if(is_error(key))
+		return key;
+
+	for(clauses = get_case_clauses(exp); clauses; clauses = lisp_cdr(clauses)) {
+		data = lisp_caar(clauses);
+		if(is_case_else(data))
+			return eval_sequence(lisp_cdar(clauses), env, context);
+		for(; data && (data->type == lisp_type_pair); data = lisp_cdr(data))
+			if(lisp_is_equal(key, lisp_car(data)))
+				return eval_sequence(lisp_cdar(clauses), env, context);
+	}
+	return NULL;
+}
+
 /* APPLICATIONS */
 
 int is_application(const lisp_data_t *exp) { return exp->type == lisp_type_pair; }
@@ -158,7 +218,118 @@ static lisp_data_t *get_procedure_environment(const lisp_data_t *proc) { return
 static lisp_data_t *make_procedure(lisp_data_t *parameters, lisp_data_t *body, lisp_data_t *env, lisp_ctx_t *context) {
 	return lisp_cons(lisp_make_symbol("closure", context), lisp_cons(parameters, lisp_cons(body, lisp_cons(env, NULL))));
 }
-static lisp_data_t *apply_primitive_procedure(const lisp_data_t *proc, const lisp_data_t *args, lisp_ctx_t *context) { return get_primitive_implementation(proc)->proc(args, context); }
+
+/* VECTORCALL PRIMITIVES */
+
+/* Calls with up to this many arguments keep them on the stack, longer ones in
+ * scratch memory that an aborted evaluation frees. */
+#define ARGV_STACK 8
+
+static int is_vector_primitive(const lisp_data_t *proc) {
+	lisp_data_t *impl;
+
+	if(!is_primitive_procedure(proc))
+		return 0;
+	impl = get_primitive_implementation(proc);
+	return impl && (impl->type == lisp_type_vprim);
+}
+
+static const char *expected_type(const unsigned int mask) {
+	switch(mask) {
+		case LISP_ARG_NUMBER: return "Expected number";
+		case LISP_ARG_LIST: return "Expected list";
+		case LISP_ARG_LIST | LISP_ARG(lisp_type_vector): return "Expected list or vector";
+		case LISP_ARG(lisp_type_integer): return "Expected integer";
+		case LISP_ARG(lisp_type_decimal): return "Expected decimal";
+		case LISP_ARG(lisp_type_string): return "Expected string";
+		case LISP_ARG(lisp_type_symbol): return "Expected symbol";
+		case LISP_ARG(lisp_type_pair): return "Expected pair";
+		case LISP_ARG(lisp_type_vector): return "Expected vector";
+		case LISP_ARG(lisp_type_f64vector): return "Expected f64vector";
+		case LISP_ARG(lisp_type_s64vector): return "Expected s64vector";
+		case LISP_ARG(lisp_type_hashtable): return "Expected hash table";
+		case LISP_ARG(lisp_type_weakbox): return "Expected weak box";
+		case LISP_ARG(lisp_type_strbuf): return "Expected string builder";
+		default: return "Wrong type of operand";
+	}
+}
+
+static lisp_data_t *prim_error(const lisp_prim_def_t *def, const char *what, const int n, lisp_ctx_t *context) {
+	char name[32], msg[96];
+	size_t i;
+
+	for(i = 0; def->name[i] && (i < sizeof(name) - 1); i++)
+		name[i] = (char)toupper((unsigned char)def->name[i]);
+	name[i] = '\0';
+
+	if(n < 0)
+		snprintf(msg, sizeof(msg), "%s -- %s", name, what);
+	else
+		snprintf(msg, sizeof(msg), "%s -- %s %d operand%s", name, what, n, (n == 1) ? "" : "s");
+	return lisp_make_error(msg, context);
+}
+
+static lisp_data_t *call_vector_primitive(const lisp_prim_def_t *def, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	unsigned int mask;
+	int i;
+
+	for(i = 0; i < argc; i++)
+		if(is_error(argv[i]))
+			return argv[i];
+
+	if(argc < def->min_args)
+		return prim_error(def, (def->min_args == def->max_args) ? "Expected" : "Expected at least", def->min_args, context);
+	if((def->max_args != LISP_VARIADIC) && (argc > def->max_args))
+		return prim_error(def, (def->min_args == def->max_args) ? "Expected" : "Expected at most", def->max_args, context);
+
+	for(i = 0; i < argc; i++) {
+		mask = def->types[(i < LISP_PRIM_TYPES) ? i : LISP_PRIM_TYPES - 1];
+		if(mask && !(mask & (argv[i] ? LISP_ARG(argv[i]->type) : LISP_ARG_NIL)))
+			return prim_error(def, expected_type(mask), -1, context);
+	}
+
+	return def->proc(argc, argv, context);
+}
+
+/* Evaluates the operands straight into the argument array, the call does not
+ * cons an argument list. */
+static lisp_data_t *eval_vector_call(const lisp_prim_def_t *def, const lisp_data_t *exps, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *stack[ARGV_STACK], **argv = stack, *out;
+	int argc = lisp_list_length(exps), i;
+
+	if((argc > ARGV_STACK) && ((argv = lisp_scratch(argc * sizeof(lisp_data_t*), NULL, context)) == NULL))
+		return lisp_make_error("APPLY -- Out of memory", context);
+
+	for(i = 0; i < argc; i++, exps = get_rest_operands(exps))
+		argv[i] = eval(get_first_operand(exps), env, context);
+
+	out = call_vector_primitive(def, argc, argv, context);
+
+	if(argv != stack)
+		lisp_unscratch(argv, context);
+	return out;
+}
+
+static lisp_data_t *apply_primitive_procedure(const lisp_data_t *proc, const lisp_data_t *args, lisp_ctx_t *context) {
+	lisp_data_t *impl = get_primitive_implementation(proc), *stack[ARGV_STACK], **argv = stack, *out;
+	int argc, i;
+
+	if(impl->type != lisp_type_vprim)
+		return impl->proc(args, context);
+
+	argc = lisp_list_length(args);
+	if((argc > ARGV_STACK) && ((argv = lisp_scratch(argc * sizeof(lisp_data_t*), NULL, context)) == NULL))
+		return lisp_make_error("APPLY -- Out of memory", context);
+
+	for(i = 0; i < argc; i++, args = lisp_cdr(args))
+		argv[i] = lisp_car(args);
+
+	out = call_vector_primitive(impl->def, argc, argv, context);
+
+	if(argv != stack)
+		lisp_unscratch(argv, context);
+	return out;
+}
 
 /* QUOTATIONS */
 
@@ -196,8 +367,13 @@ static lisp_data_t *get_assignment_value(const lisp_data_t *exp) { return lisp_c
 static lisp_data_t *scan_assignment(lisp_data_t *env, const lisp_data_t *vars, lisp_data_t *vals, lisp_data_t *var, const lisp_data_t *val, lisp_ctx_t *context) {
 	if(vars == NULL)
 		return set_variable_value(var, val, get_enclosing_env(env), context);
-	if(lisp_is_equal(var, lisp_car(vars)))
+	if(lisp_is_equal(var, lisp_car(vars))) {
+		/* Bindings in a frozen base stay as they are, the global ones as well as
+		 * those of closures made there. */
+		if(lisp_is_immutable(vals, context))
+			return lisp_make_error("SET -- Immutable binding", context);
 		return lisp_set_car(vals, val);
+	}
 	return scan_assignment(env, lisp_cdr(vars), lisp_cdr(vals), var, val, context);
 }
 static lisp_data_t *set_variable_value(lisp_data_t *var, const lisp_data_t *val, lisp_data_t *env, lisp_ctx_t *context) {
@@ -306,11 +482,16 @@ static lisp_data_t *make_set_letrec(const lisp_data_t *vars, const lisp_data_t *
 		return NULL;
 	return lisp_cons(lisp_cons(lisp_make_symbol("set!", context), lisp_cons(lisp_car(vars), lisp_cons(lisp_car(exps), NULL))), make_set_letrec(lisp_cdr(vars), lisp_cdr(exps), context));
 }
+static lisp_data_t *append_sequences(const lisp_data_t *seq1, const lisp_data_t *seq2, lisp_ctx_t *context) {
+	if(seq1 == NULL)
+		return (lisp_data_t*)seq2;
+	return lisp_cons(lisp_car(seq1), append_sequences(lisp_cdr(seq1), seq2, context));
+}
 static lisp_data_t *letrec_to_let(const lisp_data_t *exp, lisp_ctx_t *context) {
 	lisp_data_t *assignment = get_let_assignment(exp);
 	lisp_data_t *lvars = get_let_var(assignment, context);
 	lisp_data_t *lexps = get_let_exp(assignment, context);
-	return lisp_cons(lisp_make_symbol("let", context), lisp_cons(make_unassigned_letrec(lvars, context), lisp_append(make_set_letrec(lvars, lexps, context), get_let_body(exp))));
+	return lisp_cons(lisp_make_symbol("let", context), lisp_cons(make_unassigned_letrec(lvars, context), append_sequences(make_set_letrec(lvars, lexps, context), get_let_body(exp), context)));
 }
 
 /* EVALUATOR PROPER */
@@ -330,6 +511,9 @@ static lisp_data_t *apply(const lisp_data_t *proc, const lisp_data_t *args, lisp
 	lisp_data_t *out;
 	lisp_data_t *argl = args, *currarg;
 
+	if(is_error(proc))
+		return (lisp_data_t*)proc;
+
 	while(argl) {
 		currarg = lisp_car(argl);
 		if(currarg && (currarg->type == lisp_type_error))
@@ -350,11 +534,16 @@ static lisp_data_t *apply(const lisp_data_t *proc, const lisp_data_t *args, lisp
 	return lisp_make_error("APPLY -- Unknown procedure type", context);
 }
 
+static lisp_data_t *eval_application(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *proc = eval(get_operator(exp), env, context);
+
+	if(is_vector_primitive(proc))
+		return eval_vector_call(get_primitive_implementation(proc)->def, get_operands(exp), env, context);
+	return apply(proc, get_list_of_values(get_operands(exp), env, context), context);
+}
+
 static lisp_data_t *eval(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
-	if(context->eval_plz_die) {
-		context->eval_plz_die = 0;
-		ExitThread(0);
-	}
+	lisp_check_eval(context);
 
 	if(is_error(exp))
 		return (lisp_data_t*)exp;
@@ -370,6 +559,16 @@ static lisp_data_t *eval(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *c
 		return eval_definition(exp, env, context);
 	if(is_if(exp))
 		return eval_if(exp, env, context);
+	if(is_and(exp))
+		return eval_and_or(exp, 0, env, context);
+	if(is_or(exp))
+		return eval_and_or(exp, 1, env, context);
+	if(is_when(exp))
+		return eval_when(exp, 1, env, context);
+	if(is_unless(exp))
+		return eval_when(exp, 0, env, context);
+	if(is_case(exp))
+		return eval_case(exp, env, context);
 	if(is_lambda(exp))
 		return make_procedure(get_lambda_parameters(exp), get_lambda_body(exp), env, context);
 	if(is_begin(exp))
@@ -383,9 +582,7 @@ static lisp_data_t *eval(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *c
 	if(is_let(exp))
 		return eval(let_to_combination(exp, context), env, context);
 	if(is_application(exp))		
-		return apply(
-			eval(get_operator(exp), env, context),
-			get_list_of_values(get_operands(exp), env, context), context);
+		return eval_application(exp, env, context);
 	
 	return lisp_make_error("EVAL -- Unknown expression type", context);
 }
@@ -394,6 +591,175 @@ lisp_data_t *lisp_eval(const lisp_data_t *exp, lisp_ctx_t *context) {
 	return eval(exp, context->the_global_environment, context);
 }
 
+/* ANALYSIS */
+
+/* Rewrites the derived forms in exp into the core forms eval() knows, the
+ * same way eval() does every time it meets them. Lambda parameters and quoted
+ * data are left alone. */
+static lisp_data_t *expand(const lisp_data_t *exp, lisp_ctx_t *context);
+static lisp_data_t *expand_list(const lisp_data_t *exps, lisp_ctx_t *context) {
+	if(!exps || (exps->type != lisp_type_pair))
+		return (lisp_data_t*)exps;
+	return lisp_cons(expand(lisp_car(exps), context), expand_list(lisp_cdr(exps), context));
+}
+static lisp_data_t *expand_case_clauses(const lisp_data_t *clauses, lisp_ctx_t *context) {
+	if(!clauses || (clauses->type != lisp_type_pair))
+		return (lisp_data_t*)clauses;
+	return lisp_cons(lisp_cons(lisp_caar(clauses), expand_list(lisp_cdar(clauses), context)), expand_case_clauses(lisp_cdr(clauses), context));
+}
+static lisp_data_t *expand(const lisp_data_t *exp, lisp_ctx_t *context) {
+	if(!exp || (exp->type != lisp_type_pair) || is_quoted_expression(exp))
+		return (lisp_data_t*)exp;
+	if(is_lambda(exp))
+		return make_lambda(get_lambda_parameters(exp), expand_list(get_lambda_body(exp), context), context);
+	if(is_definition(exp) && lisp_cadr(exp) && !is_symbol(lisp_cadr(exp)))
+		return lisp_cons(lisp_car(exp), lisp_cons(get_definition_variable(exp), lisp_cons(expand(get_definition_value(exp, context), context), NULL)));
+	if(is_case(exp))
+		return lisp_cons(lisp_car(exp), lisp_cons(expand(get_case_key(exp), context), expand_case_clauses(get_case_clauses(exp), context)));
+	if(is_cond(exp))
+		return expand(cond_to_if(exp, context), context);
+	if(is_letrec(exp))
+		return expand(letrec_to_let(exp, context), context);
+	if(is_let_star(exp))
+		return expand(let_star_to_nested_lets(exp, context), context);
+	if(is_let(exp))
+		return expand(let_to_combination(exp, context), context);
+	return expand_list(exp, context);
+}
+
+/* DIRECT APPLICATION */
+
+/* Calls proc on argc values, with no expression to evaluate for them. The
+ * values are consed into the frame of the call directly, which is the only
+ * list a call makes. arity is -1 for primitives, which check their own.
+ * Vectorcall primitives get argv as it is. */
+static lisp_data_t *apply_values(const lisp_data_t *proc, const int arity, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *args = NULL;
+	int i;
+
+	if((arity >= 0) && (argc != arity))
+		return lisp_make_error((argc > arity) ? "APPLY -- Too many arguments" : "APPLY -- Too few arguments", context);
+	if(is_vector_primitive(proc))
+		return call_vector_primitive(get_primitive_implementation(proc)->def, argc, argv, context);
+
+	for(i = argc - 1; i >= 0; i--) {
+		if(is_error(argv[i]))
+			return argv[i];
+		if((args = lisp_cons(argv[i], args)) == NULL)
+			return lisp_make_error("APPLY -- Out of memory", context);
+	}
+
+	if(is_primitive_procedure(proc))
+		return apply_primitive_procedure(proc, args, context);
+	return eval_sequence(get_procedure_body(proc),
+		lisp_cons(make_frame(get_procedure_parameters(proc), args, context), get_procedure_environment(proc)), context);
+}
+
+/* The host calls below run on its own thread and not on the eval thread, but
+ * are held to the same limits. Past thread_timeout or the hard memory limit
+ * the call returns an error where the eval thread would end. A call made
+ * during an evaluation, say from a primitive, is under the limits of that
+ * evaluation already. exp is evaluated if it is given, otherwise proc is
+ * applied. */
+static lisp_data_t *run_limited(const lisp_data_t *exp, const lisp_data_t *proc, const int arity, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t since = lisp_heap_serial(context), mark = lisp_scratch_mark(context);
+	lisp_data_t *out = NULL;
+	jmp_buf escape;
+	int reason;
+
+	if(lisp_atomic_get(&context->thread_running) || context->escape)
+		return exp ? eval(exp, context->the_global_environment, context) : apply_values(proc, arity, argc, argv, context);
+
+	context->deadline = context->thread_timeout ? (int64_t)time(NULL) + (int64_t)context->thread_timeout : 0;
+	context->n_checks = 0;
+	context->escape = &escape;
+
+	if(setjmp(escape) == 0) {
+		out = exp ? eval(exp, context->the_global_environment, context) : apply_values(proc, arity, argc, argv, context);
+		reason = 0;
+	} else
+		reason = lisp_atomic_get(&context->eval_plz_die);
+
+	context->escape = NULL;
+	context->deadline = 0;
+	lisp_atomic_set(&context->eval_plz_die, 0);
+	lisp_free_scratch(mark, context);
+
+	/* What the call allocated and left unreachable goes, everything the
+	 * host had before stays. */
+	if(reason) {
+		lisp_gc_since(since, context);
+		out = lisp_make_error((reason == LISP_ASYNC_TIMEOUT) ? "CALL -- Timed out" : "CALL -- Hard memory limit reached", context);
+	}
+
+	return out;
+}
+
+/* Calls a procedure from C, for example from a primitive that was handed one
+ * as an argument. It runs in the evaluation that is going on, and errors in
+ * proc or the arguments are passed on like apply() does. */
+lisp_data_t *lisp_apply(const lisp_data_t *proc, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(is_error(proc))
+		return (lisp_data_t*)proc;
+	if(is_compound_procedure(proc))
+		return run_limited(NULL, proc, lisp_list_length(get_procedure_parameters(proc)), argc, argv, context);
+	if(is_primitive_procedure(proc))
+		return run_limited(NULL, proc, -1, argc, argv, context);
+	return lisp_make_error("APPLY -- Unknown procedure type", context);
+}
+
+/* PREPARED PROCEDURES */
+
+/* A procedure that was read, expanded and evaluated once, and is kept from
+ * the garbage collector until it is destroyed. */
+struct lisp_prepared_t {
+	lisp_data_t *proc;
+	int arity;
+	lisp_root_t *root;
+	lisp_ctx_t *context;
+};
+
+/* exp has to evaluate to a procedure, usually it is a lambda expression.
+ * Returns NULL if it does not read or does not make a procedure. */
+lisp_prepared_t *lisp_prepare(const char *exp, lisp_ctx_t *context) {
+	lisp_prepared_t *out;
+	lisp_data_t *proc;
+	int error = 0;
+
+	proc = lisp_read(exp, NULL, &error, context);
+	if(error)
+		return NULL;
+
+	proc = run_limited(expand(proc, context), NULL, 0, 0, NULL, context);
+	if(!is_compound_procedure(proc) && !is_primitive_procedure(proc))
+		return NULL;
+
+	if((out = malloc(sizeof(lisp_prepared_t))) == NULL)
+		return NULL;
+	if((out->root = lisp_add_root(proc, context)) == NULL) {
+		free(out);
+		return NULL;
+	}
+
+	out->proc = proc;
+	out->arity = is_compound_procedure(proc) ? lisp_list_length(get_procedure_parameters(proc)) : -1;
+	out->context = context;
+
+	return out;
+}
+
+lisp_data_t *lisp_call(lisp_prepared_t *prepared, const int argc, lisp_data_t *const *argv) {
+	return run_limited(NULL, prepared->proc, prepared->arity, argc, argv, prepared->context);
+}
+
+void lisp_destroy_prepared(lisp_prepared_t *prepared) {
+	if(!prepared)
+		return;
+
+	lisp_remove_root(prepared->root, prepared->context);
+	free(prepared);
+}
+
 int lisp_run(const char *exp, lisp_ctx_t *context) {
 	int error = 0;
 	lisp_data_t *exp_list = lisp_read(exp, NULL, &error, context);
@@ -0,0 +1,554 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/hash.h"
+#include "libisp/mem.h"
+
+/* Every change to a growing table moves this many of its old slots. A table
+ * grows to twice the size once it is three quarters full, so the old slots
+ * are all gone long before the new ones fill up, and no single insert has to
+ * move more than these. */
+#define MOVE_STEP		8
+#define MIN_SIZE		8
+
+#define SLOT_EMPTY		0
+#define SLOT_DELETED	1
+#define is_live(slot)	((slot)->hash > SLOT_DELETED)
+
+/* HASHING */
+
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static uint64_t hash_text(const char *text, uint64_t h) {
+	while(*text)
+		h = (h ^ (unsigned char)*(text++)) * 0x100000001b3ULL;
+
+	return mix(h);
+}
+
+/* 0.0 and -0.0 are equal, so they hash the same. */
+static uint64_t hash_double(const double d) {
+	uint64_t bits = 0;
+
+	if(d != 0.0)
+		memcpy(&bits, &d, sizeof(bits));
+	return mix(bits ^ 0x5bd1e995);
+}
+
+static uint64_t hash_ptr(const void *ptr) { return mix((uint64_t)(uintptr_t)ptr); }
+
+/* Numbers and symbols by value, everything else by address. */
+static uint64_t hash_eq(const lisp_data_t *d) {
+	if(!d)
+		return 0;
+
+	switch(d->type) {
+		case lisp_type_integer: return mix((uint64_t)(uint32_t)d->integer);
+		case lisp_type_decimal: return hash_double(d->decimal);
+		case lisp_type_symbol: return hash_text(d->symbol, 0xcbf29ce484222325ULL);
+		default: return hash_ptr(d);
+	}
+}
+
+/* Follows lisp_is_equal(), but only looks at the first few parts of a datum,
+ * which keeps long lists cheap and cycles finite. */
+static uint64_t hash_equal(const lisp_data_t *d, int *budget) {
+	uint64_t h;
+	size_t i;
+
+	if(!d || (--*budget < 0))
+		return 0;
+
+	switch(d->type) {
+		case lisp_type_string:
+			return hash_text(d->string, 0x84222325cbf29ce4ULL);
+		case lisp_type_pair:
+			h = hash_equal(lisp_car(d), budget);
+			return mix(h * 31 + hash_equal(lisp_cdr(d), budget) + 1);
+		case lisp_type_vector:
+			h = mix(d->vector->length + 2);
+			for(i = 0; (i < d->vector->length) && (*budget > 0); i++)
+				h = mix(h * 31 + hash_equal(d->vector->items[i], budget));
+			return h;
+		case lisp_type_f64vector:
+			h = mix(d->numvector->length + 3);
+			for(i = 0; (i < d->numvector->length) && (--*budget > 0); i++)
+				h = mix(h * 31 + hash_double(d->numvector->f64[i]));
+			return h;
+		case lisp_type_s64vector:
+			h = mix(d->numvector->length + 4);
+			for(i = 0; (i < d->numvector->length) && (--*budget > 0); i++)
+				h = mix(h * 31 + (uint64_t)d->numvector->s64[i]);
+			return h;
+		case lisp_type_prim:
+			return hash_ptr((const void*)(uintptr_t)d->proc);
+		case lisp_type_vprim:
+			return hash_ptr(d->def);
+		default:
+			return hash_eq(d);
+	}
+}
+
+static size_t hash_of(const int kind, const lisp_data_t *key) {
+	int budget = 32;
+	uint64_t h;
+
+	switch(kind) {
+		case LISP_HASH_EQUAL: h = hash_equal(key, &budget); break;
+		case LISP_HASH_STRING: h = hash_text(key->string, 0x84222325cbf29ce4ULL); break;
+		default: h = hash_eq(key); break;
+	}
+
+	/* Keep clear of the markers for empty and deleted slots. */
+	if(h <= SLOT_DELETED)
+		h += 2;
+	return (size_t)h;
+}
+
+static int is_same_key(const int kind, const lisp_data_t *a, const lisp_data_t *b) {
+	if(a == b)
+		return 1;
+	if(!a || !b)
+		return 0;
+
+	switch(kind) {
+		case LISP_HASH_EQUAL:
+			return lisp_is_equal(a, b);
+		case LISP_HASH_STRING:
+			return !strcmp(a->string, b->string);
+		default:
+			if(a->type != b->type)
+				return 0;
+			if(a->type == lisp_type_integer)
+				return a->integer == b->integer;
+			if(a->type == lisp_type_decimal)
+				return a->decimal == b->decimal;
+			if(a->type == lisp_type_symbol)
+				return !strcmp(a->symbol, b->symbol);
+			return 0;
+	}
+}
+
+static int is_valid_key(const lisp_hashtable_t *table, const lisp_data_t *key) {
+	return (table->kind != LISP_HASH_STRING) || (key && (key->type == lisp_type_string));
+}
+
+/* SLOTS */
+
+static lisp_hash_slot_t *find(const lisp_hashtable_t *table, lisp_hash_slot_t *slots, const size_t size, const size_t hash, const lisp_data_t *key) {
+	size_t i;
+
+	if(!slots)
+		return NULL;
+
+	for(i = hash & (size - 1); slots[i].hash != SLOT_EMPTY; i = (i + 1) & (size - 1))
+		if((slots[i].hash == hash) && is_same_key(table->kind, slots[i].key, key))
+			return &slots[i];
+	return NULL;
+}
+
+static lisp_hash_slot_t *find_any(const lisp_hashtable_t *table, const size_t hash, const lisp_data_t *key) {
+	lisp_hash_slot_t *out = find(table, table->slots, table->size, hash, key);
+
+	return out ? out : find(table, table->old, table->old_size, hash, key);
+}
+
+/* The key is known to be missing, so the first deleted slot can take it. */
+static void put_slot(lisp_hashtable_t *table, const size_t hash, lisp_data_t *key, lisp_data_t *value) {
+	size_t i = hash & (table->size - 1);
+
+	while(is_live(&table->slots[i]))
+		i = (i + 1) & (table->size - 1);
+
+	if(table->slots[i].hash == SLOT_EMPTY)
+		table->used++;
+	table->slots[i].hash = hash;
+	table->slots[i].key = key;
+	table->slots[i].value = value;
+}
+
+/* Moved slots are marked deleted, so lookups in old still probe past them. */
+static void move_slots(lisp_hashtable_t *table, size_t n) {
+	lisp_hash_slot_t *slot;
+
+	for(; table->old && n && (table->moved < table->old_size); n--) {
+		slot = &table->old[table->moved++];
+		if(is_live(slot)) {
+			put_slot(table, slot->hash, slot->key, slot->value);
+			slot->hash = SLOT_DELETED;
+		}
+	}
+
+	if(table->old && (table->moved == table->old_size)) {
+		free(table->old);
+		table->old = NULL;
+		table->old_size = 0;
+		table->moved = 0;
+	}
+}
+
+/* Doubles the table, or only starts over without deleted slots if they are
+ * what filled it up. */
+static int grow(lisp_hashtable_t *table) {
+	lisp_hash_slot_t *slots;
+	size_t size = table->size ? table->size : MIN_SIZE;
+
+	move_slots(table, table->old_size);
+	if(4 * (table->count + 1) > size)
+		size *= 2;
+
+	if((slots = calloc(size, sizeof(lisp_hash_slot_t))) == NULL)
+		return -1;
+
+	if(table->slots && table->count) {
+		table->old = table->slots;
+		table->old_size = table->size;
+		table->moved = 0;
+	} else {
+		free(table->slots);
+	}
+
+	table->slots = slots;
+	table->size = size;
+	table->used = 0;
+	return 0;
+}
+
+/* TABLES */
+
+lisp_data_t *lisp_make_hashtable(const int kind, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t) + sizeof(lisp_hashtable_t), context)))
+		return NULL;
+
+	out->type = lisp_type_hashtable;
+	out->hashtable = (lisp_hashtable_t*)(out + 1);
+	memset(out->hashtable, 0, sizeof(lisp_hashtable_t));
+	out->hashtable->kind = kind & ~LISP_HASH_WEAK;
+	out->hashtable->weak = kind & LISP_HASH_WEAK;
+
+	return out;
+}
+
+/* Lookups change nothing, so a frozen table can be read from many threads. */
+lisp_data_t *lisp_hashtable_ref(const lisp_data_t *table, const lisp_data_t *key, int *found) {
+	const lisp_hash_slot_t *slot = NULL;
+
+	if(is_valid_key(table->hashtable, key))
+		slot = find_any(table->hashtable, hash_of(table->hashtable->kind, key), key);
+
+	*found = (slot != NULL);
+	return slot ? slot->value : NULL;
+}
+
+/* Returns -1 if the key is not a string in a string table, or out of memory. */
+int lisp_hashtable_set(lisp_data_t *table, const lisp_data_t *key, const lisp_data_t *value) {
+	lisp_hashtable_t *ht = table->hashtable;
+	lisp_hash_slot_t *slot;
+	size_t hash;
+
+	if(!is_valid_key(ht, key))
+		return -1;
+
+	hash = hash_of(ht->kind, key);
+	move_slots(ht, MOVE_STEP);
+
+	if((slot = find_any(ht, hash, key)) != NULL) {
+		slot->value = (lisp_data_t*)value;
+		return 0;
+	}
+
+	if((4 * (ht->used + 1) > 3 * ht->size) && (grow(ht) == -1))
+		return -1;
+
+	put_slot(ht, hash, (lisp_data_t*)key, (lisp_data_t*)value);
+	ht->count++;
+	return 0;
+}
+
+/* Returns 1 if the key was there. */
+int lisp_hashtable_delete(lisp_data_t *table, const lisp_data_t *key) {
+	lisp_hashtable_t *ht = table->hashtable;
+	lisp_hash_slot_t *slot;
+
+	if(!is_valid_key(ht, key))
+		return 0;
+
+	move_slots(ht, MOVE_STEP);
+	if((slot = find_any(ht, hash_of(ht->kind, key), key)) == NULL)
+		return 0;
+
+	slot->hash = SLOT_DELETED;
+	slot->key = NULL;
+	slot->value = NULL;
+	ht->count--;
+	return 1;
+}
+
+/* Walks the entries in no particular order. *pos starts at 0, and the
+ * table must not change until the walk is done. Returns 0 after the last. */
+int lisp_hashtable_next(const lisp_data_t *table, size_t *pos, lisp_data_t **key, lisp_data_t **value) {
+	const lisp_hashtable_t *ht = table->hashtable;
+	const lisp_hash_slot_t *slot;
+
+	for(; *pos < ht->size + ht->old_size; (*pos)++) {
+		slot = (*pos < ht->size) ? &ht->slots[*pos] : &ht->old[*pos - ht->size];
+		if(is_live(slot)) {
+			*key = slot->key;
+			*value = slot->value;
+			(*pos)++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* For the collector, which calls it between marking and sweeping. Entries
+ * are only marked deleted, nothing is hashed or moved, so keys that are about
+ * to be freed are not looked at. Returns the number of entries dropped. */
+size_t lisp_hashtable_prune(lisp_data_t *table, int (*is_reachable)(const lisp_data_t*, lisp_ctx_t*), lisp_ctx_t *context) {
+	lisp_hashtable_t *ht = table->hashtable;
+	lisp_hash_slot_t *slot;
+	size_t i, out = 0;
+
+	for(i = 0; i < ht->size + ht->old_size; i++) {
+		slot = (i < ht->size) ? &ht->slots[i] : &ht->old[i - ht->size];
+		if(!is_live(slot))
+			continue;
+		if(((ht->weak & LISP_HASH_WEAK_KEYS) && !is_reachable(slot->key, context)) ||
+		   ((ht->weak & LISP_HASH_WEAK_VALUES) && !is_reachable(slot->value, context))) {
+			slot->hash = SLOT_DELETED;
+			slot->key = NULL;
+			slot->value = NULL;
+			ht->count--;
+			out++;
+		}
+	}
+	return out;
+}
+
+/* For lisp_make_copy(), which copies keys and values along with the table.
+ * Copied keys have new addresses, so everything is hashed again. */
+lisp_data_t *lisp_copy_hashtable(const lisp_data_t *in) {
+	lisp_hashtable_t *ht;
+	lisp_data_t *out, *key, *value;
+	size_t pos = 0;
+
+	if((out = malloc(sizeof(lisp_data_t) + sizeof(lisp_hashtable_t))) == NULL)
+		return NULL;
+
+	out->type = lisp_type_hashtable;
+	out->hashtable = ht = (lisp_hashtable_t*)(out + 1);
+	memset(ht, 0, sizeof(lisp_hashtable_t));
+	ht->kind = in->hashtable->kind;
+	ht->weak = in->hashtable->weak;
+
+	for(ht->size = MIN_SIZE; 4 * in->hashtable->count >= 3 * ht->size; ht->size *= 2);
+	if((ht->slots = calloc(ht->size, sizeof(lisp_hash_slot_t))) == NULL) {
+		free(out);
+		return NULL;
+	}
+
+	while(lisp_hashtable_next(in, &pos, &key, &value)) {
+		key = lisp_make_copy(key);
+		put_slot(ht, hash_of(ht->kind, key), key, lisp_make_copy(value));
+		ht->count++;
+	}
+	return out;
+}
+
+/* PRIMITIVES */
+
+static lisp_data_t *make_bool(const int val, lisp_ctx_t *context) { return lisp_make_symbol(val ? "#t" : "#f", context); }
+
+static lisp_data_t *key_error(const char *name, lisp_ctx_t *context) {
+	char msg[64];
+
+	strcpy(msg, name);
+	strcat(msg, " -- Expected string");
+	return lisp_make_error(msg, context);
+}
+
+/* (make-hash-table) compares keys with equal?, (make-hash-table 'eq) and
+ * (make-hash-table 'string) choose the other kinds. A second symbol of
+ * weak-keys, weak-values or weak makes those parts weak. */
+static lisp_data_t *prim_make_hash_table(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int kind = LISP_HASH_EQUAL;
+	lisp_data_t *out;
+
+	if(argc) {
+		if(!strcmp(argv[0]->symbol, "eq"))
+			kind = LISP_HASH_EQ;
+		else if(!strcmp(argv[0]->symbol, "string"))
+			kind = LISP_HASH_STRING;
+		else if(strcmp(argv[0]->symbol, "equal"))
+			return lisp_make_error("MAKE-HASH-TABLE -- Unknown kind", context);
+	}
+
+	if(argc > 1) {
+		if(!strcmp(argv[1]->symbol, "weak-keys"))
+			kind |= LISP_HASH_WEAK_KEYS;
+		else if(!strcmp(argv[1]->symbol, "weak-values"))
+			kind |= LISP_HASH_WEAK_VALUES;
+		else if(!strcmp(argv[1]->symbol, "weak"))
+			kind |= LISP_HASH_WEAK;
+		else
+			return lisp_make_error("MAKE-HASH-TABLE -- Unknown weakness", context);
+	}
+
+	if((out = lisp_make_hashtable(kind, context)) == NULL)
+		return lisp_make_error("MAKE-HASH-TABLE -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_is_hash_table(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(argv[0] && (argv[0]->type == lisp_type_hashtable), context);
+}
+
+/* (hash-table-ref table key [default]) */
+static lisp_data_t *prim_ref(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	int found;
+
+	if(!is_valid_key(argv[0]->hashtable, argv[1]))
+		return key_error("HASH-TABLE-REF", context);
+
+	out = lisp_hashtable_ref(argv[0], argv[1], &found);
+	if(found)
+		return out;
+	if(argc == 3)
+		return argv[2];
+	return lisp_make_error("HASH-TABLE-REF -- Key not found", context);
+}
+
+static lisp_data_t *prim_contains(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int found;
+
+	if(!is_valid_key(argv[0]->hashtable, argv[1]))
+		return key_error("HASH-TABLE-CONTAINS?", context);
+
+	lisp_hashtable_ref(argv[0], argv[1], &found);
+	return make_bool(found, context);
+}
+
+static lisp_data_t *prim_set(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("HASH-TABLE-SET! -- Immutable hash table", context);
+	if(!is_valid_key(argv[0]->hashtable, argv[1]))
+		return key_error("HASH-TABLE-SET!", context);
+
+	if(lisp_hashtable_set(argv[0], argv[1], argv[2]) == -1)
+		return lisp_make_error("HASH-TABLE-SET! -- Out of memory", context);
+	return argv[0];
+}
+
+static lisp_data_t *prim_delete(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("HASH-TABLE-DELETE! -- Immutable hash table", context);
+	if(!is_valid_key(argv[0]->hashtable, argv[1]))
+		return key_error("HASH-TABLE-DELETE!", context);
+
+	lisp_hashtable_delete(argv[0], argv[1]);
+	return argv[0];
+}
+
+static lisp_data_t *prim_count(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_int((int)argv[0]->hashtable->count, context);
+}
+
+#define ENTRY_KEY		0
+#define ENTRY_VALUE		1
+#define ENTRY_PAIR		2
+
+static lisp_data_t *collect(const lisp_data_t *table, const int what, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL, *key, *value, *item;
+	size_t pos = 0;
+
+	while(lisp_hashtable_next(table, &pos, &key, &value)) {
+		item = (what == ENTRY_KEY) ? key : (what == ENTRY_VALUE) ? value : lisp_cons(key, value);
+		if(((what == ENTRY_PAIR) && !item) || ((out = lisp_cons(item, out)) == NULL))
+			return lisp_make_error("HASH-TABLE -- Out of memory", context);
+	}
+	return out;
+}
+
+static lisp_data_t *prim_keys(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return collect(argv[0], ENTRY_KEY, context); }
+
+static lisp_data_t *prim_values(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return collect(argv[0], ENTRY_VALUE, context); }
+
+static lisp_data_t *prim_to_alist(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return collect(argv[0], ENTRY_PAIR, context); }
+
+/* Calls (proc key value) for each entry. The entries are collected first, so
+ * proc may change the table. */
+static lisp_data_t *prim_walk(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *entries = collect(argv[0], ENTRY_PAIR, context), *args[2], *val;
+
+	if(entries && (entries->type == lisp_type_error))
+		return entries;
+
+	for(; entries; entries = lisp_cdr(entries)) {
+		args[0] = lisp_caar(entries);
+		args[1] = lisp_cdar(entries);
+		val = lisp_apply(argv[1], 2, args, context);
+		if(val && (val->type == lisp_type_error))
+			return val;
+	}
+	return NULL;
+}
+
+#undef ENTRY_KEY
+#undef ENTRY_VALUE
+#undef ENTRY_PAIR
+
+#define SYMBOL		LISP_ARG(lisp_type_symbol)
+#define HASH		LISP_ARG(lisp_type_hashtable)
+#define ANY			LISP_ARG_ANY
+#define PURE		LISP_PRIM_PURE
+
+static const lisp_prim_def_t hash_prims[] = {
+	{ "make-hash-table", prim_make_hash_table, 0, 2, { SYMBOL, SYMBOL }, 0 },
+	{ "hash-table?", prim_is_hash_table, 1, 1, { ANY }, PURE },
+	{ "hash-table-ref", prim_ref, 2, 3, { HASH, ANY, ANY }, 0 },
+	{ "hash-table-contains?", prim_contains, 2, 2, { HASH, ANY }, 0 },
+	{ "hash-table-set!", prim_set, 3, 3, { HASH, ANY, ANY }, 0 },
+	{ "hash-table-delete!", prim_delete, 2, 2, { HASH, ANY }, 0 },
+	{ "hash-table-count", prim_count, 1, 1, { HASH }, 0 },
+	{ "hash-table-keys", prim_keys, 1, 1, { HASH }, 0 },
+	{ "hash-table-values", prim_values, 1, 1, { HASH }, 0 },
+	{ "hash-table->alist", prim_to_alist, 1, 1, { HASH }, 0 },
+	{ "hash-table-walk", prim_walk, 2, 2, { HASH, ANY }, 0 }
+};
+
+#undef SYMBOL
+#undef HASH
+#undef ANY
+#undef PURE
+
+void lisp_add_hash_prims(lisp_ctx_t *context) {
+	size_t i;
+
+	for(i = 0; i < sizeof(hash_prims) / sizeof(hash_prims[0]); i++)
+		lisp_add_vprim(&hash_prims[i], context);
+}
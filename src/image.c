@@ -0,0 +1,650 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/hash.h"
+#include "libisp/image.h"
+#include "libisp/load.h"
+#include "libisp/mem.h"
+#include "libisp/serial.h"
+
+/*
+ * An image is a header followed by one record per datum reachable from the
+ * global environment, in the order they were numbered:
+ *
+ *   "LISPIMG\0" | u32 version | u32 count
+ *   u8 type | payload
+ *
+ * Numbers are little endian. Strings, symbols, errors and primitive names
+ * are stored as u32 length, the bytes and a terminating NUL, so they can be
+ * handed to the constructors straight from the mapped file. Pairs store the
+ * record numbers of their car and cdr plus one, 0 being the empty list.
+ * Vectors store their length as a u32 and then their elements that way.
+ * Numeric vectors store their length and the eight bytes of each element.
+ * Hash tables store their kind and weakness or'd together and their number of
+ * entries as u32, and then the record numbers of each key and value. Weak
+ * boxes store whether they are broken and the record number of their value.
+ * String builders store their text like strings.
+ * Primitives are stored by name and looked up in the loading context.
+ */
+
+#define IMAGE_MAGIC		"LISPIMG"
+#define IMAGE_VERSION	1
+#define HEADER_SIZE		16
+
+/* OUTPUT */
+
+static void put_u32(const uint32_t val, FILE *fp) {
+	unsigned char buf[4];
+
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+	buf[2] = (val >> 16) & 0xff;
+	buf[3] = (val >> 24) & 0xff;
+	fwrite(buf, 1, 4, fp);
+}
+
+static void put_u64(const uint64_t val, FILE *fp) {
+	unsigned char buf[8];
+	int i;
+
+	for(i = 0; i < 8; i++)
+		buf[i] = (val >> (8 * i)) & 0xff;
+	fwrite(buf, 1, 8, fp);
+}
+
+static void put_f64(const double val, FILE *fp) {
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	put_u64(bits, fp);
+}
+
+static void put_str(const char *str, FILE *fp) {
+	size_t len = strlen(str);
+
+	put_u32((uint32_t)len, fp);
+	fwrite(str, 1, len + 1, fp);
+}
+
+static uint32_t ref_of(const lisp_data_t *d, const lisp_ptrmap_t *map) {
+	uint32_t out = 0;
+
+	if(d)
+		lisp_ptrmap_find(map, d, &out);
+	return d ? out + 1 : 0;
+}
+
+static int put_record(const lisp_data_t *d, const lisp_ptrmap_t *map, const lisp_ctx_t *context, FILE *fp) {
+	lisp_data_t *key, *value;
+	const char *name;
+	size_t i;
+
+	/* Both kinds of primitive are looked up by name again. */
+	fputc((d->type == lisp_type_vprim) ? lisp_type_prim : d->type, fp);
+
+	switch(d->type) {
+		case lisp_type_integer: put_u32((uint32_t)d->integer, fp); break;
+		case lisp_type_decimal: put_f64(d->decimal, fp); break;
+		case lisp_type_string: put_str(d->string, fp); break;
+		case lisp_type_symbol: put_str(d->symbol, fp); break;
+		case lisp_type_error: put_str(d->error, fp); break;
+		case lisp_type_prim:
+		case lisp_type_vprim:
+			if((name = lisp_prim_name(d, context)) == NULL)
+				return LISP_IMAGE_EPRIM;
+			put_str(name, fp);
+			break;
+		case lisp_type_pair:
+			put_u32(ref_of(d->pair->l, map), fp);
+			put_u32(ref_of(d->pair->r, map), fp);
+			break;
+		case lisp_type_vector:
+			put_u32((uint32_t)d->vector->length, fp);
+			for(i = 0; i < d->vector->length; i++)
+				put_u32(ref_of(d->vector->items[i], map), fp);
+			break;
+		case lisp_type_f64vector:
+		case lisp_type_s64vector:
+			put_u32((uint32_t)d->numvector->length, fp);
+			for(i = 0; i < d->numvector->length; i++)
+				put_u64((uint64_t)d->numvector->s64[i], fp);
+			break;
+		case lisp_type_hashtable:
+			put_u32((uint32_t)(d->hashtable->kind | d->hashtable->weak), fp);
+			put_u32((uint32_t)d->hashtable->count, fp);
+			for(i = 0; lisp_hashtable_next(d, &i, &key, &value); ) {
+				put_u32(ref_of(key, map), fp);
+				put_u32(ref_of(value, map), fp);
+			}
+			break;
+		case lisp_type_strbuf: put_str(d->strbuf->data, fp); break;
+		case lisp_type_weakbox:
+			put_u32((uint32_t)d->weakbox->broken, fp);
+			put_u32(ref_of(d->weakbox->value, map), fp);
+			break;
+		case lisp_type_lazy:
+			/* Numbering went through lisp_cdr(), which read them all. */
+			break;
+	}
+
+	return LISP_IMAGE_OK;
+}
+
+/* Data of a base of shared is left out, the copy refers to it as it is. */
+static int number_child(const lisp_data_t *child, const lisp_data_t ***nodes, size_t *n_nodes, size_t *n_alloc, lisp_ptrmap_t *map, const lisp_ctx_t *shared) {
+	const lisp_data_t **newnodes;
+	uint32_t dummy;
+
+	if(!child || lisp_ptrmap_find(map, child, &dummy) || (shared && lisp_is_immutable(child, shared)))
+		return 0;
+
+	if(*n_nodes == *n_alloc) {
+		if((newnodes = realloc(*nodes, 2 * *n_alloc * sizeof(lisp_data_t*))) == NULL)
+			return -1;
+		*nodes = newnodes;
+		*n_alloc *= 2;
+	}
+
+	if(lisp_ptrmap_insert(map, child, (uint32_t)*n_nodes) == -1)
+		return -1;
+	(*nodes)[(*n_nodes)++] = child;
+
+	return 0;
+}
+
+/* Numbers every datum reachable from root breadth first, the node list is the
+ * queue. */
+static int number_reachable(const lisp_data_t *root, const lisp_data_t ***nodes, size_t *n_nodes, size_t *n_alloc, lisp_ptrmap_t *map, const lisp_ctx_t *shared) {
+	lisp_data_t *key, *value;
+	const lisp_data_t *node;
+	size_t i, j;
+
+	if(number_child(root, nodes, n_nodes, n_alloc, map, shared) == -1)
+		return -1;
+	for(i = 0; i < *n_nodes; i++) {
+		node = (*nodes)[i];
+		if(node->type == lisp_type_vector) {
+			for(j = 0; j < node->vector->length; j++)
+				if(number_child(node->vector->items[j], nodes, n_nodes, n_alloc, map, shared) == -1)
+					return -1;
+			continue;
+		}
+		if(node->type == lisp_type_hashtable) {
+			for(j = 0; lisp_hashtable_next(node, &j, &key, &value); )
+				if((number_child(key, nodes, n_nodes, n_alloc, map, shared) == -1) ||
+				   (number_child(value, nodes, n_nodes, n_alloc, map, shared) == -1))
+					return -1;
+			continue;
+		}
+		if(node->type == lisp_type_weakbox) {
+			if(number_child(node->weakbox->value, nodes, n_nodes, n_alloc, map, shared) == -1)
+				return -1;
+			continue;
+		}
+		if(node->type != lisp_type_pair)
+			continue;
+		if((number_child(lisp_car(node), nodes, n_nodes, n_alloc, map, shared) == -1) ||
+		   (number_child(lisp_cdr(node), nodes, n_nodes, n_alloc, map, shared) == -1))
+			return -1;
+	}
+
+	return 0;
+}
+
+int lisp_save_image(const char *path, lisp_ctx_t *context) {
+	const lisp_data_t **nodes;
+	size_t n_nodes = 0, n_alloc = 1024, i;
+	int out = LISP_IMAGE_OK;
+	lisp_ptrmap_t map;
+	FILE *fp;
+
+	if(!context->the_global_environment)
+		return LISP_IMAGE_EFORMAT;
+
+	if((nodes = malloc(n_alloc * sizeof(lisp_data_t*))) == NULL)
+		return LISP_IMAGE_EMEM;
+	if(lisp_ptrmap_init(&map, 2048) == -1) {
+		free(nodes);
+		return LISP_IMAGE_EMEM;
+	}
+
+	if(number_reachable(context->the_global_environment, &nodes, &n_nodes, &n_alloc, &map, NULL) == -1)
+		out = LISP_IMAGE_EMEM;
+
+	if((out == LISP_IMAGE_OK) && ((fp = fopen(path, "wb")) == NULL))
+		out = LISP_IMAGE_EIO;
+
+	if(out == LISP_IMAGE_OK) {
+		fwrite(IMAGE_MAGIC, 1, 8, fp);
+		put_u32(IMAGE_VERSION, fp);
+		put_u32((uint32_t)n_nodes, fp);
+
+		for(i = 0; (i < n_nodes) && (out == LISP_IMAGE_OK); i++)
+			out = put_record(nodes[i], &map, context, fp);
+
+		if(ferror(fp))
+			out = LISP_IMAGE_EIO;
+		if(fclose(fp) && (out == LISP_IMAGE_OK))
+			out = LISP_IMAGE_EIO;
+	}
+
+	lisp_ptrmap_free(&map);
+	free(nodes);
+
+	return out;
+}
+
+/* INPUT */
+
+typedef struct image_t {
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+} image_t;
+
+static int get_u32(image_t *img, uint32_t *out) {
+	const unsigned char *p = img->data + img->pos;
+
+	if(img->len - img->pos < 4)
+		return -1;
+
+	*out = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	img->pos += 4;
+	return 0;
+}
+
+static int get_u64(image_t *img, uint64_t *out) {
+	int i;
+
+	if(img->len - img->pos < 8)
+		return -1;
+
+	for(*out = 0, i = 0; i < 8; i++)
+		*out |= (uint64_t)img->data[img->pos + i] << (8 * i);
+	img->pos += 8;
+	return 0;
+}
+
+static int get_f64(image_t *img, double *out) {
+	uint64_t bits;
+
+	if(get_u64(img, &bits) == -1)
+		return -1;
+	memcpy(out, &bits, sizeof(bits));
+	return 0;
+}
+
+static const char *get_str(image_t *img) {
+	const char *out;
+	uint32_t len;
+
+	if(get_u32(img, &len) == -1)
+		return NULL;
+	if(img->len - img->pos < (size_t)len + 1)
+		return NULL;
+
+	out = (const char*)img->data + img->pos;
+	if((out[len] != '\0') || (memchr(out, '\0', len) != NULL))
+		return NULL;
+
+	img->pos += len + 1;
+	return out;
+}
+
+static int get_record(image_t *img, lisp_data_t **node, uint32_t *links, lisp_ctx_t *context) {
+	const char *str;
+	uint32_t integer, i;
+	double decimal;
+	lisp_type_t type;
+
+	if(img->pos >= img->len)
+		return LISP_IMAGE_EFORMAT;
+
+	switch(img->data[img->pos++]) {
+		case lisp_type_integer:
+			if(get_u32(img, &integer) == -1)
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_make_int((int)integer, context);
+			break;
+		case lisp_type_decimal:
+			if(get_f64(img, &decimal) == -1)
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_make_decimal(decimal, context);
+			break;
+		case lisp_type_string:
+			if((str = get_str(img)) == NULL)
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_make_string(str, context);
+			break;
+		case lisp_type_symbol:
+			if((str = get_str(img)) == NULL)
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_make_symbol(str, context);
+			break;
+		case lisp_type_error:
+			if((str = get_str(img)) == NULL)
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_make_error(str, context);
+			break;
+		case lisp_type_prim:
+			if((str = get_str(img)) == NULL)
+				return LISP_IMAGE_EFORMAT;
+			if((*node = lisp_make_named_prim(str, context)) == NULL) {
+				fprintf(stderr, "ERROR: Image needs unknown primitive '%s'.\n", str);
+				return LISP_IMAGE_EPRIM;
+			}
+			break;
+		case lisp_type_pair:
+			if((get_u32(img, &links[0]) == -1) || (get_u32(img, &links[1]) == -1))
+				return LISP_IMAGE_EFORMAT;
+			*node = lisp_cons(NULL, NULL);
+			break;
+		case lisp_type_vector:
+			/* The elements are linked later, from where they are in the image. */
+			if((get_u32(img, &links[1]) == -1) || ((img->len - img->pos) / 4 < links[1]) || (img->pos > UINT32_MAX))
+				return LISP_IMAGE_EFORMAT;
+			links[0] = (uint32_t)img->pos;
+			img->pos += 4 * (size_t)links[1];
+			*node = lisp_make_vector(links[1], NULL, context);
+			break;
+		case lisp_type_f64vector:
+		case lisp_type_s64vector:
+			type = (lisp_type_t)img->data[img->pos - 1];
+			if((get_u32(img, &integer) == -1) || ((img->len - img->pos) / 8 < integer))
+				return LISP_IMAGE_EFORMAT;
+			if((*node = (type == lisp_type_f64vector) ? lisp_make_f64vector(integer, context) : lisp_make_s64vector(integer, context)) == NULL)
+				return LISP_IMAGE_EMEM;
+			/* The bits of an f64 are the same in either array. */
+			for(i = 0; i < integer; i++)
+				get_u64(img, (uint64_t*)(*node)->numvector->s64 + i);
+			break;
+		case lisp_type_hashtable:
+			/* Filled in once every key is complete, so they hash right. */
+			if((get_u32(img, &integer) == -1) || ((integer & ~LISP_HASH_WEAK) > LISP_HASH_STRING) || (get_u32(img, &links[1]) == -1) ||
+			   ((img->len - img->pos) / 8 < links[1]) || (img->pos > UINT32_MAX))
+				return LISP_IMAGE_EFORMAT;
+			links[0] = (uint32_t)img->pos;
+			img->pos += 8 * (size_t)links[1];
+			*node = lisp_make_hashtable((int)integer, context);
+			break;
+		case lisp_type_strbuf:
+			if((str = get_str(img)) == NULL)
+				return LISP_IMAGE_EFORMAT;
+			if(((*node = lisp_make_strbuf(context)) != NULL) && (lisp_strbuf_append(*node, str, strlen(str)) == -1))
+				return LISP_IMAGE_EMEM;
+			break;
+		case lisp_type_weakbox:
+			/* Linked like a pair, the value is in links[0]. */
+			if((get_u32(img, &links[1]) == -1) || (links[1] > 1) || (get_u32(img, &links[0]) == -1))
+				return LISP_IMAGE_EFORMAT;
+			if((*node = lisp_make_weak_box(NULL, context)) != NULL)
+				(*node)->weakbox->broken = (int)links[1];
+			break;
+		default:
+			return LISP_IMAGE_EFORMAT;
+	}
+
+	if(!*node)
+		return LISP_IMAGE_EMEM;
+	return LISP_IMAGE_OK;
+}
+
+static int link_vector(image_t *img, lisp_data_t *vector, const uint32_t pos, lisp_data_t **nodes, const uint32_t count) {
+	uint32_t ref;
+	size_t i;
+
+	img->pos = pos;
+	for(i = 0; i < vector->vector->length; i++) {
+		if((get_u32(img, &ref) == -1) || (ref > count))
+			return LISP_IMAGE_EFORMAT;
+		vector->vector->items[i] = ref ? nodes[ref - 1] : NULL;
+	}
+	return LISP_IMAGE_OK;
+}
+
+static int link_hashtable(image_t *img, lisp_data_t *table, const uint32_t pos, const uint32_t n_entries, lisp_data_t **nodes, const uint32_t count) {
+	uint32_t key, value, i;
+
+	img->pos = pos;
+	for(i = 0; i < n_entries; i++) {
+		if((get_u32(img, &key) == -1) || (get_u32(img, &value) == -1) || (key > count) || (value > count))
+			return LISP_IMAGE_EFORMAT;
+		if(lisp_hashtable_set(table, key ? nodes[key - 1] : NULL, value ? nodes[value - 1] : NULL) == -1)
+			return LISP_IMAGE_EFORMAT;
+	}
+	return LISP_IMAGE_OK;
+}
+
+static int is_bound_in_frame(const char *name, const lisp_data_t *frame) {
+	lisp_data_t *vars = lisp_car(frame), *var;
+
+	while(vars) {
+		var = lisp_car(vars);
+		if(var && (var->type == lisp_type_symbol) && !strcmp(var->symbol, name))
+			return 1;
+		vars = lisp_cdr(vars);
+	}
+	return 0;
+}
+
+/* Primitives the host registered but the image does not know about. */
+static int bind_new_prims(lisp_ctx_t *context) {
+	lisp_data_t *frame = lisp_car(context->the_global_environment), *obj;
+	lisp_prim_proc_list_t *curr_proc = context->the_prim_procs;
+
+	if(!frame || (frame->type != lisp_type_pair))
+		return LISP_IMAGE_EFORMAT;
+
+	while(curr_proc) {
+		if(!is_bound_in_frame(curr_proc->name, frame)) {
+			obj = lisp_make_prim_object(curr_proc, context);
+			lisp_set_car(frame, lisp_cons(lisp_make_symbol(curr_proc->name, context), lisp_car(frame)));
+			lisp_set_cdr(frame, lisp_cons(obj, lisp_cdr(frame)));
+		}
+		curr_proc = curr_proc->next;
+	}
+	return LISP_IMAGE_OK;
+}
+
+int lisp_load_image(const char *path, lisp_ctx_t *context) {
+	lisp_data_t **nodes = NULL;
+	uint32_t version, count, *links = NULL, i;
+	int out = LISP_IMAGE_OK;
+	lisp_mapping_t map;
+	image_t img;
+
+	if(lisp_map_file(path, &map) == -1)
+		return LISP_IMAGE_EIO;
+
+	img.data = (const unsigned char*)map.data;
+	img.len = map.len;
+
+	if((img.len < HEADER_SIZE) || memcmp(img.data, IMAGE_MAGIC, 8))
+		out = LISP_IMAGE_EFORMAT;
+	img.pos = 8;
+
+	if(out == LISP_IMAGE_OK) {
+		get_u32(&img, &version);
+		get_u32(&img, &count);
+		if((version != IMAGE_VERSION) || (count == 0) || (count > img.len))
+			out = LISP_IMAGE_EFORMAT;
+	}
+
+	if(out == LISP_IMAGE_OK) {
+		nodes = calloc(count, sizeof(lisp_data_t*));
+		links = calloc(2 * (size_t)count, sizeof(uint32_t));
+		if(!nodes || !links)
+			out = LISP_IMAGE_EMEM;
+	}
+
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < count); i++)
+		out = get_record(&img, &nodes[i], &links[2 * i], context);
+
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < count); i++) {
+		if(nodes[i]->type == lisp_type_vector) {
+			out = link_vector(&img, nodes[i], links[2 * i], nodes, count);
+			continue;
+		}
+		if(nodes[i]->type == lisp_type_weakbox) {
+			if(links[2 * i] > count)
+				out = LISP_IMAGE_EFORMAT;
+			else
+				nodes[i]->weakbox->value = links[2 * i] ? nodes[links[2 * i] - 1] : NULL;
+			continue;
+		}
+		if(nodes[i]->type != lisp_type_pair)
+			continue;
+		if((links[2 * i] > count) || (links[2 * i + 1] > count)) {
+			out = LISP_IMAGE_EFORMAT;
+			break;
+		}
+		nodes[i]->pair->l = links[2 * i] ? nodes[links[2 * i] - 1] : NULL;
+		nodes[i]->pair->r = links[2 * i + 1] ? nodes[links[2 * i + 1] - 1] : NULL;
+	}
+
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < count); i++)
+		if(nodes[i]->type == lisp_type_hashtable)
+			out = link_hashtable(&img, nodes[i], links[2 * i], links[2 * i + 1], nodes, count);
+
+	if(out == LISP_IMAGE_OK) {
+		context->the_global_environment = nodes[0];
+		if((out = bind_new_prims(context)) == LISP_IMAGE_OK)
+			lisp_add_builtin_cvars(context);
+		else
+			context->the_global_environment = NULL;
+	}
+
+	if(out != LISP_IMAGE_OK)
+		lisp_gc(LISP_GC_FORCE, context);
+
+	free(links);
+	free(nodes);
+	lisp_unmap_file(&map);
+
+	return out;
+}
+
+/* COPYING */
+
+static lisp_data_t *copy_of(const lisp_data_t *d, const lisp_ptrmap_t *map, lisp_data_t **copies) {
+	uint32_t pos;
+
+	if(d && lisp_ptrmap_find(map, d, &pos))
+		return copies[pos];
+	return (lisp_data_t*)d;
+}
+
+/* A copy without the references, those are linked once every datum has one. */
+static lisp_data_t *copy_node(const lisp_data_t *d, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL;
+
+	switch(d->type) {
+		case lisp_type_integer: return lisp_make_int(d->integer, context);
+		case lisp_type_decimal: return lisp_make_decimal(d->decimal, context);
+		case lisp_type_string: return lisp_make_string(d->string, context);
+		case lisp_type_symbol: return lisp_make_symbol(d->symbol, context);
+		case lisp_type_error: return lisp_make_error(d->error, context);
+		case lisp_type_prim: return lisp_make_prim(d->proc, context);
+		case lisp_type_vprim: return lisp_make_vprim(d->def, context);
+		case lisp_type_pair: return lisp_cons(NULL, NULL);
+		case lisp_type_vector: return lisp_make_vector(d->vector->length, NULL, context);
+		case lisp_type_f64vector:
+		case lisp_type_s64vector:
+			out = (d->type == lisp_type_f64vector) ? lisp_make_f64vector(d->numvector->length, context) : lisp_make_s64vector(d->numvector->length, context);
+			if(out)
+				memcpy(out->numvector->s64, d->numvector->s64, d->numvector->length * sizeof(int64_t));
+			return out;
+		case lisp_type_hashtable: return lisp_make_hashtable(d->hashtable->kind | d->hashtable->weak, context);
+		case lisp_type_strbuf:
+			if(((out = lisp_make_strbuf(context)) != NULL) && (lisp_strbuf_append(out, d->strbuf->data, strlen(d->strbuf->data)) == -1))
+				return NULL;
+			return out;
+		case lisp_type_weakbox:
+			if((out = lisp_make_weak_box(NULL, context)) != NULL)
+				out->weakbox->broken = d->weakbox->broken;
+			return out;
+		case lisp_type_lazy:
+			/* Numbering went through lisp_cdr(), which read them all. */
+			break;
+	}
+
+	return NULL;
+}
+
+/* Copies everything reachable from the global environment of from into
+ * context, the same way an image would be saved and loaded but without the
+ * file. Data of the frozen bases of from is shared and context builds on them
+ * as well. */
+int lisp_copy_image(lisp_ctx_t *context, lisp_ctx_t *from) {
+	const lisp_data_t **nodes;
+	lisp_data_t **copies = NULL, *key, *value;
+	size_t n_nodes = 0, n_alloc = 1024, i, j;
+	int out = LISP_IMAGE_OK;
+	const lisp_data_t *d;
+	lisp_ptrmap_t map;
+
+	if(!from->the_global_environment)
+		return LISP_IMAGE_EFORMAT;
+
+	if((nodes = malloc(n_alloc * sizeof(lisp_data_t*))) == NULL)
+		return LISP_IMAGE_EMEM;
+	if(lisp_ptrmap_init(&map, 2048) == -1) {
+		free(nodes);
+		return LISP_IMAGE_EMEM;
+	}
+
+	if((number_reachable(from->the_global_environment, &nodes, &n_nodes, &n_alloc, &map, from) == -1) ||
+	   ((copies = malloc(n_nodes * sizeof(lisp_data_t*))) == NULL))
+		out = LISP_IMAGE_EMEM;
+
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < n_nodes); i++)
+		if((copies[i] = copy_node(nodes[i], context)) == NULL)
+			out = LISP_IMAGE_EMEM;
+
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < n_nodes); i++) {
+		d = nodes[i];
+		if(d->type == lisp_type_pair) {
+			copies[i]->pair->l = copy_of(d->pair->l, &map, copies);
+			copies[i]->pair->r = copy_of(d->pair->r, &map, copies);
+		} else if(d->type == lisp_type_vector) {
+			for(j = 0; j < d->vector->length; j++)
+				copies[i]->vector->items[j] = copy_of(d->vector->items[j], &map, copies);
+		} else if(d->type == lisp_type_weakbox)
+			copies[i]->weakbox->value = copy_of(d->weakbox->value, &map, copies);
+	}
+
+	/* Filled in once every key is complete, so they hash right. */
+	for(i = 0; (out == LISP_IMAGE_OK) && (i < n_nodes); i++)
+		if(nodes[i]->type == lisp_type_hashtable)
+			for(j = 0; (out == LISP_IMAGE_OK) && lisp_hashtable_next(nodes[i], &j, &key, &value); )
+				if(lisp_hashtable_set(copies[i], copy_of(key, &map, copies), copy_of(value, &map, copies)) == -1)
+					out = LISP_IMAGE_EMEM;
+
+	if(out == LISP_IMAGE_OK) {
+		context->the_global_environment = copy_of(from->the_global_environment, &map, copies);
+		context->base = from->base;
+		lisp_add_builtin_cvars(context);
+	} else
+		lisp_gc(LISP_GC_FORCE, context);
+
+	lisp_ptrmap_free(&map);
+	free(copies);
+	free(nodes);
+
+	return out;
+}
@@ -0,0 +1,660 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/data.h"
+#include "libisp/hash.h"
+#include "libisp/json.h"
+#include "libisp/print.h"
+
+/*
+ * JSON values map onto data like this:
+ *
+ *   [1, 2, 3]              (1 2 3)
+ *   {"a": 1, "b": [2, 3]}  ((a . 1) (b 2 3))
+ *   {}                     an empty hash table
+ *   true false null        #t #f null
+ *
+ * Numbers without a fraction or exponent that fit an int become integers,
+ * all others decimals. Object keys become symbols, so a list is written as an
+ * object when every element is a pair with a symbol in its car that is not
+ * #t, #f or null. Other symbols are written as strings. The empty list is
+ * written as [], so {} reads as an empty table instead, and tables are written
+ * as objects with their symbol or string keys as names.
+ */
+
+#define JSON_DEPTH_MAX		65536
+#define NUMBER_BUF			64
+#define SYMBOL_CACHE		256
+
+/* DECODING */
+
+/* A container that is still open. An object member waits in key until its
+ * value has been read. */
+typedef struct frame_t {
+	lisp_data_t *head, *tail;
+	lisp_data_t *key;
+	int object;
+} frame_t;
+
+/* Keys repeat in every object of an array, so symbols are made once and
+ * shared like lisp_deserialize() does. The cache keeps the last symbol for
+ * every hash of a name. */
+typedef struct parser_t {
+	const char *pos, *end;
+	frame_t *stack;
+	size_t depth, size;
+	lisp_data_t *symbols[SYMBOL_CACHE];
+	int error;
+	lisp_ctx_t *context;
+} parser_t;
+
+static void skip_space(parser_t *p) {
+	while((p->pos < p->end) && ((*p->pos == ' ') || (*p->pos == '\t') || (*p->pos == '\n') || (*p->pos == '\r')))
+		p->pos++;
+}
+
+static int expect(parser_t *p, const char c) {
+	skip_space(p);
+	if((p->pos == p->end) || (*p->pos != c))
+		return -1;
+	p->pos++;
+	return 0;
+}
+
+static lisp_data_t *get_symbol(parser_t *p, const char *name, const size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	lisp_data_t **cached;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+	cached = &p->symbols[(h ^ (h >> 32)) & (SYMBOL_CACHE - 1)];
+
+	if(!*cached || strncmp((*cached)->symbol, name, len) || (*cached)->symbol[len])
+		*cached = lisp_make_symboln(name, len, p->context);
+	return *cached;
+}
+
+static int hex4(const char *in, uint32_t *out) {
+	int i;
+
+	*out = 0;
+	for(i = 0; i < 4; i++) {
+		*out <<= 4;
+		if((in[i] >= '0') && (in[i] <= '9'))
+			*out |= in[i] - '0';
+		else if((in[i] >= 'a') && (in[i] <= 'f'))
+			*out |= in[i] - 'a' + 10;
+		else if((in[i] >= 'A') && (in[i] <= 'F'))
+			*out |= in[i] - 'A' + 10;
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static char *put_utf8(char *out, const uint32_t c) {
+	if(c < 0x80) {
+		*out++ = (char)c;
+	} else if(c < 0x800) {
+		*out++ = (char)(0xc0 | (c >> 6));
+		*out++ = (char)(0x80 | (c & 0x3f));
+	} else if(c < 0x10000) {
+		*out++ = (char)(0xe0 | (c >> 12));
+		*out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+		*out++ = (char)(0x80 | (c & 0x3f));
+	} else {
+		*out++ = (char)(0xf0 | (c >> 18));
+		*out++ = (char)(0x80 | ((c >> 12) & 0x3f));
+		*out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+		*out++ = (char)(0x80 | (c & 0x3f));
+	}
+	return out;
+}
+
+/* Undoes the escapes of a string that has some, into out, which has room for
+ * the escaped length. An escape never gets longer when it is undone. */
+static char *unescape(const char *in, const char *end, char *out) {
+	uint32_t c, low;
+
+	while(in < end) {
+		if(*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+
+		switch(in[1]) {
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '/': *out++ = '/'; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u':
+				if((end - in < 6) || (hex4(in + 2, &c) == -1) || !c)
+					return NULL;
+				if((c >= 0xd800) && (c < 0xdc00)) {
+					if((end - in < 12) || (in[6] != '\\') || (in[7] != 'u') || (hex4(in + 8, &low) == -1) || (low < 0xdc00) || (low >= 0xe000))
+						return NULL;
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+					in += 6;
+				} else if((c >= 0xdc00) && (c < 0xe000))
+					return NULL;
+				out = put_utf8(out, c);
+				in += 4;
+				break;
+			default:
+				return NULL;
+		}
+		in += 2;
+	}
+
+	return out;
+}
+
+/* Strings without escapes, which is most of them, are made straight from the
+ * input. Strings cannot hold a NUL, so \u0000 is an error. */
+static lisp_data_t *get_text(parser_t *p, const lisp_type_t type) {
+	const char *start = ++p->pos;
+	char *buf, *end;
+	lisp_data_t *out;
+	int escaped = 0;
+
+	for(; (p->pos < p->end) && (*p->pos != '"'); p->pos++) {
+		if((unsigned char)*p->pos < 0x20)
+			break;
+		if(*p->pos == '\\') {
+			escaped = 1;
+			if(++p->pos == p->end)
+				break;
+		}
+	}
+	if((p->pos == p->end) || (*p->pos != '"')) {
+		p->error = 1;
+		return NULL;
+	}
+	p->pos++;
+
+	if(!escaped) {
+		if(type == lisp_type_symbol)
+			out = get_symbol(p, start, p->pos - start - 1);
+		else
+			out = lisp_make_stringn(start, p->pos - start - 1, p->context);
+	} else {
+		if((buf = malloc(p->pos - start)) == NULL) {
+			p->error = 1;
+			return NULL;
+		}
+		if((end = unescape(start, p->pos - 1, buf)) == NULL)
+			out = NULL;
+		else if(type == lisp_type_symbol)
+			out = get_symbol(p, buf, end - buf);
+		else
+			out = lisp_make_stringn(buf, end - buf, p->context);
+		free(buf);
+	}
+
+	if(!out)
+		p->error = 1;
+	return out;
+}
+
+static int is_digit(const char c) {
+	return (c >= '0') && (c <= '9');
+}
+
+/* Checks the JSON number syntax and adds up the digits on the way, which is
+ * all there is to do for integers. Anything else goes through strtod(). */
+static lisp_data_t *get_number(parser_t *p) {
+	const char *start = p->pos;
+	char number[NUMBER_BUF], *buf = number;
+	int negative = 0, integer = 1;
+	int64_t value = 0;
+	lisp_data_t *out;
+
+	if((p->pos < p->end) && (*p->pos == '-')) {
+		negative = 1;
+		p->pos++;
+	}
+
+	if((p->pos == p->end) || !is_digit(*p->pos)) {
+		p->error = 1;
+		return NULL;
+	}
+	if(*p->pos == '0')
+		p->pos++;
+	else
+		for(; (p->pos < p->end) && is_digit(*p->pos); p->pos++)
+			if(value <= INT_MAX)
+				value = value * 10 + (*p->pos - '0');
+
+	if((p->pos < p->end) && (*p->pos == '.')) {
+		integer = 0;
+		if((++p->pos == p->end) || !is_digit(*p->pos)) {
+			p->error = 1;
+			return NULL;
+		}
+		while((p->pos < p->end) && is_digit(*p->pos))
+			p->pos++;
+	}
+
+	if((p->pos < p->end) && ((*p->pos == 'e') || (*p->pos == 'E'))) {
+		integer = 0;
+		if((++p->pos < p->end) && ((*p->pos == '+') || (*p->pos == '-')))
+			p->pos++;
+		if((p->pos == p->end) || !is_digit(*p->pos)) {
+			p->error = 1;
+			return NULL;
+		}
+		while((p->pos < p->end) && is_digit(*p->pos))
+			p->pos++;
+	}
+
+	if(integer && (value <= (int64_t)INT_MAX + negative)) {
+		out = lisp_make_int((int)(negative ? -value : value), p->context);
+	} else {
+		/* strtod() needs a terminated copy, the input may end right here. */
+		if((p->pos - start >= NUMBER_BUF) && ((buf = malloc(p->pos - start + 1)) == NULL)) {
+			p->error = 1;
+			return NULL;
+		}
+		memcpy(buf, start, p->pos - start);
+		buf[p->pos - start] = '\0';
+		out = lisp_make_decimal(strtod(buf, NULL), p->context);
+		if(buf != number)
+			free(buf);
+	}
+
+	if(!out)
+		p->error = 1;
+	return out;
+}
+
+static lisp_data_t *get_literal(parser_t *p, const char *word, const char *symbol) {
+	size_t len = strlen(word);
+	lisp_data_t *out;
+
+	if(((size_t)(p->end - p->pos) < len) || memcmp(p->pos, word, len)) {
+		p->error = 1;
+		return NULL;
+	}
+	p->pos += len;
+
+	if((out = get_symbol(p, symbol, strlen(symbol))) == NULL)
+		p->error = 1;
+	return out;
+}
+
+static frame_t *open_frame(parser_t *p, const int object) {
+	frame_t *newstack;
+	size_t newsize;
+
+	if(p->depth == JSON_DEPTH_MAX)
+		return NULL;
+
+	if(p->depth == p->size) {
+		newsize = p->size ? 2 * p->size : 16;
+		if((newstack = realloc(p->stack, newsize * sizeof(frame_t))) == NULL)
+			return NULL;
+		p->stack = newstack;
+		p->size = newsize;
+	}
+
+	p->stack[p->depth].head = NULL;
+	p->stack[p->depth].tail = NULL;
+	p->stack[p->depth].key = NULL;
+	p->stack[p->depth].object = object;
+	return &p->stack[p->depth++];
+}
+
+static int get_key(parser_t *p, frame_t *frame) {
+	skip_space(p);
+	if((p->pos == p->end) || (*p->pos != '"'))
+		return -1;
+	if((frame->key = get_text(p, lisp_type_symbol)) == NULL)
+		return -1;
+	return expect(p, ':');
+}
+
+static int add_value(parser_t *p, frame_t *frame, lisp_data_t *value) {
+	lisp_data_t *cell;
+
+	if(frame->object && ((value = lisp_cons_in_context(frame->key, value, p->context)) == NULL))
+		return -1;
+	if((cell = lisp_cons_in_context(value, NULL, p->context)) == NULL)
+		return -1;
+
+	if(frame->tail)
+		lisp_set_cdr(frame->tail, cell);
+	else
+		frame->head = cell;
+	frame->tail = cell;
+
+	return 0;
+}
+
+/* Containers are kept on a stack of their own, so nesting is only limited by
+ * JSON_DEPTH_MAX and not by the C stack. Every value is added to the end of
+ * the innermost open container as soon as it is read. */
+static lisp_data_t *get_value(parser_t *p) {
+	lisp_data_t *value;
+	frame_t *frame;
+	char close;
+
+	while(1) {
+		skip_space(p);
+		if(p->pos == p->end) {
+			p->error = 1;
+			return NULL;
+		}
+
+		switch(*p->pos) {
+			case '[':
+			case '{':
+				close = (*p->pos == '[') ? ']' : '}';
+				p->pos++;
+				skip_space(p);
+				if((p->pos < p->end) && (*p->pos == close)) {
+					p->pos++;
+					if(close == ']')
+						value = NULL;
+					else if((value = lisp_make_hashtable(LISP_HASH_EQUAL, p->context)) == NULL)
+						p->error = 1;
+					break;
+				}
+				if((frame = open_frame(p, close == '}')) == NULL) {
+					p->error = 1;
+					return NULL;
+				}
+				if(frame->object && (get_key(p, frame) == -1)) {
+					p->error = 1;
+					return NULL;
+				}
+				continue;
+			case '"': value = get_text(p, lisp_type_string); break;
+			case 't': value = get_literal(p, "true", "#t"); break;
+			case 'f': value = get_literal(p, "false", "#f"); break;
+			case 'n': value = get_literal(p, "null", "null"); break;
+			default: value = get_number(p); break;
+		}
+		if(p->error)
+			return NULL;
+
+		/* Add the value and close every container it completes. A comma leaves
+		 * the innermost one open for the next value. */
+		while(p->depth) {
+			frame = &p->stack[p->depth - 1];
+			if(add_value(p, frame, value) == -1) {
+				p->error = 1;
+				return NULL;
+			}
+
+			skip_space(p);
+			if((p->pos < p->end) && (*p->pos == ',')) {
+				p->pos++;
+				if(frame->object && (get_key(p, frame) == -1)) {
+					p->error = 1;
+					return NULL;
+				}
+				break;
+			}
+			if((p->pos == p->end) || (*p->pos != (frame->object ? '}' : ']'))) {
+				p->error = 1;
+				return NULL;
+			}
+			p->pos++;
+			value = frame->head;
+			p->depth--;
+		}
+
+		if(!p->depth)
+			return value;
+	}
+}
+
+/* Reads one JSON value and sets *readto to the end of it, so a stream of
+ * values, one per line or otherwise, can be read one after the other. */
+lisp_data_t *lisp_from_json(const char *json, const size_t len, size_t *readto, int *error, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	parser_t p;
+
+	p.pos = json;
+	p.end = json + len;
+	p.stack = NULL;
+	p.depth = 0;
+	p.size = 0;
+	p.error = 0;
+	p.context = context;
+	memset(p.symbols, 0, sizeof(p.symbols));
+
+	out = get_value(&p);
+	free(p.stack);
+
+	*error = p.error;
+	if(readto)
+		*readto = p.pos - json;
+
+	return p.error ? NULL : out;
+}
+
+/* ENCODING */
+
+static int is_word(const lisp_data_t *d, const char *word) {
+	return d && (d->type == lisp_type_symbol) && !strcmp(d->symbol, word);
+}
+
+static int is_member(const lisp_data_t *d) {
+	const lisp_data_t *key = lisp_car(d);
+
+	return key && (key->type == lisp_type_symbol) && !is_word(key, "#t") && !is_word(key, "#f") && !is_word(key, "null");
+}
+
+/* Returns 1 for a list that is written as an object, 0 for one that is
+ * written as an array and -1 for one that is neither proper nor finite. The
+ * cycle check moves a second pointer to where the first one was at every
+ * power of two steps, which meets it inside any cycle. */
+static int list_kind(const lisp_data_t *list) {
+	const lisp_data_t *mark = list;
+	size_t steps = 0, limit = 2;
+	int object = 1;
+
+	for(; list; list = lisp_cdr(list)) {
+		if(list->type != lisp_type_pair)
+			return -1;
+		if(object && !is_member(lisp_car(list)))
+			object = 0;
+
+		if(++steps == limit) {
+			mark = list;
+			limit *= 2;
+		} else if(lisp_cdr(list) == mark)
+			return -1;
+	}
+
+	return object;
+}
+
+/* Copies runs of characters that need no escape in one piece. */
+static void put_quoted(lisp_sink_t *sink, const char *str) {
+	static const char hex[] = "0123456789abcdef";
+	const char *run = str;
+	char escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+
+	lisp_sink_put(sink, "\"", 1);
+	for(; *str; str++) {
+		if(((unsigned char)*str >= 0x20) && (*str != '"') && (*str != '\\'))
+			continue;
+
+		lisp_sink_put(sink, run, str - run);
+		run = str + 1;
+		switch(*str) {
+			case '"': lisp_sink_put(sink, "\\\"", 2); break;
+			case '\\': lisp_sink_put(sink, "\\\\", 2); break;
+			case '\b': lisp_sink_put(sink, "\\b", 2); break;
+			case '\f': lisp_sink_put(sink, "\\f", 2); break;
+			case '\n': lisp_sink_put(sink, "\\n", 2); break;
+			case '\r': lisp_sink_put(sink, "\\r", 2); break;
+			case '\t': lisp_sink_put(sink, "\\t", 2); break;
+			default:
+				escape[4] = hex[(unsigned char)*str >> 4];
+				escape[5] = hex[*str & 0xf];
+				lisp_sink_put(sink, escape, 6);
+				break;
+		}
+	}
+	lisp_sink_put(sink, run, str - run);
+	lisp_sink_put(sink, "\"", 1);
+}
+
+static int put_atom(lisp_sink_t *sink, const lisp_data_t *d) {
+	char number[LISP_NUMBER_MAX];
+
+	if(!d)
+		return lisp_sink_put(sink, "[]", 2);
+
+	switch(d->type) {
+		case lisp_type_integer:
+			return lisp_sink_put(sink, number, lisp_format_int(d->integer, number));
+		case lisp_type_decimal:
+			if((d->decimal != d->decimal) || (d->decimal - d->decimal != 0.0))
+				return -1;
+			return lisp_sink_put(sink, number, lisp_format_decimal(d->decimal, number));
+		case lisp_type_string:
+			put_quoted(sink, d->string);
+			return 0;
+		case lisp_type_symbol:
+			if(!strcmp(d->symbol, "#t"))
+				return lisp_sink_put(sink, "true", 4);
+			if(!strcmp(d->symbol, "#f"))
+				return lisp_sink_put(sink, "false", 5);
+			if(!strcmp(d->symbol, "null"))
+				return lisp_sink_put(sink, "null", 4);
+			put_quoted(sink, d->symbol);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+#define JSON_ARRAY		0
+#define JSON_OBJECT		1
+#define JSON_TABLE		2
+
+/* rest is the part of a list not written yet, or the table. */
+typedef struct open_list_t {
+	const lisp_data_t *rest;
+	size_t pos, count;
+	int kind;
+} open_list_t;
+
+static int is_name(const lisp_data_t *d) {
+	return d && ((d->type == lisp_type_symbol) || (d->type == lisp_type_string));
+}
+
+/* Starts the next element of an open container and returns 1, or 0 if it has
+ * none left. The key of a member is written right away and its value goes
+ * through the caller like any other. -1 is a table key that is not a name. */
+static int next_element(lisp_sink_t *sink, open_list_t *list, const lisp_data_t **d) {
+	lisp_data_t *key, *value;
+
+	if(list->kind == JSON_TABLE) {
+		if(!lisp_hashtable_next(list->rest, &list->pos, &key, &value))
+			return 0;
+		if(!is_name(key))
+			return -1;
+	} else {
+		if(list->count)
+			list->rest = lisp_cdr(list->rest);
+		if(!list->rest)
+			return 0;
+	}
+
+	if(list->count++)
+		lisp_sink_put(sink, ",", 1);
+	if(list->kind == JSON_ARRAY) {
+		*d = lisp_car(list->rest);
+		return 1;
+	}
+	if(list->kind == JSON_OBJECT) {
+		key = lisp_caar(list->rest);
+		value = lisp_cdar(list->rest);
+	}
+
+	put_quoted(sink, (key->type == lisp_type_symbol) ? key->symbol : key->string);
+	lisp_sink_put(sink, ":", 1);
+	*d = value;
+	return 1;
+}
+
+/* Lists are written without recursion, like the printer does. Returns -1 if
+ * writing failed or d holds something JSON has no form for, a procedure, an
+ * improper or circular list, a table key that is not a symbol or string or a
+ * decimal that is not finite. What was written up to there is left in the
+ * sink. */
+int lisp_to_json(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context) {
+	open_list_t *open = NULL, *newopen;
+	size_t depth = 0, size = 0;
+	int kind, next = 0, out = 0;
+
+	while(1) {
+		if(d && ((d->type == lisp_type_pair) || (d->type == lisp_type_hashtable))) {
+			kind = (d->type == lisp_type_pair) ? list_kind(d) : JSON_TABLE;
+			if((depth == JSON_DEPTH_MAX) || (kind == -1)) {
+				out = -1;
+				break;
+			}
+			if(depth == size) {
+				size = size ? 2 * size : 16;
+				if((newopen = realloc(open, size * sizeof(open_list_t))) == NULL) {
+					out = -1;
+					break;
+				}
+				open = newopen;
+			}
+
+			open[depth].rest = d;
+			open[depth].pos = 0;
+			open[depth].count = 0;
+			open[depth].kind = kind;
+			lisp_sink_put(sink, (kind == JSON_ARRAY) ? "[" : "{", 1);
+			depth++;
+		} else if(put_atom(sink, d) == -1) {
+			out = -1;
+			break;
+		}
+
+		/* Move on to the next element of the innermost container that has one
+		 * left, closing the others on the way. */
+		for(; depth; depth--) {
+			if((next = next_element(sink, &open[depth - 1], &d)) != 0)
+				break;
+			lisp_sink_put(sink, (open[depth - 1].kind == JSON_ARRAY) ? "]" : "}", 1);
+		}
+
+		if(next == -1)
+			out = -1;
+		if(out || !depth)
+			break;
+	}
+
+	free(open);
+	if(lisp_sink_put(sink, "", 0) == -1)
+		out = -1;
+	return out;
+}
@@ -0,0 +1,173 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/load.h"
+#include "libisp/mem.h"
+#include "libisp/read.h"
+#include "libisp/thread.h"
+
+/* MAPPING */
+
+/* On POSIX the file is mapped over an anonymous region one byte larger than
+ * the file, so there always is a zero byte behind its last page. */
+int lisp_map_file(const char *path, lisp_mapping_t *map) {
+#ifdef _WIN32
+	FILE *fp;
+	long len;
+	char *data;
+
+	if((fp = fopen(path, "rb")) == NULL)
+		return -1;
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if((len < 0) || ((data = malloc(len + 1)) == NULL)) {
+		fclose(fp);
+		return -1;
+	}
+	if(fread(data, 1, len, fp) != (size_t)len) {
+		free(data);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	data[len] = '\0';
+	map->data = data;
+	map->len = (size_t)len;
+	map->size = (size_t)len + 1;
+#else
+	size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+	struct stat st;
+	void *data;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+
+	if((fstat(fd, &st) == -1) || (st.st_size < 0)) {
+		close(fd);
+		return -1;
+	}
+
+	map->len = st.st_size;
+	map->size = (map->len / pagesize + 1) * pagesize;
+
+	if((data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	if(map->len && (mmap(data, map->len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+		munmap(data, map->size);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	madvise(data, map->size, MADV_SEQUENTIAL);
+	map->data = data;
+#endif
+	return 0;
+}
+
+void lisp_unmap_file(lisp_mapping_t *map) {
+#ifdef _WIN32
+	free((void*)map->data);
+#else
+	munmap((void*)map->data, map->size);
+#endif
+	map->data = NULL;
+}
+
+/* LOADING */
+
+/* An evaluation on the eval thread that ended without a result. What it
+ * allocated up to the memory limit is collected first, or there would be no
+ * room for the error. */
+static lisp_data_t *load_error(const int status, lisp_ctx_t *context) {
+	switch(status) {
+		case LISP_ASYNC_CANCELLED:
+			return lisp_make_error("LOAD -- Cancelled", context);
+		case LISP_ASYNC_TIMEOUT:
+			return lisp_make_error("LOAD -- Timed out", context);
+		case LISP_ASYNC_MEMLIMIT:
+			lisp_gc(LISP_GC_FORCE, context);
+			return lisp_make_error("LOAD -- Hard memory limit reached", context);
+	}
+	return lisp_make_error("LOAD -- Could not start evaluation", context);
+}
+
+/* Reads and evaluates one form after the other, straight from the buffer.
+ * Only the host may collect garbage between the forms; the load primitive
+ * runs inside eval() and passes gc = 0. Loading stops at the first error, and
+ * on the host also when a form times out or runs out of memory. */
+lisp_data_t *lisp_load_forms(const char *exp, const int gc, lisp_ctx_t *context) {
+	lisp_data_t *form, *out = NULL;
+	size_t readto;
+	int error, status, first = 1;
+
+	while(1) {
+		while(isspace((unsigned char)*exp))
+			exp++;
+		if(!*exp)
+			break;
+
+		if(gc && !first)
+			lisp_gc(LISP_GC_LOWMEM, context);
+		first = 0;
+
+		form = lisp_read(exp, &readto, &error, context);
+		if(error)
+			return lisp_make_error("LOAD -- Syntax error", context);
+		exp += readto;
+
+		if(gc) {
+			out = lisp_eval_wait(form, &status, context);
+			if(status != LISP_ASYNC_DONE)
+				return load_error(status, context);
+		} else
+			out = lisp_eval(form, context);
+		if(out && (out->type == lisp_type_error))
+			break;
+	}
+
+	return out;
+}
+
+lisp_data_t *lisp_load_file(const char *path, lisp_ctx_t *context) {
+	lisp_mapping_t map;
+	lisp_data_t *out;
+
+	if(lisp_map_file(path, &map) == -1)
+		return lisp_make_error("LOAD -- Could not read file", context);
+
+	out = lisp_load_forms(map.data, 1, context);
+	lisp_unmap_file(&map);
+
+	return out;
+}
@@ -9,6 +9,7 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,67 +17,127 @@
 #include "libisp/builtin.h"
 #include "libisp/data.h"
 #include "libisp/eval.h"
+#include "libisp/hash.h"
 #include "libisp/mem.h"
 #include "libisp/thread.h"
 
 typedef struct alloclist_t {
-	lisp_data_t *memory;
+	lisp_ctx_t *owner;
 	char *file;
 	int line;
 	size_t size;
+	size_t serial;
 	char mark;
 	struct alloclist_t *next;
+	struct alloclist_t *prev;
 } alloclist_t;
 
-/* ALLOCATOR */
+/* The list entry lives right in front of the data it describes, so looking it
+ * up is pointer arithmetic and the list never has to be searched. That is
+ * only done for pointers in the context's allocation set below, anything
+ * else may not have a header to read. */
 
-static alloclist_t *make_entry(lisp_data_t *memory, const char *file, const int line, const size_t size) {
-	alloclist_t *out;
-	
-	if((out = malloc(sizeof(alloclist_t))) == NULL)
-		return NULL;	
+#define ENTRY_SIZE			((sizeof(alloclist_t) + 15) & ~(size_t)15)
+#define entry_of(memory)	((alloclist_t*)((char*)(memory) - ENTRY_SIZE))
+#define memory_of(entry)	((lisp_data_t*)((char*)(entry) + ENTRY_SIZE))
 
-	out->memory = memory;
-	out->line = line;
-	out->file = (char*)file;	
-	out->mark = 0;
-	out->size = size;
-	out->next = NULL;
+/* ALLOCATION SET */
 
-	return out;
+/* Every pointer the allocator handed out in a context and did not free yet,
+ * in an open addressing table that is kept at most half full. An allocation
+ * and its entry take about 64 bytes or more, so the number of the 64 byte block
+ * it starts in is used as is. That spreads them well enough and keeps data
+ * allocated together close together in the table too. */
+
+static size_t slot_of(const void *memory, const size_t size) {
+	return (size_t)((uintptr_t)memory >> 6) & (size - 1);
 }
 
-static void addtolist(alloclist_t *entry, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *last = NULL;
-	if(!current) {
-		context->alloc_list = entry;
-		context->mem_list_entries++;		
-		return;
+static int is_allocated(const void *memory, const lisp_ctx_t *context) {
+	size_t mask = context->alloc_set_size - 1, i;
+
+	if(!memory || !context->alloc_set)
+		return 0;
+
+	for(i = slot_of(memory, context->alloc_set_size); context->alloc_set[i]; i = (i + 1) & mask)
+		if(context->alloc_set[i] == memory)
+			return 1;
+	return 0;
+}
+
+static void put_slot(const void **set, const size_t size, const void *memory) {
+	size_t i;
+
+	for(i = slot_of(memory, size); set[i]; i = (i + 1) & (size - 1));
+	set[i] = memory;
+}
+
+static int add_to_set(const void *memory, lisp_ctx_t *context) {
+	const void **grown;
+	size_t size, i;
+
+	if(2 * (context->mem_list_entries + 1) > context->alloc_set_size) {
+		size = context->alloc_set_size ? 2 * context->alloc_set_size : 1024;
+		if((grown = calloc(size, sizeof(void*))) == NULL)
+			return -1;
+		for(i = 0; i < context->alloc_set_size; i++)
+			if(context->alloc_set[i])
+				put_slot(grown, size, context->alloc_set[i]);
+		free((void*)context->alloc_set);
+		context->alloc_set = grown;
+		context->alloc_set_size = size;
 	}
 
-	while(current && ((void*)current->memory < (void*)entry->memory)) {
-		last = current;		
-		current = current->next;
+	put_slot(context->alloc_set, context->alloc_set_size, memory);
+	return 0;
+}
+
+/* Moves later entries of the same run back into the hole, so no probe
+ * sequence is cut short and no tombstones are needed. An entry may fill the
+ * hole at i unless its home slot lies in (i, j]. */
+static void remove_from_set(const void *memory, lisp_ctx_t *context) {
+	size_t mask = context->alloc_set_size - 1, i, j, home;
+	const void **set = context->alloc_set;
+
+	for(i = slot_of(memory, context->alloc_set_size); set[i] != memory; i = (i + 1) & mask)
+		if(!set[i])
+			return;
+
+	for(j = i;;) {
+		set[i] = NULL;
+		do {
+			j = (j + 1) & mask;
+			if(!set[j])
+				return;
+			home = slot_of(set[j], context->alloc_set_size);
+		} while((i <= j) ? ((home > i) && (home <= j)) : ((home > i) || (home <= j)));
+		set[i] = set[j];
+		i = j;
 	}
+}
 
-	if(last)
-		last->next = entry;
-	else
-		context->alloc_list = entry;		
-	
-	entry->next = current;
+/* ALLOCATOR */
+
+static void addtolist(alloclist_t *entry, lisp_ctx_t *context) {
+	entry->prev = NULL;
+	entry->next = context->alloc_list;
+	if(context->alloc_list)
+		context->alloc_list->prev = entry;
+	context->alloc_list = entry;
 
 	context->mem_list_entries++;	
 }
 
 lisp_data_t *lisp_dalloc(const size_t size, const char *file, const int line, lisp_ctx_t *context) {
-	lisp_data_t *memory;
 	size_t newsize = context->mem_allocated + size;
 	alloclist_t *newentry;
 
 	if(newsize > context->mem_lim_hard) {
-		if(context->thread_running)
-			for(;;);
+		if(context->escape) {
+			fprintf(stderr, "-- ERROR: Hard memory limit reached.\n");
+			lisp_atomic_cas(&context->eval_plz_die, 0, LISP_ASYNC_MEMLIMIT);
+			lisp_abort_eval(context);
+		}
 		return NULL;
 	} else if(!(context->warned) && (newsize > context->mem_lim_soft)) {
 		if(context->mem_verbosity == LISP_GC_VERBOSE)
@@ -85,73 +146,100 @@ lisp_data_t *lisp_dalloc(const size_t size, const char *file, const int line, li
 	} else if((context->warned) && (newsize < context->mem_lim_soft))
 		context->warned = 0;
 
-	memory = malloc(size);
+	if((newentry = malloc(ENTRY_SIZE + size)) == NULL)
+		return NULL;
+	if(add_to_set(memory_of(newentry), context) == -1) {
+		free(newentry);
+		return NULL;
+	}
 
-	if(memory) {
-		if((newentry = make_entry(memory, file, line, size))) {
-			addtolist(newentry, context);
+	newentry->owner = context;
+	newentry->file = (char*)file;
+	newentry->line = line;
+	newentry->size = size;
+	newentry->serial = ++context->n_allocs;
+	newentry->mark = 0;
+	addtolist(newentry, context);
 
-			context->mem_allocated += size;
-			if(context->mem_allocated > context->n_bytes_peak)
-				context->n_bytes_peak = context->mem_allocated;
+	context->mem_allocated += size;
+	if(context->mem_allocated > context->n_bytes_peak)
+		context->n_bytes_peak = context->mem_allocated;
 
-			context->n_allocs++;
-		} else {
-			fprintf(stderr, "ERROR: malloc() failed for new memory list entry.\n");
-			free(memory);
-			return NULL;
-		}
-	}
-	return memory;
+	return memory_of(newentry);
 }
 
 /* GARBAGE COLLECTOR */
 
-static int delfromlist(const void *memory, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *last = NULL;
+static alloclist_t *find_in_list(const void *memory, lisp_ctx_t *context) {
+	return is_allocated(memory, context) ? entry_of(memory) : NULL;
+}
 
-	if(!memory)
-		return 0;
+/* A frozen base does not allocate any more, so its set can be read from any
+ * thread. */
+static int is_base_entry(const void *memory, const lisp_ctx_t *context) {
+	const lisp_ctx_t *base;
 
-	while(current) {
-		if((void*)current->memory < (void*)memory) {
-			 last = current;
-			 current = current->next;
-		} else {
-			if(last)
-				last->next = current->next;
-			else
-				context->alloc_list = current->next;
-
-			context->mem_allocated -= current->size;
-			context->mem_list_entries--;
-			free(current);
+	for(base = context->base; base; base = base->base)
+		if(is_allocated(memory, base))
 			return 1;
-		}		
-	}
 
 	return 0;
 }
 
+int lisp_is_immutable(const lisp_data_t *data, const lisp_ctx_t *context) {
+	return is_base_entry(data, context);
+}
+
+static void delfromlist(alloclist_t *entry, lisp_ctx_t *context) {
+	if(entry->prev)
+		entry->prev->next = entry->next;
+	else
+		context->alloc_list = entry->next;
+	if(entry->next)
+		entry->next->prev = entry->prev;
+
+	remove_from_set(memory_of(entry), context);
+	entry->owner = NULL;
+	context->mem_allocated -= entry->size;
+	context->mem_list_entries--;
+}
+
+static void free_entry(alloclist_t *entry, lisp_ctx_t *context) {
+	lisp_data_t *in = memory_of(entry);
+
+	delfromlist(entry, context);
+
+	if(in->type == lisp_type_string)
+		free(in->string);
+	if(in->type == lisp_type_symbol)
+		free(in->symbol);
+	if(in->type == lisp_type_error)
+		free(in->error);
+	if(in->type == lisp_type_pair)
+		free(in->pair);
+	if(in->type == lisp_type_lazy)
+		free(in->lazy);
+	if(in->type == lisp_type_strbuf)
+		free(in->strbuf->data);
+	if(in->type == lisp_type_hashtable) {
+		free(in->hashtable->slots);
+		free(in->hashtable->old);
+	}
+
+	free(entry);
+	context->n_frees++;
+}
+
 void lisp_free_data(lisp_data_t *in, lisp_ctx_t *context) {
+	alloclist_t *entry;
+
 	if(!in)
 		return;
 
-	if(delfromlist(in, context)) {
-		if(in->type == lisp_type_string)
-			free(in->string);
-		if(in->type == lisp_type_symbol)
-			free(in->symbol);
-		if(in->type == lisp_type_error)
-			free(in->error);
-		if(in->type == lisp_type_pair)
-			free(in->pair);
-
-		free(in);
-		context->n_frees++;
-	} else {
+	if((entry = find_in_list(in, context)))
+		free_entry(entry, context);
+	else
 		fprintf(stderr, "-- WARNING: Called free() on unknown pointer.\n");
-	}
 }
 
 static void clear_mark(lisp_ctx_t *context) {
@@ -163,45 +251,124 @@ static void clear_mark(lisp_ctx_t *context) {
 	}
 }
 
-static alloclist_t *find_in_list(const void *memory, lisp_ctx_t *context) {
-	alloclist_t *current =  context->alloc_list;
+/* Data of a base context counts as reachable, it is never collected from
+ * here. */
+static int is_marked(const lisp_data_t *data, lisp_ctx_t *context) {
+	alloclist_t *entry;
 
-	if(!memory)
-		return NULL;
+	if(!data || ((entry = find_in_list(data, context)) == NULL))
+		return 1;
+	return entry->mark;
+}
 
-	while(current) {
-		if(current->memory == memory)
-			return current;
-		current = current->next;
+static void mark(lisp_data_t *start, lisp_ctx_t *context);
+
+static void mark_children(lisp_data_t *start, lisp_ctx_t *context) {
+	lisp_data_t *key, *value;
+	size_t i;
+
+	/* Not lisp_cdr(), collecting must not read lazy tails. */
+	if(start->type == lisp_type_pair) {
+		mark(start->pair->l, context);
+		mark(start->pair->r, context);
+	} else if(start->type == lisp_type_vector) {
+		for(i = 0; i < start->vector->length; i++)
+			mark(start->vector->items[i], context);
+	} else if(start->type == lisp_type_weakbox) {
+		start->weakbox->next_weak = context->the_weak;
+		context->the_weak = start;
+	} else if(start->type == lisp_type_hashtable) {
+		/* Values under weak keys are left to mark_ephemerons(). */
+		if(start->hashtable->weak) {
+			start->hashtable->next_weak = context->the_weak;
+			context->the_weak = start;
+		}
+		i = 0;
+		while(lisp_hashtable_next(start, &i, &key, &value)) {
+			if(!(start->hashtable->weak & LISP_HASH_WEAK_KEYS))
+				mark(key, context);
+			if(!(start->hashtable->weak & LISP_HASH_WEAK_VALUES) && (!(start->hashtable->weak & LISP_HASH_WEAK_KEYS) || is_marked(key, context)))
+				mark(value, context);
+		}
 	}
-
-	return NULL;
 }
 
+/* Lists are followed along their cdrs in a loop, only the cars recurse, so
+ * long lists don't depend on the compiler turning the call into a jump. */
 static void mark(lisp_data_t *start, lisp_ctx_t *context) {
 	alloclist_t *list_entry;
-	lisp_data_t *head, *tail;
 
-	if(!start)
-		return;
+	while(start) {
+		list_entry = find_in_list(start, context);
+
+		if(!list_entry) {
+			/* The frozen base heap is never collected through a derived context. */
+			if(!is_base_entry(start, context))
+				fprintf(stderr, "ERROR: %p not found in memory list.\n", start);
+			return;
+		}
 
-	list_entry = find_in_list(start, context);
+		if(list_entry->mark)
+			return;
+		list_entry->mark = 1;
 
-	if(!list_entry) {
-		fprintf(stderr, "ERROR: %p not found in memory list.\n", start);
-		return;
+		if(start->type != lisp_type_pair) {
+			mark_children(start, context);
+			return;
+		}
+		mark(start->pair->l, context);
+		start = start->pair->r;
 	}
+}
 
-	if(list_entry->mark == 0) {
-		list_entry->mark = 1;
-		
-		if(start->type == lisp_type_pair) {
-			head = lisp_car(start);
-			tail = lisp_cdr(start);
-			mark(head, context);
-			mark(tail, context);
+static lisp_data_t *next_weak(const lisp_data_t *data) {
+	return (data->type == lisp_type_hashtable) ? data->hashtable->next_weak : data->weakbox->next_weak;
+}
+
+/* A value in a table with weak keys is reachable once its key is, and the
+ * key may only have been marked after the table was. Marking such values
+ * can reach further keys, so this goes on until nothing changes. */
+static void mark_ephemerons(lisp_ctx_t *context) {
+	lisp_data_t *current, *key, *value;
+	int changed = 1;
+	size_t pos;
+
+	while(changed) {
+		changed = 0;
+		for(current = context->the_weak; current; current = next_weak(current)) {
+			if((current->type != lisp_type_hashtable) || (current->hashtable->weak != LISP_HASH_WEAK_KEYS))
+				continue;
+			pos = 0;
+			while(lisp_hashtable_next(current, &pos, &key, &value)) {
+				if(is_marked(key, context) && !is_marked(value, context)) {
+					mark(value, context);
+					changed = 1;
+				}
+			}
 		}
-	} 
+	}
+}
+
+/* Drops what only weak references still point to, before sweep() frees it.
+ * With prune unset only the list of weak data is taken apart. */
+static void clear_weak(const int prune, lisp_ctx_t *context) {
+	lisp_data_t *current = context->the_weak, *next;
+
+	for(; current; current = next) {
+		next = next_weak(current);
+		if(current->type == lisp_type_hashtable) {
+			if(prune)
+				lisp_hashtable_prune(current, is_marked, context);
+			current->hashtable->next_weak = NULL;
+		} else {
+			if(prune && !is_marked(current->weakbox->value, context)) {
+				current->weakbox->value = NULL;
+				current->weakbox->broken = 1;
+			}
+			current->weakbox->next_weak = NULL;
+		}
+	}
+	context->the_weak = NULL;
 }
 
 static void sweep(const int req_mark, lisp_ctx_t *context) {
@@ -210,28 +377,212 @@ static void sweep(const int req_mark, lisp_ctx_t *context) {
 	while(current) {
 		buf = current->next;
 		if(current->mark == req_mark)
-			lisp_free_data(current->memory, context);		
+			free_entry(current, context);
 		current = buf;
 	}
 }
 
+/* Refuses to run while a thread the host left behind may still use the
+ * context. */
 size_t lisp_gc(const int force, lisp_ctx_t *context) {
 	size_t old_mem = context->mem_allocated;
+	lisp_root_t *root;
+
+	if(context->frozen || lisp_context_busy(context))
+		return 0;
 
 	if((force == LISP_GC_FORCE) || (context->mem_allocated > context->mem_lim_soft)) {
 		clear_mark(context);
 		mark(context->the_global_environment, context);
+		for(root = context->the_roots; root; root = root->next)
+			mark((lisp_data_t*)root->data, context);
+		mark_ephemerons(context);
+		clear_weak(1, context);
 		sweep(0, context);
 	}
 
 	return old_mem - context->mem_allocated;
 }
 
+/* Collects only what was allocated after lisp_heap_serial() returned since,
+ * and may run in the middle of an evaluation. Everything older counts as
+ * reachable and its references are roots, so pointers the interrupted C code
+ * still holds stay valid as long as they all predate since. */
+size_t lisp_gc_since(const size_t since, lisp_ctx_t *context) {
+	size_t old_mem = context->mem_allocated;
+	alloclist_t *current;
+	lisp_root_t *root;
+
+	if(context->frozen)
+		return 0;
+
+	for(current = context->alloc_list; current; current = current->next)
+		current->mark = (current->serial <= since);
+	for(current = context->alloc_list; current; current = current->next)
+		if(current->serial <= since)
+			mark_children(memory_of(current), context);
+	for(root = context->the_roots; root; root = root->next)
+		mark((lisp_data_t*)root->data, context);
+	mark_ephemerons(context);
+	clear_weak(1, context);
+	sweep(0, context);
+
+	return old_mem - context->mem_allocated;
+}
+
+size_t lisp_heap_serial(const lisp_ctx_t *context) {
+	return context->n_allocs;
+}
+
+/* LAZY TAILS */
+
+static int has_lazy_tail(const lisp_data_t *data) {
+	return (data->type == lisp_type_pair) && data->pair->r && (data->pair->r->type == lisp_type_lazy);
+}
+
+/* Reads every lazy list tail the context holds, so that nothing is left that
+ * would allocate in it after it was frozen. A pass reads the whole lists the
+ * tails it finds belong to, lists nested in them are found by the next one. */
+void lisp_force_all_lazy(lisp_ctx_t *context) {
+	lisp_data_t **pairs = NULL, **newpairs, *pair;
+	size_t n_pairs, size = 0, i;
+	alloclist_t *current;
+
+	do {
+		n_pairs = 0;
+		for(current = context->alloc_list; current; current = current->next) {
+			if(!has_lazy_tail(memory_of(current)))
+				continue;
+			if(n_pairs == size) {
+				if((newpairs = realloc(pairs, (size ? 2 * size : 64) * sizeof(lisp_data_t*))) == NULL)
+					break;
+				pairs = newpairs;
+				size = size ? 2 * size : 64;
+			}
+			pairs[n_pairs++] = memory_of(current);
+		}
+
+		for(i = 0; i < n_pairs; i++)
+			for(pair = pairs[i]; pair && (pair->type == lisp_type_pair); pair = lisp_cdr(pair));
+	} while(n_pairs);
+
+	free(pairs);
+}
+
+/* ROOTS */
+
+/* Keeps data alive through lisp_gc() until the root is removed again. */
+lisp_root_t *lisp_add_root(const lisp_data_t *data, lisp_ctx_t *context) {
+	lisp_root_t *out;
+
+	if((out = malloc(sizeof(lisp_root_t))) == NULL)
+		return NULL;
+
+	out->data = data;
+	out->prev = NULL;
+	out->next = context->the_roots;
+	if(context->the_roots)
+		context->the_roots->prev = out;
+	context->the_roots = out;
+
+	return out;
+}
+
+void lisp_remove_root(lisp_root_t *root, lisp_ctx_t *context) {
+	if(!root)
+		return;
+
+	if(root->prev)
+		root->prev->next = root->next;
+	else
+		context->the_roots = root->next;
+	if(root->next)
+		root->next->prev = root->prev;
+
+	free(root);
+}
+
+void lisp_free_roots(lisp_ctx_t *context) {
+	while(context->the_roots)
+		lisp_remove_root(context->the_roots, context);
+}
+
+/* SCRATCH */
+
+/* Memory that C code keeps across a call that may abort the evaluation, like
+ * lisp_apply() or the allocator. Where the abort lands everything registered
+ * after the mark taken there is freed, release() is run on it first. */
+
+typedef struct lisp_scratch_t {
+	void (*release)(void*);
+	size_t serial;
+	struct lisp_scratch_t *next;
+	struct lisp_scratch_t *prev;
+} lisp_scratch_t;
+
+#define SCRATCH_SIZE		((sizeof(lisp_scratch_t) + 15) & ~(size_t)15)
+#define scratch_of(memory)	((lisp_scratch_t*)((char*)(memory) - SCRATCH_SIZE))
+#define memory_of_scratch(s)	((void*)((char*)(s) + SCRATCH_SIZE))
+
+void *lisp_scratch(const size_t size, void (*release)(void*), lisp_ctx_t *context) {
+	lisp_scratch_t *s;
+
+	if((s = malloc(SCRATCH_SIZE + size)) == NULL)
+		return NULL;
+
+	s->release = release;
+	s->serial = ++context->n_scratch;
+	s->prev = NULL;
+	s->next = context->the_scratch;
+	if(s->next)
+		s->next->prev = s;
+	context->the_scratch = s;
+
+	return memory_of_scratch(s);
+}
+
+/* Frees without calling release(), the caller is done with it. */
+void lisp_unscratch(void *memory, lisp_ctx_t *context) {
+	lisp_scratch_t *s;
+
+	if(memory == NULL)
+		return;
+
+	s = scratch_of(memory);
+	if(s->prev)
+		s->prev->next = s->next;
+	else
+		context->the_scratch = s->next;
+	if(s->next)
+		s->next->prev = s->prev;
+	free(s);
+}
+
+size_t lisp_scratch_mark(const lisp_ctx_t *context) {
+	return context->n_scratch;
+}
+
+/* Newer blocks are at the front of the list. */
+void lisp_free_scratch(const size_t mark, lisp_ctx_t *context) {
+	lisp_scratch_t *s;
+
+	while((s = context->the_scratch) != NULL && s->serial > mark) {
+		context->the_scratch = s->next;
+		if(s->next)
+			s->next->prev = NULL;
+		if(s->release)
+			s->release(memory_of_scratch(s));
+		free(s);
+	}
+}
+
 /* FREE */
 
 void lisp_free_data_rec(lisp_data_t *in, lisp_ctx_t *context) {
 	clear_mark(context);
 	mark(in, context);
+	mark_ephemerons(context);
+	clear_weak(0, context);
 	sweep(1, context);
 }
 
@@ -0,0 +1,761 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define LISP_NUMVEC_AVX2
+#endif
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/mem.h"
+#include "libisp/thread.h"
+
+/* f64vectors and s64vectors keep their elements unboxed, so the operations
+ * on whole vectors below run over plain arrays. Each one has a scalar kernel
+ * and, on x86-64, an AVX2 kernel that is picked when the processor has it.
+ * Sums are added up in several lanes there, which can change the last bits of
+ * a floating point result. Integers wrap around at 64 bits. */
+
+typedef enum op_t {
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MIN, OP_MAX,
+	OP_NEG, OP_ABS, OP_SQRT, OP_SQUARE, OP_FLOOR, OP_CEILING, OP_TRUNCATE
+} op_t;
+
+#define wrap(x)		((int64_t)(uint64_t)(x))
+
+/* SCALAR KERNELS */
+
+/* b advances by bstep, which is 0 to use the same b for every element. */
+static void f64_zip_scalar(const op_t op, const double *a, const double *b, const size_t bstep, double *out, const size_t n) {
+	size_t i;
+
+	switch(op) {
+		case OP_ADD: for(i = 0; i < n; i++) out[i] = a[i] + b[i * bstep]; break;
+		case OP_SUB: for(i = 0; i < n; i++) out[i] = a[i] - b[i * bstep]; break;
+		case OP_MUL: for(i = 0; i < n; i++) out[i] = a[i] * b[i * bstep]; break;
+		case OP_DIV: for(i = 0; i < n; i++) out[i] = a[i] / b[i * bstep]; break;
+		case OP_MIN: for(i = 0; i < n; i++) out[i] = (a[i] < b[i * bstep]) ? a[i] : b[i * bstep]; break;
+		case OP_MAX: for(i = 0; i < n; i++) out[i] = (a[i] > b[i * bstep]) ? a[i] : b[i * bstep]; break;
+		default: break;
+	}
+}
+
+static void f64_unary_scalar(const op_t op, const double *a, double *out, const size_t n) {
+	size_t i;
+
+	switch(op) {
+		case OP_NEG: for(i = 0; i < n; i++) out[i] = -a[i]; break;
+		case OP_ABS: for(i = 0; i < n; i++) out[i] = fabs(a[i]); break;
+		case OP_SQRT: for(i = 0; i < n; i++) out[i] = sqrt(a[i]); break;
+		case OP_SQUARE: for(i = 0; i < n; i++) out[i] = a[i] * a[i]; break;
+		case OP_FLOOR: for(i = 0; i < n; i++) out[i] = floor(a[i]); break;
+		case OP_CEILING: for(i = 0; i < n; i++) out[i] = ceil(a[i]); break;
+		case OP_TRUNCATE: for(i = 0; i < n; i++) out[i] = trunc(a[i]); break;
+		default: break;
+	}
+}
+
+static double f64_combine(const op_t op, const double acc, const double x) {
+	switch(op) {
+		case OP_MIN: return (x < acc) ? x : acc;
+		case OP_MAX: return (x > acc) ? x : acc;
+		default: return acc + x;
+	}
+}
+
+/* OP_ADD, OP_MIN or OP_MAX over at least one element for the last two. */
+static double f64_reduce_scalar(const op_t op, const double *a, const size_t n) {
+	double out = (op == OP_ADD) ? 0.0 : a[0];
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		out = f64_combine(op, out, a[i]);
+	return out;
+}
+
+static double f64_dot_scalar(const double *a, const double *b, const size_t n) {
+	double out = 0.0;
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		out += a[i] * b[i];
+	return out;
+}
+
+static void s64_zip_scalar(const op_t op, const int64_t *a, const int64_t *b, const size_t bstep, int64_t *out, const size_t n) {
+	size_t i;
+
+	switch(op) {
+		case OP_ADD: for(i = 0; i < n; i++) out[i] = wrap((uint64_t)a[i] + (uint64_t)b[i * bstep]); break;
+		case OP_SUB: for(i = 0; i < n; i++) out[i] = wrap((uint64_t)a[i] - (uint64_t)b[i * bstep]); break;
+		case OP_MUL: for(i = 0; i < n; i++) out[i] = wrap((uint64_t)a[i] * (uint64_t)b[i * bstep]); break;
+		case OP_MIN: for(i = 0; i < n; i++) out[i] = (a[i] < b[i * bstep]) ? a[i] : b[i * bstep]; break;
+		case OP_MAX: for(i = 0; i < n; i++) out[i] = (a[i] > b[i * bstep]) ? a[i] : b[i * bstep]; break;
+		default: break;
+	}
+}
+
+/* Rounding leaves integers as they are. */
+static void s64_unary_scalar(const op_t op, const int64_t *a, int64_t *out, const size_t n) {
+	size_t i;
+
+	switch(op) {
+		case OP_NEG: for(i = 0; i < n; i++) out[i] = wrap(0 - (uint64_t)a[i]); break;
+		case OP_ABS: for(i = 0; i < n; i++) out[i] = (a[i] < 0) ? wrap(0 - (uint64_t)a[i]) : a[i]; break;
+		case OP_SQUARE: for(i = 0; i < n; i++) out[i] = wrap((uint64_t)a[i] * (uint64_t)a[i]); break;
+		case OP_FLOOR:
+		case OP_CEILING:
+		case OP_TRUNCATE: memcpy(out, a, n * sizeof(int64_t)); break;
+		default: break;
+	}
+}
+
+static int64_t s64_combine(const op_t op, const int64_t acc, const int64_t x) {
+	switch(op) {
+		case OP_MIN: return (x < acc) ? x : acc;
+		case OP_MAX: return (x > acc) ? x : acc;
+		default: return wrap((uint64_t)acc + (uint64_t)x);
+	}
+}
+
+static int64_t s64_reduce_scalar(const op_t op, const int64_t *a, const size_t n) {
+	int64_t out = (op == OP_ADD) ? 0 : a[0];
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		out = s64_combine(op, out, a[i]);
+	return out;
+}
+
+static int64_t s64_dot_scalar(const int64_t *a, const int64_t *b, const size_t n) {
+	uint64_t out = 0;
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		out += (uint64_t)a[i] * (uint64_t)b[i];
+	return wrap(out);
+}
+
+/* AVX2 KERNELS */
+
+/* Four elements at a time, the rest goes to the scalar kernel. Loads are
+ * unaligned, the elements are only 16 byte aligned. */
+
+#ifdef LISP_NUMVEC_AVX2
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2
+
+static int has_avx2(void) {
+	int regs[4];
+
+	__cpuid(regs, 0);
+	if(regs[0] < 7)
+		return 0;
+	__cpuid(regs, 1);
+	if(!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)) || ((_xgetbv(0) & 6) != 6))
+		return 0;
+	__cpuidex(regs, 7, 0);
+	return (regs[1] >> 5) & 1;
+}
+#else
+#define AVX2		__attribute__((target("avx2")))
+
+static int has_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#define F64_ZIP(expr) \
+	for(; i + 4 <= n; i += 4) { \
+		x = _mm256_loadu_pd(a + i); \
+		y = bstep ? _mm256_loadu_pd(b + i) : k; \
+		_mm256_storeu_pd(out + i, expr); \
+	}
+
+AVX2 static void f64_zip_avx2(const op_t op, const double *a, const double *b, const size_t bstep, double *out, const size_t n) {
+	__m256d x, y, k = _mm256_set1_pd(bstep ? 0.0 : *b);
+	size_t i = 0;
+
+	switch(op) {
+		case OP_ADD: F64_ZIP(_mm256_add_pd(x, y)); break;
+		case OP_SUB: F64_ZIP(_mm256_sub_pd(x, y)); break;
+		case OP_MUL: F64_ZIP(_mm256_mul_pd(x, y)); break;
+		case OP_DIV: F64_ZIP(_mm256_div_pd(x, y)); break;
+		case OP_MIN: F64_ZIP(_mm256_min_pd(x, y)); break;
+		case OP_MAX: F64_ZIP(_mm256_max_pd(x, y)); break;
+		default: break;
+	}
+
+	f64_zip_scalar(op, a + i, b + i * bstep, bstep, out + i, n - i);
+}
+
+#define F64_UNARY(expr) \
+	for(; i + 4 <= n; i += 4) { \
+		x = _mm256_loadu_pd(a + i); \
+		_mm256_storeu_pd(out + i, expr); \
+	}
+
+AVX2 static void f64_unary_avx2(const op_t op, const double *a, double *out, const size_t n) {
+	__m256d x, sign = _mm256_set1_pd(-0.0);
+	size_t i = 0;
+
+	switch(op) {
+		case OP_NEG: F64_UNARY(_mm256_xor_pd(x, sign)); break;
+		case OP_ABS: F64_UNARY(_mm256_andnot_pd(sign, x)); break;
+		case OP_SQRT: F64_UNARY(_mm256_sqrt_pd(x)); break;
+		case OP_SQUARE: F64_UNARY(_mm256_mul_pd(x, x)); break;
+		case OP_FLOOR: F64_UNARY(_mm256_round_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)); break;
+		case OP_CEILING: F64_UNARY(_mm256_round_pd(x, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC)); break;
+		case OP_TRUNCATE: F64_UNARY(_mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)); break;
+		default: break;
+	}
+
+	f64_unary_scalar(op, a + i, out + i, n - i);
+}
+
+AVX2 static __m256d f64_combine_avx2(const op_t op, const __m256d acc, const __m256d x) {
+	switch(op) {
+		case OP_MIN: return _mm256_min_pd(x, acc);
+		case OP_MAX: return _mm256_max_pd(x, acc);
+		default: return _mm256_add_pd(acc, x);
+	}
+}
+
+/* Two sets of lanes, so one addition does not have to wait for the other. */
+AVX2 static double f64_reduce_avx2(const op_t op, const double *a, const size_t n) {
+	__m256d acc0, acc1;
+	double lanes[4], out;
+	size_t i;
+
+	if(n < 8)
+		return f64_reduce_scalar(op, a, n);
+
+	acc0 = _mm256_loadu_pd(a);
+	acc1 = _mm256_loadu_pd(a + 4);
+	for(i = 8; i + 8 <= n; i += 8) {
+		acc0 = f64_combine_avx2(op, acc0, _mm256_loadu_pd(a + i));
+		acc1 = f64_combine_avx2(op, acc1, _mm256_loadu_pd(a + i + 4));
+	}
+	_mm256_storeu_pd(lanes, f64_combine_avx2(op, acc0, acc1));
+
+	out = f64_combine(op, f64_combine(op, lanes[0], lanes[1]), f64_combine(op, lanes[2], lanes[3]));
+	for(; i < n; i++)
+		out = f64_combine(op, out, a[i]);
+	return out;
+}
+
+AVX2 static double f64_dot_avx2(const double *a, const double *b, const size_t n) {
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	double lanes[4], out;
+	size_t i;
+
+	for(i = 0; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+	}
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+	out = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	return out + f64_dot_scalar(a + i, b + i, n - i);
+}
+
+#define S64_ZIP(expr) \
+	for(; i + 4 <= n; i += 4) { \
+		x = _mm256_loadu_si256((const __m256i*)(a + i)); \
+		y = bstep ? _mm256_loadu_si256((const __m256i*)(b + i)) : k; \
+		_mm256_storeu_si256((__m256i*)(out + i), expr); \
+	}
+
+/* There is no 64 bit multiplication in AVX2, that one stays scalar. */
+AVX2 static void s64_zip_avx2(const op_t op, const int64_t *a, const int64_t *b, const size_t bstep, int64_t *out, const size_t n) {
+	__m256i x, y, k = _mm256_set1_epi64x(bstep ? 0 : *b);
+	size_t i = 0;
+
+	switch(op) {
+		case OP_ADD: S64_ZIP(_mm256_add_epi64(x, y)); break;
+		case OP_SUB: S64_ZIP(_mm256_sub_epi64(x, y)); break;
+		case OP_MIN: S64_ZIP(_mm256_blendv_epi8(y, x, _mm256_cmpgt_epi64(y, x))); break;
+		case OP_MAX: S64_ZIP(_mm256_blendv_epi8(y, x, _mm256_cmpgt_epi64(x, y))); break;
+		default: break;
+	}
+
+	s64_zip_scalar(op, a + i, b + i * bstep, bstep, out + i, n - i);
+}
+
+AVX2 static void s64_unary_avx2(const op_t op, const int64_t *a, int64_t *out, const size_t n) {
+	__m256i x, zero = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for(; (op == OP_NEG) && (i + 4 <= n); i += 4) {
+		x = _mm256_loadu_si256((const __m256i*)(a + i));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_sub_epi64(zero, x));
+	}
+	for(; (op == OP_ABS) && (i + 4 <= n); i += 4) {
+		x = _mm256_loadu_si256((const __m256i*)(a + i));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_blendv_epi8(x, _mm256_sub_epi64(zero, x), _mm256_cmpgt_epi64(zero, x)));
+	}
+
+	s64_unary_scalar(op, a + i, out + i, n - i);
+}
+
+AVX2 static __m256i s64_combine_avx2(const op_t op, const __m256i acc, const __m256i x) {
+	switch(op) {
+		case OP_MIN: return _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+		case OP_MAX: return _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+		default: return _mm256_add_epi64(acc, x);
+	}
+}
+
+AVX2 static int64_t s64_reduce_avx2(const op_t op, const int64_t *a, const size_t n) {
+	__m256i acc0, acc1;
+	int64_t lanes[4], out;
+	size_t i;
+
+	if(n < 8)
+		return s64_reduce_scalar(op, a, n);
+
+	acc0 = _mm256_loadu_si256((const __m256i*)a);
+	acc1 = _mm256_loadu_si256((const __m256i*)(a + 4));
+	for(i = 8; i + 8 <= n; i += 8) {
+		acc0 = s64_combine_avx2(op, acc0, _mm256_loadu_si256((const __m256i*)(a + i)));
+		acc1 = s64_combine_avx2(op, acc1, _mm256_loadu_si256((const __m256i*)(a + i + 4)));
+	}
+	_mm256_storeu_si256((__m256i*)lanes, s64_combine_avx2(op, acc0, acc1));
+
+	out = s64_combine(op, s64_combine(op, lanes[0], lanes[1]), s64_combine(op, lanes[2], lanes[3]));
+	for(; i < n; i++)
+		out = s64_combine(op, out, a[i]);
+	return out;
+}
+
+#endif
+
+/* DISPATCH */
+
+typedef struct kernels_t {
+	void (*f64_zip)(const op_t op, const double *a, const double *b, const size_t bstep, double *out, const size_t n);
+	void (*f64_unary)(const op_t op, const double *a, double *out, const size_t n);
+	double (*f64_reduce)(const op_t op, const double *a, const size_t n);
+	double (*f64_dot)(const double *a, const double *b, const size_t n);
+	void (*s64_zip)(const op_t op, const int64_t *a, const int64_t *b, const size_t bstep, int64_t *out, const size_t n);
+	void (*s64_unary)(const op_t op, const int64_t *a, int64_t *out, const size_t n);
+	int64_t (*s64_reduce)(const op_t op, const int64_t *a, const size_t n);
+	int64_t (*s64_dot)(const int64_t *a, const int64_t *b, const size_t n);
+} kernels_t;
+
+static const kernels_t scalar_kernels = {
+	f64_zip_scalar, f64_unary_scalar, f64_reduce_scalar, f64_dot_scalar,
+	s64_zip_scalar, s64_unary_scalar, s64_reduce_scalar, s64_dot_scalar
+};
+
+#ifdef LISP_NUMVEC_AVX2
+static const kernels_t avx2_kernels = {
+	f64_zip_avx2, f64_unary_avx2, f64_reduce_avx2, f64_dot_avx2,
+	s64_zip_avx2, s64_unary_avx2, s64_reduce_avx2, s64_dot_scalar
+};
+#endif
+
+/* 0 until the first call has looked at the processor, then 1 for the scalar
+ * kernels and 2 for AVX2. */
+static int simd_level = 0;
+
+static const kernels_t *kernels(void) {
+	int level = lisp_atomic_get(&simd_level);
+
+	if(!level) {
+		level = 1;
+#ifdef LISP_NUMVEC_AVX2
+		if(has_avx2())
+			level = 2;
+#endif
+		lisp_atomic_set(&simd_level, level);
+	}
+
+#ifdef LISP_NUMVEC_AVX2
+	if(level == 2)
+		return &avx2_kernels;
+#endif
+	return &scalar_kernels;
+}
+
+/* PRIMITIVES */
+
+/* The evaluator has checked the types against numvec_prims[], so argv[0]
+ * is an f64vector or an s64vector in all of these, and the other vectors
+ * are of the same type. */
+
+static double decimal_of(const lisp_data_t *num) { return (num->type == lisp_type_integer) ? (double)num->integer : num->decimal; }
+static int is_f64(const lisp_data_t *v) { return v->type == lisp_type_f64vector; }
+
+/* Integers that do not fit an int come back as decimals. */
+static lisp_data_t *make_s64(const int64_t val, lisp_ctx_t *context) {
+	if((val < INT_MIN) || (val > INT_MAX))
+		return lisp_make_decimal((double)val, context);
+	return lisp_make_int((int)val, context);
+}
+
+static lisp_data_t *numvec_error(const lisp_data_t *v, const char *what, lisp_ctx_t *context) {
+	char msg[96];
+
+	snprintf(msg, sizeof(msg), "%s%s", is_f64(v) ? "F64VECTOR-" : "S64VECTOR-", what);
+	return lisp_make_error(msg, context);
+}
+
+static lisp_data_t *make_like(const lisp_data_t *v, const size_t length, lisp_ctx_t *context) {
+	return is_f64(v) ? lisp_make_f64vector(length, context) : lisp_make_s64vector(length, context);
+}
+
+static lisp_data_t *load(const lisp_data_t *v, const size_t i, lisp_ctx_t *context) {
+	if(is_f64(v))
+		return lisp_make_decimal(v->numvector->f64[i], context);
+	return make_s64(v->numvector->s64[i], context);
+}
+
+/* num is a number, and an integer for an s64vector. */
+static void store(lisp_data_t *v, const size_t i, const lisp_data_t *num) {
+	if(is_f64(v))
+		v->numvector->f64[i] = decimal_of(num);
+	else
+		v->numvector->s64[i] = num->integer;
+}
+
+static int is_index(const lisp_data_t *v, const lisp_data_t *k) { return (k->integer >= 0) && ((size_t)k->integer < v->numvector->length); }
+
+static lisp_data_t *make_numvec(const lisp_type_t type, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	size_t i;
+
+	if(argv[0]->integer < 0)
+		return lisp_make_error((type == lisp_type_f64vector) ? "MAKE-F64VECTOR -- Negative length" : "MAKE-S64VECTOR -- Negative length", context);
+
+	out = (type == lisp_type_f64vector) ? lisp_make_f64vector((size_t)argv[0]->integer, context) : lisp_make_s64vector((size_t)argv[0]->integer, context);
+	if(!out)
+		return lisp_make_error((type == lisp_type_f64vector) ? "MAKE-F64VECTOR -- Out of memory" : "MAKE-S64VECTOR -- Out of memory", context);
+
+	for(i = 0; (argc > 1) && (i < out->numvector->length); i++)
+		store(out, i, argv[1]);
+	return out;
+}
+
+static lisp_data_t *prim_make_f64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_numvec(lisp_type_f64vector, argc, argv, context); }
+
+static lisp_data_t *prim_make_s64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return make_numvec(lisp_type_s64vector, argc, argv, context); }
+
+static lisp_data_t *numvec_of(lisp_data_t *out, const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	int i;
+
+	if(!out)
+		return lisp_make_error("VECTOR -- Out of memory", context);
+	for(i = 0; i < argc; i++)
+		store(out, i, argv[i]);
+	return out;
+}
+
+static lisp_data_t *prim_f64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return numvec_of(lisp_make_f64vector(argc, context), argc, argv, context); }
+
+static lisp_data_t *prim_s64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return numvec_of(lisp_make_s64vector(argc, context), argc, argv, context); }
+
+static lisp_data_t *prim_is_f64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_symbol((argv[0] && (argv[0]->type == lisp_type_f64vector)) ? "#t" : "#f", context);
+}
+
+static lisp_data_t *prim_is_s64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_symbol((argv[0] && (argv[0]->type == lisp_type_s64vector)) ? "#t" : "#f", context);
+}
+
+static lisp_data_t *prim_length(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return lisp_make_int((int)argv[0]->numvector->length, context);
+}
+
+static lisp_data_t *prim_ref(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(!is_index(argv[0], argv[1]))
+		return numvec_error(argv[0], "REF -- Index out of range", context);
+	return load(argv[0], argv[1]->integer, context);
+}
+
+static lisp_data_t *prim_set(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return numvec_error(argv[0], "SET! -- Immutable vector", context);
+	if(!is_index(argv[0], argv[1]))
+		return numvec_error(argv[0], "SET! -- Index out of range", context);
+
+	store(argv[0], argv[1]->integer, argv[2]);
+	return argv[0];
+}
+
+static lisp_data_t *prim_fill(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t i;
+
+	if(lisp_is_immutable(argv[0], context))
+		return numvec_error(argv[0], "FILL! -- Immutable vector", context);
+
+	for(i = 0; i < argv[0]->numvector->length; i++)
+		store(argv[0], i, argv[1]);
+	return argv[0];
+}
+
+static lisp_data_t *prim_to_list(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL;
+	size_t i;
+
+	for(i = argv[0]->numvector->length; i > 0; i--)
+		if((out = lisp_cons(load(argv[0], i - 1, context), out)) == NULL)
+			return numvec_error(argv[0], "->LIST -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *list_to_numvec(lisp_data_t *out, const lisp_data_t *list, const char *error, lisp_ctx_t *context) {
+	lisp_data_t *num;
+	size_t i;
+
+	for(i = 0; out && (i < out->numvector->length); i++, list = lisp_cdr(list)) {
+		num = lisp_car(list);
+		if(!num || ((num->type != lisp_type_integer) && ((num->type != lisp_type_decimal) || !is_f64(out))))
+			return lisp_make_error(error, context);
+		store(out, i, num);
+	}
+	return out;
+}
+
+static lisp_data_t *prim_list_to_f64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	long n = lisp_count_pairs(argv[0], context);
+
+	if(n < 0)
+		return lisp_make_error((n == LISP_LIST_CIRCULAR) ? "LIST->F64VECTOR -- Circular list" : "LIST->F64VECTOR -- Expected list", context);
+	return list_to_numvec(lisp_make_f64vector((size_t)n, context), argv[0], "LIST->F64VECTOR -- Expected number", context);
+}
+
+static lisp_data_t *prim_list_to_s64vector(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	long n = lisp_count_pairs(argv[0], context);
+
+	if(n < 0)
+		return lisp_make_error((n == LISP_LIST_CIRCULAR) ? "LIST->S64VECTOR -- Circular list" : "LIST->S64VECTOR -- Expected list", context);
+	return list_to_numvec(lisp_make_s64vector((size_t)n, context), argv[0], "LIST->S64VECTOR -- Expected integer", context);
+}
+
+/* Applies a built-in operation to every element of a, or of a and b, which
+ * have the same type and length. A null b with bstep 0 means the number k. */
+static lisp_data_t *zip(const op_t op, const lisp_data_t *a, const lisp_data_t *b, const lisp_data_t *k, lisp_ctx_t *context) {
+	size_t n = a->numvector->length;
+	double dk;
+	int64_t ik;
+	lisp_data_t *out;
+
+	if(!(out = make_like(a, n, context)))
+		return numvec_error(a, "MAP -- Out of memory", context);
+
+	if(is_f64(a)) {
+		dk = k ? decimal_of(k) : 0.0;
+		kernels()->f64_zip(op, a->numvector->f64, b ? b->numvector->f64 : &dk, b ? 1 : 0, out->numvector->f64, n);
+	} else {
+		ik = k ? k->integer : 0;
+		kernels()->s64_zip(op, a->numvector->s64, b ? b->numvector->s64 : &ik, b ? 1 : 0, out->numvector->s64, n);
+	}
+	return out;
+}
+
+static lisp_data_t *zip_checked(const op_t op, lisp_data_t *const *argv, const char *name, lisp_ctx_t *context) {
+	char what[48];
+
+	if(argv[0]->numvector->length != argv[1]->numvector->length) {
+		snprintf(what, sizeof(what), "%s -- Length mismatch", name);
+		return numvec_error(argv[0], what, context);
+	}
+	return zip(op, argv[0], argv[1], NULL, context);
+}
+
+static lisp_data_t *prim_add(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return zip_checked(OP_ADD, argv, "ADD", context); }
+
+static lisp_data_t *prim_sub(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return zip_checked(OP_SUB, argv, "SUB", context); }
+
+static lisp_data_t *prim_mul(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return zip_checked(OP_MUL, argv, "MUL", context); }
+
+static lisp_data_t *prim_scale(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return zip(OP_MUL, argv[0], NULL, argv[1], context); }
+
+static lisp_data_t *prim_dot(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t n = argv[0]->numvector->length;
+
+	if(n != argv[1]->numvector->length)
+		return numvec_error(argv[0], "DOT -- Length mismatch", context);
+	if(is_f64(argv[0]))
+		return lisp_make_decimal(kernels()->f64_dot(argv[0]->numvector->f64, argv[1]->numvector->f64, n), context);
+	return make_s64(kernels()->s64_dot(argv[0]->numvector->s64, argv[1]->numvector->s64, n), context);
+}
+
+static lisp_data_t *reduce(const op_t op, const lisp_data_t *v, lisp_ctx_t *context) {
+	if(is_f64(v))
+		return lisp_make_decimal(kernels()->f64_reduce(op, v->numvector->f64, v->numvector->length), context);
+	return make_s64(kernels()->s64_reduce(op, v->numvector->s64, v->numvector->length), context);
+}
+
+static lisp_data_t *prim_sum(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) { return reduce(OP_ADD, argv[0], context); }
+
+static lisp_data_t *prim_min(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(!argv[0]->numvector->length)
+		return numvec_error(argv[0], "MIN -- Empty vector", context);
+	return reduce(OP_MIN, argv[0], context);
+}
+
+static lisp_data_t *prim_max(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(!argv[0]->numvector->length)
+		return numvec_error(argv[0], "MAX -- Empty vector", context);
+	return reduce(OP_MAX, argv[0], context);
+}
+
+/* The built-in procedures map runs as a kernel, with the arity they are
+ * called with. Division and square roots of integers are not among them. */
+static const struct map_op_t {
+	const char *name;
+	int arity;
+	op_t op;
+	int s64;
+} map_ops[] = {
+	{ "+", 2, OP_ADD, 1 }, { "-", 2, OP_SUB, 1 }, { "*", 2, OP_MUL, 1 }, { "/", 2, OP_DIV, 0 },
+	{ "min", 2, OP_MIN, 1 }, { "max", 2, OP_MAX, 1 },
+	{ "-", 1, OP_NEG, 1 }, { "abs", 1, OP_ABS, 1 }, { "sqrt", 1, OP_SQRT, 0 }, { "square", 1, OP_SQUARE, 1 },
+	{ "floor", 1, OP_FLOOR, 1 }, { "ceiling", 1, OP_CEILING, 1 }, { "truncate", 1, OP_TRUNCATE, 1 }
+};
+
+static const struct map_op_t *find_map_op(const lisp_data_t *proc, const int arity, const int f64) {
+	const lisp_data_t *impl;
+	size_t i;
+
+	if(!proc || (proc->type != lisp_type_pair) || !lisp_car(proc) || (lisp_car(proc)->type != lisp_type_symbol) || strcmp(lisp_car(proc)->symbol, "primitive"))
+		return NULL;
+	if(!(impl = lisp_cadr(proc)) || (impl->type != lisp_type_vprim) || !lisp_is_builtin_prim(impl->def))
+		return NULL;
+
+	for(i = 0; i < sizeof(map_ops) / sizeof(map_ops[0]); i++)
+		if((map_ops[i].arity == arity) && (f64 || map_ops[i].s64) && !strcmp(map_ops[i].name, impl->def->name))
+			return &map_ops[i];
+	return NULL;
+}
+
+/* Any other procedure is called for each element with boxed numbers. */
+static lisp_data_t *map_apply(const lisp_data_t *proc, const int arity, lisp_data_t *const *vectors, lisp_ctx_t *context) {
+	lisp_data_t *out, *args[2], *val;
+	size_t i;
+	int j;
+
+	if(!(out = make_like(vectors[0], vectors[0]->numvector->length, context)))
+		return numvec_error(vectors[0], "MAP -- Out of memory", context);
+
+	for(i = 0; i < out->numvector->length; i++) {
+		for(j = 0; j < arity; j++)
+			args[j] = load(vectors[j], i, context);
+		val = lisp_apply(proc, arity, args, context);
+
+		if(val && (val->type == lisp_type_error))
+			return val;
+		if(!val || ((val->type != lisp_type_integer) && ((val->type != lisp_type_decimal) || !is_f64(out))))
+			return numvec_error(out, is_f64(out) ? "MAP -- Expected number" : "MAP -- Expected integer", context);
+		store(out, i, val);
+	}
+	return out;
+}
+
+/* (f64vector-map proc v) or (f64vector-map proc v w). */
+static lisp_data_t *prim_map(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	const lisp_data_t *v = argv[1];
+	const struct map_op_t *op;
+	lisp_data_t *out;
+
+	if((argc == 3) && (v->numvector->length != argv[2]->numvector->length))
+		return numvec_error(v, "MAP -- Length mismatch", context);
+
+	if(!(op = find_map_op(argv[0], argc - 1, is_f64(v))))
+		return map_apply(argv[0], argc - 1, argv + 1, context);
+	if(argc == 3)
+		return zip(op->op, v, argv[2], NULL, context);
+
+	if(!(out = make_like(v, v->numvector->length, context)))
+		return numvec_error(v, "MAP -- Out of memory", context);
+	if(is_f64(v))
+		kernels()->f64_unary(op->op, v->numvector->f64, out->numvector->f64, v->numvector->length);
+	else
+		kernels()->s64_unary(op->op, v->numvector->s64, out->numvector->s64, v->numvector->length);
+	return out;
+}
+
+#define NUMBER		LISP_ARG_NUMBER
+#define INTEGER		LISP_ARG(lisp_type_integer)
+#define LIST		LISP_ARG_LIST
+#define F64			LISP_ARG(lisp_type_f64vector)
+#define S64			LISP_ARG(lisp_type_s64vector)
+#define ANY			LISP_ARG_ANY
+#define PURE		LISP_PRIM_PURE
+
+static const lisp_prim_def_t numvec_prims[] = {
+	{ "make-f64vector", prim_make_f64vector, 1, 2, { INTEGER, NUMBER }, 0 },
+	{ "f64vector", prim_f64vector, 0, LISP_VARIADIC, LISP_ARGS_ALL(NUMBER), 0 },
+	{ "f64vector?", prim_is_f64vector, 1, 1, { ANY }, PURE },
+	{ "f64vector-length", prim_length, 1, 1, { F64 }, PURE },
+	{ "f64vector-ref", prim_ref, 2, 2, { F64, INTEGER }, 0 },
+	{ "f64vector-set!", prim_set, 3, 3, { F64, INTEGER, NUMBER }, 0 },
+	{ "f64vector-fill!", prim_fill, 2, 2, { F64, NUMBER }, 0 },
+	{ "f64vector->list", prim_to_list, 1, 1, { F64 }, 0 },
+	{ "list->f64vector", prim_list_to_f64vector, 1, 1, { LIST }, 0 },
+	{ "f64vector-add", prim_add, 2, 2, { F64, F64 }, 0 },
+	{ "f64vector-sub", prim_sub, 2, 2, { F64, F64 }, 0 },
+	{ "f64vector-mul", prim_mul, 2, 2, { F64, F64 }, 0 },
+	{ "f64vector-scale", prim_scale, 2, 2, { F64, NUMBER }, 0 },
+	{ "f64vector-dot", prim_dot, 2, 2, { F64, F64 }, 0 },
+	{ "f64vector-sum", prim_sum, 1, 1, { F64 }, 0 },
+	{ "f64vector-min", prim_min, 1, 1, { F64 }, 0 },
+	{ "f64vector-max", prim_max, 1, 1, { F64 }, 0 },
+	{ "f64vector-map", prim_map, 2, 3, { ANY, F64, F64 }, 0 },
+
+	{ "make-s64vector", prim_make_s64vector, 1, 2, { INTEGER, INTEGER }, 0 },
+	{ "s64vector", prim_s64vector, 0, LISP_VARIADIC, LISP_ARGS_ALL(INTEGER), 0 },
+	{ "s64vector?", prim_is_s64vector, 1, 1, { ANY }, PURE },
+	{ "s64vector-length", prim_length, 1, 1, { S64 }, PURE },
+	{ "s64vector-ref", prim_ref, 2, 2, { S64, INTEGER }, 0 },
+	{ "s64vector-set!", prim_set, 3, 3, { S64, INTEGER, INTEGER }, 0 },
+	{ "s64vector-fill!", prim_fill, 2, 2, { S64, INTEGER }, 0 },
+	{ "s64vector->list", prim_to_list, 1, 1, { S64 }, 0 },
+	{ "list->s64vector", prim_list_to_s64vector, 1, 1, { LIST }, 0 },
+	{ "s64vector-add", prim_add, 2, 2, { S64, S64 }, 0 },
+	{ "s64vector-sub", prim_sub, 2, 2, { S64, S64 }, 0 },
+	{ "s64vector-mul", prim_mul, 2, 2, { S64, S64 }, 0 },
+	{ "s64vector-scale", prim_scale, 2, 2, { S64, INTEGER }, 0 },
+	{ "s64vector-dot", prim_dot, 2, 2, { S64, S64 }, 0 },
+	{ "s64vector-sum", prim_sum, 1, 1, { S64 }, 0 },
+	{ "s64vector-min", prim_min, 1, 1, { S64 }, 0 },
+	{ "s64vector-max", prim_max, 1, 1, { S64 }, 0 },
+	{ "s64vector-map", prim_map, 2, 3, { ANY, S64, S64 }, 0 }
+};
+
+#undef NUMBER
+#undef INTEGER
+#undef LIST
+#undef F64
+#undef S64
+#undef ANY
+#undef PURE
+
+void lisp_add_numvec_prims(lisp_ctx_t *context) {
+	size_t i;
+
+	for(i = 0; i < sizeof(numvec_prims) / sizeof(numvec_prims[0]); i++)
+		lisp_add_vprim(&numvec_prims[i], context);
+}
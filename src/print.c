@@ -9,57 +9,620 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+#include <float.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "libisp/data.h"
 #include "libisp/eval.h"
+#include "libisp/print.h"
+
+#define SINK_CHUNK		4096
+
+struct lisp_sink_t {
+	lisp_buffer_t *buf;
+	FILE *fp;
+	int fd;
+
+	char chunk[SINK_CHUNK];
+	size_t len;
+	int error;
+};
+
+/* SINKS */
+
+/* Buffer sinks append straight to their buffer, the others collect output in
+ * a chunk and only write it out when it is full or flushed. */
+
+static void init_sink(lisp_sink_t *sink, lisp_buffer_t *buf, FILE *fp, const int fd) {
+	sink->buf = buf;
+	sink->fp = fp;
+	sink->fd = fd;
+	sink->len = 0;
+	sink->error = 0;
+}
+
+static lisp_sink_t *new_sink(lisp_buffer_t *buf, FILE *fp, const int fd) {
+	lisp_sink_t *out;
+
+	if((out = malloc(sizeof(lisp_sink_t))) == NULL)
+		return NULL;
+
+	init_sink(out, buf, fp, fd);
+	return out;
+}
+
+lisp_sink_t *lisp_make_buffer_sink(lisp_buffer_t *buf) { return new_sink(buf, NULL, -1); }
+lisp_sink_t *lisp_make_file_sink(FILE *fp) { return new_sink(NULL, fp, -1); }
+lisp_sink_t *lisp_make_fd_sink(const int fd) { return new_sink(NULL, NULL, fd); }
+
+static void write_out(lisp_sink_t *sink, const char *data, const size_t len) {
+	size_t done = 0;
+	int ret;
+
+	if(sink->fp) {
+		if(fwrite(data, 1, len, sink->fp) != len)
+			sink->error = 1;
+		return;
+	}
+
+	while(done < len) {
+		if((ret = write(sink->fd, data + done, (unsigned int)(len - done))) <= 0) {
+			sink->error = 1;
+			return;
+		}
+		done += ret;
+	}
+}
+
+static void flush_chunk(lisp_sink_t *sink) {
+	if(sink->len)
+		write_out(sink, sink->chunk, sink->len);
+	sink->len = 0;
+}
+
+static void put(lisp_sink_t *sink, const char *data, const size_t len) {
+	if(sink->buf) {
+		if(lisp_buffer_append(sink->buf, data, len) == -1)
+			sink->error = 1;
+		return;
+	}
+
+	if(sink->len + len > SINK_CHUNK) {
+		flush_chunk(sink);
+		if(len > SINK_CHUNK) {
+			write_out(sink, data, len);
+			return;
+		}
+	}
+
+	memcpy(sink->chunk + sink->len, data, len);
+	sink->len += len;
+}
+
+static void put_char(lisp_sink_t *sink, const char c) {
+	put(sink, &c, 1);
+}
+
+static void put_str(lisp_sink_t *sink, const char *str) {
+	put(sink, str, strlen(str));
+}
+
+int lisp_sink_put(lisp_sink_t *sink, const char *data, const size_t len) {
+	put(sink, data, len);
+	return sink->error ? -1 : 0;
+}
+
+int lisp_sink_flush(lisp_sink_t *sink) {
+	flush_chunk(sink);
+	if(sink->fp && fflush(sink->fp))
+		sink->error = 1;
+
+	return sink->error ? -1 : 0;
+}
+
+void lisp_destroy_sink(lisp_sink_t *sink) {
+	if(!sink)
+		return;
+
+	lisp_sink_flush(sink);
+	free(sink);
+}
+
+/* NUMBERS */
+
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Two digits per division, written back to front. */
+static size_t format_uint(uint64_t u, char *out) {
+	char buf[20], *pos = buf + sizeof(buf);
+
+	while(u >= 100) {
+		pos -= 2;
+		memcpy(pos, digit_pairs + 2 * (u % 100), 2);
+		u /= 100;
+	}
+	if(u >= 10) {
+		pos -= 2;
+		memcpy(pos, digit_pairs + 2 * u, 2);
+	} else {
+		*--pos = (char)('0' + u);
+	}
+
+	memcpy(out, pos, buf + sizeof(buf) - pos);
+	return buf + sizeof(buf) - pos;
+}
+
+static size_t format_s64(const int64_t i, char *out) {
+	if(i < 0) {
+		*out = '-';
+		return 1 + format_uint(0 - (uint64_t)i, out + 1);
+	}
+	return format_uint((uint64_t)i, out);
+}
+
+size_t lisp_format_int(const int i, char *out) {
+	if(i < 0) {
+		*out = '-';
+		return 1 + format_uint(0u - (unsigned int)i, out + 1);
+	}
+	return format_uint((unsigned int)i, out);
+}
+
+/* Most decimals in data are short, like prices or measurements. Below 2^50
+ * only one integer m can give back d as m / 10^k, so the first k for which
+ * the nearest one does has the fewest digits there are, and no digits have to
+ * be searched for. Both the multiplication and the check are a single
+ * correctly rounded operation. */
+static size_t format_short_decimal(const double d, char *out) {
+	char digits[20], *pos = out;
+	double scaled, magnitude = fabs(d);
+	uint64_t m;
+	size_t n;
+	int k;
+
+	if((magnitude < 1e-7) || (magnitude >= (double)((uint64_t)1 << 50)))
+		return 0;
+
+	for(k = 0; k <= 22; k++) {
+		if((scaled = magnitude * powers_of_ten[k]) >= (double)((uint64_t)1 << 50))
+			return 0;
+		m = (uint64_t)(scaled + 0.5);
+		if((double)m / powers_of_ten[k] == magnitude)
+			break;
+	}
+	if(k > 22)
+		return 0;
+
+	if(d < 0)
+		*pos++ = '-';
+
+	n = format_uint(m, digits);
+	if(!k) {
+		memcpy(pos, digits, n);
+		pos += n;
+		*pos++ = '.';
+		*pos++ = '0';
+	} else if(n > (size_t)k) {
+		memcpy(pos, digits, n - k);
+		pos += n - k;
+		*pos++ = '.';
+		memcpy(pos, digits + n - k, k);
+		pos += k;
+	} else {
+		*pos++ = '0';
+		*pos++ = '.';
+		memset(pos, '0', k - n);
+		pos += k - n;
+		memcpy(pos, digits, n);
+		pos += n;
+	}
+
+	return pos - out;
+}
+
+/* Writes the fewest digits that read back as the same double. Any decimal
+ * with up to 15 digits survives the trip through a normal double, so if a
+ * short one exists, rounding to 15 digits finds it, and the same goes for 16.
+ * Seventeen always do. Subnormals hold fewer digits and try every length. The
+ * result has a point or an exponent, so it reads back as a decimal and not as
+ * an integer. */
+size_t lisp_format_decimal(const double d, char *out) {
+	char buf[32], digits[20], *pos = out;
+	int precision, exponent, n = 0, i;
+	const char *c;
+
+	if(d != d)
+		return (size_t)sprintf(out, "nan");
+	if((d - d) != 0.0)
+		return (size_t)sprintf(out, (d < 0) ? "-inf" : "inf");
+	if((n = (int)format_short_decimal(d, out)) > 0)
+		return n;
+
+	for(precision = (fabs(d) < DBL_MIN) ? 0 : 14; precision < 16; precision++) {
+		sprintf(buf, "%.*e", precision, d);
+		if(strtod(buf, NULL) == d)
+			break;
+	}
+	if(precision == 16)
+		sprintf(buf, "%.16e", d);
+
+	c = buf;
+	if(*c == '-')
+		*pos++ = *c++;
+	for(; *c != 'e'; c++)
+		if(*c != '.')
+			digits[n++] = *c;
+	exponent = atoi(c + 1);
+
+	while((n > 1) && (digits[n - 1] == '0'))
+		n--;
+
+	if((exponent >= 21) || (exponent < -7)) {
+		*pos++ = digits[0];
+		if(n > 1) {
+			*pos++ = '.';
+			memcpy(pos, digits + 1, n - 1);
+			pos += n - 1;
+		}
+		*pos++ = 'e';
+		pos += lisp_format_int(exponent, pos);
+	} else if(exponent < 0) {
+		*pos++ = '0';
+		*pos++ = '.';
+		for(i = exponent + 1; i < 0; i++)
+			*pos++ = '0';
+		memcpy(pos, digits, n);
+		pos += n;
+	} else if(n <= exponent + 1) {
+		memcpy(pos, digits, n);
+		pos += n;
+		for(i = n; i <= exponent; i++)
+			*pos++ = '0';
+		*pos++ = '.';
+		*pos++ = '0';
+	} else {
+		memcpy(pos, digits, exponent + 1);
+		pos += exponent + 1;
+		*pos++ = '.';
+		memcpy(pos, digits + exponent + 1, n - exponent - 1);
+		pos += n - exponent - 1;
+	}
+
+	return pos - out;
+}
+
+/* PRINTER */
+
+static const char *opaque_name(const lisp_data_t *d, lisp_ctx_t *context) {
+	if(d == context->the_global_environment)
+		return "<env>";
+	if((d->type == lisp_type_pair) && is_compound_procedure(d))
+		return "<proc>";
+	return NULL;
+}
+
+static int is_open_list(const lisp_data_t *d, lisp_ctx_t *context) {
+	return d && (d->type == lisp_type_pair) && !opaque_name(d, context);
+}
+
+static int is_vector(const lisp_data_t *d) { return d && (d->type == lisp_type_vector); }
+
+/* Numeric vectors hold no references, so they print like atoms. */
+static void put_numvector(lisp_sink_t *sink, const lisp_data_t *d) {
+	char number[LISP_NUMBER_MAX];
+	size_t i;
+
+	put(sink, (d->type == lisp_type_f64vector) ? "#f64(" : "#s64(", 5);
+	for(i = 0; i < d->numvector->length; i++) {
+		if(i)
+			put_char(sink, ' ');
+		if(d->type == lisp_type_f64vector)
+			put(sink, number, lisp_format_decimal(d->numvector->f64[i], number));
+		else
+			put(sink, number, format_s64(d->numvector->s64[i], number));
+	}
+	put_char(sink, ')');
+}
+
+static void put_atom(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context) {
+	char number[LISP_NUMBER_MAX];
+	const char *name;
+
+	if(!d) {
+		put(sink, "()", 2);
+		return;
+	}
+	if((name = opaque_name(d, context)) != NULL) {
+		put_str(sink, name);
+		return;
+	}
+
+	switch(d->type) {
+		case lisp_type_prim:
+		case lisp_type_vprim: put(sink, "<proc>", 6); break;
+		case lisp_type_hashtable: put(sink, "<hash-table>", 12); break;
+		case lisp_type_weakbox: put(sink, "<weak-box>", 10); break;
+		case lisp_type_strbuf: put(sink, "<string-builder>", 16); break;
+		case lisp_type_integer: put(sink, number, lisp_format_int(d->integer, number)); break;
+		case lisp_type_decimal: put(sink, number, lisp_format_decimal(d->decimal, number)); break;
+		case lisp_type_symbol: put_str(sink, d->symbol); break;
+		case lisp_type_string:
+			put_char(sink, '"');
+			put_str(sink, d->string);
+			put_char(sink, '"');
+			break;
+		case lisp_type_error:
+			put(sink, "ERROR: '", 8);
+			put_str(sink, d->error);
+			put_char(sink, '\'');
+			break;
+		case lisp_type_f64vector:
+		case lisp_type_s64vector: put_numvector(sink, d); break;
+		case lisp_type_pair:
+		case lisp_type_lazy:
+		case lisp_type_vector:
+			break;
+	}
+}
+
+typedef struct print_stack_t {
+	const lisp_data_t **items;
+	size_t depth, size;
+} print_stack_t;
+
+static int push(print_stack_t *stack, const lisp_data_t *d) {
+	const lisp_data_t **newitems;
+	size_t newsize;
+
+	if(stack->depth == stack->size) {
+		newsize = stack->size ? 2 * stack->size : 16;
+		if((newitems = realloc((void*)stack->items, newsize * sizeof(lisp_data_t*))) == NULL)
+			return -1;
+		stack->items = newitems;
+		stack->size = newsize;
+	}
+
+	stack->items[stack->depth++] = d;
+	return 0;
+}
+
+/* Pairs and vectors that are reached more than once get a label. The map holds only
+ * those, with 0 until the label has been printed and 1 more than it after. */
+typedef struct labels_t {
+	lisp_ptrmap_t map;
+	uint32_t next;
+} labels_t;
+
+static int is_walked(const lisp_data_t *d, lisp_ctx_t *context) { return is_open_list(d, context) || is_vector(d); }
+
+/* Leaves the elements of a vector seen for the first time for later. */
+static int find_shared_vector(const lisp_data_t *d, lisp_ptrmap_t *seen, print_stack_t *pending, lisp_ctx_t *context) {
+	uint32_t shared;
+	size_t i;
+	int out;
+
+	if((out = lisp_ptrmap_intern(seen, d, 0, &shared)) == 1) {
+		*lisp_ptrmap_ref(seen, d) = 1;
+		return 0;
+	}
+
+	for(i = 0; (out == 0) && (i < d->vector->length); i++)
+		if(is_walked(d->vector->items[i], context))
+			out = push(pending, d->vector->items[i]);
+	return out;
+}
+
+/* Walks along the cdrs and leaves the cars for later, a pair or vector seen
+ * before is marked shared in seen and not walked again. */
+static int find_shared(const lisp_data_t *d, lisp_ptrmap_t *seen, lisp_ctx_t *context) {
+	print_stack_t pending = { NULL, 0, 0 };
+	uint32_t shared;
+	int out = 0;
+
+	while(!out) {
+		for(; is_open_list(d, context); d = lisp_cdr(d)) {
+			if((out = lisp_ptrmap_intern(seen, d, 0, &shared)) == 1) {
+				*lisp_ptrmap_ref(seen, d) = 1;
+				out = 0;
+				break;
+			}
+			if((out == -1) ||
+			   (is_walked(lisp_car(d), context) && ((out = push(&pending, lisp_car(d))) == -1)))
+				break;
+		}
+		if(!out && is_vector(d))
+			out = find_shared_vector(d, seen, &pending, context);
+
+		if(!pending.depth)
+			break;
+		d = pending.items[--pending.depth];
+	}
+
+	free((void*)pending.items);
+	return out;
+}
 
-static void print_data_rec(const lisp_data_t *d, int print_parens, lisp_ctx_t *context) {
-	lisp_data_t *head, *tail;
-
-	if(!d)
-		printf("()");
-	else if(d == context->the_global_environment)
-		printf("<env>");
-	else {
-		switch(d->type) {
-			case lisp_type_prim: printf("<proc>"); break;
-			case lisp_type_integer: printf("%d", d->integer); break;
-			case lisp_type_decimal: printf("%g", d->decimal); break;
-			case lisp_type_symbol: printf("%s", d->symbol); break;
-			case lisp_type_string: printf("\"%s\"", d->string); break;
-			case lisp_type_error: printf("ERROR: '%s'", d->error); break;
-			case lisp_type_pair:
-				if(is_compound_procedure(d)) {
-					printf("<proc>");
-					break;
-				}
-
-				if(print_parens)
-					printf("(");
-
-				head = lisp_car(d);
-				tail = lisp_cdr(d);
-
-				if(tail) {
-					print_data_rec(head, 1, context);
-					if(tail->type != lisp_type_pair) {
-						printf(" . ");
-						print_data_rec(tail, 1, context);
-					} else {
-						printf(" ");
-						print_data_rec(tail, 0, context);
-					}
-				} else {
-					print_data_rec(head, 1, context);
-				}
-
-				if(print_parens)
-					printf(")");
+static int keep_shared(lisp_ptrmap_t *shared, const lisp_ptrmap_t *seen) {
+	size_t i;
+
+	for(i = 0; i < seen->size; i++)
+		if(seen->entries[i].key && seen->entries[i].val && (lisp_ptrmap_insert(shared, seen->entries[i].key, 0) == -1))
+			return -1;
+	return 0;
+}
+
+static int is_shared(const lisp_data_t *d, const labels_t *labels) {
+	return labels && lisp_ptrmap_ref(&labels->map, d);
+}
+
+/* Writes the label of a shared datum. Returns 1 if it was printed before
+ * and the reference is all that is left to write. */
+static int put_label(lisp_sink_t *sink, const lisp_data_t *d, labels_t *labels) {
+	char number[LISP_NUMBER_MAX];
+	uint32_t *label;
+
+	if(!labels || !(label = lisp_ptrmap_ref(&labels->map, d)))
+		return 0;
+
+	put_char(sink, '#');
+	if(!*label) {
+		*label = 1 + labels->next++;
+		put(sink, number, lisp_format_int((int)(*label - 1), number));
+		put_char(sink, '=');
+		return 0;
+	}
+
+	put(sink, number, lisp_format_int((int)(*label - 1), number));
+	put_char(sink, '#');
+	return 1;
+}
+
+static int print_data(lisp_sink_t *sink, const lisp_data_t *d, labels_t *labels, lisp_ctx_t *context);
+
+/* Vectors are printed one call deeper for each one they are nested in, the
+ * lists in them still take no stack. */
+static void put_value(lisp_sink_t *sink, const lisp_data_t *d, labels_t *labels, lisp_ctx_t *context) {
+	size_t i;
+
+	if(!is_vector(d)) {
+		put_atom(sink, d, context);
+		return;
+	}
+	if(put_label(sink, d, labels))
+		return;
+
+	put(sink, "#(", 2);
+	for(i = 0; i < d->vector->length; i++) {
+		if(i)
+			put_char(sink, ' ');
+		print_data(sink, d->vector->items[i], labels, context);
+	}
+	put_char(sink, ')');
+}
+
+/* Lists are printed with a stack of the lists that are still open, so only
+ * nesting takes up room there and long lists take none. A shared tail ends
+ * the list it is in with " . " and is printed like a list of its own. */
+static int print_data(lisp_sink_t *sink, const lisp_data_t *d, labels_t *labels, lisp_ctx_t *context) {
+	print_stack_t open = { NULL, 0, 0 };
+	const lisp_data_t *tail;
+
+	while(1) {
+		while(is_open_list(d, context) && !put_label(sink, d, labels)) {
+			if(push(&open, d) == -1) {
+				sink->error = 1;
+				free((void*)open.items);
+				return -1;
+			}
+			put_char(sink, '(');
+			d = lisp_car(d);
 		}
+
+		if(!is_open_list(d, context))
+			put_value(sink, d, labels, context);
+
+		/* Move on to the next element of the innermost list that has one left,
+		 * closing the others on the way. */
+		for(; open.depth; open.depth--) {
+			tail = lisp_cdr(open.items[open.depth - 1]);
+			if(is_open_list(tail, context) && is_shared(tail, labels)) {
+				put(sink, " . ", 3);
+				open.items[open.depth - 1] = NULL;
+				d = tail;
+				break;
+			}
+			if(is_open_list(tail, context)) {
+				put_char(sink, ' ');
+				open.items[open.depth - 1] = tail;
+				d = lisp_car(tail);
+				break;
+			}
+			if(tail) {
+				if(tail->type == lisp_type_pair)
+					put_char(sink, ' ');
+				else
+					put(sink, " . ", 3);
+				put_value(sink, tail, labels, context);
+			}
+			put_char(sink, ')');
+		}
+
+		if(!open.depth)
+			break;
 	}
+
+	free((void*)open.items);
+	return sink->error ? -1 : 0;
+}
+
+int lisp_print_to(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context) {
+	return print_data(sink, d, NULL, context);
+}
+
+/* Finds the shared pairs first, which takes one pass over the cells, so the
+ * printing pass writes every one of them once at most. Only the shared pairs
+ * are kept for that pass, in a map small enough to stay in the cache, and
+ * without any it is the same as lisp_print_to(). */
+int lisp_print_shared_to(lisp_sink_t *sink, const lisp_data_t *d, lisp_ctx_t *context) {
+	lisp_ptrmap_t seen;
+	labels_t labels;
+	int out = -1;
+
+	labels.next = 0;
+	if(lisp_ptrmap_init(&seen, 256) == -1) {
+		sink->error = 1;
+		return -1;
+	}
+	if(lisp_ptrmap_init(&labels.map, 16) == -1) {
+		lisp_ptrmap_free(&seen);
+		sink->error = 1;
+		return -1;
+	}
+
+	if(find_shared(d, &seen, context) == 0)
+		out = keep_shared(&labels.map, &seen);
+	lisp_ptrmap_free(&seen);
+
+	if(out == 0)
+		out = print_data(sink, d, labels.map.used ? &labels : NULL, context);
+	else
+		sink->error = 1;
+
+	lisp_ptrmap_free(&labels.map);
+	return out;
 }
 
 void lisp_print(const lisp_data_t *d, lisp_ctx_t *context) {
-	print_data_rec(d, 1, context);
+	lisp_sink_t sink;
+
+	init_sink(&sink, NULL, stdout, -1);
+	lisp_print_to(&sink, d, context);
+	flush_chunk(&sink);
+}
+
+void lisp_print_shared(const lisp_data_t *d, lisp_ctx_t *context) {
+	lisp_sink_t sink;
+
+	init_sink(&sink, NULL, stdout, -1);
+	lisp_print_shared_to(&sink, d, context);
+	flush_chunk(&sink);
 }
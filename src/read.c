@@ -9,249 +9,945 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define LISP_READ_SSE2
+#endif
+
+#include <stdint.h>
 #include <stdio.h>
-
-#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "libisp/data.h"
-
-lisp_data_t *lisp_read(const char *exp, size_t *readto, int *error, lisp_ctx_t *context);
-
-static size_t skip_whitespace(const char *exp) {
-	const char *out = exp;
-
-	while(*out && isspace(*out))
-		out++;
-
-	return out - exp;
+#include "libisp/mem.h"
+#include "libisp/read.h"
+#include "libisp/serial.h"
+
+#define READER_CHUNK	4096
+
+struct lisp_reader_t {
+	char *buf;
+	size_t size, len;
+	size_t start, scan;
+
+	int depth, in_string, in_token, in_label, in_datum;
+
+	FILE *fp;
+	int fd;
+	int eof;
+};
+
+/* LEXER */
+
+#define is_space(c)			(((c) == ' ') || ((unsigned char)((c) - '\t') < 5))
+#define is_digit(c)			((unsigned char)((c) - '0') < 10)
+#define is_symbol_char(c)	(symbol_chars[(unsigned char)(c) >> 5] & (1u << ((unsigned char)(c) & 31)))
+
+/* One bit per character allowed in a symbol:
+ * 0-9 a-z A-Z ! $ % & * + - . / : < = > ? @ ^ _ ~ ' # */
+static const uint32_t symbol_chars[8] = {
+	0x00000000, 0xf7ffecfa, 0xc7ffffff, 0x47fffffe, 0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
+
+#ifdef LISP_READ_SSE2
+/* The scanners below look at 16 bytes at a time. Their loads are aligned, so
+ * they never touch the page behind the terminating NUL, but they do read the
+ * rest of its block; bytes in front of the start are masked off. */
+
+#ifdef _MSC_VER
+static int first_bit(const unsigned int mask) { unsigned long out; _BitScanForward(&out, mask); return (int)out; }
+#define NO_SANITIZE
+#else
+#define first_bit(mask)		__builtin_ctz(mask)
+#if defined(__clang__) || defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE			__attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE
+#endif
+#endif
+
+static __m128i whitespace_mask(const __m128i v) {
+	const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+
+	return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+						_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
 }
 
-static int is_string(const char *exp, size_t *len) {
-	const char *end;
+NO_SANITIZE static const char *skip_whitespace(const char *exp) {
+	const char *block = (const char*)((uintptr_t)exp & ~(uintptr_t)15);
+	unsigned int mask = 0xffff << (exp - block);
+	__m128i v;
+
+	if(!is_space(*exp))
+		return exp;
+
+	while(1) {
+		v = _mm_load_si128((const __m128i*)block);
+		mask &= ~_mm_movemask_epi8(whitespace_mask(v));
+		if(mask & 0xffff)
+			return block + first_bit(mask);
+		block += 16;
+		mask = 0xffff;
+	}
+}
 
-	if(*exp == '\"') {
-		end = strchr(exp + 1, '\"');
-		if(end) {
-			*len = end - exp + 1;
-			return 1;
-		}
+/* First whitespace, ')' or NUL. */
+NO_SANITIZE static const char *token_end(const char *exp) {
+	const char *block = (const char*)((uintptr_t)exp & ~(uintptr_t)15);
+	unsigned int mask = 0xffff << (exp - block);
+	__m128i v, hits;
+
+	while(1) {
+		v = _mm_load_si128((const __m128i*)block);
+		hits = _mm_or_si128(whitespace_mask(v),
+			   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(')')), _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+		mask &= _mm_movemask_epi8(hits);
+		if(mask)
+			return block + first_bit(mask);
+		block += 16;
+		mask = 0xffff;
 	}
-	return 0;
 }
 
-static int is_symbol(const char *exp, size_t *len) {
-	const char *allowed = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ!$%&*+-./:<=>?@^_~'#";
-	
-	*len = 0;
-	while(exp[*len] && !isspace(exp[*len]) && exp[*len] != ')') {
-		if(!strchr(allowed, exp[*len]))			
-			return 0;		
-		(*len)++;
+/* First '"' or NUL. */
+NO_SANITIZE static const char *string_end(const char *exp) {
+	const char *block = (const char*)((uintptr_t)exp & ~(uintptr_t)15);
+	unsigned int mask = 0xffff << (exp - block);
+	__m128i v, hits;
+
+	while(1) {
+		v = _mm_load_si128((const __m128i*)block);
+		hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		mask &= _mm_movemask_epi8(hits);
+		if(mask)
+			return block + first_bit(mask);
+		block += 16;
+		mask = 0xffff;
 	}
-	return 1;
 }
+#else
+static const char *skip_whitespace(const char *exp) {
+	while(is_space(*exp))
+		exp++;
 
-static int is_quotation(const char *exp) {
-	if(*exp == '\'')
-		return 1;
-	return 0;
+	return exp;
 }
 
-static int is_decimal(const char *exp, size_t *len, double *out) {
-	size_t pointfound = 0;
+static const char *token_end(const char *exp) {
+	while(*exp && !is_space(*exp) && (*exp != ')'))
+		exp++;
 
-	*len = 0;
-	if(exp[0] == '-')
-		(*len)++;
+	return exp;
+}
+
+static const char *string_end(const char *exp) {
+	while(*exp && (*exp != '\"'))
+		exp++;
+
+	return exp;
+}
+#endif
 
-	while(exp[*len] && !isspace(exp[*len]) && exp[*len] != ')') {
-		if(exp[*len] == '.')
-			pointfound = 1;
-		else if(((exp[*len] < '0') || (exp[*len] > '9')) && exp[*len]) {
+static int is_symbol(const char *exp, const char *end) {
+	for(; exp < end; exp++)
+		if(!is_symbol_char(*exp))
 			return 0;
+	return 1;
+}
+
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Classifies and converts a token in one pass. A number is an optional '-'
+ * followed by digits and dots only; any dot makes it a decimal, and so does
+ * an exponent after at least one digit. Integers wrap around like they always
+ * did. A decimal whose digits fit into 53 bits with at most 22 of them behind
+ * the point is exactly one correctly rounded division away, everything else
+ * goes through strtod(). */
+lisp_type_t lisp_parse_number(const char *exp, const char *end, int *integer, double *decimal) {
+	const char *pos = exp;
+	unsigned int wrapped = 0;
+	uint64_t mantissa = 0;
+	int digits = 0, points = 0, fraction = 0, negative = 0, exact = 1;
+
+	if(*pos == '-') {
+		negative = 1;
+		pos++;
+	}
+
+	for(; pos < end; pos++) {
+		if(is_digit(*pos)) {
+			wrapped = wrapped * 10 + (*pos - '0');
+			if(mantissa < ((uint64_t)1 << 53))
+				mantissa = mantissa * 10 + (*pos - '0');
+			else
+				exact = 0;
+			digits++;
+			if(points)
+				fraction++;
+		} else if(*pos == '.') {
+			points++;
+		} else if(((*pos == 'e') || (*pos == 'E')) && digits && (points <= 1)) {
+			if((++pos < end) && ((*pos == '+') || (*pos == '-')))
+				pos++;
+			if(pos == end)
+				return lisp_type_symbol;
+			for(; pos < end; pos++)
+				if(!is_digit(*pos))
+					return lisp_type_symbol;
+			*decimal = strtod(exp, NULL);
+			return lisp_type_decimal;
+		} else {
+			return lisp_type_symbol;
 		}
-		(*len)++;
 	}
 
-	if(pointfound) {		
-		*out = strtod(exp, NULL);
-		return 1;
+	if(!points) {
+		if(!digits)
+			return lisp_type_symbol;
+		*integer = (int)(negative ? 0u - wrapped : wrapped);
+		return lisp_type_integer;
 	}
-	return 0;
+
+	if(!digits)
+		*decimal = 0.0;
+	else if((points == 1) && exact && (mantissa <= ((uint64_t)1 << 53)) && (fraction <= 22))
+		*decimal = (negative ? -(double)mantissa : (double)mantissa) / powers_of_ten[fraction];
+	else
+		*decimal = strtod(exp, NULL);
+
+	return lisp_type_decimal;
 }
 
-static int is_integer(const char *exp, size_t *len, int *out) {
-	int fact = 1, numbers = 0;
+/* READER */
 
-	*len = 0;
-	if(*exp == '-') {
-		fact = -1;
-		(*len)++;
-	}
+/* The reader walks its input once, front to back. Atoms are classified in
+ * place and handed to the constructors as slices, combinations are built
+ * while their elements are read. A lazy read only builds the first pair of
+ * each combination and leaves a placeholder pointing back into the input as
+ * its tail. */
 
-	*out = 0;
+#define READ_QUOTED		1
+#define READ_LAZY		2
 
-	while(exp[*len] && !isspace(exp[*len]) && exp[*len] != ')') {
-		if(exp[*len] >= '0' && exp[*len] <= '9') {
-			numbers++;
-			*out *= 10;
-			*out += exp[*len] - '0';
-		} else
-			return 0;
-		(*len)++;
+#define is_dot(pos)		((*(pos) == '.') && (token_end(pos) == (pos) + 1))
+
+#define LABEL_DIGITS	9
+
+/* Datum labels seen so far in one read: the map goes from the label number
+ * plus one to the slot of the datum it names. */
+typedef struct read_labels_t {
+	lisp_ptrmap_t map;
+	lisp_data_t **datums;
+	uint32_t used, size;
+} read_labels_t;
+
+static lisp_data_t *read_subexp(const char **exp, const int flags, read_labels_t *labels, int *error, lisp_ctx_t *context);
+static int check_subexp(const char **exp, const int flags);
+
+static lisp_data_t *make_lazy(const char *pos, const int flags, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+		return NULL;
+
+	if(!(out->lazy = malloc(sizeof(lisp_lazy_t)))) {
+		out->type = lisp_type_integer;
+		lisp_free_data(out, context);
+		return NULL;
 	}
 
-	*out *= fact;
+	out->type = lisp_type_lazy;
+	out->lazy->pos = pos;
+	out->lazy->flags = flags;
+	out->lazy->context = context;
 
-	if(numbers)
-		return 1;
-	return 0;
+	return out;
 }
 
-static int is_combination(const char *exp, size_t *len) {
-	size_t parens = 1;
+/* Reads the next element of a combination, pos is just past the '(' or the
+ * previous element. After a dot it reads the tail itself. */
+static lisp_data_t *read_lazy_tail(const char **exp, const int flags, int *error, lisp_ctx_t *context) {
+	const char *pos = skip_whitespace(*exp);
+	lisp_data_t *car, *out;
 
-	if(*exp != '(')
-		return 0;
-		
-	*len = 1;
-	while(exp[*len]) {
-		if(exp[*len] == '(')
-			parens++;
-		else if(exp[*len] == ')')
-			parens--;
-		(*len)++;
-		if(parens == 0)
-			return 1;
+	if(*pos == ')') {
+		*exp = pos + 1;
+		return NULL;
 	}
 
-	return 0;
+	if(is_dot(pos)) {
+		pos++;
+		out = read_subexp(&pos, flags, NULL, error, context);
+		*exp = skip_whitespace(pos) + 1;
+		return out;
+	}
+
+	car = read_subexp(&pos, flags, NULL, error, context);
+	if(*error)
+		return NULL;
+
+	if((out = lisp_cons(car, make_lazy(pos, flags, context))) == NULL)
+		*error = 1;
+
+	return out;
 }
 
-void get_last_subexp(const char *exp, size_t *pos) {
-	size_t paren = 0;
+/* Reads the pair a placeholder stands for and frees the placeholder, the cdr
+ * it sat in is its only reference. The input was checked by lisp_read_lazy(),
+ * so only running out of memory can fail here, which ends the list early. */
+lisp_data_t *lisp_force_lazy(lisp_data_t *lazy) {
+	lisp_ctx_t *context = lazy->lazy->context;
+	const char *pos = lazy->lazy->pos;
+	lisp_data_t *out;
+	int error = 0;
 
-	if(strlen(exp) == 0) {
-		*pos = 0;
-		return;
+	out = read_lazy_tail(&pos, lazy->lazy->flags, &error, context);
+	lisp_free_data(lazy, context);
+
+	return error ? NULL : out;
+}
+
+/* head is the first pair to use if the combination has a label, so the
+ * elements can refer to it. */
+static lisp_data_t *read_combination(const char **exp, const int flags, read_labels_t *labels, lisp_data_t *head, int *error, lisp_ctx_t *context) {
+	lisp_data_t *out = NULL, *last = NULL, *newdata, *newpair;
+	const char *pos = *exp + 1;
+
+	/* Only the first element is read, the rest of the combination is skipped
+	 * to find where the enclosing one goes on. */
+	if(flags & READ_LAZY) {
+		if(check_subexp(exp, flags) == -1) {
+			*error = 1;
+			return NULL;
+		}
+		return read_lazy_tail(&pos, flags, error, context);
 	}
 
-	for(*pos = strlen(exp) - 1; *pos > 0; (*pos)--)
-		if(!isspace(exp[*pos]))
+	while(1) {
+		pos = skip_whitespace(pos);
+
+		if(*pos == ')')
+			break;
+		if(!*pos) {
+			*error = 1;
+			return NULL;
+		}
+
+		if(last && is_dot(pos)) {
+			pos++;
+			newdata = read_subexp(&pos, flags, labels, error, context);
+			if(*error || (*(pos = skip_whitespace(pos)) != ')')) {
+				*error = 1;
+				return NULL;
+			}
+			lisp_set_cdr(last, newdata);
 			break;
+		}
 
-	for(; *pos > 0; (*pos)--) {
-		if(exp[*pos] == ')')
-			paren++;
-		else if(exp[*pos] == '(')
-			paren--;
+		newdata = read_subexp(&pos, flags, labels, error, context);
+		if(*error)
+			return NULL;
 
-		if(!paren) {
-			if(isspace(exp[*pos]))
-				break;
+		if(!last && head) {
+			newpair = head;
+			lisp_set_car(head, newdata);
+		} else if((newpair = lisp_cons(newdata, NULL)) == NULL) {
+			*error = 1;
+			return NULL;
 		}
+
+		if(last)
+			lisp_set_cdr(last, newpair);
+		else
+			out = newpair;
+		last = newpair;
 	}
 
-	*pos += skip_whitespace(exp + *pos);	
+	*exp = pos + 1;
+	return out;
 }
 
-static int is_empty_combination(const char *exp) {
-	size_t pos = skip_whitespace(exp);
+/* A vector is read as a list first, which is then moved into it. Lazy reads
+ * read vectors whole. */
+static lisp_data_t *read_vector(const char **exp, const int flags, read_labels_t *labels, int *error, lisp_ctx_t *context) {
+	const char *pos = *exp + 1;
+	lisp_data_t *list, *out, *next;
+	size_t length = 0;
 
-	if(exp[pos] != '(')
-		return 0;
-	
-	pos += skip_whitespace(exp + pos + 1) + 1;
-	if(exp[pos] != ')')
+	list = read_combination(&pos, flags & ~READ_LAZY, labels, NULL, error, context);
+	if(*error)
+		return NULL;
+
+	for(out = list; out && (out->type == lisp_type_pair); out = out->pair->r)
+		length++;
+	if(out || ((out = lisp_make_vector(length, NULL, context)) == NULL)) {
+		*error = 1;
+		return NULL;
+	}
+
+	for(length = 0; list; list = next) {
+		next = list->pair->r;
+		out->vector->items[length++] = list->pair->l;
+		lisp_free_data(list, context);
+	}
+
+	*exp = pos;
+	return out;
+}
+
+/* "#f64(" and "#s64(" open numeric vectors, pos is at the '#'. */
+static int numvector_prefix(const char *pos, lisp_type_t *type) {
+	if(((pos[1] != 'f') && (pos[1] != 's')) || (pos[2] != '6') || (pos[3] != '4') || (pos[4] != '('))
 		return 0;
-	
+	*type = (pos[1] == 'f') ? lisp_type_f64vector : lisp_type_s64vector;
 	return 1;
 }
 
-static lisp_data_t *read_subexp(const char *exp, size_t already_quoted, size_t *readto, int *error, lisp_ctx_t *context) {
-	char *buf, *newexp;
-	int integer;
+/* An optional '-' and digits that fit into 64 bits. */
+static int parse_s64(const char *exp, const char *end, int64_t *out) {
+	uint64_t u = 0, limit = (uint64_t)INT64_MAX;
+	int negative = (*exp == '-');
+
+	if(negative) {
+		exp++;
+		limit++;
+	}
+	if(exp == end)
+		return -1;
+
+	for(; exp < end; exp++) {
+		if(!is_digit(*exp) || (u > (limit - (*exp - '0')) / 10))
+			return -1;
+		u = u * 10 + (*exp - '0');
+	}
+
+	*out = negative ? (int64_t)(0 - u) : (int64_t)u;
+	return 0;
+}
+
+/* Walks the numbers of a numeric vector after its '(' up to the ')', and
+ * stores them unless out is NULL. Integers go through strtod() for an
+ * f64vector, so large ones do not wrap around. Returns the position after the
+ * ')', or NULL if anything in between is not a number of the right kind. */
+static const char *scan_numvector(const char *pos, const lisp_type_t type, size_t *length, lisp_numvector_t *out) {
+	const char *end;
 	double decimal;
-	size_t skip, newread, exppos;
-	lisp_data_t *newdata, *out = NULL;
-	
-	skip = skip_whitespace(exp);
-	exp += skip;
-	
-	*readto = 0;
-
-	if(is_quotation(exp) && !already_quoted) {
-		out = lisp_cons(lisp_make_symbol("quote", context), lisp_cons(read_subexp(exp + 1, 1, &newread, error, context), NULL));
-		*readto += newread + 1;
-	} else if(is_decimal(exp, readto, &decimal)) {
-		out = lisp_make_decimal(decimal, context);
-	} else if(is_integer(exp, readto, &integer)) {		
-		out = lisp_make_int(integer, context);
-	} else if(is_string(exp, readto)) {
-		if((buf = malloc(*readto - 1)) == NULL)
-			return NULL;
-		
-		strncpy(buf, exp + 1, *readto - 2);
-		buf[*readto - 2] = '\0';
-		out = lisp_make_string(buf, context);		
-		free(buf);		
-	} else if(is_symbol(exp, readto)) {		
-		if((buf = malloc(*readto + 1)) == NULL)
+	int64_t s64;
+	int integer;
+	lisp_type_t kind;
+
+	for(*length = 0; *(pos = skip_whitespace(pos)) != ')'; pos = end, (*length)++) {
+		if((end = token_end(pos)) == pos)
 			return NULL;
-		strncpy(buf, exp, *readto);
-		buf[*readto] = '\0';
-		out = lisp_make_symbol(buf, context);
-		free(buf);
-	} else if(is_combination(exp, readto)) {
-		if(is_empty_combination(exp)) {			
-			out = NULL;
+
+		if(type == lisp_type_s64vector) {
+			if(parse_s64(pos, end, &s64) == -1)
+				return NULL;
+			if(out)
+				out->s64[*length] = s64;
 		} else {
-			if((newexp = malloc(*readto)) == NULL)
+			if((kind = lisp_parse_number(pos, end, &integer, &decimal)) == lisp_type_symbol)
 				return NULL;
-			buf = newexp;
+			if(out)
+				out->f64[*length] = (kind == lisp_type_integer) ? strtod(pos, NULL) : decimal;
+		}
+	}
+
+	return pos + 1;
+}
+
+/* Numbers are counted first, then read into the vector. */
+static lisp_data_t *read_numvector(const char **exp, const lisp_type_t type, int *error, lisp_ctx_t *context) {
+	const char *pos = *exp + 5;
+	lisp_data_t *out;
+	size_t length;
+
+	if(!scan_numvector(pos, type, &length, NULL)) {
+		*error = 1;
+		return NULL;
+	}
+	out = (type == lisp_type_f64vector) ? lisp_make_f64vector(length, context) : lisp_make_s64vector(length, context);
+	if(!out) {
+		*error = 1;
+		return NULL;
+	}
 
-			strncpy(newexp, exp + 1, *readto - 2);
-			newexp[*readto - 2] = '\0';
-			newexp += skip_whitespace(newexp);
+	*exp = scan_numvector(pos, type, &length, out->numvector);
+	return out;
+}
+
+/* A label is '#' and up to LABEL_DIGITS digits, followed by '=' in front of
+ * the datum it names or by '#' where it refers to it. Returns the '=' or the
+ * '#' after the digits, or NULL if pos does not start a label. */
+static const char *label_end(const char *pos, uint32_t *number) {
+	const char *digits = ++pos;
+
+	for(*number = 0; is_digit(*pos) && (pos - digits < LABEL_DIGITS); pos++)
+		*number = *number * 10 + (*pos - '0');
+
+	if((pos == digits) || ((*pos != '=') && (*pos != '#')))
+		return NULL;
+	if((*pos == '#') && (token_end(pos + 1) != pos + 1))
+		return NULL;
+	return pos;
+}
 
-			out = NULL;
-			do {
-				get_last_subexp(newexp, &exppos);
-				newdata = read_subexp(newexp + exppos, already_quoted, &newread, error, context);
-				out = lisp_cons(newdata, out);
-				newexp[exppos] = '\0';			
-			} while(newexp[0]);
+static int define_label(read_labels_t *labels, const uint32_t number, lisp_data_t *datum) {
+	lisp_data_t **newdatums;
+	uint32_t *slot;
 
-			free(buf);
+	if(!labels->map.entries && (lisp_ptrmap_init(&labels->map, 64) == -1))
+		return -1;
+
+	if((slot = lisp_ptrmap_ref(&labels->map, (lisp_data_t*)(uintptr_t)(number + 1))) != NULL) {
+		labels->datums[*slot] = datum;
+		return 0;
+	}
+
+	if(labels->used == labels->size) {
+		if((newdatums = realloc(labels->datums, (2 * labels->size + 16) * sizeof(lisp_data_t*))) == NULL)
+			return -1;
+		labels->datums = newdatums;
+		labels->size = 2 * labels->size + 16;
+	}
+
+	labels->datums[labels->used] = datum;
+	return lisp_ptrmap_insert(&labels->map, (lisp_data_t*)(uintptr_t)(number + 1), labels->used++);
+}
+
+static int find_label(const read_labels_t *labels, const uint32_t number, lisp_data_t **datum) {
+	const uint32_t *slot;
+
+	if(!labels->map.entries || !(slot = lisp_ptrmap_ref(&labels->map, (lisp_data_t*)(uintptr_t)(number + 1))))
+		return -1;
+
+	*datum = labels->datums[*slot];
+	return 0;
+}
+
+/* A labelled combination gets its first pair before its elements are read,
+ * which is what lets them refer back to it. */
+static lisp_data_t *read_label(const char **exp, const char *end, const uint32_t number, const int flags, read_labels_t *labels, int *error, lisp_ctx_t *context) {
+	const char *pos = skip_whitespace(end + 1);
+	lisp_data_t *out = NULL, *head = NULL;
+
+	if(*end == '#') {
+		if(find_label(labels, number, &out) == -1)
+			*error = 1;
+		*exp = end + 1;
+		return out;
+	}
+
+	if(*pos == '(') {
+		if(((head = lisp_cons(NULL, NULL)) == NULL) || (define_label(labels, number, head) == -1)) {
+			*error = 1;
+			return NULL;
 		}
+		out = read_combination(&pos, flags, labels, head, error, context);
 	} else {
+		out = read_subexp(&pos, flags, labels, error, context);
+	}
+
+	if(!*error && (define_label(labels, number, out) == -1))
 		*error = 1;
-		return NULL;
+
+	*exp = pos;
+	return out;
+}
+
+static lisp_data_t *read_subexp(const char **exp, const int flags, read_labels_t *labels, int *error, lisp_ctx_t *context) {
+	const char *pos = skip_whitespace(*exp), *end;
+	lisp_data_t *out = NULL, *quoted;
+	double decimal;
+	uint32_t number;
+	int integer;
+	lisp_type_t type;
+
+	if((*pos == '\'') && !(flags & READ_QUOTED)) {
+		pos++;
+		quoted = read_subexp(&pos, flags | READ_QUOTED, labels, error, context);
+		if(*error)
+			return NULL;
+		out = lisp_cons(lisp_make_symbol("quote", context), lisp_cons(quoted, NULL));
+	} else if(*pos == '(') {
+		out = read_combination(&pos, flags, labels, NULL, error, context);
+	} else if((*pos == '#') && (pos[1] == '(')) {
+		out = read_vector(&pos, flags, labels, error, context);
+	} else if((*pos == '#') && numvector_prefix(pos, &type)) {
+		out = read_numvector(&pos, type, error, context);
+	} else if((*pos == '#') && (end = label_end(pos, &number)) != NULL) {
+		if(!labels) {
+			*error = 1;
+			return NULL;
+		}
+		out = read_label(&pos, end, number, flags, labels, error, context);
+	} else if(*pos == '\"') {
+		if(*(end = string_end(pos + 1)) != '\"') {
+			*error = 1;
+			return NULL;
+		}
+		out = lisp_make_stringn(pos + 1, end - pos - 1, context);
+		pos = end + 1;
+	} else {
+		end = token_end(pos);
+
+		if(end == pos)
+			*error = 1;
+		else if((type = lisp_parse_number(pos, end, &integer, &decimal)) == lisp_type_decimal)
+			out = lisp_make_decimal(decimal, context);
+		else if(type == lisp_type_integer)
+			out = lisp_make_int(integer, context);
+		else if(is_symbol(pos, end))
+			out = lisp_make_symboln(pos, end - pos, context);
+		else
+			*error = 1;
+
+		pos = end;
 	}
 
-	*readto += skip;
-	
-	if(!(*readto))
+	*exp = pos;
+
+	if(*error)
 		return NULL;
+	return out;
+}
 
-	return out;	
+/* Walks a datum like read_subexp() without building anything, so a lazy read
+ * can reject bad input up front. */
+static int check_subexp(const char **exp, const int flags) {
+	const char *pos = skip_whitespace(*exp), *end;
+	uint32_t number;
+	int elements, vector;
+	lisp_type_t type;
+	size_t length;
+
+	if((*pos == '\'') && !(flags & READ_QUOTED)) {
+		pos++;
+		if(check_subexp(&pos, flags | READ_QUOTED) == -1)
+			return -1;
+	} else if((*pos == '(') || ((*pos == '#') && (pos[1] == '('))) {
+		vector = (*pos == '#');
+		for(pos += 1 + vector, elements = 0; *(pos = skip_whitespace(pos)) != ')'; elements++) {
+			if(elements && is_dot(pos)) {
+				if(vector)
+					return -1;
+				pos++;
+				if((check_subexp(&pos, flags) == -1) || (*(pos = skip_whitespace(pos)) != ')'))
+					return -1;
+				break;
+			}
+			if(!*pos || (check_subexp(&pos, flags) == -1))
+				return -1;
+		}
+		pos++;
+	} else if((*pos == '#') && numvector_prefix(pos, &type)) {
+		if((pos = scan_numvector(pos + 5, type, &length, NULL)) == NULL)
+			return -1;
+	} else if(*pos == '\"') {
+		if(*(end = string_end(pos + 1)) != '\"')
+			return -1;
+		pos = end + 1;
+	} else {
+		/* Numbers are made of symbol characters too. Lazy reads cannot keep
+		 * track of labels. */
+		end = token_end(pos);
+		if((*pos == '#') && label_end(pos, &number))
+			return -1;
+		if((end == pos) || !is_symbol(pos, end))
+			return -1;
+		pos = end;
+	}
+
+	*exp = pos;
+	return 0;
 }
 
-lisp_data_t *lisp_read(const char *exp, size_t *readto, int *error, lisp_ctx_t *context) {
-	size_t l = strlen(exp), int_readto;
-	lisp_data_t *out;
+static lisp_data_t *read_datum(const char *exp, size_t *readto, int *error, const int flags, lisp_ctx_t *context) {
+	const char *pos = skip_whitespace(exp);
+	read_labels_t labels = { { NULL, 0, 0 }, NULL, 0, 0 };
+	lisp_data_t *out = NULL;
+
 	*error = 0;
 
-	int_readto = 0;
-	if(!l)		
-		return NULL;
-	
-	out = read_subexp(exp, 0, &int_readto, error, context);
+	if(*pos)
+		out = read_subexp(&pos, flags, (flags & READ_LAZY) ? NULL : &labels, error, context);
+
+	if(labels.map.entries)
+		lisp_ptrmap_free(&labels.map);
+	free(labels.datums);
 
 	if(readto)
-		*readto = int_readto;
+		*readto = pos - exp;
+
+	return out;
+}
+
+lisp_data_t *lisp_read(const char *exp, size_t *readto, int *error, lisp_ctx_t *context) {
+	return read_datum(exp, readto, error, 0, context);
+}
+
+/* Every combination is checked as a whole when its first pair is read, so
+ * errors still show up here and not when a tail is read later. */
+lisp_data_t *lisp_read_lazy(const char *exp, size_t *readto, int *error, lisp_ctx_t *context) {
+	return read_datum(exp, readto, error, READ_LAZY, context);
+}
+
+/* STREAMING */
+
+/* The reader keeps only the datum it is working on. It scans new input just
+ * far enough to find where that datum ends and then hands the slice to
+ * lisp_read(), so every byte is scanned twice at most. */
+
+static lisp_reader_t *new_reader(FILE *fp, const int fd) {
+	lisp_reader_t *out;
+
+	if((out = malloc(sizeof(lisp_reader_t))) == NULL)
+		return NULL;
+
+	if((out->buf = malloc(READER_CHUNK)) == NULL) {
+		free(out);
+		return NULL;
+	}
+
+	out->buf[0] = '\0';
+	out->size = READER_CHUNK;
+	out->len = 0;
+	out->start = 0;
+	out->scan = 0;
+	out->depth = 0;
+	out->in_string = 0;
+	out->in_token = 0;
+	out->in_label = 0;
+	out->in_datum = 0;
+	out->fp = fp;
+	out->fd = fd;
+	out->eof = 0;
 
 	return out;
 }
+
+lisp_reader_t *lisp_make_reader(void) { return new_reader(NULL, -1); }
+lisp_reader_t *lisp_make_file_reader(FILE *fp) { return new_reader(fp, -1); }
+lisp_reader_t *lisp_make_fd_reader(const int fd) { return new_reader(NULL, fd); }
+
+void lisp_destroy_reader(lisp_reader_t *reader) {
+	if(!reader)
+		return;
+
+	free(reader->buf);
+	free(reader);
+}
+
+/* Drops what has been consumed and makes room for at least space more bytes
+ * plus the terminator. */
+static int reserve(lisp_reader_t *reader, const size_t space) {
+	size_t newsize;
+	char *newbuf;
+
+	if(reader->start) {
+		memmove(reader->buf, reader->buf + reader->start, reader->len - reader->start);
+		reader->len -= reader->start;
+		reader->scan -= reader->start;
+		reader->start = 0;
+	}
+
+	if(reader->len + space + 1 <= reader->size)
+		return 0;
+
+	for(newsize = reader->size; newsize < reader->len + space + 1; newsize *= 2);
+	if((newbuf = realloc(reader->buf, newsize)) == NULL)
+		return -1;
+
+	reader->buf = newbuf;
+	reader->size = newsize;
+	return 0;
+}
+
+int lisp_reader_feed(lisp_reader_t *reader, const char *buf, const size_t len) {
+	if(!buf) {
+		reader->eof = 1;
+		return 0;
+	}
+
+	if(reserve(reader, len) == -1)
+		return -1;
+
+	memcpy(reader->buf + reader->len, buf, len);
+	reader->len += len;
+	reader->buf[reader->len] = '\0';
+
+	return 0;
+}
+
+static void fill(lisp_reader_t *reader) {
+	size_t got = 0;
+	int ret;
+
+	if(reserve(reader, READER_CHUNK) == -1) {
+		reader->eof = 1;
+		return;
+	}
+
+	if(reader->fp) {
+		if(fgets(reader->buf + reader->len, READER_CHUNK + 1, reader->fp))
+			got = strlen(reader->buf + reader->len);
+	} else {
+		if((ret = read(reader->fd, reader->buf + reader->len, READER_CHUNK)) > 0)
+			got = ret;
+	}
+
+	if(!got)
+		reader->eof = 1;
+
+	reader->len += got;
+	reader->buf[reader->len] = '\0';
+}
+
+static void reset_scan(lisp_reader_t *reader) {
+	reader->start = reader->scan;
+	reader->depth = 0;
+	reader->in_string = 0;
+	reader->in_token = 0;
+	reader->in_label = 0;
+	reader->in_datum = 0;
+}
+
+/* Advances the scan position up to the end of the current datum. Returns 1
+ * when it is complete, 0 if more input is needed and -1 on a stray ')'. */
+static int scan_datum(lisp_reader_t *reader) {
+	lisp_type_t type;
+	char c;
+
+	for(; reader->scan < reader->len; reader->scan++) {
+		if(reader->in_string) {
+			reader->scan = string_end(reader->buf + reader->scan) - reader->buf;
+			if(reader->scan >= reader->len)
+				break;
+			if(reader->buf[reader->scan] != '\"')
+				continue;
+			reader->in_string = 0;
+			if(!reader->depth) {
+				reader->scan++;
+				return 1;
+			}
+			continue;
+		}
+
+		/* '#' and digits are a label if an '=' follows, which makes them part
+		 * of the datum after it. Anything else makes them a token. in_label
+		 * is 2 once a letter has been seen, as in "#f64". */
+		if(reader->in_label) {
+			c = reader->buf[reader->scan];
+			if(is_digit(c))
+				continue;
+			if(((c == 'f') || (c == 's')) && (reader->buf[reader->scan - 1] == '#')) {
+				reader->in_label = 2;
+				continue;
+			}
+			if((c == '=') && (reader->in_label == 1)) {
+				reader->in_label = 0;
+				continue;
+			}
+			/* "#(", "#f64(" and "#s64(" open vectors, which are scanned like
+			 * combinations. */
+			if((c != '(') || ((reader->in_label == 1) ? (reader->buf[reader->scan - 1] != '#') : ((reader->scan < 4) || !numvector_prefix(reader->buf + reader->scan - 4, &type))))
+				reader->in_token = 1;
+			reader->in_label = 0;
+		}
+
+		if(reader->in_token) {
+			reader->scan = token_end(reader->buf + reader->scan) - reader->buf;
+			if(reader->scan >= reader->len)
+				break;
+			if(!reader->buf[reader->scan])
+				continue;
+			reader->in_token = 0;
+			if(!reader->depth)
+				return 1;
+		}
+
+		c = reader->buf[reader->scan];
+
+		if(is_space(c)) {
+			if(!reader->in_datum)
+				reader->start = reader->scan + 1;
+		} else if(c == '(') {
+			reader->depth++;
+			reader->in_datum = 1;
+		} else if(c == ')') {
+			if(!reader->depth) {
+				reader->scan++;
+				return -1;
+			}
+			if(!--reader->depth) {
+				reader->scan++;
+				return 1;
+			}
+		} else if(c == '\"') {
+			reader->in_string = 1;
+			reader->in_datum = 1;
+		} else if(c == '\'') {
+			reader->in_datum = 1;
+		} else if(c == '#') {
+			reader->in_label = 1;
+			reader->in_datum = 1;
+		} else {
+			reader->in_token = 1;
+			reader->in_datum = 1;
+		}
+	}
+
+	return 0;
+}
+
+lisp_data_t *lisp_reader_next(lisp_reader_t *reader, int *status, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	int found, error;
+	char c;
+
+	while((found = scan_datum(reader)) == 0) {
+		if(!reader->eof && (reader->fp || (reader->fd != -1)))
+			fill(reader);
+		else if(!reader->eof) {
+			*status = LISP_READ_MORE;
+			return NULL;
+		} else if(reader->in_token || reader->in_label) {
+			found = 1;
+			break;
+		} else if(reader->in_datum) {
+			found = -1;
+			break;
+		} else {
+			reset_scan(reader);
+			*status = LISP_READ_EOF;
+			return NULL;
+		}
+	}
+
+	if(found == -1) {
+		reset_scan(reader);
+		*status = LISP_READ_ERROR;
+		return NULL;
+	}
+
+	c = reader->buf[reader->scan];
+	reader->buf[reader->scan] = '\0';
+	out = lisp_read(reader->buf + reader->start, NULL, &error, context);
+	reader->buf[reader->scan] = c;
+
+	reset_scan(reader);
+
+	*status = error ? LISP_READ_ERROR : LISP_READ_OK;
+	return error ? NULL : out;
+}
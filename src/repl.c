@@ -32,79 +32,18 @@ void print_banner(void) {
 	printf("                             `'-----''                      Read SICP for help.\n\n");
 }
 
-int balanced_parens(char *exp) {
-	int out = 0;
-	char c;
-
-	while((c = *(exp++))) {
-		if(c == '(')
-			out++;
-		if(c == ')')
-			out--;
-	}
-
-	return out;
-}
-
-static char *get_line(FILE *fp) {
-	size_t size = 0, len  = 0, last = 0;
-	char *buf  = NULL;
-
-	do {
-		size += BUFSIZ;
-		buf = realloc(buf, size);
-		fgets(buf + last, size, fp);
-		len = strlen(buf);
-		last = len - 1;
-	} while (!feof(fp) && buf[last]!='\n');
-	buf[last] = '\0';
-
-	return buf;
-}
-
-char *input_exp(int *paren) {
-	char *out, *buf;
-	size_t bufsize = BUFSIZ, newlen;
-	
-	*paren = 0;
-
-	if((out = malloc(bufsize)) == NULL) {
-		fprintf(stderr, "ERROR: malloc(%zd) failed.\n", bufsize);
-		return NULL;
-	}
-
-	memset(out, 0, bufsize);
-	do {
-		printf("%s", INPUT_PROMPT);
-		buf = get_line(stdin);
-		*paren += balanced_parens(buf);
-		newlen = strlen(out) + strlen(buf) + 2;
-
-		if(newlen > bufsize) {
-			bufsize += BUFSIZ;
-			if((out = realloc(out, bufsize)) == NULL) {
-				fprintf(stderr, "ERROR: realloc(%zd) failed.\n", bufsize);
-				return NULL;
-			}
-		}
-		if(strlen(out))
-			strcat(out, " ");
-		else
-			newlen--;
-
-		strcat(out, buf);
-		out[newlen - 1] = '\0';
-		free(buf);
-	} while(*paren > 0);
+static int is_quit(const lisp_data_t *exp) {
+	lisp_data_t *op = lisp_car(exp);
 
-	return out;
+	return op && (op->type == lisp_type_symbol) && !strcmp(op->symbol, "quit") && !lisp_cdr(exp);
 }
 
 int main(void) {
-	lisp_data_t *exp_list, *ret;
-	size_t readto, reclaimed;
-	int error, paren = 0;
-	char *exp, *buf;
+	lisp_data_t *exp, *ret;
+	lisp_reader_t *reader;
+	char line[BUFSIZ];
+	size_t reclaimed, len;
+	int status, prompt = 1, quit = 0;
 
 	lisp_ctx_t *context;
 
@@ -112,45 +51,50 @@ int main(void) {
 
 	context = lisp_make_context(1024 * 768, 1024 * 1024, LISP_GC_SILENT, 60);
 	lisp_setup_env(context);
+	reader = lisp_make_reader();
 	print_banner();
 
-	while(1) {
-		readto = 0;
-
-		exp = input_exp(&paren);
-		if(paren < 0) {
-			fprintf(stderr, "-- Syntax error: Unbalanced parentheses.\n");
-			free(exp);
-			continue;
+	while(!quit) {
+		if(prompt)
+			printf("%s", INPUT_PROMPT);
+
+		if(fgets(line, sizeof(line), stdin)) {
+			len = strlen(line);
+			prompt = len && (line[len - 1] == '\n');
+			lisp_reader_feed(reader, line, len);
+		} else {
+			lisp_reader_feed(reader, NULL, 0);
+			quit = 1;
 		}
 
-		if(!strcmp(exp, "(quit)")) {
-			printf("%s\n", GOODBYE);
-			free(exp);
-			break;
-		}
-		buf = exp;
+		while(1) {
+			exp = lisp_reader_next(reader, &status, context);
+
+			if((status == LISP_READ_MORE) || (status == LISP_READ_EOF))
+				break;
 
-		do {
-			exp_list = lisp_read(exp, &readto, &error, context);
-		
-			if(error) {
-				printf("-- Syntax Error: '%s'\n", exp);
+			if(status == LISP_READ_ERROR) {
+				printf("-- Syntax error.\n");
+				continue;
+			}
+
+			if(is_quit(exp)) {
+				printf("%s\n", GOODBYE);
+				quit = 1;
 				break;
-			} else {
-				ret = lisp_eval_thread(exp_list, context);
-				printf("%s", OUTPUT_PROMPT);
-				lisp_print(ret, context);
-				printf("\n");
-			}	
-		
-			exp += readto;
+			}
+
+			ret = lisp_eval_thread(exp, context);
+			printf("%s", OUTPUT_PROMPT);
+			lisp_print_shared(ret, context);
+			printf("\n");
 
 			if((reclaimed = lisp_gc(LISP_GC_LOWMEM, context)) && (context->mem_verbosity == LISP_GC_VERBOSE))
 				printf("-- GC: %zd bytes of memory reclaimed.\n", reclaimed);
-		} while(strlen(exp));
-		free(buf);
+		}
 	}
+
+	lisp_destroy_reader(reader);
 	lisp_destroy_context(context);
 
 	return EXIT_SUCCESS;
@@ -25,7 +25,8 @@ lisp_data_t *sample_proc(const lisp_data_t *args, lisp_ctx_t *context) {
 
 int main(void) {
 	lisp_ctx_t *context;
-	lisp_data_t *exp, *ret;
+	lisp_prepared_t *prepared;
+	lisp_data_t *exp, *ret, *args[2];
 	size_t readto;
 	int errcode;
 
@@ -77,6 +78,18 @@ int main(void) {
 		fprintf(stderr, "lisp_read() failed.\n");
 	}
 
+	/* A procedure that is called over and over with values from the host is
+	 * prepared once, and calling it does not read anything. */
+	prepared = lisp_prepare("(lambda (x y) (sqrt (sum-of-squares x y)))", context);
+	if(prepared) {
+		args[0] = lisp_make_int(5, context);
+		args[1] = lisp_make_int(12, context);
+		ret = lisp_call(prepared, 2, args);
+		lisp_print(ret, context);
+		printf("\n");
+		lisp_destroy_prepared(prepared);
+	}
+
 	/************************************
 	 * STEP 3: Clean up after yourself. *
 	 ************************************/
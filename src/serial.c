@@ -0,0 +1,834 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/hash.h"
+#include "libisp/mem.h"
+#include "libisp/serial.h"
+
+/*
+ * A serialized datum is a version byte, the number of pairs and vectors and
+ * the number of distinct symbols, followed by the datum itself:
+ *
+ *   u8 version | u32 pairs | u32 symbols | datum
+ *
+ * Every datum starts with a tag byte. Integers are zigzag varints, decimals
+ * their IEEE bits in eight little endian bytes, texts a varint length and the
+ * bytes. A pair is followed by its car and then its cdr, a vector by its
+ * length as a varint and its elements. Numeric vectors have their length and
+ * then eight little endian bytes per element. A hash table is its kind and
+ * weakness or'd into a byte, the number of entries as a varint and each key
+ * followed by its value. A weak box is a byte that is 1 if it is broken and
+ * then its value. A string builder is written like a string. Pairs, vectors
+ * of all kinds, hash tables, weak boxes and string builders are numbered in
+ * the order they are written, and writing one a second time only writes a
+ * reference to its number, which is how shared structure and cycles survive. Atoms cannot be
+ * told apart from equal copies of themselves and are written out each time.
+ * Symbols go into a table of their own by name, and repeated ones are written
+ * as their index in it.
+ */
+
+#define SERIAL_VERSION	1
+#define HEADER_SIZE		9
+
+#define TAG_NIL			0
+#define TAG_INT			1
+#define TAG_DECIMAL		2
+#define TAG_STRING		3
+#define TAG_SYMBOL		4
+#define TAG_SYMREF		5
+#define TAG_ERROR		6
+#define TAG_PRIM		7
+#define TAG_PAIR		8
+#define TAG_REF			9
+#define TAG_VECTOR		10
+#define TAG_F64VECTOR	11
+#define TAG_S64VECTOR	12
+#define TAG_HASHTABLE	13
+#define TAG_WEAKBOX		14
+#define TAG_STRBUF		15
+
+/* BUFFER */
+
+void lisp_buffer_init(lisp_buffer_t *buf) {
+	buf->data = NULL;
+	buf->len = 0;
+	buf->size = 0;
+}
+
+static int reserve(lisp_buffer_t *buf, const size_t len) {
+	unsigned char *newdata;
+	size_t newsize;
+
+	if(buf->len + len <= buf->size)
+		return 0;
+
+	for(newsize = buf->size ? buf->size : 256; newsize < buf->len + len; newsize *= 2);
+	if((newdata = realloc(buf->data, newsize)) == NULL)
+		return -1;
+
+	buf->data = newdata;
+	buf->size = newsize;
+	return 0;
+}
+
+int lisp_buffer_append(lisp_buffer_t *buf, const void *data, const size_t len) {
+	if(reserve(buf, len) == -1)
+		return -1;
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+void lisp_buffer_free(lisp_buffer_t *buf) {
+	free(buf->data);
+	lisp_buffer_init(buf);
+}
+
+/* POINTER MAP */
+
+static size_t hash_ptr(const void *ptr, const size_t size) {
+	uint64_t h = (uint64_t)(uintptr_t)ptr;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return (size_t)h & (size - 1);
+}
+
+/* Keys and values sit next to each other, so a probe touches one cache line. */
+int lisp_ptrmap_init(lisp_ptrmap_t *map, const size_t size) {
+	map->size = size;
+	map->used = 0;
+
+	if((map->entries = calloc(size, sizeof(lisp_ptrmap_entry_t))) == NULL)
+		return -1;
+	return 0;
+}
+
+void lisp_ptrmap_free(lisp_ptrmap_t *map) {
+	free(map->entries);
+}
+
+/* Returns where the value of key is kept, so it can be changed in place. */
+uint32_t *lisp_ptrmap_ref(const lisp_ptrmap_t *map, const lisp_data_t *key) {
+	size_t i = hash_ptr(key, map->size);
+
+	while(map->entries[i].key) {
+		if(map->entries[i].key == key)
+			return &map->entries[i].val;
+		i = (i + 1) & (map->size - 1);
+	}
+	return NULL;
+}
+
+int lisp_ptrmap_find(const lisp_ptrmap_t *map, const lisp_data_t *key, uint32_t *val) {
+	const uint32_t *ref = lisp_ptrmap_ref(map, key);
+
+	if(ref)
+		*val = *ref;
+	return ref != NULL;
+}
+
+static int ptrmap_reserve(lisp_ptrmap_t *map) {
+	lisp_ptrmap_t bigger;
+	size_t i;
+
+	if(2 * (map->used + 1) <= map->size)
+		return 0;
+
+	if(lisp_ptrmap_init(&bigger, 2 * map->size) == -1)
+		return -1;
+	for(i = 0; i < map->size; i++)
+		if(map->entries[i].key)
+			lisp_ptrmap_insert(&bigger, map->entries[i].key, map->entries[i].val);
+	lisp_ptrmap_free(map);
+	*map = bigger;
+
+	return 0;
+}
+
+int lisp_ptrmap_insert(lisp_ptrmap_t *map, const lisp_data_t *key, const uint32_t val) {
+	size_t i;
+
+	if(ptrmap_reserve(map) == -1)
+		return -1;
+
+	i = hash_ptr(key, map->size);
+	while(map->entries[i].key)
+		i = (i + 1) & (map->size - 1);
+
+	map->entries[i].key = key;
+	map->entries[i].val = val;
+	map->used++;
+
+	return 0;
+}
+
+/* Looks up key and adds it with val if it is missing, in a single probe.
+ * Returns 1 and sets *found when it was there already. */
+int lisp_ptrmap_intern(lisp_ptrmap_t *map, const lisp_data_t *key, const uint32_t val, uint32_t *found) {
+	size_t i;
+
+	if(ptrmap_reserve(map) == -1)
+		return -1;
+
+	i = hash_ptr(key, map->size);
+	while(map->entries[i].key) {
+		if(map->entries[i].key == key) {
+			*found = map->entries[i].val;
+			return 1;
+		}
+		i = (i + 1) & (map->size - 1);
+	}
+
+	map->entries[i].key = key;
+	map->entries[i].val = val;
+	map->used++;
+
+	return 0;
+}
+
+/* SYMBOL TABLE */
+
+typedef struct symtab_t {
+	const char **names;
+	uint32_t *vals;
+	size_t size;
+	size_t used;
+} symtab_t;
+
+static size_t hash_name(const char *name, const size_t size) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while(*name)
+		h = (h ^ (unsigned char)*(name++)) * 0x100000001b3ULL;
+
+	return (size_t)(h ^ (h >> 32)) & (size - 1);
+}
+
+static int symtab_init(symtab_t *tab, const size_t size) {
+	tab->size = size;
+	tab->used = 0;
+	tab->names = calloc(size, sizeof(char*));
+	tab->vals = malloc(size * sizeof(uint32_t));
+
+	if(!tab->names || !tab->vals) {
+		free(tab->names);
+		free(tab->vals);
+		return -1;
+	}
+	return 0;
+}
+
+static void symtab_free(symtab_t *tab) {
+	free(tab->names);
+	free(tab->vals);
+}
+
+static size_t symtab_slot(const symtab_t *tab, const char *name) {
+	size_t i = hash_name(name, tab->size);
+
+	while(tab->names[i] && strcmp(tab->names[i], name))
+		i = (i + 1) & (tab->size - 1);
+
+	return i;
+}
+
+static int symtab_insert(symtab_t *tab, const char *name, const uint32_t val) {
+	symtab_t bigger;
+	size_t i;
+
+	if(2 * (tab->used + 1) > tab->size) {
+		if(symtab_init(&bigger, 2 * tab->size) == -1)
+			return -1;
+		for(i = 0; i < tab->size; i++)
+			if(tab->names[i])
+				symtab_insert(&bigger, tab->names[i], tab->vals[i]);
+		symtab_free(tab);
+		*tab = bigger;
+	}
+
+	i = symtab_slot(tab, name);
+	tab->names[i] = name;
+	tab->vals[i] = val;
+	tab->used++;
+
+	return 0;
+}
+
+/* OUTPUT */
+
+typedef struct encoder_t {
+	lisp_buffer_t *buf;
+	lisp_ptrmap_t objects;
+	symtab_t symbols;
+	uint32_t n_objects, n_symbols;
+	const lisp_ctx_t *context;
+} encoder_t;
+
+static void put_byte(const unsigned char val, lisp_buffer_t *buf) {
+	buf->data[buf->len++] = val;
+}
+
+static void put_varint(uint32_t val, lisp_buffer_t *buf) {
+	while(val >= 0x80) {
+		put_byte((unsigned char)(val | 0x80), buf);
+		val >>= 7;
+	}
+	put_byte((unsigned char)val, buf);
+}
+
+static void put_u32(const uint32_t val, unsigned char *out) {
+	out[0] = val & 0xff;
+	out[1] = (val >> 8) & 0xff;
+	out[2] = (val >> 16) & 0xff;
+	out[3] = (val >> 24) & 0xff;
+}
+
+static int put_text(const unsigned char tag, const char *text, lisp_buffer_t *buf) {
+	size_t len = strlen(text);
+
+	if((len > UINT32_MAX) || (reserve(buf, 6 + len) == -1))
+		return -1;
+
+	put_byte(tag, buf);
+	put_varint((uint32_t)len, buf);
+	memcpy(buf->data + buf->len, text, len);
+	buf->len += len;
+
+	return 0;
+}
+
+static int put_atom(const lisp_data_t *d, encoder_t *enc) {
+	lisp_buffer_t *buf = enc->buf;
+	const char *name;
+	uint64_t bits;
+	uint32_t zigzag;
+	int i;
+
+	switch(d->type) {
+		case lisp_type_integer:
+			zigzag = ((uint32_t)d->integer << 1) ^ (uint32_t)(d->integer >> 31);
+			put_byte(TAG_INT, buf);
+			put_varint(zigzag, buf);
+			return 0;
+		case lisp_type_decimal:
+			memcpy(&bits, &d->decimal, sizeof(bits));
+			put_byte(TAG_DECIMAL, buf);
+			for(i = 0; i < 8; i++)
+				put_byte((unsigned char)(bits >> (8 * i)), buf);
+			return 0;
+		case lisp_type_string:
+			return put_text(TAG_STRING, d->string, buf);
+		case lisp_type_error:
+			return put_text(TAG_ERROR, d->error, buf);
+		case lisp_type_prim:
+		case lisp_type_vprim:
+			if((name = lisp_prim_name(d, enc->context)) == NULL)
+				return -1;
+			return put_text(TAG_PRIM, name, buf);
+		default:
+			return -1;
+	}
+}
+
+static int put_symbol(const lisp_data_t *d, encoder_t *enc) {
+	size_t slot = symtab_slot(&enc->symbols, d->symbol);
+
+	if(enc->symbols.names[slot]) {
+		put_byte(TAG_SYMREF, enc->buf);
+		put_varint(enc->symbols.vals[slot], enc->buf);
+		return 0;
+	}
+
+	if(symtab_insert(&enc->symbols, d->symbol, enc->n_symbols++) == -1)
+		return -1;
+	return put_text(TAG_SYMBOL, d->symbol, enc->buf);
+}
+
+static int put_datum(const lisp_data_t *d, encoder_t *enc);
+
+static int put_vector(const lisp_data_t *d, encoder_t *enc) {
+	size_t i;
+
+	if(d->vector->length > UINT32_MAX)
+		return -1;
+
+	put_byte(TAG_VECTOR, enc->buf);
+	put_varint((uint32_t)d->vector->length, enc->buf);
+	for(i = 0; i < d->vector->length; i++)
+		if(put_datum(d->vector->items[i], enc) == -1)
+			return -1;
+	return 0;
+}
+
+/* f64 and s64 elements are both eight bytes, written like decimals. */
+static int put_numvector(const lisp_data_t *d, encoder_t *enc) {
+	size_t i;
+	uint64_t bits;
+	int j;
+
+	if((d->numvector->length > UINT32_MAX) || (reserve(enc->buf, 6 + 8 * d->numvector->length) == -1))
+		return -1;
+
+	put_byte((d->type == lisp_type_f64vector) ? TAG_F64VECTOR : TAG_S64VECTOR, enc->buf);
+	put_varint((uint32_t)d->numvector->length, enc->buf);
+	for(i = 0; i < d->numvector->length; i++) {
+		memcpy(&bits, d->numvector->s64 + i, sizeof(bits));
+		for(j = 0; j < 8; j++)
+			put_byte((unsigned char)(bits >> (8 * j)), enc->buf);
+	}
+	return 0;
+}
+
+static int put_hashtable(const lisp_data_t *d, encoder_t *enc) {
+	lisp_data_t *key, *value;
+	size_t pos = 0;
+
+	if(d->hashtable->count > UINT32_MAX)
+		return -1;
+
+	put_byte(TAG_HASHTABLE, enc->buf);
+	put_byte((unsigned char)(d->hashtable->kind | d->hashtable->weak), enc->buf);
+	put_varint((uint32_t)d->hashtable->count, enc->buf);
+	while(lisp_hashtable_next(d, &pos, &key, &value))
+		if((put_datum(key, enc) == -1) || (put_datum(value, enc) == -1))
+			return -1;
+	return 0;
+}
+
+/* Lists are walked along their cdrs in a loop, only cars and the elements of
+ * vectors recurse. */
+static int put_datum(const lisp_data_t *d, encoder_t *enc) {
+	uint32_t ref;
+
+	while(1) {
+		if(reserve(enc->buf, 16) == -1)
+			return -1;
+
+		if(!d) {
+			put_byte(TAG_NIL, enc->buf);
+			return 0;
+		}
+
+		if(d->type == lisp_type_symbol)
+			return put_symbol(d, enc);
+		if((d->type != lisp_type_pair) && (d->type != lisp_type_vector) && (d->type != lisp_type_f64vector) && (d->type != lisp_type_s64vector) &&
+		   (d->type != lisp_type_hashtable) && (d->type != lisp_type_weakbox) && (d->type != lisp_type_strbuf))
+			return put_atom(d, enc);
+
+		switch(lisp_ptrmap_intern(&enc->objects, d, enc->n_objects, &ref)) {
+			case -1:
+				return -1;
+			case 1:
+				put_byte(TAG_REF, enc->buf);
+				put_varint(ref, enc->buf);
+				return 0;
+		}
+		enc->n_objects++;
+
+		if(d->type == lisp_type_vector)
+			return put_vector(d, enc);
+		if(d->type == lisp_type_hashtable)
+			return put_hashtable(d, enc);
+		if(d->type == lisp_type_weakbox) {
+			put_byte(TAG_WEAKBOX, enc->buf);
+			put_byte((unsigned char)d->weakbox->broken, enc->buf);
+			return put_datum(d->weakbox->value, enc);
+		}
+		if(d->type == lisp_type_strbuf)
+			return put_text(TAG_STRBUF, d->strbuf->data, enc->buf);
+		if(d->type != lisp_type_pair)
+			return put_numvector(d, enc);
+
+		put_byte(TAG_PAIR, enc->buf);
+		if(put_datum(lisp_car(d), enc) == -1)
+			return -1;
+		d = lisp_cdr(d);
+	}
+}
+
+int lisp_serialize(const lisp_data_t *data, lisp_buffer_t *buf, lisp_ctx_t *context) {
+	size_t start = buf->len;
+	encoder_t enc;
+	int out;
+
+	enc.buf = buf;
+	enc.n_objects = 0;
+	enc.n_symbols = 0;
+	enc.context = context;
+
+	if(lisp_ptrmap_init(&enc.objects, 256) == -1)
+		return -1;
+	if(symtab_init(&enc.symbols, 64) == -1) {
+		lisp_ptrmap_free(&enc.objects);
+		return -1;
+	}
+
+	if((out = reserve(buf, HEADER_SIZE)) == 0) {
+		buf->len += HEADER_SIZE;
+		out = put_datum(data, &enc);
+	}
+
+	if(out == 0) {
+		buf->data[start] = SERIAL_VERSION;
+		put_u32(enc.n_objects, buf->data + start + 1);
+		put_u32(enc.n_symbols, buf->data + start + 5);
+	} else {
+		buf->len = start;
+	}
+
+	symtab_free(&enc.symbols);
+	lisp_ptrmap_free(&enc.objects);
+
+	return out;
+}
+
+/* INPUT */
+
+typedef struct decoder_t {
+	const unsigned char *pos, *end;
+	lisp_data_t **objects, **symbols;
+	uint32_t n_objects, n_symbols;
+	uint32_t max_objects, max_symbols;
+	lisp_ctx_t *context;
+	int error;
+} decoder_t;
+
+static uint32_t get_varint(decoder_t *dec) {
+	uint32_t out = 0;
+	int shift;
+
+	for(shift = 0; (shift < 35) && (dec->pos < dec->end); shift += 7) {
+		out |= (uint32_t)(*dec->pos & 0x7f) << shift;
+		if(!(*(dec->pos++) & 0x80))
+			return out;
+	}
+
+	dec->error = 1;
+	return 0;
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+	return in[0] | (in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static const char *get_text(decoder_t *dec, uint32_t *len) {
+	const char *out;
+
+	*len = get_varint(dec);
+	if(dec->error || ((size_t)(dec->end - dec->pos) < *len)) {
+		dec->error = 1;
+		return NULL;
+	}
+
+	out = (const char*)dec->pos;
+	dec->pos += *len;
+	return out;
+}
+
+/* Errors and primitive names are looked up or stored as C strings. */
+static char *get_name(decoder_t *dec) {
+	const char *text;
+	uint32_t len;
+	char *out;
+
+	if((text = get_text(dec, &len)) == NULL)
+		return NULL;
+	if((out = malloc((size_t)len + 1)) == NULL)
+		return NULL;
+
+	memcpy(out, text, len);
+	out[len] = '\0';
+	return out;
+}
+
+static lisp_data_t *number(lisp_data_t *d, decoder_t *dec) {
+	if(!d || (dec->n_objects >= dec->max_objects)) {
+		dec->error = 1;
+		return NULL;
+	}
+	return dec->objects[dec->n_objects++] = d;
+}
+
+static lisp_data_t *made(lisp_data_t *d, decoder_t *dec) {
+	if(!d)
+		dec->error = 1;
+	return d;
+}
+
+static lisp_data_t *get_atom(const unsigned char tag, decoder_t *dec) {
+	lisp_ctx_t *context = dec->context;
+	const char *text;
+	lisp_data_t *d;
+	uint64_t bits = 0;
+	uint32_t len, val;
+	double decimal;
+	char *name;
+	int i;
+
+	switch(tag) {
+		case TAG_NIL:
+			return NULL;
+		case TAG_INT:
+			val = get_varint(dec);
+			return made(lisp_make_int((int)((val >> 1) ^ (0u - (val & 1))), context), dec);
+		case TAG_DECIMAL:
+			if(dec->end - dec->pos < 8)
+				break;
+			for(i = 0; i < 8; i++)
+				bits |= (uint64_t)*(dec->pos++) << (8 * i);
+			memcpy(&decimal, &bits, sizeof(decimal));
+			return made(lisp_make_decimal(decimal, context), dec);
+		case TAG_STRING:
+			if((text = get_text(dec, &len)) == NULL)
+				break;
+			return made(lisp_make_stringn(text, len, context), dec);
+		case TAG_ERROR:
+			if((name = get_name(dec)) == NULL)
+				break;
+			d = lisp_make_error(name, context);
+			free(name);
+			return made(d, dec);
+		case TAG_PRIM:
+			if((name = get_name(dec)) == NULL)
+				break;
+			d = lisp_make_named_prim(name, context);
+			free(name);
+			if(!d)
+				break;
+			return made(d, dec);
+		case TAG_SYMBOL:
+			if((text = get_text(dec, &len)) == NULL)
+				break;
+			if(dec->n_symbols >= dec->max_symbols)
+				break;
+			if((dec->symbols[dec->n_symbols] = lisp_make_symboln(text, len, context)) == NULL)
+				break;
+			return dec->symbols[dec->n_symbols++];
+		case TAG_SYMREF:
+			val = get_varint(dec);
+			if(dec->error || (val >= dec->n_symbols))
+				break;
+			return dec->symbols[val];
+		case TAG_REF:
+			val = get_varint(dec);
+			if(dec->error || (val >= dec->n_objects))
+				break;
+			return dec->objects[val];
+	}
+
+	dec->error = 1;
+	return NULL;
+}
+
+static lisp_data_t *get_datum(decoder_t *dec);
+
+/* Numbered before its elements are read, like a pair before its car. */
+static lisp_data_t *get_vector(decoder_t *dec) {
+	uint32_t length = get_varint(dec), i;
+	lisp_data_t *out;
+
+	/* Every element takes at least one byte. */
+	if(dec->error || (length > (size_t)(dec->end - dec->pos))) {
+		dec->error = 1;
+		return NULL;
+	}
+
+	if((out = number(lisp_make_vector(length, NULL, dec->context), dec)) == NULL)
+		return NULL;
+	for(i = 0; (i < length) && !dec->error; i++)
+		out->vector->items[i] = get_datum(dec);
+
+	return out;
+}
+
+static lisp_data_t *get_numvector(const unsigned char tag, decoder_t *dec) {
+	uint32_t length = get_varint(dec), i;
+	uint64_t bits;
+	lisp_data_t *out;
+	int j;
+
+	if(dec->error || (length > (size_t)(dec->end - dec->pos) / 8)) {
+		dec->error = 1;
+		return NULL;
+	}
+
+	out = (tag == TAG_F64VECTOR) ? lisp_make_f64vector(length, dec->context) : lisp_make_s64vector(length, dec->context);
+	if((out = number(out, dec)) == NULL)
+		return NULL;
+	for(i = 0; i < length; i++) {
+		for(bits = 0, j = 0; j < 8; j++)
+			bits |= (uint64_t)*(dec->pos++) << (8 * j);
+		memcpy(out->numvector->s64 + i, &bits, sizeof(bits));
+	}
+
+	return out;
+}
+
+/* Each entry takes at least two bytes. Keys are hashed as they are read, so
+ * a key that refers back to a datum that is still being read may hash
+ * differently from the finished one. */
+static lisp_data_t *get_hashtable(decoder_t *dec) {
+	lisp_data_t *out, *key, *value;
+	uint32_t count, i;
+	int kind;
+
+	if(dec->pos >= dec->end) {
+		dec->error = 1;
+		return NULL;
+	}
+	kind = *(dec->pos++);
+	count = get_varint(dec);
+	if(dec->error || ((kind & ~LISP_HASH_WEAK) > LISP_HASH_STRING) || (count > (size_t)(dec->end - dec->pos) / 2)) {
+		dec->error = 1;
+		return NULL;
+	}
+
+	if((out = number(lisp_make_hashtable(kind, dec->context), dec)) == NULL)
+		return NULL;
+	for(i = 0; (i < count) && !dec->error; i++) {
+		key = get_datum(dec);
+		value = get_datum(dec);
+		if(!dec->error && (lisp_hashtable_set(out, key, value) == -1))
+			dec->error = 1;
+	}
+
+	return out;
+}
+
+static lisp_data_t *get_strbuf(decoder_t *dec) {
+	lisp_data_t *out;
+	const char *text;
+	uint32_t len;
+
+	if((text = get_text(dec, &len)) == NULL)
+		return NULL;
+	if((out = number(lisp_make_strbuf(dec->context), dec)) == NULL)
+		return NULL;
+	if(lisp_strbuf_append(out, text, len) == -1)
+		dec->error = 1;
+
+	return out;
+}
+
+static lisp_data_t *get_weakbox(decoder_t *dec) {
+	lisp_data_t *out;
+
+	if((dec->pos >= dec->end) || (*dec->pos > 1)) {
+		dec->error = 1;
+		return NULL;
+	}
+
+	if((out = number(lisp_make_weak_box(NULL, dec->context), dec)) == NULL)
+		return NULL;
+	out->weakbox->broken = *(dec->pos++);
+	out->weakbox->value = get_datum(dec);
+
+	return out;
+}
+
+/* Mirrors put_datum(): a run of pairs along the cdrs is linked up in a loop,
+ * each pair numbered before its car is read so references to it resolve. */
+static lisp_data_t *get_datum(decoder_t *dec) {
+	lisp_data_t *out = NULL, *last = NULL, *d;
+	lisp_ctx_t *context = dec->context;
+	unsigned char tag;
+
+	while(!dec->error) {
+		if(dec->pos >= dec->end) {
+			dec->error = 1;
+			break;
+		}
+
+		if((tag = *(dec->pos++)) == TAG_PAIR) {
+			if((d = number(lisp_cons(NULL, NULL), dec)) == NULL)
+				break;
+		} else if(tag == TAG_VECTOR) {
+			d = get_vector(dec);
+		} else if((tag == TAG_F64VECTOR) || (tag == TAG_S64VECTOR)) {
+			d = get_numvector(tag, dec);
+		} else if(tag == TAG_HASHTABLE) {
+			d = get_hashtable(dec);
+		} else if(tag == TAG_WEAKBOX) {
+			d = get_weakbox(dec);
+		} else if(tag == TAG_STRBUF) {
+			d = get_strbuf(dec);
+		} else {
+			d = get_atom(tag, dec);
+		}
+
+		if(last)
+			lisp_set_cdr(last, d);
+		else
+			out = d;
+
+		if(tag != TAG_PAIR)
+			break;
+
+		last = d;
+		lisp_set_car(d, get_datum(dec));
+	}
+
+	return dec->error ? NULL : out;
+}
+
+lisp_data_t *lisp_deserialize(const void *data, const size_t len, size_t *readto, int *error, lisp_ctx_t *context) {
+	const unsigned char *in = (const unsigned char*)data;
+	lisp_data_t *out = NULL;
+	decoder_t dec;
+
+	*error = 1;
+	if(readto)
+		*readto = 0;
+
+	if((len < HEADER_SIZE) || (in[0] != SERIAL_VERSION))
+		return NULL;
+
+	dec.pos = in + HEADER_SIZE;
+	dec.end = in + len;
+	dec.max_objects = get_u32(in + 1);
+	dec.max_symbols = get_u32(in + 5);
+	dec.n_objects = 0;
+	dec.n_symbols = 0;
+	dec.context = context;
+	dec.error = 0;
+
+	/* Every record takes at least one byte, anything else is corrupt. */
+	if((dec.max_objects > len) || (dec.max_symbols > len))
+		return NULL;
+
+	dec.objects = malloc(((size_t)dec.max_objects + dec.max_symbols + 1) * sizeof(lisp_data_t*));
+	if(!dec.objects)
+		return NULL;
+	dec.symbols = dec.objects + dec.max_objects;
+
+	out = get_datum(&dec);
+	free(dec.objects);
+
+	if(dec.error)
+		return NULL;
+
+	*error = 0;
+	if(readto)
+		*readto = dec.pos - in;
+
+	return out;
+}
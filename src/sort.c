@@ -0,0 +1,366 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/mem.h"
+
+/* All sorts are stable and work on an array the items are copied into. With
+ * a procedure to call that is a merge sort: runs of RUN items are sorted by
+ * insertion and then merged bottom-up, switching between the array and a
+ * buffer of the same size. */
+
+#define RUN	16
+
+static lisp_data_t *sort_error(const char *name, const char *what, lisp_ctx_t *context) {
+	char msg[64];
+
+	snprintf(msg, sizeof(msg), "%s -- %s", name, what);
+	return lisp_make_error(msg, context);
+}
+
+/* NUMBERS */
+
+/* With the builtin < or > and nothing but numbers in the sequence, the
+ * procedure is never called. Each number gets a 64 bit key that orders like
+ * its value as a double, and the keys go through a least significant digit
+ * radix sort, one byte per pass, which is stable. A pass is skipped where all
+ * keys have the same byte, as the low bytes of small integers do. > sorts by
+ * the complemented keys. */
+
+typedef struct keyed_t {
+	uint64_t key;
+	lisp_data_t *item;
+} keyed_t;
+
+static uint64_t key_of(const lisp_data_t *number, const int descending) {
+	double d = (number->type == lisp_type_integer) ? (double)number->integer : number->decimal;
+	uint64_t u;
+
+	/* -0.0 and 0.0 are equal to <. */
+	if(d == 0)
+		d = 0;
+	memcpy(&u, &d, sizeof(u));
+	u = (u >> 63) ? ~u : (u | ((uint64_t)1 << 63));
+	return descending ? ~u : u;
+}
+
+static void insert_keyed(keyed_t *a, const size_t n) {
+	keyed_t x;
+	size_t i, j;
+
+	for(i = 1; i < n; i++) {
+		x = a[i];
+		for(j = i; (j > 0) && (x.key < a[j - 1].key); j--)
+			a[j] = a[j - 1];
+		a[j] = x;
+	}
+}
+
+/* Leaves the sorted keys in a, b is a buffer of the same size. */
+static void radix_keyed(keyed_t *a, keyed_t *b, const size_t n) {
+	size_t counts[8][256], i, sum, count;
+	keyed_t *src = a, *dst = b, *t;
+	int pass;
+
+	memset(counts, 0, sizeof(counts));
+	for(i = 0; i < n; i++)
+		for(pass = 0; pass < 8; pass++)
+			counts[pass][(a[i].key >> (8 * pass)) & 0xff]++;
+
+	for(pass = 0; pass < 8; pass++) {
+		if(counts[pass][(src[0].key >> (8 * pass)) & 0xff] == n)
+			continue;
+		for(i = 0, sum = 0; i < 256; i++) {
+			count = counts[pass][i];
+			counts[pass][i] = sum;
+			sum += count;
+		}
+		for(i = 0; i < n; i++)
+			dst[counts[pass][(src[i].key >> (8 * pass)) & 0xff]++] = src[i];
+		t = src; src = dst; dst = t;
+	}
+	if(src != a)
+		memcpy(a, src, n * sizeof(keyed_t));
+}
+
+/* Returns 1 when sorted, 0 if out of memory and -1 if an item is not a
+ * number. */
+static int sort_keyed(lisp_data_t **items, const size_t n, const int descending, lisp_ctx_t *context) {
+	keyed_t *a;
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		if(!items[i] || ((items[i]->type != lisp_type_integer) && (items[i]->type != lisp_type_decimal)))
+			return -1;
+	if((a = lisp_scratch(2 * n * sizeof(keyed_t), NULL, context)) == NULL)
+		return 0;
+
+	for(i = 0; i < n; i++) {
+		a[i].key = key_of(items[i], descending);
+		a[i].item = items[i];
+	}
+	if(n < 4 * RUN)
+		insert_keyed(a, n);
+	else
+		radix_keyed(a, a + n, n);
+
+	for(i = 0; i < n; i++)
+		items[i] = a[i].item;
+	lisp_unscratch(a, context);
+	return 1;
+}
+
+/* Returns 1 for < and -1 for > when proc is the builtin primitive. */
+static int builtin_order(const lisp_data_t *proc) {
+	const lisp_data_t *impl;
+
+	if(!proc || (proc->type != lisp_type_pair) || !lisp_car(proc) || (lisp_car(proc)->type != lisp_type_symbol) || strcmp(lisp_car(proc)->symbol, "primitive"))
+		return 0;
+	if(!(impl = lisp_cadr(proc)) || (impl->type != lisp_type_vprim) || !lisp_is_builtin_prim(impl->def))
+		return 0;
+
+	if(!strcmp(impl->def->name, "<"))
+		return 1;
+	if(!strcmp(impl->def->name, ">"))
+		return -1;
+	return 0;
+}
+
+/* ANY PROCEDURE */
+
+/* Any other procedure is called as (proc a b) and has to say whether a goes
+ * before b. The first error it returns ends the sort. The collector does not
+ * run during an evaluation, and n log n calls leave a lot of garbage, so
+ * whatever the calls allocated is collected each time it has grown as large
+ * as the heap the sort started with. */
+
+#define MIN_GARBAGE	(16 << 20)
+
+typedef struct order_t {
+	const lisp_data_t *proc;
+	lisp_data_t *error;
+	size_t since, garbage, limit;
+	lisp_ctx_t *context;
+} order_t;
+
+static int before(lisp_data_t *a, lisp_data_t *b, order_t *order) {
+	lisp_data_t *args[2], *val;
+	int out;
+
+	if(order->error)
+		return 0;
+
+	args[0] = a;
+	args[1] = b;
+	val = lisp_apply(order->proc, 2, args, order->context);
+
+	if(val && (val->type == lisp_type_error)) {
+		order->error = val;
+		return 0;
+	}
+	out = !val || (val->type != lisp_type_symbol) || strcmp(val->symbol, "#f");
+
+	if(order->context->mem_allocated > order->limit) {
+		lisp_gc_since(order->since, order->context);
+		order->limit = order->context->mem_allocated + order->garbage;
+	}
+	return out;
+}
+
+static void insert_items(lisp_data_t **a, const size_t lo, const size_t hi, order_t *order) {
+	lisp_data_t *x;
+	size_t i, j;
+
+	for(i = lo + 1; (i < hi) && !order->error; i++) {
+		x = a[i];
+		for(j = i; (j > lo) && before(x, a[j - 1], order); j--)
+			a[j] = a[j - 1];
+		a[j] = x;
+	}
+}
+
+static void merge_items(lisp_data_t *const *src, lisp_data_t **dst, const size_t lo, const size_t mid, const size_t hi, order_t *order) {
+	size_t i = lo, j = mid, k = lo;
+
+	while((i < mid) && (j < hi))
+		dst[k++] = before(src[j], src[i], order) ? src[j++] : src[i++];
+	memcpy(dst + k, src + i, (mid - i) * sizeof(lisp_data_t*));
+	memcpy(dst + k + mid - i, src + j, (hi - j) * sizeof(lisp_data_t*));
+}
+
+/* Returns NULL when done, otherwise the error. */
+static lisp_data_t *sort_items(lisp_data_t **items, const size_t n, const lisp_data_t *proc, const char *name, lisp_ctx_t *context) {
+	lisp_data_t **a = items, **b, **t, *out = NULL;
+	order_t order;
+	size_t i, width;
+	int dir, done;
+
+	if(n < 2)
+		return NULL;
+	if((dir = builtin_order(proc)) && ((done = sort_keyed(items, n, dir < 0, context)) >= 0))
+		return done ? NULL : sort_error(name, "Out of memory", context);
+
+	if((b = lisp_scratch(n * sizeof(lisp_data_t*), NULL, context)) == NULL)
+		return sort_error(name, "Out of memory", context);
+	order.proc = proc;
+	order.error = NULL;
+	order.since = lisp_heap_serial(context);
+	order.garbage = (context->mem_allocated > MIN_GARBAGE) ? context->mem_allocated : MIN_GARBAGE;
+	order.limit = context->mem_allocated + order.garbage;
+	order.context = context;
+
+	for(i = 0; i < n; i += RUN)
+		insert_items(a, i, (n - i < RUN) ? n : i + RUN, &order);
+	for(width = RUN; (width < n) && !order.error; width *= 2) {
+		for(i = 0; i < n; i += 2 * width)
+			merge_items(a, b, i, (n - i < width) ? n : i + width, (n - i < 2 * width) ? n : i + 2 * width, &order);
+		t = a; a = b; b = t;
+	}
+
+	if(order.error)
+		out = order.error;
+	else if(a != items)
+		memcpy(items, a, n * sizeof(lisp_data_t*));
+	lisp_unscratch((a == items) ? b : a, context);
+	return out;
+}
+
+/* SEQUENCES */
+
+/* Copies the items of a list or vector into a new array, *n is set to their
+ * number. Returns NULL and sets *n to 0 for an empty sequence. *error is 1
+ * when out of memory, 2 for an improper and 3 for a circular list. The array
+ * is scratch memory, the comparisons may abort the evaluation. */
+static lisp_data_t **collect(const lisp_data_t *seq, size_t *n, int *error, lisp_ctx_t *context) {
+	const lisp_data_t *list;
+	lisp_data_t **out;
+	long pairs;
+	size_t i;
+
+	*error = 0;
+	*n = 0;
+	if(seq && (seq->type == lisp_type_vector)) {
+		if((*n = seq->vector->length) == 0)
+			return NULL;
+		if((out = lisp_scratch(*n * sizeof(lisp_data_t*), NULL, context)) == NULL)
+			*error = 1;
+		else
+			memcpy(out, seq->vector->items, *n * sizeof(lisp_data_t*));
+		return out;
+	}
+
+	if((pairs = lisp_count_pairs(seq, context)) < 0) {
+		*error = (pairs == LISP_LIST_CIRCULAR) ? 3 : 2;
+		return NULL;
+	}
+	if((*n = (size_t)pairs) == 0)
+		return NULL;
+
+	if((out = lisp_scratch(*n * sizeof(lisp_data_t*), NULL, context)) == NULL) {
+		*error = 1;
+		return NULL;
+	}
+	for(i = 0, list = seq; list; list = lisp_cdr(list))
+		out[i++] = lisp_car(list);
+	return out;
+}
+
+/* n is the length collect() found, so a list is known to end. */
+static int is_frozen(const lisp_data_t *seq, size_t n, const lisp_ctx_t *context) {
+	if(seq && (seq->type == lisp_type_vector))
+		return lisp_is_immutable(seq, context);
+
+	for(; n-- > 0; seq = lisp_cdr(seq))
+		if(lisp_is_immutable(seq, context))
+			return 1;
+	return 0;
+}
+
+static lisp_data_t *sort_seq(lisp_data_t *seq, const lisp_data_t *proc, const int in_place, const char *name, lisp_ctx_t *context) {
+	lisp_data_t **items, *out = NULL, *list;
+	size_t n, i;
+	int error;
+
+	items = collect(seq, &n, &error, context);
+	if(error)
+		return sort_error(name, (error == 1) ? "Out of memory" : (error == 3) ? "Circular list" : "Expected list", context);
+	if(in_place && is_frozen(seq, n, context)) {
+		lisp_unscratch(items, context);
+		return sort_error(name, (seq->type == lisp_type_vector) ? "Immutable vector" : "Immutable pair", context);
+	}
+	if((out = sort_items(items, n, proc, name, context)) != NULL) {
+		lisp_unscratch(items, context);
+		return out;
+	}
+
+	if(in_place) {
+		if(seq && (seq->type == lisp_type_vector))
+			memcpy(seq->vector->items, items, n * sizeof(lisp_data_t*));
+		else
+			for(i = 0, list = seq; list; list = lisp_cdr(list))
+				list->pair->l = items[i++];
+		out = seq;
+	} else if(seq && (seq->type == lisp_type_vector)) {
+		if((out = lisp_make_vector(n, NULL, context)) == NULL)
+			out = sort_error(name, "Out of memory", context);
+		else if(n)
+			memcpy(out->vector->items, items, n * sizeof(lisp_data_t*));
+	} else {
+		for(i = n; i > 0; i--)
+			if((out = lisp_cons(items[i - 1], out)) == NULL) {
+				out = sort_error(name, "Out of memory", context);
+				break;
+			}
+	}
+
+	lisp_unscratch(items, context);
+	return out;
+}
+
+/* (sort seq less?) and (stable-sort seq less?) return a new sequence of the
+ * same kind, (sort! seq less?) reorders seq itself and returns it. */
+static lisp_data_t *prim_sort(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return sort_seq(argv[0], argv[1], 0, "SORT", context);
+}
+
+static lisp_data_t *prim_stable_sort(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return sort_seq(argv[0], argv[1], 0, "STABLE-SORT", context);
+}
+
+static lisp_data_t *prim_sort_in_place(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return sort_seq(argv[0], argv[1], 1, "SORT!", context);
+}
+
+#define SEQUENCE	(LISP_ARG_LIST | LISP_ARG(lisp_type_vector))
+#define ANY		LISP_ARG_ANY
+
+static const lisp_prim_def_t sort_prims[] = {
+	{ "sort", prim_sort, 2, 2, { SEQUENCE, ANY }, 0 },
+	{ "sort!", prim_sort_in_place, 2, 2, { SEQUENCE, ANY }, 0 },
+	{ "stable-sort", prim_stable_sort, 2, 2, { SEQUENCE, ANY }, 0 }
+};
+
+#undef SEQUENCE
+#undef ANY
+
+void lisp_add_sort_prims(lisp_ctx_t *context) {
+	size_t i;
+
+	for(i = 0; i < sizeof(sort_prims) / sizeof(sort_prims[0]); i++)
+		lisp_add_vprim(&sort_prims[i], context);
+}
@@ -0,0 +1,391 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define LISP_TEXT_SSE2
+#endif
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/mem.h"
+#include "libisp/print.h"
+#include "libisp/read.h"
+
+/* Strings are terminated byte arrays, indices and lengths count bytes. */
+
+/* SEARCH */
+
+#ifdef LISP_TEXT_SSE2
+/* Compares the first and the last byte of the needle at 32 positions at a
+ * time and only looks at the rest where both match. Loads are unaligned and
+ * stay inside the first n bytes, the tail is left to the scalar loop. */
+
+#ifdef _MSC_VER
+static int first_bit(const unsigned int mask) { unsigned long out; _BitScanForward(&out, mask); return (int)out; }
+#else
+#define first_bit(mask)		__builtin_ctz(mask)
+#endif
+
+static unsigned int candidates(const char *pos, const size_t m, const __m128i first, const __m128i last) {
+	const __m128i a = _mm_loadu_si128((const __m128i*)pos), b = _mm_loadu_si128((const __m128i*)(pos + m - 1));
+
+	return (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+}
+
+static const char *search_block(const char *hay, const size_t n, const char *needle, const size_t m, size_t *at) {
+	const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+	unsigned int mask;
+	size_t i;
+
+	for(i = 0; i + m - 1 + 32 <= n; i += 32) {
+		mask = candidates(hay + i, m, first, last) | (candidates(hay + i + 16, m, first, last) << 16);
+		for(; mask; mask &= mask - 1)
+			if(!memcmp(hay + i + first_bit(mask) + 1, needle + 1, m - 2))
+				return hay + i + first_bit(mask);
+	}
+
+	*at = i;
+	return NULL;
+}
+#endif
+
+/* First place in the n bytes at hay where the m bytes of needle are, or NULL.
+ * Single bytes go to memchr(), which the C library vectorizes already. */
+static const char *search(const char *hay, const size_t n, const char *needle, const size_t m) {
+#ifdef LISP_TEXT_SSE2
+	const char *out;
+#endif
+	size_t i = 0;
+
+	if(!m)
+		return hay;
+	if(m > n)
+		return NULL;
+	if(m == 1)
+		return memchr(hay, needle[0], n);
+
+#ifdef LISP_TEXT_SSE2
+	if((out = search_block(hay, n, needle, m, &i)) != NULL)
+		return out;
+#endif
+
+	for(; i + m <= n; i++)
+		if((hay[i] == needle[0]) && (hay[i + m - 1] == needle[m - 1]) && !memcmp(hay + i + 1, needle + 1, m - 2))
+			return hay + i;
+	return NULL;
+}
+
+/* STRING BUILDERS */
+
+lisp_data_t *lisp_make_strbuf(lisp_ctx_t *context) {
+	lisp_data_t *out;
+	char *data;
+
+	if((data = malloc(16)) == NULL)
+		return NULL;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t) + sizeof(lisp_strbuf_t), context))) {
+		free(data);
+		return NULL;
+	}
+
+	out->type = lisp_type_strbuf;
+	out->strbuf = (lisp_strbuf_t*)(out + 1);
+	out->strbuf->data = data;
+	out->strbuf->data[0] = '\0';
+	out->strbuf->length = 0;
+	out->strbuf->size = 16;
+
+	return out;
+}
+
+/* Grows by doubling, so appending n bytes one piece at a time is O(n). */
+int lisp_strbuf_append(lisp_data_t *strbuf, const char *text, const size_t len) {
+	lisp_strbuf_t *buf = strbuf->strbuf;
+	size_t size = buf->size;
+	char *data;
+
+	if(len > (size_t)-1 / 2 - buf->length)
+		return -1;
+
+	while(buf->length + len + 1 > size)
+		size *= 2;
+	if(size != buf->size) {
+		if((data = realloc(buf->data, size)) == NULL)
+			return -1;
+		buf->data = data;
+		buf->size = size;
+	}
+
+	memcpy(buf->data + buf->length, text, len);
+	buf->length += len;
+	buf->data[buf->length] = '\0';
+	return 0;
+}
+
+/* PRIMITIVES */
+
+/* The evaluator has checked the types against text_prims[]. */
+
+static lisp_data_t *make_bool(const int val, lisp_ctx_t *context) { return lisp_make_symbol(val ? "#t" : "#f", context); }
+
+static lisp_data_t *make_index(const char *pos, const char *start, lisp_ctx_t *context) {
+	if(!pos)
+		return make_bool(0, context);
+	if(pos - start > INT_MAX)
+		return lisp_make_error("STRING -- Index out of range", context);
+	return lisp_make_int((int)(pos - start), context);
+}
+
+/* Optional start index argument i of a search in text of length len. */
+static int start_of(const int argc, lisp_data_t *const *argv, const int i, const size_t len, size_t *out) {
+	*out = 0;
+	if(argc <= i)
+		return 0;
+	if((argv[i]->integer < 0) || ((size_t)argv[i]->integer > len))
+		return -1;
+	*out = (size_t)argv[i]->integer;
+	return 0;
+}
+
+static lisp_data_t *prim_string_length(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t len = strlen(argv[0]->string);
+
+	if(len > INT_MAX)
+		return lisp_make_error("STRING-LENGTH -- String too long", context);
+	return lisp_make_int((int)len, context);
+}
+
+/* (substring s start [end]) */
+static lisp_data_t *prim_substring(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	size_t len = strlen(argv[0]->string), start, end;
+	lisp_data_t *out;
+
+	if((start_of(argc, argv, 1, len, &start) == -1) || (start_of(argc, argv, 2, len, &end) == -1) || ((argc > 2) && (end < start)))
+		return lisp_make_error("SUBSTRING -- Index out of range", context);
+	if(argc < 3)
+		end = len;
+
+	if((out = lisp_make_stringn(argv[0]->string + start, end - start, context)) == NULL)
+		return lisp_make_error("SUBSTRING -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_string_append(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	size_t len = 0, part;
+	char *buf;
+	int i;
+
+	for(i = 0; i < argc; i++)
+		len += strlen(argv[i]->string);
+
+	if((buf = malloc(len + 1)) == NULL)
+		return lisp_make_error("STRING-APPEND -- Out of memory", context);
+	for(len = 0, i = 0; i < argc; i++) {
+		part = strlen(argv[i]->string);
+		memcpy(buf + len, argv[i]->string, part);
+		len += part;
+	}
+
+	out = lisp_make_stringn(buf, len, context);
+	free(buf);
+	if(!out)
+		return lisp_make_error("STRING-APPEND -- Out of memory", context);
+	return out;
+}
+
+/* (string-index s c [start]) with c a string of one character, the index of
+ * its first occurrence or #f. */
+static lisp_data_t *prim_string_index(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	const char *s = argv[0]->string;
+	size_t len = strlen(s), start;
+
+	if(!argv[1]->string[0] || argv[1]->string[1])
+		return lisp_make_error("STRING-INDEX -- Expected one character", context);
+	if(start_of(argc, argv, 2, len, &start) == -1)
+		return lisp_make_error("STRING-INDEX -- Index out of range", context);
+
+	return make_index(memchr(s + start, argv[1]->string[0], len - start), s, context);
+}
+
+/* (string-search s pattern [start]), the index of the first occurrence or
+ * #f. */
+static lisp_data_t *prim_string_search(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	const char *s = argv[0]->string;
+	size_t len = strlen(s), start;
+
+	if(start_of(argc, argv, 2, len, &start) == -1)
+		return lisp_make_error("STRING-SEARCH -- Index out of range", context);
+
+	return make_index(search(s + start, len - start, argv[1]->string, strlen(argv[1]->string)), s, context);
+}
+
+/* (string-split s separator) splits at every occurrence, so the fields can
+ * be empty and there is always one more of them than separators. */
+static lisp_data_t *prim_string_split(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	const char *s = argv[0]->string, *sep = argv[1]->string, *end = s + strlen(s), *pos;
+	size_t m = strlen(sep);
+	lisp_data_t *out = NULL, *last = NULL, *item;
+
+	if(!m)
+		return lisp_make_error("STRING-SPLIT -- Empty separator", context);
+
+	while(1) {
+		if((pos = search(s, end - s, sep, m)) == NULL)
+			pos = end;
+		if(((item = lisp_make_stringn(s, pos - s, context)) == NULL) || ((item = lisp_cons(item, NULL)) == NULL))
+			return lisp_make_error("STRING-SPLIT -- Out of memory", context);
+		if(last)
+			lisp_set_cdr(last, item);
+		else
+			out = item;
+		last = item;
+
+		if(pos == end)
+			return out;
+		s = pos + m;
+	}
+}
+
+/* Takes what the reader takes as a number, anything else is #f. */
+static lisp_data_t *prim_string_to_number(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	const char *s = argv[0]->string;
+	double decimal;
+	int integer;
+
+	switch(lisp_parse_number(s, s + strlen(s), &integer, &decimal)) {
+		case lisp_type_integer: return lisp_make_int(integer, context);
+		case lisp_type_decimal: return lisp_make_decimal(decimal, context);
+		default: return make_bool(0, context);
+	}
+}
+
+/* Numbers come out the way they are printed. */
+static size_t format_number(const lisp_data_t *num, char *out) {
+	return (num->type == lisp_type_integer) ? lisp_format_int(num->integer, out) : lisp_format_decimal(num->decimal, out);
+}
+
+static lisp_data_t *prim_number_to_string(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	char number[LISP_NUMBER_MAX];
+
+	return lisp_make_stringn(number, format_number(argv[0], number), context);
+}
+
+static lisp_data_t *prim_make_string_builder(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if((out = lisp_make_strbuf(context)) == NULL)
+		return lisp_make_error("MAKE-STRING-BUILDER -- Out of memory", context);
+	return out;
+}
+
+static lisp_data_t *prim_is_string_builder(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	return make_bool(argv[0] && (argv[0]->type == lisp_type_strbuf), context);
+}
+
+/* (string-builder-append! b x ...) adds strings, symbols and numbers the way
+ * display shows them and returns b. */
+static lisp_data_t *prim_string_builder_append(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	char number[LISP_NUMBER_MAX];
+	const char *text;
+	size_t len;
+	int i;
+
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("STRING-BUILDER-APPEND! -- Immutable string builder", context);
+
+	for(i = 1; i < argc; i++) {
+		if(argv[i]->type == lisp_type_string)
+			len = strlen(text = argv[i]->string);
+		else if(argv[i]->type == lisp_type_symbol)
+			len = strlen(text = argv[i]->symbol);
+		else {
+			len = format_number(argv[i], number);
+			text = number;
+		}
+
+		if(lisp_strbuf_append(argv[0], text, len) == -1)
+			return lisp_make_error("STRING-BUILDER-APPEND! -- Out of memory", context);
+	}
+	return argv[0];
+}
+
+static lisp_data_t *prim_string_builder_length(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(argv[0]->strbuf->length > INT_MAX)
+		return lisp_make_error("STRING-BUILDER-LENGTH -- String too long", context);
+	return lisp_make_int((int)argv[0]->strbuf->length, context);
+}
+
+static lisp_data_t *prim_string_builder_to_string(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if((out = lisp_make_stringn(argv[0]->strbuf->data, argv[0]->strbuf->length, context)) == NULL)
+		return lisp_make_error("STRING-BUILDER->STRING -- Out of memory", context);
+	return out;
+}
+
+/* Keeps the memory for the next round. */
+static lisp_data_t *prim_string_builder_clear(const int argc, lisp_data_t *const *argv, lisp_ctx_t *context) {
+	if(lisp_is_immutable(argv[0], context))
+		return lisp_make_error("STRING-BUILDER-CLEAR! -- Immutable string builder", context);
+
+	argv[0]->strbuf->length = 0;
+	argv[0]->strbuf->data[0] = '\0';
+	return argv[0];
+}
+
+#define NUMBER		LISP_ARG_NUMBER
+#define INTEGER		LISP_ARG(lisp_type_integer)
+#define STRING		LISP_ARG(lisp_type_string)
+#define BUILDER		LISP_ARG(lisp_type_strbuf)
+#define TEXT		(LISP_ARG(lisp_type_string) | LISP_ARG(lisp_type_symbol) | LISP_ARG_NUMBER)
+#define ANY			LISP_ARG_ANY
+#define PURE		LISP_PRIM_PURE
+
+static const lisp_prim_def_t text_prims[] = {
+	{ "string-length", prim_string_length, 1, 1, { STRING }, PURE },
+	{ "substring", prim_substring, 2, 3, { STRING, INTEGER, INTEGER }, PURE },
+	{ "string-append", prim_string_append, 0, LISP_VARIADIC, LISP_ARGS_ALL(STRING), PURE },
+	{ "string-index", prim_string_index, 2, 3, { STRING, STRING, INTEGER }, PURE },
+	{ "string-search", prim_string_search, 2, 3, { STRING, STRING, INTEGER }, PURE },
+	{ "string-split", prim_string_split, 2, 2, { STRING, STRING }, PURE },
+	{ "string->number", prim_string_to_number, 1, 1, { STRING }, PURE },
+	{ "number->string", prim_number_to_string, 1, 1, { NUMBER }, PURE },
+	{ "make-string-builder", prim_make_string_builder, 0, 0, { ANY }, 0 },
+	{ "string-builder?", prim_is_string_builder, 1, 1, { ANY }, PURE },
+	{ "string-builder-append!", prim_string_builder_append, 1, LISP_VARIADIC, { BUILDER, TEXT, TEXT, TEXT }, 0 },
+	{ "string-builder-length", prim_string_builder_length, 1, 1, { BUILDER }, 0 },
+	{ "string-builder->string", prim_string_builder_to_string, 1, 1, { BUILDER }, 0 },
+	{ "string-builder-clear!", prim_string_builder_clear, 1, 1, { BUILDER }, 0 }
+};
+
+#undef NUMBER
+#undef INTEGER
+#undef STRING
+#undef BUILDER
+#undef TEXT
+#undef ANY
+#undef PURE
+
+void lisp_add_text_prims(lisp_ctx_t *context) {
+	size_t i;
+
+	for(i = 0; i < sizeof(text_prims) / sizeof(text_prims[0]); i++)
+		lisp_add_vprim(&text_prims[i], context);
+}
@@ -13,82 +13,391 @@
 #include <Windows.h>
 #include <WinBase.h>
 #else
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #define HANDLE pthread_t
 #endif
 
+#include <setjmp.h>
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 
+#include "libisp/builtin.h"
 #include "libisp/defs.h"
 #include "libisp/eval.h"
 #include "libisp/mem.h"
+#include "libisp/thread.h"
+
+/* How often the host looks at a thread it waits for, and how long a cancelled
+ * thread has to stop before it is left to finish on its own. */
+#define POLL_MS			100
+#define GRACE_MS		1000
 
-typedef struct {
+/* What the thread and the host agree on about who frees the handle. */
+#define THREAD_RUNNING	0
+#define THREAD_FINISHED	1
+#define THREAD_ORPHANED	2
+
+struct lisp_async_t {
 	lisp_data_t *exp, *result;
 	lisp_ctx_t *context;
-} threadparam_t;
+	lisp_async_callback callback;
+	void *userdata;
+	time_t starttime;
+	int status;
+	int state;
+	HANDLE thread_handle;
+#ifndef _WIN32
+	int fd[2];
+#endif
+};
+
+/* Ends the evaluation in the context. A context the host destroyed while the
+ * thread was left running is destroyed here, returns 1 if it was. */
+static int release_context(lisp_ctx_t *context) {
+	context->deadline = 0;
+	lisp_atomic_set(&context->eval_plz_die, 0);
+	if(lisp_atomic_cas(&context->thread_running, LISP_THREAD_RUNNING, 0))
+		return 0;
+
+	lisp_atomic_set(&context->thread_running, 0);
+	lisp_destroy_context(context);
+	return 1;
+}
+
+int lisp_context_busy(const lisp_ctx_t *context) {
+	return lisp_atomic_get(&context->thread_running) != 0;
+}
+
+/* NOTIFICATION */
 
 #ifdef _WIN32
-static DWORD WINAPI thread(LPVOID in) {
+static int open_notifier(lisp_async_t *handle) { return 0; }
+static void close_notifier(lisp_async_t *handle) { }
+static void notify(lisp_async_t *handle) { }
+
+static void wait_for_thread(lisp_async_t *handle, const int timeout_ms) {
+	WaitForSingleObject(handle->thread_handle, timeout_ms);
+}
+
+static void detach_thread(HANDLE thread_handle) {
+	CloseHandle(thread_handle);
+}
 #else
-static void *thread(void *in) {
+static int open_notifier(lisp_async_t *handle) {
+#ifdef __linux__
+	if((handle->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		return -1;
+	handle->fd[1] = handle->fd[0];
+#else
+	if(pipe(handle->fd) == -1)
+		return -1;
+	fcntl(handle->fd[0], F_SETFL, fcntl(handle->fd[0], F_GETFL) | O_NONBLOCK);
+	fcntl(handle->fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(handle->fd[1], F_SETFD, FD_CLOEXEC);
 #endif
-	threadparam_t *param = (threadparam_t*)in;
+	return 0;
+}
 
-	param->result = lisp_eval(param->exp, param->context);
-	param->context->thread_running = 0;
-#ifndef _WIN32
-	pthread_exit(NULL);
+static void close_notifier(lisp_async_t *handle) {
+	close(handle->fd[0]);
+	if(handle->fd[1] != handle->fd[0])
+		close(handle->fd[1]);
+}
+
+static void notify(lisp_async_t *handle) {
+	uint64_t one = 1;
+
+	if(write(handle->fd[1], &one, sizeof(one)) != sizeof(one))
+		fprintf(stderr, "-- WARNING: Could not signal eval() completion.\n");
+}
+
+static void drain_notifier(lisp_async_t *handle) {
+	uint64_t buf;
+
+	while(read(handle->fd[0], &buf, sizeof(buf)) > 0);
+}
+
+static void wait_for_thread(lisp_async_t *handle, const int timeout_ms) {
+	struct pollfd pfd;
+
+	pfd.fd = handle->fd[0];
+	pfd.events = POLLIN;
+	poll(&pfd, 1, timeout_ms);
+}
+
+static void detach_thread(HANDLE thread_handle) {
+	pthread_detach(thread_handle);
+}
 #endif
-	return 0;
+
+static int is_finished(lisp_async_t *handle) {
+	return lisp_atomic_get(&handle->state) != THREAD_RUNNING;
+}
+
+/* Detaches a thread that did not stop and hands its handle over to it.
+ * Returns 0 if it finished after all and can be joined. The thread may free
+ * the handle as soon as it is orphaned, so nothing in it is read after that. */
+static int orphan_thread(lisp_async_t *handle) {
+	HANDLE thread_handle = handle->thread_handle;
+
+	if(!lisp_atomic_cas(&handle->state, THREAD_RUNNING, THREAD_ORPHANED))
+		return 0;
+
+	detach_thread(thread_handle);
+	return 1;
 }
 
-static void kill_thread(threadparam_t *info, const char *msg, HANDLE thread_handle, lisp_ctx_t *context) {
-	context->eval_plz_die = 1;
-	fprintf(stderr, "%s", msg);
-	info->result = NULL;
-	context->thread_running = 0;
+/* EVAL THREAD */
+
+/* eval() and the allocator leave through the escape when asked to die. Nobody
+ * waits for an orphaned thread any more, so it frees its handle itself. */
+static void run(lisp_async_t *handle) {
+	lisp_ctx_t *context = handle->context;
+	size_t mark = lisp_scratch_mark(context);
+	jmp_buf escape;
+
+	context->escape = &escape;
+	if(setjmp(escape) == 0)
+		handle->result = lisp_eval(handle->exp, context);
+	context->escape = NULL;
+	lisp_free_scratch(mark, context);
+
+	/* The host only frees a handle it did not orphan after joining the
+	 * thread, so it is still there to notify through. */
+	if(lisp_atomic_cas(&handle->state, THREAD_RUNNING, THREAD_FINISHED)) {
+		notify(handle);
+		return;
+	}
+
+	release_context(context);
+	close_notifier(handle);
+	free(handle);
 }
 
-static HANDLE spawn_thread(threadparam_t *param) {
 #ifdef _WIN32
-	return CreateThread(NULL, 0, thread, param, 0, NULL);
+static DWORD WINAPI thread(LPVOID in) {
+	run((lisp_async_t*)in);
+	return 0;
+}
 #else
-	pthread_t thread_handle;
+static void *thread(void *in) {
+	run((lisp_async_t*)in);
+	return NULL;
+}
+#endif
 
-	if(pthread_create(&thread_handle, NULL, thread, param)) {
+static int spawn_thread(lisp_async_t *handle) {
+#ifdef _WIN32
+	if((handle->thread_handle = CreateThread(NULL, 0, thread, handle, 0, NULL)) == NULL) {
 		fprintf(stderr, "ERROR: Could not spawn eval() thread.\n");
-		return 0;
+		return -1;
 	}
-	pthread_detach(thread_handle);
+#else
+	if(pthread_create(&handle->thread_handle, NULL, thread, handle)) {
+		fprintf(stderr, "ERROR: Could not spawn eval() thread.\n");
+		return -1;
+	}
+#endif
+	return 0;
+}
 
-	return thread_handle;
+static void join_thread(lisp_async_t *handle) {
+#ifdef _WIN32
+	WaitForSingleObject(handle->thread_handle, INFINITE);
+	CloseHandle(handle->thread_handle);
+#else
+	pthread_join(handle->thread_handle, NULL);
 #endif
 }
 
-lisp_data_t *lisp_eval_thread(const lisp_data_t *exp, lisp_ctx_t *context) {
-	HANDLE thread_handle;
-	threadparam_t info;
-	time_t starttime = time(NULL);
+/* LIMITS */
+
+/* The eval thread and calls from the host both set up an escape to leave
+ * through. */
+void lisp_abort_eval(lisp_ctx_t *context) {
+	longjmp(*(jmp_buf*)context->escape, 1);
+}
+
+/* Only the eval thread and calls from the host through lisp_call() and the
+ * like are held to the limits, lisp_eval() on the host's thread is not. */
+void lisp_poll_eval(lisp_ctx_t *context) {
+	if(!context->escape)
+		return;
+
+	if(context->deadline && ((int64_t)time(NULL) > context->deadline))
+		if(lisp_atomic_cas(&context->eval_plz_die, 0, LISP_ASYNC_TIMEOUT))
+			fprintf(stderr, "-- ERROR: eval() timed out.\n");
+
+	if(lisp_atomic_get(&context->eval_plz_die))
+		lisp_abort_eval(context);
+}
+
+/* ASYNCHRONOUS EVALUATION */
+
+lisp_async_t *lisp_eval_async(const lisp_data_t *exp, lisp_async_callback callback, void *userdata, lisp_ctx_t *context) {
+	lisp_async_t *out;
+
+	if(context->frozen) {
+		fprintf(stderr, "ERROR: Cannot eval() in a frozen context.\n");
+		return NULL;
+	}
+
+	if(lisp_atomic_get(&context->thread_running)) {
+		fprintf(stderr, "ERROR: eval() already running in this context.\n");
+		return NULL;
+	}
+
+	if((out = malloc(sizeof(lisp_async_t))) == NULL)
+		return NULL;
+
+	out->exp = (lisp_data_t*)exp;
+	out->result = NULL;
+	out->context = context;
+	out->callback = callback;
+	out->userdata = userdata;
+	out->starttime = time(NULL);
+	out->status = LISP_ASYNC_RUNNING;
+	out->state = THREAD_RUNNING;
+
+	if(open_notifier(out) == -1) {
+		fprintf(stderr, "ERROR: Could not create eval() notifier.\n");
+		free(out);
+		return NULL;
+	}
+
+	context->deadline = context->thread_timeout ? (int64_t)out->starttime + (int64_t)context->thread_timeout : 0;
+	context->n_checks = 0;
+	lisp_atomic_set(&context->eval_plz_die, 0);
+	lisp_atomic_set(&context->thread_running, LISP_THREAD_RUNNING);
+
+	if(spawn_thread(out) == -1) {
+		release_context(context);
+		close_notifier(out);
+		free(out);
+		return NULL;
+	}
+
+	return out;
+}
+
+int lisp_eval_poll(lisp_async_t *handle) {
+	lisp_ctx_t *context = handle->context;
 	size_t reclaimed;
+	int reason;
+
+	if(handle->status != LISP_ASYNC_RUNNING)
+		return handle->status;
+
+	if(!is_finished(handle)) {
+		if(context->thread_timeout && (time(NULL) - handle->starttime > context->thread_timeout))
+			if(lisp_atomic_cas(&context->eval_plz_die, 0, LISP_ASYNC_TIMEOUT))
+				fprintf(stderr, "-- ERROR: eval() timed out.\n");
+		return LISP_ASYNC_RUNNING;
+	}
 
-	info.exp = (lisp_data_t*)exp;
-	info.context = context;
-	context->thread_running = 1;
-
-	thread_handle = spawn_thread(&info);
-
-	while(context->thread_running) {
-		if(context->thread_timeout && (time(NULL) - starttime > context->thread_timeout))
-			kill_thread(&info, "-- ERROR: eval() timed out.\n", thread_handle, context);
-		if(context->mem_allocated + sizeof(lisp_data_t) >= context->mem_lim_hard) {
-			kill_thread(&info, "-- ERROR: Hard memory limit reached.\n", 
-				thread_handle, context);
-			if((context->mem_verbosity == LISP_GC_VERBOSE) && (reclaimed = lisp_gc(LISP_GC_FORCE, context)))
-				printf("-- GC: %zu bytes of memory reclaimed.\n", reclaimed);			
-		}
+#ifndef _WIN32
+	drain_notifier(handle);
+#endif
+
+	if((reason = lisp_atomic_get(&context->eval_plz_die))) {
+		handle->status = reason;
+		handle->result = NULL;
+	} else {
+		handle->status = LISP_ASYNC_DONE;
 	}
 
-	return info.result;
+	if(release_context(context))
+		handle->context = NULL;
+	else if((handle->status == LISP_ASYNC_MEMLIMIT) && (context->mem_verbosity == LISP_GC_VERBOSE) && (reclaimed = lisp_gc(LISP_GC_FORCE, context)))
+		printf("-- GC: %zu bytes of memory reclaimed.\n", reclaimed);
+
+	if(handle->callback)
+		handle->callback(handle, handle->status, handle->result, handle->userdata);
+
+	return handle->status;
+}
+
+void lisp_eval_cancel(lisp_async_t *handle) {
+	if(handle->status == LISP_ASYNC_RUNNING)
+		lisp_atomic_cas(&handle->context->eval_plz_die, 0, LISP_ASYNC_CANCELLED);
+}
+
+int lisp_eval_fd(const lisp_async_t *handle) {
+#ifdef _WIN32
+	return -1;
+#else
+	return handle->fd[0];
+#endif
+}
+
+lisp_data_t *lisp_eval_result(const lisp_async_t *handle) {
+	if(handle->status != LISP_ASYNC_DONE)
+		return NULL;
+	return handle->result;
+}
+
+/* A cancelled evaluation stops at its next step. A thread that does not get
+ * there in time, say in a primitive that blocks, is left to finish on its own
+ * and the context stays busy until it does, see lisp_context_busy(). */
+void lisp_eval_free(lisp_async_t *handle) {
+	int waited;
+
+	if(!handle)
+		return;
+
+	if(handle->status == LISP_ASYNC_RUNNING)
+		lisp_eval_cancel(handle);
+
+	for(waited = 0; lisp_eval_poll(handle) == LISP_ASYNC_RUNNING; waited += POLL_MS) {
+		if((waited >= GRACE_MS) && orphan_thread(handle))
+			return;
+		wait_for_thread(handle, POLL_MS);
+	}
+
+	join_thread(handle);
+	close_notifier(handle);
+	free(handle);
+}
+
+/* SYNCHRONOUS EVALUATION */
+
+static int is_overdue(const lisp_async_t *handle) {
+	return handle->context->deadline && ((int64_t)time(NULL) > handle->context->deadline);
+}
+
+/* *status is what lisp_eval_poll() returned in the end, LISP_ASYNC_REFUSED if
+ * no evaluation could be started. Past its deadline the thread is given up on
+ * like in lisp_eval_free(), which counts as LISP_ASYNC_TIMEOUT. */
+lisp_data_t *lisp_eval_wait(const lisp_data_t *exp, int *status, lisp_ctx_t *context) {
+	lisp_async_t *handle;
+	lisp_data_t *out;
+
+	if((handle = lisp_eval_async(exp, NULL, NULL, context)) == NULL) {
+		*status = LISP_ASYNC_REFUSED;
+		return NULL;
+	}
+
+	while(((*status = lisp_eval_poll(handle)) == LISP_ASYNC_RUNNING) && !is_overdue(handle))
+		wait_for_thread(handle, POLL_MS);
+	if(*status == LISP_ASYNC_RUNNING)
+		*status = LISP_ASYNC_TIMEOUT;
+
+	out = lisp_eval_result(handle);
+	lisp_eval_free(handle);
+
+	return out;
+}
+
+lisp_data_t *lisp_eval_thread(const lisp_data_t *exp, lisp_ctx_t *context) {
+	int status;
+
+	return lisp_eval_wait(exp, &status, context);
 }
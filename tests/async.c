@@ -0,0 +1,258 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <malloc.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define MEM_SOFT	(1024 * 1024 * 512)
+#define MEM_HARD	((size_t)1024 * 1024 * 1024)
+
+/* Runs for longer than any test waits, but in steps eval() can stop at. */
+static const char *forever = "(fold-left (lambda (a x) (fold-left (lambda (b y) b) a xs)) 0 xs)";
+
+static int unblocked;
+
+static lisp_data_t *host_block(const lisp_data_t *args, lisp_ctx_t *context) {
+	sleep(3);
+	__atomic_add_fetch(&unblocked, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lisp_data_t *read_exp(const char *exp, lisp_ctx_t *context) {
+	size_t readto;
+	int error;
+
+	return lisp_read(exp, &readto, &error, context);
+}
+
+static lisp_ctx_t *make_context(const size_t timeout) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, timeout);
+
+	lisp_add_prim_proc("block", host_block, context);
+	lisp_setup_env(context);
+	lisp_eval(read_exp("(define xs (vector->list (make-vector 100000 1)))", context), context);
+
+	return context;
+}
+
+/* The eval thread keeps the deadline by itself, a host that only waits on the
+ * fd learns about the timeout without ever polling before. */
+static void test_timeout_unpolled(void) {
+	lisp_ctx_t *context = make_context(1);
+	lisp_async_t *handle;
+	struct pollfd pfd;
+
+	handle = lisp_eval_async(read_exp(forever, context), NULL, NULL, context);
+	check(handle != NULL);
+
+	pfd.fd = lisp_eval_fd(handle);
+	pfd.events = POLLIN;
+	check(poll(&pfd, 1, 10000) == 1);
+	check(lisp_eval_poll(handle) == LISP_ASYNC_TIMEOUT);
+	check(lisp_eval_result(handle) == NULL);
+
+	lisp_eval_free(handle);
+	lisp_destroy_context(context);
+}
+
+static void test_cancel(void) {
+	lisp_ctx_t *context = make_context(0);
+	lisp_async_t *handle;
+	double start = now();
+
+	handle = lisp_eval_async(read_exp(forever, context), NULL, NULL, context);
+	check(lisp_eval_poll(handle) == LISP_ASYNC_RUNNING);
+	lisp_eval_cancel(handle);
+	while(lisp_eval_poll(handle) == LISP_ASYNC_RUNNING)
+		usleep(1000);
+	check(lisp_eval_poll(handle) == LISP_ASYNC_CANCELLED);
+	check(now() - start < 1.0);
+
+	lisp_eval_free(handle);
+	lisp_destroy_context(context);
+}
+
+/* A thread stuck in a primitive is left behind, the context stays busy until
+ * it finishes. */
+static void test_free_bounded(void) {
+	lisp_ctx_t *context = make_context(0);
+	lisp_async_t *handle;
+	double start = now();
+	int i;
+
+	handle = lisp_eval_async(read_exp("(block)", context), NULL, NULL, context);
+	usleep(100000);
+	lisp_eval_free(handle);
+	check(now() - start < 2.5);
+
+	check(lisp_eval_async(read_exp("(+ 1 2)", context), NULL, NULL, context) == NULL);
+	for(i = 0; (i < 100) && lisp_context_busy(context); i++)
+		usleep(100000);
+	check(!lisp_context_busy(context));
+
+	expect("(+ 1 2)", "3", context);
+	lisp_destroy_context(context);
+}
+
+/* Destroying the context while a thread it was left to still runs in it is
+ * put off until that thread ends, and the garbage collector keeps out. */
+static void test_destroy_orphaned(void) {
+	lisp_ctx_t *context = make_context(0);
+	lisp_async_t *handle;
+	int seen = __atomic_load_n(&unblocked, __ATOMIC_ACQUIRE), i;
+	double start = now();
+
+	handle = lisp_eval_async(read_exp("(block)", context), NULL, NULL, context);
+	usleep(100000);
+	lisp_eval_free(handle);
+	check(now() - start < 2.5);
+
+	check(lisp_context_busy(context));
+	check(lisp_gc(LISP_GC_FORCE, context) == 0);
+	lisp_destroy_context(context);
+
+	/* Give the thread time to destroy it before the process goes. */
+	for(i = 0; (i < 100) && (__atomic_load_n(&unblocked, __ATOMIC_ACQUIRE) == seen); i++)
+		usleep(100000);
+	check(__atomic_load_n(&unblocked, __ATOMIC_ACQUIRE) != seen);
+	usleep(200000);
+}
+
+/* Walks in primitives that call no Lisp code are held to the deadline too. */
+static void test_timeout_native(void) {
+	lisp_ctx_t *context = make_context(1);
+	lisp_async_t *handle;
+	double start = now();
+
+	expect("(define c (list 1))", "(1)", context);
+	lisp_eval(read_exp("(set-cdr! c c)", context), context);
+
+	handle = lisp_eval_async(read_exp("(list-tail c 2147483647)", context), NULL, NULL, context);
+	while(lisp_eval_poll(handle) == LISP_ASYNC_RUNNING)
+		usleep(1000);
+	check(lisp_eval_poll(handle) == LISP_ASYNC_TIMEOUT);
+	check(now() - start < 3.0);
+
+	lisp_eval_free(handle);
+	lisp_destroy_context(context);
+}
+
+static int is_error(const lisp_data_t *data, const char *error) {
+	return data && (data->type == lisp_type_error) && !strcmp(data->error, error);
+}
+
+/* Calls from the host run on its own thread but under the same limits, and
+ * the context is still usable after one was stopped. */
+static void test_call_timeout(void) {
+	lisp_ctx_t *context = make_context(1);
+	lisp_prepared_t *spin, *add;
+	lisp_data_t *argv[2];
+	double start = now();
+	char exp[256];
+
+	snprintf(exp, sizeof(exp), "(lambda () %s)", forever);
+	spin = lisp_prepare(exp, context);
+	add = lisp_prepare("(lambda (a b) (+ a b))", context);
+	check(spin && add);
+
+	check(is_error(lisp_call(spin, 0, NULL), "CALL -- Timed out"));
+	check(now() - start < 5.0);
+
+	argv[0] = lisp_make_int(1, context);
+	argv[1] = lisp_make_int(2, context);
+	check(lisp_call(add, 2, argv)->integer == 3);
+	expect("(+ 1 2)", "3", context);
+
+	lisp_destroy_prepared(spin);
+	lisp_destroy_prepared(add);
+	lisp_destroy_context(context);
+}
+
+static void test_call_memlimit(void) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024 * 8, 1024 * 1024 * 32, LISP_GC_SILENT, 0);
+	lisp_prepared_t *grow;
+	lisp_data_t *n;
+
+	lisp_setup_env(context);
+	grow = lisp_prepare("(lambda (n) (length (vector->list (make-vector n 0))))", context);
+	check(grow != NULL);
+
+	n = lisp_make_int(4000000, context);
+	check(is_error(lisp_call(grow, 1, &n), "CALL -- Hard memory limit reached"));
+
+	n = lisp_make_int(10, context);
+	check(lisp_call(grow, 1, &n)->integer == 10);
+
+	lisp_destroy_prepared(grow);
+	lisp_destroy_context(context);
+}
+
+/* Argument arrays of long calls are not on the stack, they have to be freed
+ * when the call is aborted while they are still used. */
+static void check_abort_frees(const char *exp) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024, 1024 * 1024 * 4, LISP_GC_SILENT, 0);
+	lisp_prepared_t *grow;
+	lisp_data_t *n;
+	size_t before;
+	int i;
+
+	lisp_setup_env(context);
+	grow = lisp_prepare(exp, context);
+	check(grow != NULL);
+
+	n = lisp_make_int(1000000, context);
+	lisp_add_root(n, context);
+	check(is_error(lisp_call(grow, 1, &n), "CALL -- Hard memory limit reached"));
+	lisp_gc(LISP_GC_FORCE, context);
+	before = mallinfo2().uordblks;
+	for(i = 0; i < 500; i++) {
+		if(!is_error(lisp_call(grow, 1, &n), "CALL -- Hard memory limit reached"))
+			break;
+		lisp_gc(LISP_GC_FORCE, context);
+	}
+	check(i == 500);
+	check(mallinfo2().uordblks < before + 16 * 1024);
+
+	lisp_destroy_prepared(grow);
+	lisp_destroy_context(context);
+}
+
+static void test_call_abort_frees(void) {
+	check_abort_frees("(lambda (n) (+ 1 2 3 4 5 6 7 8 (length (vector->list (make-vector n 0)))))");
+	check_abort_frees("(lambda (n) (map (lambda (a b c d e) (length (vector->list (make-vector n 0)))) '(1) '(2) '(3) '(4) '(5)))");
+	check_abort_frees("(lambda (n) (sort (vector->list (make-vector 64 1)) (lambda (a b) (< (length (vector->list (make-vector n 0))) 0))))");
+	check_abort_frees("(lambda (n) (apply (lambda (a b c d e f g h i) (length (vector->list (make-vector n 0)))) 1 2 3 4 5 6 7 8 '(9)))");
+}
+
+int main(void) {
+	test_timeout_unpolled();
+	test_cancel();
+	test_free_bounded();
+	test_destroy_orphaned();
+	test_timeout_native();
+	test_call_timeout();
+	test_call_memlimit();
+	test_call_abort_frees();
+
+	return test_result("async");
+}
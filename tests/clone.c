@@ -0,0 +1,155 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "test.h"
+
+#define MEM_SOFT	(1024 * 1024 * 4)
+#define MEM_HARD	(1024 * 1024 * 64)
+
+static lisp_data_t *host_twice(const lisp_data_t *args, lisp_ctx_t *context) {
+	return lisp_make_int(2 * lisp_car(args)->integer, context);
+}
+
+static lisp_ctx_t *make_base(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 60);
+
+	lisp_add_prim_proc("twice", host_twice, context);
+	lisp_setup_env(context);
+	expect("(define counter 0)", "0", context);
+	expect("(define (get) counter)", "<proc>", context);
+	expect("(define lst (list 1 2 3))", "(1 2 3)", context);
+	expect("(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))", "<proc>", context);
+	expect("(define bump (let ((n 0)) (lambda () (set! n (+ n 1)))))", "<proc>", context);
+
+	return context;
+}
+
+/* Base and clone both go on changing their own data after the clone. */
+static void test_mutate_both(void) {
+	lisp_ctx_t *base = make_base(), *clone;
+
+	expect("(next)", "1", base);
+	clone = lisp_clone_context(base);
+	check(clone != NULL);
+
+	expect("(set! counter 5)", "5", base);
+	expect("(get)", "5", base);
+	expect("(set-car! lst 10)", "(10 2 3)", base);
+	expect("lst", "(10 2 3)", base);
+	expect("(next)", "2", base);
+
+	expect("(get)", "0", clone);
+	expect("lst", "(1 2 3)", clone);
+	expect("(set! counter 7)", "7", clone);
+	expect("(get)", "7", clone);
+	expect("(set-cdr! (cdr lst) '(30))", "(2 30)", clone);
+	expect("lst", "(1 2 30)", clone);
+	expect("(next)", "2", clone);
+	expect("(next)", "3", clone);
+	expect("(twice 21)", "42", clone);
+
+	expect("(get)", "5", base);
+	expect("lst", "(10 2 3)", base);
+	expect("(next)", "3", base);
+
+	/* Either can go first. */
+	lisp_destroy_context(base);
+	expect("(define later (cons counter lst))", "(7 1 2 30)", clone);
+	lisp_gc(LISP_GC_FORCE, clone);
+	expect("later", "(7 1 2 30)", clone);
+	lisp_destroy_context(clone);
+}
+
+static void test_clone_of_clone(void) {
+	lisp_ctx_t *base = make_base(), *clone, *second;
+
+	clone = lisp_clone_context(base);
+	expect("(set-car! lst 'a)", "(a 2 3)", clone);
+	second = lisp_clone_context(clone);
+	expect("(set-car! lst 'b)", "(b 2 3)", second);
+
+	expect("(car lst)", "1", base);
+	expect("(car lst)", "a", clone);
+	expect("(car lst)", "b", second);
+
+	lisp_destroy_context(clone);
+	lisp_destroy_context(base);
+	expect("(twice (length lst))", "6", second);
+	lisp_destroy_context(second);
+}
+
+/* A frozen base is shared and stays as it is. set! on one of its bindings is
+ * an error and does not define a global of the same name. */
+static void test_frozen_base(void) {
+	lisp_ctx_t *base = make_base(), *derived, *clone;
+
+	lisp_freeze_context(base);
+	derived = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 60);
+	lisp_setup_env_from(derived, base);
+
+	expect("(set! counter 1)", "ERROR: 'SET -- Immutable binding'", derived);
+	expect("(get)", "0", derived);
+	expect("(bump)", "ERROR: 'SET -- Immutable binding'", derived);
+	/* The failed set! is not the last expression, so next goes on. */
+	expect("(next)", "0", derived);
+	expect("(next)", "0", derived);
+	expect("n", "ERROR: 'LOOKUP -- Unbound variable'", derived);
+	expect("(set-car! lst 5)", "ERROR: 'SET-CAR! -- Immutable pair'", derived);
+
+	/* Definitions of its own are copied into a clone, the base is shared. */
+	expect("(define mine (list 4 5))", "(4 5)", derived);
+	clone = lisp_clone_context(derived);
+	expect("(set-car! mine 40)", "(40 5)", clone);
+	expect("mine", "(40 5)", clone);
+	expect("mine", "(4 5)", derived);
+	expect("(set-car! lst 5)", "ERROR: 'SET-CAR! -- Immutable pair'", clone);
+	expect("(length lst)", "3", clone);
+	expect("(bump)", "ERROR: 'SET -- Immutable binding'", clone);
+	expect("(next)", "0", clone);
+
+	lisp_destroy_context(clone);
+	lisp_destroy_context(derived);
+	lisp_destroy_context(base);
+}
+
+/* Lists read lazily into a base are read in full when it is frozen, so a
+ * context built on it never allocates in the base. */
+static void test_lazy_base(void) {
+	lisp_ctx_t *base = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 60), *derived, *clone;
+	size_t readto, entries;
+	int error;
+
+	lisp_setup_env(base);
+	lisp_eval(lisp_read_lazy("(define big '(1 2 (3 (4 5) 6) 7 8))", &readto, &error, base), base);
+	check(!error);
+	lisp_freeze_context(base);
+	entries = base->mem_list_entries;
+
+	derived = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 60);
+	lisp_setup_env_from(derived, base);
+	expect("big", "(1 2 (3 (4 5) 6) 7 8)", derived);
+	clone = lisp_clone_context(derived);
+	expect("(length (caddr big))", "3", clone);
+	check(base->mem_list_entries == entries);
+
+	lisp_destroy_context(clone);
+	lisp_destroy_context(derived);
+	lisp_destroy_context(base);
+}
+
+int main(void) {
+	test_mutate_both();
+	test_clone_of_clone();
+	test_frozen_base();
+	test_lazy_base();
+
+	return test_result("clone");
+}
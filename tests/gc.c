@@ -0,0 +1,91 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "test.h"
+
+#define LONG_LIST	1000000
+
+/* Marking follows the cdrs in a loop, a list this long overflowed the stack
+ * when every pair was a recursive call. */
+static void test_long_list(void) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024 * 512, 1024 * 1024 * 1024, LISP_GC_SILENT, 60);
+	lisp_data_t *list = NULL;
+	lisp_root_t *root;
+	int i;
+
+	lisp_setup_env(context);
+	for(i = LONG_LIST; i > 0; i--)
+		list = lisp_cons(lisp_make_int(i, context), list);
+	root = lisp_add_root(list, context);
+
+	lisp_gc(LISP_GC_FORCE, context);
+	check(lisp_car(list)->integer == 1);
+
+	lisp_remove_root(root, context);
+	check(lisp_gc(LISP_GC_FORCE, context) > 0);
+	lisp_destroy_context(context);
+}
+
+/* The same list reached through a vector in the global environment. */
+static void test_long_list_in_vector(void) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024 * 512, 1024 * 1024 * 1024, LISP_GC_SILENT, 60);
+	lisp_data_t *list = NULL;
+	size_t readto;
+	int i, error;
+
+	lisp_setup_env(context);
+	lisp_run("(define v (make-vector 1 '()))", context);
+	for(i = LONG_LIST; i > 0; i--)
+		list = lisp_cons(lisp_make_int(i, context), list);
+	lisp_eval(lisp_read("v", &readto, &error, context), context)->vector->items[0] = list;
+
+	lisp_gc(LISP_GC_FORCE, context);
+	expect("(length (vector-ref v 0))", "1000000", context);
+	lisp_destroy_context(context);
+}
+
+/* Memory the allocator did not hand out, or that another context or an
+ * earlier free owns, is refused without reading anything around it. */
+static void test_foreign_free(void) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024, 1024 * 1024 * 16, LISP_GC_SILENT, 60);
+	lisp_ctx_t *other = lisp_make_context(1024 * 1024, 1024 * 1024 * 16, LISP_GC_SILENT, 60);
+	char *block = calloc(1, 256);
+	lisp_data_t local, *datum;
+	size_t entries;
+
+	lisp_setup_env(context);
+	entries = context->mem_list_entries;
+
+	lisp_free_data((lisp_data_t*)(block + 128), context);
+	lisp_free_data(&local, context);
+	lisp_free_data(lisp_make_int(1, other), context);
+	check(context->mem_list_entries == entries);
+
+	datum = lisp_make_int(1, context);
+	lisp_free_data(datum, context);
+	lisp_free_data(datum, context);
+	check(context->mem_list_entries == entries);
+
+	lisp_gc(LISP_GC_FORCE, context);
+	expect("(length (list 1 2 3))", "3", context);
+
+	free(block);
+	lisp_destroy_context(other);
+	lisp_destroy_context(context);
+}
+
+int main(void) {
+	test_long_list();
+	test_long_list_in_vector();
+	test_foreign_free();
+
+	return test_result("gc");
+}
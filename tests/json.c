@@ -0,0 +1,91 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "test.h"
+
+/* Reads json, writes it back and compares the result to want. */
+#define round_trip(json, want, context) round_trip_at(json, want, context, __FILE__, __LINE__)
+
+static void round_trip_at(const char *json, const char *want, lisp_ctx_t *context, const char *file, const int line) {
+	lisp_buffer_t buf;
+	lisp_sink_t *sink;
+	lisp_data_t *in;
+	int error, written;
+
+	in = lisp_from_json(json, strlen(json), NULL, &error, context);
+	if(error) {
+		fprintf(stderr, "%s:%d: can't read %s\n", file, line, json);
+		test_failures++;
+		return;
+	}
+
+	lisp_buffer_init(&buf);
+	sink = lisp_make_buffer_sink(&buf);
+	written = lisp_to_json(sink, in, context);
+	lisp_sink_flush(sink);
+	lisp_destroy_sink(sink);
+	lisp_buffer_append(&buf, "", 1);
+
+	if((written == -1) || strcmp((char*)buf.data, want)) {
+		fprintf(stderr, "%s:%d: %s came back as %s, expected %s\n", file, line, json, (char*)buf.data, want);
+		test_failures++;
+	}
+	lisp_buffer_free(&buf);
+}
+
+static void test_empty(lisp_ctx_t *context) {
+	round_trip("[]", "[]", context);
+	round_trip("{}", "{}", context);
+	round_trip(" { } ", "{}", context);
+	round_trip("[{}, [], {}]", "[{},[],{}]", context);
+	round_trip("{\"a\": {}, \"b\": []}", "{\"a\":{},\"b\":[]}", context);
+	round_trip("[[[]], {\"c\": [{}]}]", "[[[]],{\"c\":[{}]}]", context);
+}
+
+static void test_values(lisp_ctx_t *context) {
+	round_trip("[1, 2.5, \"x\", true, false, null]", "[1,2.5,\"x\",true,false,null]", context);
+	round_trip("{\"a\": 1, \"b\": [2, 3]}", "{\"a\":1,\"b\":[2,3]}", context);
+}
+
+/* Tables are written as objects, with symbols and strings as names. */
+static void test_tables(lisp_ctx_t *context) {
+	lisp_buffer_t buf;
+	lisp_sink_t *sink;
+	lisp_data_t *table;
+
+	table = lisp_make_hashtable(LISP_HASH_EQUAL, context);
+	lisp_hashtable_set(table, lisp_make_string("k", context), lisp_make_int(1, context));
+
+	lisp_buffer_init(&buf);
+	sink = lisp_make_buffer_sink(&buf);
+	check(lisp_to_json(sink, table, context) == 0);
+	lisp_sink_flush(sink);
+	lisp_buffer_append(&buf, "", 1);
+	check(!strcmp((char*)buf.data, "{\"k\":1}"));
+
+	buf.len = 0;
+	lisp_hashtable_set(table, lisp_make_int(2, context), lisp_make_int(3, context));
+	check(lisp_to_json(sink, table, context) == -1);
+	lisp_destroy_sink(sink);
+	lisp_buffer_free(&buf);
+}
+
+int main(void) {
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024, 1024 * 1024 * 16, LISP_GC_SILENT, 60);
+
+	lisp_setup_env(context);
+	test_empty(context);
+	test_values(context);
+	test_tables(context);
+	lisp_destroy_context(context);
+
+	return test_result("json");
+}
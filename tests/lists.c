@@ -0,0 +1,55 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "test.h"
+
+#define MEM_SOFT	(1024 * 1024 * 64)
+#define MEM_HARD	(1024 * 1024 * 256)
+
+/* Every primitive that walks a list to its end turns a circular one down
+ * instead of going round it forever. */
+static void test_circular(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 0);
+
+	lisp_setup_env(context);
+	expect("(define (tie! l) (set-cdr! (cddr l) l) 0)", "<proc>", context);
+	expect("(define c (list 1 2 3))", "(1 2 3)", context);
+	expect("(tie! c)", "0", context);
+
+	expect("(length c)", "ERROR: 'LENGTH -- Circular list'", context);
+	expect("(append c (list 4))", "ERROR: 'APPEND -- Circular list'", context);
+	expect("(reverse c)", "ERROR: 'REVERSE -- Circular list'", context);
+	expect("(member 4 c)", "ERROR: 'MEMBER -- Circular list'", context);
+	expect("(assoc 4 c)", "ERROR: 'ASSOC -- Circular list'", context);
+	expect("(map + c)", "ERROR: 'MAP -- Circular list'", context);
+	expect("(filter odd? c)", "ERROR: 'FILTER -- Circular list'", context);
+	expect("(fold-left + 0 c)", "ERROR: 'FOLD-LEFT -- Circular list'", context);
+	expect("(fold-right + 0 c)", "ERROR: 'REVERSE -- Circular list'", context);
+	expect("(reduce + 0 c)", "ERROR: 'REDUCE -- Circular list'", context);
+	expect("(apply + c)", "ERROR: 'APPLY -- Circular list'", context);
+	expect("(list->vector c)", "ERROR: 'LIST->VECTOR -- Circular list'", context);
+	expect("(list->f64vector c)", "ERROR: 'LIST->F64VECTOR -- Circular list'", context);
+	expect("(sort c <)", "ERROR: 'SORT -- Circular list'", context);
+
+	/* Bounded walks still work, and map stops at the shorter list. */
+	expect("(list-ref c 7)", "2", context);
+	expect("(map + c (list 10 20 30 40))", "(11 22 33 41)", context);
+	expect("(length (list 1 2 3 4))", "4", context);
+	expect("(length (cons 1 2))", "ERROR: 'LENGTH -- Expected list'", context);
+
+	lisp_destroy_context(context);
+}
+
+int main(void) {
+	test_circular();
+
+	return test_result("lists");
+}
@@ -0,0 +1,124 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <unistd.h>
+
+#include "test.h"
+
+#define MEM_SOFT	(1024 * 1024 * 8)
+#define MEM_HARD	((size_t)1024 * 1024 * 1024)
+
+static char path[] = "/tmp/libisp-load-XXXXXX";
+
+static void write_source(const char *source) {
+	FILE *fp = fopen(path, "w");
+
+	fputs(source, fp);
+	fclose(fp);
+}
+
+static int is_error(const lisp_data_t *data, const char *error) {
+	return data && (data->type == lisp_type_error) && !strcmp(data->error, error);
+}
+
+static void test_load(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 10);
+	lisp_data_t *out;
+
+	lisp_setup_env(context);
+	write_source("(define a 1)\n(define b (+ a 1))\n(* b 3)\n");
+	out = lisp_load_file(path, context);
+	check(out && (out->type == lisp_type_integer) && (out->integer == 6));
+	expect("b", "2", context);
+
+	write_source("(define c 1)\nnowhere\n(define d 2)\n");
+	check(lisp_load_file(path, context)->type == lisp_type_error);
+	expect("d", "ERROR: 'LOOKUP -- Unbound variable'", context);
+
+	lisp_destroy_context(context);
+}
+
+/* A form that ends the eval thread early stops loading, the forms after it are
+ * not evaluated. */
+static void test_load_timeout(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, MEM_HARD, LISP_GC_SILENT, 1);
+
+	lisp_setup_env(context);
+	write_source("(define xs (vector->list (make-vector 100000 1)))\n"
+				 "(fold-left (lambda (a x) (fold-left (lambda (b y) b) a xs)) 0 xs)\n"
+				 "(define after 1)\n");
+	check(is_error(lisp_load_file(path, context), "LOAD -- Timed out"));
+	expect("after", "ERROR: 'LOOKUP -- Unbound variable'", context);
+
+	lisp_destroy_context(context);
+}
+
+static void test_load_memlimit(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, 1024 * 1024 * 32, LISP_GC_SILENT, 10);
+
+	lisp_setup_env(context);
+	write_source("(define big (vector->list (make-vector 4000000 0)))\n(define after 1)\n");
+	check(is_error(lisp_load_file(path, context), "LOAD -- Hard memory limit reached"));
+	expect("after", "ERROR: 'LOOKUP -- Unbound variable'", context);
+
+	lisp_destroy_context(context);
+}
+
+static int count_maps(void) {
+	FILE *fp = fopen("/proc/self/maps", "r");
+	int c, out = 0;
+
+	if(fp == NULL)
+		return -1;
+	while((c = fgetc(fp)) != EOF)
+		out += (c == '\n');
+	fclose(fp);
+
+	return out;
+}
+
+/* A (load) that is aborted in the middle still unmaps its file. */
+static void test_load_aborted(void) {
+	lisp_ctx_t *context = lisp_make_context(MEM_SOFT, 1024 * 1024 * 32, LISP_GC_SILENT, 10);
+	char exp[64];
+	size_t readto;
+	int i, error, before;
+
+	lisp_setup_env(context);
+	write_source("(define big (vector->list (make-vector 4000000 0)))\n");
+	snprintf(exp, sizeof(exp), "(load \"%s\")", path);
+
+	before = count_maps();
+	for(i = 0; i < 8; i++) {
+		check(lisp_eval_thread(lisp_read(exp, &readto, &error, context), context) == NULL);
+		lisp_gc(LISP_GC_FORCE, context);
+	}
+	check(count_maps() == before);
+	expect("big", "ERROR: 'LOOKUP -- Unbound variable'", context);
+
+	lisp_destroy_context(context);
+}
+
+int main(void) {
+	int fd;
+
+	if((fd = mkstemp(path)) == -1)
+		return EXIT_FAILURE;
+	close(fd);
+
+	test_load();
+	test_load_timeout();
+	test_load_memlimit();
+	test_load_aborted();
+
+	unlink(path);
+	return test_result("load");
+}
@@ -0,0 +1,58 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "test.h"
+
+int test_failures = 0;
+
+void check_at(const int cond, const char *what, const char *file, const int line) {
+	if(cond)
+		return;
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+	test_failures++;
+}
+
+/* Evaluates exp and compares the printed result to want. */
+void expect_at(const char *exp, const char *want, lisp_ctx_t *context, const char *file, const int line) {
+	lisp_buffer_t buf;
+	lisp_sink_t *sink;
+	lisp_data_t *in;
+	size_t readto;
+	int error;
+
+	lisp_buffer_init(&buf);
+	in = lisp_read(exp, &readto, &error, context);
+	if(error) {
+		fprintf(stderr, "%s:%d: can't read %s\n", file, line, exp);
+		test_failures++;
+		return;
+	}
+
+	sink = lisp_make_buffer_sink(&buf);
+	lisp_print_to(sink, lisp_eval(in, context), context);
+	lisp_sink_flush(sink);
+	lisp_destroy_sink(sink);
+	lisp_buffer_append(&buf, "", 1);
+
+	if(strcmp((char*)buf.data, want)) {
+		fprintf(stderr, "%s:%d: %s gave %s, expected %s\n", file, line, exp, (char*)buf.data, want);
+		test_failures++;
+	}
+	lisp_buffer_free(&buf);
+}
+
+int test_result(const char *name) {
+	if(test_failures)
+		fprintf(stderr, "%s: %d failed\n", name, test_failures);
+	else
+		printf("%s: ok\n", name);
+	return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
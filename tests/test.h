@@ -0,0 +1,30 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#ifndef LISP_TEST_H_
+#define LISP_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp.h"
+
+extern int test_failures;
+
+#define check(cond) check_at(cond, #cond, __FILE__, __LINE__)
+#define expect(exp, want, context) expect_at(exp, want, context, __FILE__, __LINE__)
+
+void check_at(const int cond, const char *what, const char *file, const int line);
+void expect_at(const char *exp, const char *want, lisp_ctx_t *context, const char *file, const int line);
+int test_result(const char *name);
+
+#endif
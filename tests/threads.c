@@ -0,0 +1,94 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include <pthread.h>
+
+#include "test.h"
+
+/* Many contexts allocating and collecting at the same time, all on top of one
+ * frozen base. Run it with 'make tsan' to have the accesses checked. */
+
+#define N_CONTEXTS	64
+#define N_ROUNDS	4
+
+static const char *base_defs[] = {
+	"(define (range a b) (if (>= a b) '() (cons a (range (+ a 1) b))))",
+	"(define (squares n) (let ((t (make-hash-table))) (map (lambda (x) (hash-table-set! t x (* x x))) (range 0 n)) t))",
+	"(define shared (range 0 100))",
+	NULL
+};
+
+typedef struct worker_t {
+	pthread_t thread;
+	const lisp_ctx_t *base;
+	int failed;
+} worker_t;
+
+static int eval_int(const char *exp, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	size_t readto;
+	int error;
+
+	out = lisp_read(exp, &readto, &error, context);
+	if(error || ((out = lisp_eval(out, context)) == NULL) || (out->type != lisp_type_integer))
+		return -1;
+	return out->integer;
+}
+
+static void *work(void *arg) {
+	worker_t *worker = arg;
+	lisp_ctx_t *context = lisp_make_context(1024 * 1024 * 4, 1024 * 1024 * 64, LISP_GC_SILENT, 60);
+	int round;
+
+	lisp_setup_env_from(context, worker->base);
+	lisp_run("(define mine (range 0 200))", context);
+	for(round = 0; round < N_ROUNDS; round++) {
+		if(eval_int("(apply + shared)", context) != 4950)
+			worker->failed++;
+		if(eval_int("(apply + (map (lambda (x) (* 2 x)) mine))", context) != 39800)
+			worker->failed++;
+		if(eval_int("(hash-table-ref (squares 300) 299)", context) != 89401)
+			worker->failed++;
+		if(eval_int("(vector-ref (list->vector (sort (range 0 500) >)) 0)", context) != 499)
+			worker->failed++;
+		if(eval_int("(string-length (string-append \"abc\" (number->string (length mine))))", context) != 6)
+			worker->failed++;
+		lisp_gc(LISP_GC_FORCE, context);
+	}
+	lisp_destroy_context(context);
+
+	return NULL;
+}
+
+int main(void) {
+	lisp_ctx_t *base = lisp_make_context(1024 * 1024 * 4, 1024 * 1024 * 64, LISP_GC_SILENT, 60);
+	worker_t workers[N_CONTEXTS];
+	int i;
+
+	lisp_setup_env(base);
+	for(i = 0; base_defs[i]; i++)
+		lisp_run(base_defs[i], base);
+	lisp_freeze_context(base);
+
+	for(i = 0; i < N_CONTEXTS; i++) {
+		workers[i].base = base;
+		workers[i].failed = 0;
+		check(pthread_create(&workers[i].thread, NULL, work, &workers[i]) == 0);
+	}
+	for(i = 0; i < N_CONTEXTS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		check(workers[i].failed == 0);
+	}
+
+	lisp_destroy_context(base);
+
+	return test_result("threads");
+}